@@ -0,0 +1,492 @@
+/***************************************************************************
+ * $Id: bench.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin, headless render benchmark
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+/*    kmloverlay_bench: times KMLOverlayFactory rendering outside of OpenCPN.
+ *
+ *    kmloverlay_bench [options] file.kml...
+ *          --frames N        frames per backend (default 300)
+ *          --warmup N        untimed frames first, images decode meanwhile (default 10)
+ *          --size WxH        canvas size (default 1024x768)
+ *          --script FILE     viewport sequence, one "clat clon span" per line,
+ *                            span in degrees of longitude across the canvas
+ *          --budget MB       memory budget, 0 for unlimited
+ *          --dc / --gl       only run one backend
+ *          --zero-alloc      then pans in a small circle at the middle view
+ *                            of the script, lap after lap, until a whole lap
+ *                            allocates nothing. Fails when the null or GL
+ *                            backend still allocates after 5 laps, the DC
+ *                            is only reported: wxDC allocates on some ports.
+ *
+ *    Without a script the view zooms from the extent of all layers into
+ *    its centre, pans around it and zooms back out. After each frame a
+ *    few points of the canvas are picked, as on mouse hover, and timed
+ *    apart. KMLOVERLAY_TRACE names a trace_event file to write, as for
+ *    the plugin.
+ *************************************************************************/
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/dcmemory.h>
+#include <wx/image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "factory.h"
+#include "kmlcompiler.h"
+#include "icons.h"
+#include "ocpn_stub.h"
+#include "trace.h"
+
+#ifdef KMLOVERLAY_BENCH_OSMESA
+  #include <GL/osmesa.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Every allocation of the process, worker threads included
+static std::atomic<unsigned long long> s_allocations( 0 );
+
+void *operator new( size_t sz )
+{
+      s_allocations.fetch_add( 1, std::memory_order_relaxed );
+      void *p = malloc( sz ? sz : 1 );
+      if ( !p )
+            throw std::bad_alloc();
+      return p;
+}
+
+void *operator new[]( size_t sz )
+{
+      return operator new( sz );
+}
+
+void operator delete( void *p ) noexcept
+{
+      free( p );
+}
+
+void operator delete[]( void *p ) noexcept
+{
+      free( p );
+}
+
+struct BenchView
+{
+      double clat;
+      double clon;
+      double span;
+};
+
+struct BenchResult
+{
+      std::vector<double> ms;
+      std::vector<double> pick_ms;
+      unsigned long long  picked;
+      unsigned long long  vertices;
+      unsigned long long  allocations;
+};
+
+static bool LoadScript( const char *path, std::vector<BenchView> *views )
+{
+      FILE *f = fopen( path, "r" );
+      if ( !f )
+            return false;
+      char line[256];
+      while ( fgets( line, sizeof( line ), f ) ) {
+            BenchView v;
+            if ( line[0] == '#' )
+                  continue;
+            if ( sscanf( line, "%lf %lf %lf", &v.clat, &v.clon, &v.span ) == 3 && v.span > 0 )
+                  views->push_back( v );
+      }
+      fclose( f );
+      return !views->empty();
+}
+
+static void DefaultScript( const KMLOverlayScene::Bounds &bounds, int frames, std::vector<BenchView> *views )
+{
+      double south = KMLOverlayScene::FromFixed( bounds.south ), north = KMLOverlayScene::FromFixed( bounds.north );
+      double west = KMLOverlayScene::FromFixed( bounds.west ), east = KMLOverlayScene::FromFixed( bounds.east );
+      double clat = ( south + north ) / 2, clon = ( west + east ) / 2;
+      double extent = std::max( east - west, 1e-3 ) * 1.1;
+
+      // A third zooming in 64 times, a third panning in a circle, a third zooming out
+      int third = std::max( frames / 3, 1 );
+      for ( int i = 0; i < third; i++ ) {
+            BenchView v = { clat, clon, extent / pow( 64., (double)i / third ) };
+            views->push_back( v );
+      }
+      double span = extent / 8;
+      for ( int i = 0; i < third; i++ ) {
+            double a = 2 * M_PI * i / third;
+            BenchView v = { clat + span / 2 * sin( a ), clon + span / 2 * cos( a ), span };
+            views->push_back( v );
+      }
+      for ( int i = 0; (int)views->size() < frames; i++ ) {
+            BenchView v = { clat, clon, extent / 64 * pow( 64., (double)i / third ) };
+            views->push_back( v );
+      }
+}
+
+static double Percentile( std::vector<double> sorted, double p )
+{
+      if ( sorted.empty() )
+            return 0;
+      std::sort( sorted.begin(), sorted.end() );
+      size_t idx = (size_t)ceil( p / 100. * sorted.size() );
+      return sorted[idx ? idx-1 : 0];
+}
+
+static void Report( const char *backend, const BenchResult &r )
+{
+      size_t n = r.ms.size();
+      if ( !n )
+            return;
+      printf( "%-4s %6lu frames  p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms  %12.0f vertices/frame  %10.1f allocs/frame\n",
+              backend, (unsigned long)n, Percentile( r.ms, 50 ), Percentile( r.ms, 95 ), Percentile( r.ms, 99 ),
+              (double)r.vertices / n, (double)r.allocations / n );
+      if ( !r.pick_ms.empty() )
+            printf( "%-4s %6lu picks   p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms  %12.1f%% hits\n",
+                    "", (unsigned long)r.pick_ms.size(), Percentile( r.pick_ms, 50 ), Percentile( r.pick_ms, 95 ),
+                    Percentile( r.pick_ms, 99 ), 100. * r.picked / r.pick_ms.size() );
+}
+
+// Hover over a few points of the frame just drawn
+static void Pick( KMLOverlayFactory *factory, PlugIn_ViewPort *vp, BenchResult *result )
+{
+      static const double spots[][2] = { { .5, .5 }, { .25, .25 }, { .75, .25 }, { .25, .75 }, { .75, .75 } };
+      for ( size_t i = 0; i < sizeof( spots ) / sizeof( spots[0] ); i++ ) {
+            double lat, lon;
+            wxPoint pt( (int)( vp->pix_width * spots[i][0] ), (int)( vp->pix_height * spots[i][1] ) );
+            GetCanvasLLPix( vp, pt, &lat, &lon );
+
+            wxString name, description;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bool hit = factory->Pick( lat, lon, &name, &description );
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+            result->pick_ms.push_back( std::chrono::duration<double, std::milli>( end - start ).count() );
+            result->picked += hit;
+      }
+}
+
+// Backend specific drawing of one frame
+class BenchTarget
+{
+public:
+      virtual ~BenchTarget() {}
+      virtual void Render( KMLOverlayFactory *factory, PlugIn_ViewPort *vp ) = 0;
+};
+
+class BenchDC : public BenchTarget
+{
+public:
+      BenchDC( int width, int height ) : m_bitmap( width, height ) { m_dc.SelectObject( m_bitmap ); }
+      ~BenchDC() { m_dc.SelectObject( wxNullBitmap ); }
+      void Render( KMLOverlayFactory *factory, PlugIn_ViewPort *vp )
+      {
+            m_dc.SetBackground( *wxWHITE_BRUSH );
+            m_dc.Clear();
+            factory->RenderOverlay( m_dc, vp );
+      }
+private:
+      wxBitmap   m_bitmap;
+      wxMemoryDC m_dc;
+};
+
+// The traversal alone, what the backends add on top of it
+class BenchNull : public BenchTarget
+{
+public:
+      void Render( KMLOverlayFactory *factory, PlugIn_ViewPort *vp )
+      {
+            factory->RenderNullOverlay( vp, NULL );
+      }
+};
+
+#ifdef KMLOVERLAY_BENCH_OSMESA
+class BenchGL : public BenchTarget
+{
+public:
+      BenchGL( int width, int height ) : m_buffer( (size_t)width * height * 4 )
+      {
+            // Depth and stencil as the chart canvas, polygons with holes use the stencil
+            m_context = OSMesaCreateContextExt( OSMESA_RGBA, 24, 8, 0, NULL );
+            if ( m_context && OSMesaMakeCurrent( m_context, &m_buffer[0], GL_UNSIGNED_BYTE, width, height ) ) {
+                  // Same setup as the chart canvas: pixels, origin at the top left
+                  glViewport( 0, 0, width, height );
+                  glMatrixMode( GL_PROJECTION );
+                  glLoadIdentity();
+                  glOrtho( 0, width, height, 0, -1, 1 );
+                  glMatrixMode( GL_MODELVIEW );
+                  glLoadIdentity();
+            } else {
+                  fprintf( stderr, "OSMesa context creation failed\n" );
+                  if ( m_context )
+                        OSMesaDestroyContext( m_context );
+                  m_context = NULL;
+            }
+      }
+      ~BenchGL() { if ( m_context ) OSMesaDestroyContext( m_context ); }
+      bool IsOk() { return m_context != NULL; }
+      void Render( KMLOverlayFactory *factory, PlugIn_ViewPort *vp )
+      {
+            glClearColor( 1, 1, 1, 1 );
+            glClear( GL_COLOR_BUFFER_BIT );
+            factory->RenderGLOverlay( NULL, vp );
+            // Software rendering, the frame isn't done until it is flushed
+            glFinish();
+      }
+private:
+      OSMesaContext              m_context;
+      std::vector<unsigned char> m_buffer;
+};
+#endif
+
+static void Run( BenchTarget *target, KMLOverlayFactory *factory, const std::vector<BenchView> &views,
+                 int warmup, int width, int height, BenchResult *result )
+{
+      PlugIn_ViewPort vp;
+      for ( int i = 0; i < warmup; i++ ) {
+            const BenchView &v = views[i % views.size()];
+            KMLOverlayBenchSetViewport( &vp, v.clat, v.clon, v.span, width, height );
+            target->Render( factory, &vp );
+      }
+
+      result->vertices = 0;
+      result->allocations = 0;
+      result->picked = 0;
+      result->ms.reserve( views.size() );
+      for ( size_t i = 0; i < views.size(); i++ ) {
+            const BenchView &v = views[i];
+            KMLOverlayBenchSetViewport( &vp, v.clat, v.clon, v.span, width, height );
+
+            unsigned long long projected = g_bench_counters.projected;
+            unsigned long long allocations = s_allocations.load( std::memory_order_relaxed );
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            target->Render( factory, &vp );
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+            result->ms.push_back( std::chrono::duration<double, std::milli>( end - start ).count() );
+            result->vertices += g_bench_counters.projected - projected;
+            result->allocations += s_allocations.load( std::memory_order_relaxed ) - allocations;
+            Pick( factory, &vp, result );
+      }
+}
+
+// Laps of the zero allocation check, and frames per lap
+static const int ZeroAllocLaps = 5;
+static const int ZeroAllocFrames = 16;
+
+// Caches warm up during the first laps: once everything in view was drawn
+// at this scale, a lap allocates nothing. Picks aren't part of the check.
+static bool ZeroAlloc( const char *backend, BenchTarget *target, KMLOverlayFactory *factory,
+                       const BenchView &middle, int width, int height, bool required )
+{
+      PlugIn_ViewPort vp;
+      unsigned long long worst = 0;
+      for ( int lap = 1; lap <= ZeroAllocLaps; lap++ ) {
+            worst = 0;
+            for ( int i = 0; i < ZeroAllocFrames; i++ ) {
+                  double a = 2 * M_PI * i / ZeroAllocFrames;
+                  KMLOverlayBenchSetViewport( &vp, middle.clat + middle.span / 16 * sin( a ),
+                                              middle.clon + middle.span / 16 * cos( a ), middle.span, width, height );
+                  unsigned long long allocations = s_allocations.load( std::memory_order_relaxed );
+                  target->Render( factory, &vp );
+                  worst = std::max( worst, s_allocations.load( std::memory_order_relaxed ) - allocations );
+            }
+            if ( !worst ) {
+                  printf( "%-4s zero allocations from lap %d\n", backend, lap );
+                  return true;
+            }
+      }
+      printf( "%-4s still %llu allocs/frame after %d laps%s\n", backend, worst, ZeroAllocLaps,
+              required ? "" : ", not required" );
+      return !required;
+}
+
+static int Usage()
+{
+      fprintf( stderr, "usage: kmloverlay_bench [--frames N] [--warmup N] [--size WxH] [--script FILE]\n"
+                       "                        [--budget MB] [--dc|--gl|--null] [--zero-alloc] file.kml...\n" );
+      return 2;
+}
+
+static int Bench( int argc, char **argv )
+{
+      int frames = 300, warmup = 10, width = 1024, height = 768, budget = 0;
+      bool dc = true, gl = true, null = true, zero_alloc = false;
+      const char *script = NULL;
+      std::vector<wxString> files;
+
+      for ( int i = 1; i < argc; i++ ) {
+            bool more = i+1 < argc;
+            if ( !strcmp( argv[i], "--frames" ) && more )
+                  frames = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--warmup" ) && more )
+                  warmup = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--size" ) && more ) {
+                  if ( sscanf( argv[++i], "%dx%d", &width, &height ) != 2 )
+                        return Usage();
+            }
+            else if ( !strcmp( argv[i], "--script" ) && more )
+                  script = argv[++i];
+            else if ( !strcmp( argv[i], "--budget" ) && more )
+                  budget = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--dc" ) )
+                  gl = null = false;
+            else if ( !strcmp( argv[i], "--gl" ) )
+                  dc = null = false;
+            else if ( !strcmp( argv[i], "--null" ) )
+                  dc = gl = false;
+            else if ( !strcmp( argv[i], "--zero-alloc" ) )
+                  zero_alloc = true;
+            else if ( argv[i][0] == '-' )
+                  return Usage();
+            else
+                  files.push_back( wxString( argv[i], wxConvFile ) );
+      }
+      if ( files.empty() || frames <= 0 || width <= 0 || height <= 0 )
+            return Usage();
+
+      KMLOverlayFactory factory( NULL );
+      factory.SetMemoryBudget( budget > 0 ? (size_t)budget * 1024 * 1024 : 0 );
+      KMLOverlayScene::Bounds bounds;
+      for ( size_t i = 0; i < files.size(); i++ ) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if ( !factory.Add( files[i], true ) ) {
+                  fprintf( stderr, "%s: failed to load\n", (const char *)files[i].mb_str() );
+                  return 1;
+            }
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            printf( "loaded %s in %.1f ms\n", (const char *)files[i].mb_str(),
+                    std::chrono::duration<double, std::milli>( end - start ).count() );
+
+            // Only needed for the default script, the factory doesn't expose it
+            if ( !script ) {
+                  KMLOverlayScene scene;
+                  kmlengine::KmzFilePtr kmz;
+                  size_t kmz_size;
+                  std::string error;
+                  if ( KMLOverlayCompiler::CompileFile( std::string( files[i].mb_str() ), &scene, &kmz, &kmz_size, &error )
+                        && !scene.GetBounds().IsEmpty() ) {
+                        const KMLOverlayScene::Bounds &b = scene.GetBounds();
+                        bounds.Extend( b.south, b.west );
+                        bounds.Extend( b.north, b.east );
+                  }
+            }
+      }
+
+      std::vector<BenchView> views;
+      if ( script ) {
+            if ( !LoadScript( script, &views ) ) {
+                  fprintf( stderr, "%s: no viewport in script\n", script );
+                  return 1;
+            }
+      } else {
+            if ( bounds.IsEmpty() ) {
+                  fprintf( stderr, "nothing to draw\n" );
+                  return 1;
+            }
+            DefaultScript( bounds, frames, &views );
+      }
+
+      int rc = 0;
+      const BenchView &middle = views[views.size() / 2];
+      if ( null ) {
+            BenchNull target;
+            BenchResult result;
+            Run( &target, &factory, views, warmup, width, height, &result );
+            Report( "null", result );
+            if ( zero_alloc && !ZeroAlloc( "null", &target, &factory, middle, width, height, true ) )
+                  rc = 1;
+      }
+      if ( dc ) {
+            BenchDC target( width, height );
+            BenchResult result;
+            Run( &target, &factory, views, warmup, width, height, &result );
+            Report( "dc", result );
+            if ( zero_alloc )
+                  ZeroAlloc( "dc", &target, &factory, middle, width, height, false );
+      }
+#ifdef KMLOVERLAY_BENCH_OSMESA
+      if ( gl ) {
+            BenchGL target( width, height );
+            if ( target.IsOk() ) {
+                  BenchResult result;
+                  Run( &target, &factory, views, warmup, width, height, &result );
+                  Report( "gl", result );
+                  if ( zero_alloc && !ZeroAlloc( "gl", &target, &factory, middle, width, height, true ) )
+                        rc = 1;
+            }
+      }
+#else
+      if ( gl && !dc )
+            fprintf( stderr, "built without OSMesa, no GL rendering\n" );
+#endif
+      return rc;
+}
+
+class KMLOverlayBenchApp : public wxApp
+{
+public:
+      bool OnInit() { return true; }
+};
+
+IMPLEMENT_APP_NO_MAIN( KMLOverlayBenchApp )
+
+int main( int argc, char **argv )
+{
+      if ( !wxEntryStart( argc, argv ) ) {
+            fprintf( stderr, "failed to initialize wxWidgets\n" );
+            return 1;
+      }
+      wxInitAllImageHandlers();
+      initialize_images();
+
+      wxString trace;
+      if ( wxGetEnv( _T("KMLOVERLAY_TRACE"), &trace ) )
+            KMLOverlayTrace::Start( trace );
+      int rc = Bench( argc, argv );
+      KMLOverlayTrace::Stop();
+
+      wxEntryCleanup();
+      return rc;
+}
@@ -0,0 +1,438 @@
+/***************************************************************************
+ * $Id: corpus.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin, synthetic test corpus
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/image.h>
+#include <wx/mstream.h>
+#include <wx/filename.h>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include <kml/engine.h>
+#include "corpus.h"
+
+// Shared styles in the document, placemarks pick one at random
+static const unsigned KMLOverlayCorpusStyles = 8;
+
+namespace {
+
+// Every format draws the same random numbers in the same order, so a
+// seed gives the same shapes and colours whatever the format
+class Writer
+{
+public:
+      Writer( const KMLOverlayCorpusOptions &options ) : m_options( options ), m_state( options.seed ? options.seed : 1 ), m_next( 0 ) {}
+      void Write( std::string *out );
+
+private:
+      struct StyleValues
+      {
+            unsigned line;          // aabbggrr, as in KML
+            unsigned width;
+            unsigned fill;
+      };
+
+      // xorshift, deterministic and fast enough not to show in the timings
+      unsigned Rand()
+      {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 17;
+            m_state ^= m_state << 5;
+            return m_state;
+      }
+      double Uniform() { return ( Rand() & 0xffffff ) / (double)0x1000000; }
+
+      StyleValues MakeStyle();
+      void Style( std::string *kml, const char *id, const StyleValues &style );
+      void Properties( std::string *json, const StyleValues &style );
+      void Walk( double lat, double lon, double step, unsigned long n, bool closed );
+      void Coordinates( std::string *out, unsigned long idx, bool timed );
+      void Placemark( std::string *out, unsigned long idx );
+      void Folder( std::string *out, unsigned level, unsigned long first, unsigned long count );
+
+      const KMLOverlayCorpusOptions &m_options;
+      unsigned      m_state;
+      unsigned long m_next;
+      char          m_buf[128];
+      StyleValues   m_shared[KMLOverlayCorpusStyles];
+      std::vector< std::pair<double, double> > m_walk;   // lat, lon
+      std::string   m_tracks;        // GPX wants waypoints first
+      bool          m_first;         // no comma before the next GeoJSON feature
+};
+
+Writer::StyleValues Writer::MakeStyle()
+{
+      StyleValues style;
+      style.line = Rand() | 0x80000000u;
+      style.width = 1 + Rand() % 4;
+      style.fill = Rand() | 0x80000000u;
+      return style;
+}
+
+void Writer::Style( std::string *kml, const char *id, const StyleValues &style )
+{
+      if ( id ) {
+            *kml += "<Style id=\"";
+            *kml += id;
+            *kml += "\">";
+      } else {
+            *kml += "<Style>";
+      }
+      snprintf( m_buf, sizeof( m_buf ), "<LineStyle><color>%08x</color><width>%u</width></LineStyle>", style.line, style.width );
+      *kml += m_buf;
+      snprintf( m_buf, sizeof( m_buf ), "<PolyStyle><color>%08x</color></PolyStyle></Style>\n", style.fill );
+      *kml += m_buf;
+}
+
+void Writer::Properties( std::string *json, const StyleValues &style )
+{
+      // simplestyle, #rrggbb and an opacity
+      snprintf( m_buf, sizeof( m_buf ), ",\"stroke\":\"#%02x%02x%02x\",\"stroke-opacity\":%.3f,\"stroke-width\":%u",
+                style.line & 0xff, style.line >> 8 & 0xff, style.line >> 16 & 0xff, ( style.line >> 24 ) / 255., style.width );
+      *json += m_buf;
+      snprintf( m_buf, sizeof( m_buf ), ",\"fill\":\"#%02x%02x%02x\",\"fill-opacity\":%.3f",
+                style.fill & 0xff, style.fill >> 8 & 0xff, style.fill >> 16 & 0xff, ( style.fill >> 24 ) / 255. );
+      *json += m_buf;
+}
+
+void Writer::Walk( double lat, double lon, double step, unsigned long n, bool closed )
+{
+      m_walk.clear();
+      double lat0 = lat, lon0 = lon;
+      for ( unsigned long i = 0; i < n; i++ ) {
+            if ( closed && i == n-1 ) {
+                  lat = lat0;
+                  lon = lon0;
+            }
+            m_walk.push_back( std::make_pair( lat, lon ) );
+            lat += ( Uniform() - 0.5 ) * step;
+            lon += ( Uniform() - 0.5 ) * step;
+      }
+}
+
+// The last walk. Timed GPX points are a second apart, from an hour per
+// placemark after 2020-01-01.
+void Writer::Coordinates( std::string *out, unsigned long idx, bool timed )
+{
+      switch ( m_options.format ) {
+      case KMLOverlayCorpusOptions::FORMAT_KML:
+            *out += "<coordinates>";
+            for ( size_t i = 0; i < m_walk.size(); i++ ) {
+                  snprintf( m_buf, sizeof( m_buf ), "%.7f,%.7f,0 ", m_walk[i].second, m_walk[i].first );
+                  *out += m_buf;
+            }
+            *out += "</coordinates>";
+            break;
+      case KMLOverlayCorpusOptions::FORMAT_GEOJSON:
+            *out += "[";
+            for ( size_t i = 0; i < m_walk.size(); i++ ) {
+                  snprintf( m_buf, sizeof( m_buf ), i ? ",[%.7f,%.7f]" : "[%.7f,%.7f]", m_walk[i].second, m_walk[i].first );
+                  *out += m_buf;
+            }
+            *out += "]";
+            break;
+      case KMLOverlayCorpusOptions::FORMAT_GPX:
+            *out += "<trkseg>";
+            for ( size_t i = 0; i < m_walk.size(); i++ ) {
+                  snprintf( m_buf, sizeof( m_buf ), "<trkpt lat=\"%.7f\" lon=\"%.7f\">", m_walk[i].first, m_walk[i].second );
+                  *out += m_buf;
+                  if ( timed ) {
+                        time_t when = 1577836800 + (time_t)idx * 3600 + i;
+                        struct tm tm;
+                        gmtime_r( &when, &tm );
+                        strftime( m_buf, sizeof( m_buf ), "<time>%Y-%m-%dT%H:%M:%SZ</time>", &tm );
+                        *out += m_buf;
+                  }
+                  *out += "</trkpt>";
+            }
+            *out += "</trkseg>";
+            break;
+      }
+}
+
+void Writer::Placemark( std::string *out, unsigned long idx )
+{
+      const KMLOverlayCorpusOptions::Format format = m_options.format;
+      StyleValues style;
+      int shared = -1;
+      if ( Uniform() < m_options.shared_styles )
+            shared = Rand() % KMLOverlayCorpusStyles;
+      else
+            style = MakeStyle();
+
+      if ( format == KMLOverlayCorpusOptions::FORMAT_KML ) {
+            snprintf( m_buf, sizeof( m_buf ), "<Placemark id=\"p%lu\"><name>%lu</name>", idx, idx );
+            *out += m_buf;
+            if ( shared >= 0 ) {
+                  snprintf( m_buf, sizeof( m_buf ), "<styleUrl>#s%d</styleUrl>", shared );
+                  *out += m_buf;
+            } else {
+                  Style( out, NULL, style );
+            }
+      } else if ( format == KMLOverlayCorpusOptions::FORMAT_GEOJSON ) {
+            snprintf( m_buf, sizeof( m_buf ), "%s{\"type\":\"Feature\",\"id\":\"p%lu\",\"properties\":{\"name\":\"%lu\"",
+                      m_first ? "" : ",\n", idx, idx );
+            *out += m_buf;
+            m_first = false;
+            Properties( out, shared >= 0 ? m_shared[shared] : style );
+            *out += "},\"geometry\":";
+      }
+
+      // Everything within 40-50N 10W-10E, a few km per step
+      double lat = 40 + 10 * Uniform(), lon = -10 + 20 * Uniform();
+      double kind = Uniform();
+      unsigned long n = m_options.vertices < 2 ? 2 : m_options.vertices;
+      if ( kind < m_options.points ) {
+            Walk( lat, lon, 0, 1, false );
+            if ( format == KMLOverlayCorpusOptions::FORMAT_KML ) {
+                  *out += "<Point>";
+                  Coordinates( out, idx, false );
+                  *out += "</Point>";
+            } else if ( format == KMLOverlayCorpusOptions::FORMAT_GEOJSON ) {
+                  snprintf( m_buf, sizeof( m_buf ), "{\"type\":\"Point\",\"coordinates\":[%.7f,%.7f]}", lon, lat );
+                  *out += m_buf;
+            } else {
+                  snprintf( m_buf, sizeof( m_buf ), "<wpt lat=\"%.7f\" lon=\"%.7f\"><name>%lu</name></wpt>\n", lat, lon, idx );
+                  *out += m_buf;
+                  return;
+            }
+      } else if ( kind < m_options.points + m_options.polygons ) {
+            // GPX has no polygons, rings become segments of a track
+            n = n < 4 ? 4 : n;
+            if ( format == KMLOverlayCorpusOptions::FORMAT_KML )
+                  *out += "<Polygon><outerBoundaryIs><LinearRing>";
+            else if ( format == KMLOverlayCorpusOptions::FORMAT_GEOJSON )
+                  *out += "{\"type\":\"Polygon\",\"coordinates\":[";
+            else {
+                  snprintf( m_buf, sizeof( m_buf ), "<trk><name>%lu</name>", idx );
+                  m_tracks += m_buf;
+            }
+            std::string *rings = format == KMLOverlayCorpusOptions::FORMAT_GPX ? &m_tracks : out;
+            Walk( lat, lon, 0.02, n, true );
+            Coordinates( rings, idx, false );
+            if ( format == KMLOverlayCorpusOptions::FORMAT_KML )
+                  *out += "</LinearRing></outerBoundaryIs>";
+            for ( unsigned h = 0; h < m_options.holes; h++ ) {
+                  double hlat = lat + 0.01 * Uniform();
+                  double hlon = lon + 0.01 * Uniform();
+                  Walk( hlat, hlon, 0.002, n, true );
+                  if ( format == KMLOverlayCorpusOptions::FORMAT_KML )
+                        *out += "<innerBoundaryIs><LinearRing>";
+                  else if ( format == KMLOverlayCorpusOptions::FORMAT_GEOJSON )
+                        *out += ",";
+                  Coordinates( rings, idx, false );
+                  if ( format == KMLOverlayCorpusOptions::FORMAT_KML )
+                        *out += "</LinearRing></innerBoundaryIs>";
+            }
+            if ( format == KMLOverlayCorpusOptions::FORMAT_KML )
+                  *out += "</Polygon>";
+            else if ( format == KMLOverlayCorpusOptions::FORMAT_GEOJSON )
+                  *out += "]}";
+            else
+                  m_tracks += "</trk>\n";
+      } else {
+            Walk( lat, lon, 0.02, n, false );
+            if ( format == KMLOverlayCorpusOptions::FORMAT_KML ) {
+                  *out += "<LineString>";
+                  Coordinates( out, idx, false );
+                  *out += "</LineString>";
+            } else if ( format == KMLOverlayCorpusOptions::FORMAT_GEOJSON ) {
+                  *out += "{\"type\":\"LineString\",\"coordinates\":";
+                  Coordinates( out, idx, false );
+                  *out += "}";
+            } else {
+                  // Lines are the timed tracks, as recorded by a GPS
+                  snprintf( m_buf, sizeof( m_buf ), "<trk><name>%lu</name>", idx );
+                  m_tracks += m_buf;
+                  Coordinates( &m_tracks, idx, true );
+                  m_tracks += "</trk>\n";
+            }
+      }
+      if ( format == KMLOverlayCorpusOptions::FORMAT_KML )
+            *out += "</Placemark>\n";
+      else if ( format == KMLOverlayCorpusOptions::FORMAT_GEOJSON )
+            *out += "}";
+}
+
+void Writer::Folder( std::string *out, unsigned level, unsigned long first, unsigned long count )
+{
+      // Only KML has folders, the other formats are flat
+      bool kml = m_options.format == KMLOverlayCorpusOptions::FORMAT_KML;
+      if ( kml ) {
+            snprintf( m_buf, sizeof( m_buf ), "<Folder><name>level %u</name>\n", level );
+            *out += m_buf;
+      }
+      if ( level >= m_options.depth ) {
+            for ( unsigned long i = 0; i < count; i++ )
+                  Placemark( out, first + i );
+      } else {
+            unsigned long half = count / 2;
+            Folder( out, level + 1, first, half );
+            Folder( out, level + 1, first + half, count - half );
+      }
+      if ( kml )
+            *out += "</Folder>\n";
+}
+
+void Writer::Write( std::string *out )
+{
+      for ( unsigned i = 0; i < KMLOverlayCorpusStyles; i++ )
+            m_shared[i] = MakeStyle();
+      m_first = true;
+
+      if ( m_options.format == KMLOverlayCorpusOptions::FORMAT_GEOJSON ) {
+            *out += "{\"type\":\"FeatureCollection\",\"name\":\"kmloverlay corpus\",\"features\":[\n";
+            Folder( out, 0, 0, m_options.placemarks );
+            *out += "\n]}\n";
+            return;
+      }
+      if ( m_options.format == KMLOverlayCorpusOptions::FORMAT_GPX ) {
+            *out += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<gpx version=\"1.1\" creator=\"kmloverlay corpus\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n";
+            Folder( out, 0, 0, m_options.placemarks );
+            *out += m_tracks;
+            std::string().swap( m_tracks );
+            *out += "</gpx>\n";
+            return;
+      }
+
+      *out += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+              "<kml xmlns=\"http://www.opengis.net/kml/2.2\"><Document><name>kmloverlay corpus</name>\n";
+      for ( unsigned i = 0; i < KMLOverlayCorpusStyles; i++ ) {
+            snprintf( m_buf, sizeof( m_buf ), "s%u", i );
+            std::string id( m_buf );
+            Style( out, id.c_str(), m_shared[i] );
+      }
+      for ( unsigned i = 0; i < m_options.overlays; i++ ) {
+            double south = 40 + 9 * Uniform(), west = -10 + 19 * Uniform();
+            snprintf( m_buf, sizeof( m_buf ), "<GroundOverlay><Icon><href>images/overlay%u.png</href></Icon>", i );
+            *out += m_buf;
+            snprintf( m_buf, sizeof( m_buf ), "<LatLonBox><north>%.6f</north><south>%.6f</south>", south + 1, south );
+            *out += m_buf;
+            snprintf( m_buf, sizeof( m_buf ), "<east>%.6f</east><west>%.6f</west></LatLonBox></GroundOverlay>\n", west + 1, west );
+            *out += m_buf;
+      }
+      Folder( out, 0, 0, m_options.placemarks );
+      *out += "</Document></kml>\n";
+}
+
+}
+
+unsigned long long KMLOverlayCorpusOptions::GetVertexCount() const
+{
+      // Expected count, the kind of each placemark is random
+      unsigned long n = vertices < 2 ? 2 : vertices;
+      double lines = 1. - points - polygons;
+      double rings = polygons * ( 1 + holes ) * ( n < 4 ? 4 : n );
+      return (unsigned long long)( placemarks * ( points + lines * n + rings ) );
+}
+
+static bool MakeImage( const KMLOverlayCorpusOptions &options, unsigned idx, std::string *png )
+{
+      wxImage image( options.overlay_width, options.overlay_height );
+      unsigned char *d = image.GetData();
+      for ( unsigned y = 0; y < options.overlay_height; y++ ) {
+            for ( unsigned x = 0; x < options.overlay_width; x++ ) {
+                  *d++ = x * 255 / options.overlay_width;
+                  *d++ = y * 255 / options.overlay_height;
+                  *d++ = ( x ^ y ^ idx ) & 0xff;
+            }
+      }
+      wxMemoryOutputStream os;
+      if ( !image.SaveFile( os, wxBITMAP_TYPE_PNG ) )
+            return false;
+      png->resize( os.GetSize() );
+      os.CopyTo( &(*png)[0], png->size() );
+      return true;
+}
+
+static bool WriteFile( const std::string &path, const std::string &data )
+{
+      FILE *f = fopen( path.c_str(), "wb" );
+      if ( !f )
+            return false;
+      bool ok = fwrite( data.data(), 1, data.size(), f ) == data.size();
+      return fclose( f ) == 0 && ok;
+}
+
+bool KMLOverlayWriteCorpus( const KMLOverlayCorpusOptions &options, const std::string &path, std::string *error )
+{
+      std::string kml;
+      Writer( options ).Write( &kml );
+      if ( options.format != KMLOverlayCorpusOptions::FORMAT_KML ) {
+            // No container for assets, overlays are KML only
+            if ( !WriteFile( path, kml ) ) {
+                  *error = "failed to write " + path;
+                  return false;
+            }
+            return true;
+      }
+
+      kmlengine::KmzFilePtr kmz;
+      std::string basedir;
+      if ( options.kmz ) {
+            kmz = kmlengine::KmzFile::Create( path.c_str() );
+            if ( !kmz || !kmz->AddFile( kml, "doc.kml" ) ) {
+                  *error = "failed to create " + path;
+                  return false;
+            }
+      } else {
+            if ( !WriteFile( path, kml ) ) {
+                  *error = "failed to write " + path;
+                  return false;
+            }
+            // Images go next to the document, as hrefs are relative
+            size_t sep = path.find_last_of( "/\\" );
+            basedir = sep == std::string::npos ? std::string() : path.substr( 0, sep+1 );
+            if ( options.overlays && !wxFileName::Mkdir( wxString( ( basedir + "images" ).c_str(), wxConvFile ),
+                                                       0777, wxPATH_MKDIR_FULL ) ) {
+                  *error = "failed to create " + basedir + "images";
+                  return false;
+            }
+      }
+      std::string().swap( kml );
+
+      for ( unsigned i = 0; i < options.overlays; i++ ) {
+            std::string png;
+            char name[64];
+            snprintf( name, sizeof( name ), "images/overlay%u.png", i );
+            bool ok = MakeImage( options, i, &png );
+            if ( ok )
+                  ok = kmz ? kmz->AddFile( png, name ) : WriteFile( basedir + name, png );
+            if ( !ok ) {
+                  *error = std::string( "failed to write " ) + name;
+                  return false;
+            }
+      }
+      return true;
+}
@@ -0,0 +1,77 @@
+/***************************************************************************
+ * $Id: corpus.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin, synthetic test corpus
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayCorpus_H_
+#define _KMLOverlayCorpus_H_
+
+#include <string>
+
+/*    Synthetic KML/KMZ documents with a controlled shape, for benchmarks.
+ *
+ *    Placemarks are spread over leaf folders of a binary folder tree.
+ *    Lines and rings are random walks, the same seed always gives the
+ *    same document. The same placemarks can be written as GeoJSON, or as
+ *    GPX where points are waypoints, lines timed tracks and polygons
+ *    tracks with a segment per ring; both are flat and have no overlays.
+ *************************************************************************/
+
+struct KMLOverlayCorpusOptions
+{
+      enum Format
+      {
+            FORMAT_KML,
+            FORMAT_GEOJSON,
+            FORMAT_GPX
+      };
+
+      unsigned long placemarks;
+      unsigned long vertices;         // per LineString and polygon ring
+      double        polygons;         // fraction of placemarks that are polygons
+      double        points;           // fraction of placemarks that are points
+      unsigned      holes;            // inner rings per polygon
+      double        shared_styles;    // fraction of placemarks using a shared style
+      unsigned      depth;            // folder nesting
+      unsigned      overlays;         // GroundOverlays, with their image in the KMZ
+      unsigned      overlay_width;
+      unsigned      overlay_height;
+      bool          kmz;
+      Format        format;
+      unsigned      seed;
+
+      KMLOverlayCorpusOptions()
+            : placemarks( 1000 ), vertices( 100 ), polygons( 0.25 ), points( 0.1 ), holes( 0 ),
+              shared_styles( 0.9 ), depth( 2 ), overlays( 0 ), overlay_width( 512 ), overlay_height( 512 ),
+              kmz( false ), format( FORMAT_KML ), seed( 1 ) {}
+
+      // Total number of coordinates written
+      unsigned long long GetVertexCount() const;
+};
+
+bool KMLOverlayWriteCorpus( const KMLOverlayCorpusOptions &options, const std::string &path, std::string *error );
+
+#endif
@@ -0,0 +1,249 @@
+/***************************************************************************
+ * $Id: imagebench.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+/*    kmloverlay_imagebench: the pixel kernels of imageops.cpp against the
+ *    loops they replaced.
+ *
+ *    kmloverlay_imagebench [options]
+ *          --size WxH        source image (default 2048x2048)
+ *          --iterations N    runs of each kernel, the best is kept (default 20)
+ *
+ *    Each pair is checked to give the same pixels, except resampling
+ *    where the old path is a nearest neighbour wxImage::Scale and the
+ *    high quality one is shown for comparison. The exit status is 1 when
+ *    a kernel disagrees with its reference loop.
+ *************************************************************************/
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "imageops.h"
+
+// The GL upload loop as it was
+static void LegacyToRGBA( const unsigned char *d, const unsigned char *a, unsigned char mr, unsigned char mg,
+                          unsigned char mb, unsigned char *e, int sb )
+{
+      unsigned char r, g, b;
+      for ( int i=0 ; i<sb ; i++ ) {
+            r = d[i*3 + 0];
+            g = d[i*3 + 1];
+            b = d[i*3 + 2];
+
+            e[i*4 + 0] = r;
+            e[i*4 + 1] = g;
+            e[i*4 + 2] = b;
+
+            e[i*4 + 3] = a ? a[i] :
+            ((r==mr)&&(g==mg)&&(b==mb) ? 0 : 255);
+      }
+}
+
+// The ground overlay alpha plane as it was
+static unsigned char *LegacyFillAlpha( unsigned char value, int size )
+{
+      unsigned char *alphad = (unsigned char *)malloc ( size * sizeof ( unsigned char ) );
+      unsigned char *a = alphad;
+      for ( int i=0 ; i<size; i++ ) {
+            *a++ = value;
+      }
+      return alphad;
+}
+
+class BenchTimer
+{
+public:
+      BenchTimer() : m_best( 1e30 ) {}
+      void Start() { m_start = std::chrono::steady_clock::now(); }
+      void Stop()
+      {
+            double ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - m_start ).count();
+            if ( ms < m_best )
+                  m_best = ms;
+      }
+      double GetBest() const { return m_best; }
+
+private:
+      std::chrono::steady_clock::time_point m_start;
+      double m_best;
+};
+
+static void Report( const char *name, const BenchTimer &before, const BenchTimer &after, double mpixels )
+{
+      printf( "%-28s %10.3f %10.3f %8.2fx %10.1f\n", name, before.GetBest(), after.GetBest(),
+              before.GetBest() / after.GetBest(), mpixels / ( after.GetBest() / 1000 ) );
+}
+
+static int Usage()
+{
+      fprintf( stderr, "usage: kmloverlay_imagebench [--size WxH] [--iterations N]\n" );
+      return 2;
+}
+
+static int ImageBench( int argc, char **argv )
+{
+      int width = 2048, height = 2048, iterations = 20;
+      for ( int i = 1; i < argc; i++ ) {
+            bool more = i+1 < argc;
+            if ( !strcmp( argv[i], "--size" ) && more ) {
+                  if ( sscanf( argv[++i], "%dx%d", &width, &height ) != 2 )
+                        return Usage();
+            } else if ( !strcmp( argv[i], "--iterations" ) && more ) {
+                  iterations = atoi( argv[++i] );
+            } else {
+                  return Usage();
+            }
+      }
+      if ( width < 64 || height < 64 || iterations < 1 )
+            return Usage();
+
+      // Noise, with one pixel in eight of the mask colour
+      size_t count = (size_t)width * height;
+      const unsigned char mask[3] = { 1, 2, 3 };
+      wxImage image( width, height, false );
+      image.SetAlpha();
+      srand( 1 );
+      for ( size_t i = 0; i < count; i++ ) {
+            bool masked = rand() % 8 == 0;
+            for ( int c = 0; c < 3; c++ )
+                  image.GetData()[3*i + c] = masked ? mask[c] : (unsigned char)rand();
+            image.GetAlpha()[i] = (unsigned char)rand();
+      }
+      double mpixels = count / 1e6;
+      int failures = 0;
+
+      printf( "kernels: %s, %dx%d, best of %d\n", KMLOverlayImageOps::GetKernelName(), width, height, iterations );
+      printf( "%-28s %10s %10s %9s %10s\n", "", "before ms", "after ms", "speedup", "Mpx/s" );
+
+      std::vector<unsigned char> expected( 4 * count ), actual( 4 * count );
+      for ( int with_alpha = 0; with_alpha < 2; with_alpha++ ) {
+            const unsigned char *alpha = with_alpha ? image.GetAlpha() : NULL;
+            BenchTimer before, after;
+            for ( int i = 0; i < iterations; i++ ) {
+                  before.Start();
+                  LegacyToRGBA( image.GetData(), alpha, mask[0], mask[1], mask[2], &expected[0], (int)count );
+                  before.Stop();
+                  after.Start();
+                  KMLOverlayImageOps::ToRGBA( image.GetData(), alpha, mask, &actual[0], count );
+                  after.Stop();
+            }
+            if ( expected != actual ) {
+                  printf( "FAIL: ToRGBA differs\n" );
+                  failures++;
+            }
+            Report( with_alpha ? "rgb+alpha to rgba" : "rgb+mask to rgba", before, after, mpixels );
+      }
+
+      {
+            BenchTimer before, after;
+            std::vector<unsigned char> plane( count );
+            for ( int i = 0; i < iterations; i++ ) {
+                  before.Start();
+                  unsigned char *legacy = LegacyFillAlpha( 0x80, (int)count );
+                  before.Stop();
+                  after.Start();
+                  KMLOverlayImageOps::FillAlpha( &plane[0], 0x80, count );
+                  after.Stop();
+                  if ( memcmp( legacy, &plane[0], count ) )
+                        failures++;
+                  free( legacy );
+            }
+            Report( "constant alpha fill", before, after, mpixels );
+      }
+
+      {
+            // Against the obvious loop, nothing did this before
+            BenchTimer before, after;
+            std::vector<unsigned char> plane( count ), reference( count );
+            for ( int i = 0; i < iterations; i++ ) {
+                  memcpy( &reference[0], image.GetAlpha(), count );
+                  memcpy( &plane[0], image.GetAlpha(), count );
+                  before.Start();
+                  for ( size_t j = 0; j < count; j++ )
+                        reference[j] = (unsigned char)( ( reference[j] * 0x80 + 127 ) / 255 );
+                  before.Stop();
+                  after.Start();
+                  KMLOverlayImageOps::ScaleAlpha( &plane[0], 0x80, count );
+                  after.Stop();
+            }
+            if ( reference != plane ) {
+                  printf( "FAIL: ScaleAlpha differs\n" );
+                  failures++;
+            }
+            Report( "alpha scale", before, after, mpixels );
+      }
+
+      // Down to a third, the usual ground overlay seen whole, and up by half
+      const double factors[] = { 1. / 3, 1.5 };
+      for ( size_t f = 0; f < sizeof( factors ) / sizeof( factors[0] ); f++ ) {
+            int dw = (int)( width * factors[f] ), dh = (int)( height * factors[f] );
+            BenchTimer nearest, high, resample;
+            for ( int i = 0; i < iterations; i++ ) {
+                  nearest.Start();
+                  wxImage a = image.Scale( dw, dh );
+                  nearest.Stop();
+                  high.Start();
+                  wxImage b = image.Scale( dw, dh, wxIMAGE_QUALITY_HIGH );
+                  high.Stop();
+                  resample.Start();
+                  wxImage c = KMLOverlayImageOps::Resample( image, dw, dh );
+                  resample.Stop();
+                  if ( c.GetWidth() != dw || c.GetHeight() != dh || !c.HasAlpha() )
+                        failures++;
+            }
+            char name[64];
+            snprintf( name, sizeof( name ), "resample x%.2f, nearest", factors[f] );
+            Report( name, nearest, resample, mpixels );
+            snprintf( name, sizeof( name ), "resample x%.2f, high", factors[f] );
+            Report( name, high, resample, mpixels );
+      }
+
+      if ( failures ) {
+            printf( "FAIL: %d mismatches\n", failures );
+            return 1;
+      }
+      return 0;
+}
+
+int main( int argc, char **argv )
+{
+      wxInitializer initializer;
+      if ( !initializer ) {
+            fprintf( stderr, "failed to initialize wxWidgets\n" );
+            return 1;
+      }
+      return ImageBench( argc, argv );
+}
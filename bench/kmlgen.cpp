@@ -0,0 +1,124 @@
+/***************************************************************************
+ * $Id: kmlgen.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin, synthetic test corpus
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+/*    kmloverlay_kmlgen: writes a synthetic KML, KMZ, GeoJSON or GPX document.
+ *
+ *    kmloverlay_kmlgen [options] out.kml|out.kmz|out.geojson|out.gpx
+ *          --placemarks N      (default 1000)
+ *          --vertices N        per LineString and polygon ring (default 100)
+ *          --polygons F        fraction of polygons (default 0.25)
+ *          --points F          fraction of points (default 0.1)
+ *          --holes N           inner rings per polygon (default 0)
+ *          --shared-styles F   fraction of placemarks using a shared style (default 0.9)
+ *          --depth N           folder nesting (default 2)
+ *          --overlays N        GroundOverlays (default 0)
+ *          --overlay-size WxH  GroundOverlay image size (default 512x512)
+ *          --seed N
+ *
+ *    The format follows the extension of the output.
+ *************************************************************************/
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/init.h>
+#include <wx/image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "corpus.h"
+
+static int Usage()
+{
+      fprintf( stderr, "usage: kmloverlay_kmlgen [--placemarks N] [--vertices N] [--polygons F] [--points F]\n"
+                       "                         [--holes N] [--shared-styles F] [--depth N] [--overlays N]\n"
+                       "                         [--overlay-size WxH] [--seed N] out.kml|out.kmz|out.geojson|out.gpx\n" );
+      return 2;
+}
+
+int main( int argc, char **argv )
+{
+      wxInitializer initializer;
+      if ( !initializer.IsOk() ) {
+            fprintf( stderr, "failed to initialize wxWidgets\n" );
+            return 1;
+      }
+      wxInitAllImageHandlers();
+
+      KMLOverlayCorpusOptions options;
+      const char *out = NULL;
+      for ( int i = 1; i < argc; i++ ) {
+            bool more = i+1 < argc;
+            if ( !strcmp( argv[i], "--placemarks" ) && more )
+                  options.placemarks = strtoul( argv[++i], NULL, 10 );
+            else if ( !strcmp( argv[i], "--vertices" ) && more )
+                  options.vertices = strtoul( argv[++i], NULL, 10 );
+            else if ( !strcmp( argv[i], "--polygons" ) && more )
+                  options.polygons = atof( argv[++i] );
+            else if ( !strcmp( argv[i], "--points" ) && more )
+                  options.points = atof( argv[++i] );
+            else if ( !strcmp( argv[i], "--holes" ) && more )
+                  options.holes = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--shared-styles" ) && more )
+                  options.shared_styles = atof( argv[++i] );
+            else if ( !strcmp( argv[i], "--depth" ) && more )
+                  options.depth = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--overlays" ) && more )
+                  options.overlays = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--overlay-size" ) && more ) {
+                  if ( sscanf( argv[++i], "%ux%u", &options.overlay_width, &options.overlay_height ) != 2 )
+                        return Usage();
+            }
+            else if ( !strcmp( argv[i], "--seed" ) && more )
+                  options.seed = strtoul( argv[++i], NULL, 10 );
+            else if ( argv[i][0] == '-' || out )
+                  return Usage();
+            else
+                  out = argv[i];
+      }
+      if ( !out || options.points + options.polygons > 1 || !options.overlay_width || !options.overlay_height )
+            return Usage();
+
+      size_t len = strlen( out );
+      options.kmz = len > 4 && !strcasecmp( out + len - 4, ".kmz" );
+      if ( ( len > 8 && !strcasecmp( out + len - 8, ".geojson" ) ) || ( len > 5 && !strcasecmp( out + len - 5, ".json" ) ) )
+            options.format = KMLOverlayCorpusOptions::FORMAT_GEOJSON;
+      else if ( len > 4 && !strcasecmp( out + len - 4, ".gpx" ) )
+            options.format = KMLOverlayCorpusOptions::FORMAT_GPX;
+
+      std::string error;
+      if ( !KMLOverlayWriteCorpus( options, out, &error ) ) {
+            fprintf( stderr, "%s\n", error.c_str() );
+            return 1;
+      }
+      printf( "%s: %lu placemarks, about %llu vertices\n", out, options.placemarks, options.GetVertexCount() );
+      return 0;
+}
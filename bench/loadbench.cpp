@@ -0,0 +1,285 @@
+/***************************************************************************
+ * $Id: loadbench.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin, load scaling benchmark
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+/*    kmloverlay_loadbench: how loading scales with the size of a document.
+ *
+ *    kmloverlay_loadbench [options]
+ *          --min-vertices N    (default 1000)
+ *          --max-vertices N    (default 10000000)
+ *          --vertices N        per LineString (default 100)
+ *          --kmz               measure KMZ rather than plain KML
+ *          --format F          kml, geojson or gpx (default kml)
+ *          --max-exponent F    fail above this growth exponent (default 1.2)
+ *          --dir DIR           where the corpus is written (default the temp dir)
+ *
+ *    Each size is measured in a child process so that peak RSS is its own:
+ *    parse time (read, parse, compile), peak RSS, and time to first frame
+ *    (KMLOverlayFactory::Add then one RenderOverlay into a wxMemoryDC).
+ *    Growth exponents are fitted on a log-log scale from 10^4 vertices up,
+ *    below that fixed costs dominate. The same corpus in each format gives
+ *    comparable parse times. The exit status is 1 when parse time,
+ *    time to first frame or RSS grows faster than the maximum exponent.
+ *************************************************************************/
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/dcmemory.h>
+#include <wx/filefn.h>
+#include <wx/filename.h>
+#include <wx/image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <vector>
+#include "factory.h"
+#include "kmlcompiler.h"
+#include "icons.h"
+#include "ocpn_stub.h"
+#include "corpus.h"
+
+struct LoadSample
+{
+      unsigned long long vertices;
+      double             parse_ms;
+      double             ttff_ms;
+      double             rss_mb;
+};
+
+static double Since( const std::chrono::steady_clock::time_point &start )
+{
+      return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+static double PeakRSS()
+{
+      struct rusage usage;
+      getrusage( RUSAGE_SELF, &usage );
+#ifdef __APPLE__
+      return usage.ru_maxrss / 1048576.;      // bytes
+#else
+      return usage.ru_maxrss / 1024.;         // kilobytes
+#endif
+}
+
+// Runs in the child process
+static bool Measure( const std::string &path, LoadSample *sample )
+{
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      {
+            KMLOverlayScene scene;
+            kmlengine::KmzFilePtr kmz;
+            size_t kmz_size;
+            std::string error;
+            if ( !KMLOverlayCompiler::CompileFile( path, &scene, &kmz, &kmz_size, &error ) ) {
+                  fprintf( stderr, "%s: %s\n", path.c_str(), error.c_str() );
+                  return false;
+            }
+            sample->vertices = scene.GetVertexCount();
+      }
+      sample->parse_ms = Since( start );
+
+      start = std::chrono::steady_clock::now();
+      KMLOverlayFactory factory( NULL );
+      if ( !factory.Add( wxString( path.c_str(), wxConvFile ), true ) )
+            return false;
+      // The corpus lies within 40-50N 10W-10E
+      PlugIn_ViewPort vp;
+      KMLOverlayBenchSetViewport( &vp, 45, 0, 22, 1024, 768 );
+      wxBitmap bitmap( 1024, 768 );
+      wxMemoryDC dc( bitmap );
+      factory.RenderOverlay( dc, &vp );
+      sample->ttff_ms = Since( start );
+
+      sample->rss_mb = PeakRSS();
+      return true;
+}
+
+static bool MeasureInChild( const std::string &path, LoadSample *sample )
+{
+      int fd[2];
+      if ( pipe( fd ) )
+            return false;
+      fflush( stdout );
+      pid_t pid = fork();
+      if ( pid < 0 )
+            return false;
+      if ( pid == 0 ) {
+            close( fd[0] );
+            bool ok = Measure( path, sample );
+            ok = ok && write( fd[1], sample, sizeof( *sample ) ) == (ssize_t)sizeof( *sample );
+            _exit( ok ? 0 : 1 );
+      }
+      close( fd[1] );
+      bool ok = read( fd[0], sample, sizeof( *sample ) ) == (ssize_t)sizeof( *sample );
+      close( fd[0] );
+      int status;
+      waitpid( pid, &status, 0 );
+      return ok && WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+}
+
+// Least squares slope of log(y) against log(x)
+static double Exponent( const std::vector<LoadSample> &samples, double LoadSample::*field )
+{
+      double sx = 0, sy = 0, sxx = 0, sxy = 0;
+      int n = 0;
+      for ( size_t i = 0; i < samples.size(); i++ ) {
+            if ( samples[i].vertices < 10000 && samples.size() > 2 )
+                  continue;
+            double x = log( (double)samples[i].vertices ), y = log( std::max( samples[i].*field, 1e-3 ) );
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+            n++;
+      }
+      if ( n < 2 || n * sxx == sx * sx )
+            return 0;
+      return ( n * sxy - sx * sy ) / ( n * sxx - sx * sx );
+}
+
+static int Usage()
+{
+      fprintf( stderr, "usage: kmloverlay_loadbench [--min-vertices N] [--max-vertices N] [--vertices N]\n"
+                       "                            [--kmz] [--format kml|geojson|gpx] [--max-exponent F] [--dir DIR]\n" );
+      return 2;
+}
+
+static int LoadBench( int argc, char **argv )
+{
+      unsigned long long min_vertices = 1000, max_vertices = 10000000;
+      KMLOverlayCorpusOptions options;
+      double max_exponent = 1.2;
+      wxString dir = wxFileName::GetTempDir();
+
+      for ( int i = 1; i < argc; i++ ) {
+            bool more = i+1 < argc;
+            if ( !strcmp( argv[i], "--min-vertices" ) && more )
+                  min_vertices = strtoull( argv[++i], NULL, 10 );
+            else if ( !strcmp( argv[i], "--max-vertices" ) && more )
+                  max_vertices = strtoull( argv[++i], NULL, 10 );
+            else if ( !strcmp( argv[i], "--vertices" ) && more )
+                  options.vertices = strtoul( argv[++i], NULL, 10 );
+            else if ( !strcmp( argv[i], "--kmz" ) )
+                  options.kmz = true;
+            else if ( !strcmp( argv[i], "--format" ) && more ) {
+                  const char *format = argv[++i];
+                  if ( !strcmp( format, "kml" ) )
+                        options.format = KMLOverlayCorpusOptions::FORMAT_KML;
+                  else if ( !strcmp( format, "geojson" ) )
+                        options.format = KMLOverlayCorpusOptions::FORMAT_GEOJSON;
+                  else if ( !strcmp( format, "gpx" ) )
+                        options.format = KMLOverlayCorpusOptions::FORMAT_GPX;
+                  else
+                        return Usage();
+            }
+            else if ( !strcmp( argv[i], "--max-exponent" ) && more )
+                  max_exponent = atof( argv[++i] );
+            else if ( !strcmp( argv[i], "--dir" ) && more )
+                  dir = wxString( argv[++i], wxConvFile );
+            else
+                  return Usage();
+      }
+      if ( !min_vertices || min_vertices > max_vertices || options.vertices < 2 ||
+           ( options.kmz && options.format != KMLOverlayCorpusOptions::FORMAT_KML ) )
+            return Usage();
+      const wxChar *extension = options.kmz ? _T("kmz") : _T("kml");
+      if ( options.format == KMLOverlayCorpusOptions::FORMAT_GEOJSON )
+            extension = _T("geojson");
+      else if ( options.format == KMLOverlayCorpusOptions::FORMAT_GPX )
+            extension = _T("gpx");
+
+      std::vector<LoadSample> samples;
+      printf( "%12s %12s %12s %10s\n", "vertices", "parse ms", "ttff ms", "peak MB" );
+      for ( unsigned long long target = min_vertices; target <= max_vertices; target *= 10 ) {
+            // Lines only, so the vertex count is exact
+            options.points = 0;
+            options.polygons = 0;
+            options.placemarks = std::max( target / options.vertices, 1ULL );
+
+            wxFileName fn( dir, wxString::Format( _T("kmloverlay_corpus_%llu.%s"), target, extension ) );
+            std::string path( fn.GetFullPath().mb_str() );
+            std::string error;
+            if ( !KMLOverlayWriteCorpus( options, path, &error ) ) {
+                  fprintf( stderr, "%s\n", error.c_str() );
+                  return 1;
+            }
+
+            LoadSample sample;
+            bool ok = MeasureInChild( path, &sample );
+            wxRemoveFile( fn.GetFullPath() );
+            if ( !ok ) {
+                  fprintf( stderr, "%s: measure failed\n", path.c_str() );
+                  return 1;
+            }
+            printf( "%12llu %12.1f %12.1f %10.1f\n", sample.vertices, sample.parse_ms, sample.ttff_ms, sample.rss_mb );
+            samples.push_back( sample );
+      }
+
+      double parse = Exponent( samples, &LoadSample::parse_ms );
+      double ttff = Exponent( samples, &LoadSample::ttff_ms );
+      double rss = Exponent( samples, &LoadSample::rss_mb );
+      printf( "growth exponents: parse %.2f, time to first frame %.2f, peak RSS %.2f (max %.2f)\n",
+              parse, ttff, rss, max_exponent );
+      if ( parse > max_exponent || ttff > max_exponent || rss > max_exponent ) {
+            printf( "FAIL: superlinear scaling\n" );
+            return 1;
+      }
+      return 0;
+}
+
+class KMLOverlayLoadBenchApp : public wxApp
+{
+public:
+      bool OnInit() { return true; }
+};
+
+IMPLEMENT_APP_NO_MAIN( KMLOverlayLoadBenchApp )
+
+int main( int argc, char **argv )
+{
+      if ( !wxEntryStart( argc, argv ) ) {
+            fprintf( stderr, "failed to initialize wxWidgets\n" );
+            return 1;
+      }
+      wxInitAllImageHandlers();
+      initialize_images();
+
+      int rc = LoadBench( argc, argv );
+
+      wxEntryCleanup();
+      return rc;
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ * $Id: ocpn_stub.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin, headless render benchmark
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <math.h>
+#include "ocpn_stub.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Metres per degree of longitude at the equator, as used for view_scale_ppm
+static const double KMLOverlayBenchMetresPerDegree = 111319.490793;
+
+KMLOverlayBenchCounters g_bench_counters = { 0, 0 };
+
+static double MercatorY( double lat )
+{
+      if ( lat > 85. )
+            lat = 85.;
+      if ( lat < -85. )
+            lat = -85.;
+      return log( tan( M_PI/4 + lat * M_PI/360 ) ) * 180 / M_PI;
+}
+
+static double InverseMercatorY( double y )
+{
+      return ( 2 * atan( exp( y * M_PI/180 ) ) - M_PI/2 ) * 180 / M_PI;
+}
+
+void KMLOverlayBenchSetViewport( PlugIn_ViewPort *vp, double clat, double clon, double span,
+                                 int width, int height )
+{
+      double ppd = width / span;
+      vp->clat = clat;
+      vp->clon = clon;
+      vp->view_scale_ppm = ppd / KMLOverlayBenchMetresPerDegree;
+      vp->skew = 0;
+      vp->rotation = 0;
+      vp->chart_scale = 1;
+      vp->pix_width = width;
+      vp->pix_height = height;
+      vp->rv_rect = wxRect( 0, 0, width, height );
+      vp->b_quilt = false;
+      vp->m_projection_type = 0;
+      vp->lon_min = clon - span / 2;
+      vp->lon_max = clon + span / 2;
+      double cy = MercatorY( clat );
+      vp->lat_min = InverseMercatorY( cy - height / ppd / 2 );
+      vp->lat_max = InverseMercatorY( cy + height / ppd / 2 );
+      vp->bValid = true;
+}
+
+void GetCanvasPixLL( PlugIn_ViewPort *vp, wxPoint *pp, double lat, double lon )
+{
+      g_bench_counters.projected++;
+      double ppd = vp->view_scale_ppm * KMLOverlayBenchMetresPerDegree;
+      double x = ( lon - vp->clon ) * ppd;
+      double y = ( MercatorY( lat ) - MercatorY( vp->clat ) ) * ppd;
+      pp->x = (int)floor( vp->pix_width / 2 + x + 0.5 );
+      pp->y = (int)floor( vp->pix_height / 2 - y + 0.5 );
+}
+
+void GetCanvasLLPix( PlugIn_ViewPort *vp, wxPoint p, double *plat, double *plon )
+{
+      double ppd = vp->view_scale_ppm * KMLOverlayBenchMetresPerDegree;
+      *plon = vp->clon + ( p.x - vp->pix_width / 2 ) / ppd;
+      *plat = InverseMercatorY( MercatorY( vp->clat ) + ( vp->pix_height / 2 - p.y ) / ppd );
+}
+
+void RequestRefresh( wxWindow *win )
+{
+      g_bench_counters.refresh++;
+}
+
+wxWindow *GetOCPNCanvasWindow()
+{
+      return NULL;
+}
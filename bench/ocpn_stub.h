@@ -0,0 +1,59 @@
+/***************************************************************************
+ * $Id: ocpn_stub.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin, headless render benchmark
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayBenchStub_H_
+#define _KMLOverlayBenchStub_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include "../../../include/ocpn_plugin.h"
+
+/*    Stand-in for the part of the OpenCPN plugin API used by the renderer.
+ *
+ *    Projection is spherical Mercator around the viewport centre, which
+ *    is what the chart canvas does for the non-skewed, non-rotated case.
+ *************************************************************************/
+
+struct KMLOverlayBenchCounters
+{
+      unsigned long long projected;      // GetCanvasPixLL calls, i.e. vertices submitted
+      unsigned long      refresh;        // RequestRefresh calls
+};
+
+extern KMLOverlayBenchCounters g_bench_counters;
+
+// Fills the viewport for a view centred on clat/clon, span degrees of
+// longitude wide
+void KMLOverlayBenchSetViewport( PlugIn_ViewPort *vp, double clat, double clon, double span,
+                                 int width, int height );
+
+#endif
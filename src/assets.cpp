@@ -0,0 +1,431 @@
+/***************************************************************************
+ * $Id: assets.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <vector>
+#include <wx/mstream.h>
+#include <kml/base/file.h>
+#include "assets.h"
+#include "imageops.h"
+#include "trace.h"
+
+// Pyramids stop at this size, icons and small tiles get none
+static const int MinLevelSize = 256;
+
+static std::string MakeKey( const std::string &source, const std::string &href )
+{
+      return source + '\n' + href;
+}
+
+static size_t ImageSize( const wxImage *image )
+{
+      size_t sz = (size_t)image->GetWidth() * image->GetHeight();
+      return sz * ( image->HasAlpha() ? 4 : 3 );
+}
+
+// Halved by 2x2 boxes until the next level would be under MinLevelSize
+static void BuildPyramid( const wxImage *image, std::vector<wxImage *> *levels )
+{
+      // Averaging would blend the mask colour into its neighbours
+      if ( image->HasMask() )
+            return;
+      const wxImage *level = image;
+      while ( level->GetWidth() >= 2 * MinLevelSize && level->GetHeight() >= 2 * MinLevelSize ) {
+            int w = level->GetWidth(), h = level->GetHeight();
+            wxImage *half = new wxImage( w / 2, h / 2, false );
+            KMLOverlayImageOps::HalveBox( level->GetData(), w, h, 3, half->GetData() );
+            if ( level->HasAlpha() ) {
+                  half->SetAlpha();
+                  KMLOverlayImageOps::HalveBox( level->GetAlpha(), w, h, 1, half->GetAlpha() );
+            }
+            levels->push_back( half );
+            level = half;
+      }
+}
+
+size_t KMLOverlayAssetCache::ReleaseImages( Entry *entry )
+{
+      size_t sz = 0;
+      if ( entry->image )
+            sz += ImageSize( entry->image );
+      delete entry->image;
+      entry->image = NULL;
+      for ( size_t i = 0; i < entry->levels.size(); i++ ) {
+            sz += ImageSize( entry->levels[i] );
+            delete entry->levels[i];
+      }
+      entry->levels.clear();
+      return sz;
+}
+
+KMLOverlayAssetCache::KMLOverlayAssetCache( KMLOverlayWorkerPool *pool, wxEvtHandler *handler )
+      : m_pool( pool ), m_handler( handler ), m_clock( 0 )
+{
+      m_stats.hits = 0;
+      m_stats.misses = 0;
+      m_stats.failures = 0;
+      m_stats.bytes_inflated = 0;
+      m_stats.resident = 0;
+}
+
+KMLOverlayAssetCache::~KMLOverlayAssetCache()
+{
+      // The pool must be gone by now, no job can still reference us
+      for ( std::map<std::string, Entry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it )
+      {
+            ReleaseImages( it->second );
+            delete it->second;
+      }
+      for ( std::map<std::string, Source *>::iterator it = m_sources.begin(); it != m_sources.end(); ++it )
+      {
+            delete it->second;
+      }
+}
+
+void KMLOverlayAssetCache::OpenSource( const std::string &source, const kmlengine::KmzFilePtr &kmz )
+{
+      wxMutexLocker lock( m_source_mutex );
+
+      std::map<std::string, Source *>::iterator it = m_sources.find( source );
+      if ( it != m_sources.end() )
+      {
+            it->second->refs++;
+            return;
+      }
+
+      Source *src = new Source();
+      src->refs = 1;
+      IndexSource( src, source, kmz );
+      m_sources[source] = src;
+}
+
+void KMLOverlayAssetCache::IndexSource( Source *src, const std::string &source, const kmlengine::KmzFilePtr &kmz )
+{
+      KMLOverlayTrace::Scope trace( "index build", source.c_str() );
+      src->kmz = kmz;
+      src->entries.clear();
+      src->basedir.clear();
+      if ( kmz )
+      {
+            // Index the archive once, so unknown hrefs fail without inflating anything
+            std::vector<std::string> entries;
+            if ( src->kmz->List( &entries ) )
+                  src->entries.insert( entries.begin(), entries.end() );
+      }
+      else
+      {
+            size_t sep = source.find_last_of( "/\\" );
+            if ( sep != std::string::npos )
+                  src->basedir = source.substr( 0, sep+1 );
+      }
+}
+
+void KMLOverlayAssetCache::ReloadSource( const std::string &source, const kmlengine::KmzFilePtr &kmz )
+{
+      {
+            wxMutexLocker lock( m_source_mutex );
+
+            std::map<std::string, Source *>::iterator it = m_sources.find( source );
+            if ( it == m_sources.end() )
+                  return;
+            IndexSource( it->second, source, kmz );
+      }
+
+      // Images still decoding are left to their job, they are at worst
+      // one version behind until the next reload.
+      wxMutexLocker lock( m_mutex );
+      std::string prefix = MakeKey( source, std::string() );
+      std::map<std::string, Entry *>::iterator it = m_entries.lower_bound( prefix );
+      while ( it != m_entries.end() && it->first.compare( 0, prefix.size(), prefix ) == 0 )
+      {
+            if ( it->second->state == ASSET_PENDING )
+            {
+                  ++it;
+                  continue;
+            }
+            m_stats.resident -= ReleaseImages( it->second );
+            delete it->second;
+            m_entries.erase( it++ );
+      }
+}
+
+void KMLOverlayAssetCache::CloseSource( const std::string &source )
+{
+      wxMutexLocker lock( m_source_mutex );
+
+      std::map<std::string, Source *>::iterator it = m_sources.find( source );
+      if ( it == m_sources.end() )
+            return;
+      if ( --it->second->refs == 0 )
+      {
+            delete it->second;
+            m_sources.erase( it );
+      }
+}
+
+KMLOverlayAssetCache::Entry *KMLOverlayAssetCache::Lookup( const std::string &source, const std::string &href,
+                                                            bool pyramid, int priority )
+{
+      bool submit = false;
+      Entry *entry;
+      {
+            wxMutexLocker lock( m_mutex );
+
+            // Every image drawn is looked up each frame, the key is built
+            // in a string that keeps its capacity
+            m_key.assign( source );
+            m_key.append( 1, '\n' );
+            m_key.append( href );
+            std::map<std::string, Entry *>::iterator it = m_entries.find( m_key );
+            if ( it != m_entries.end() )
+            {
+                  entry = it->second;
+                  if ( entry->state == ASSET_READY )
+                  {
+                        m_stats.hits++;
+                        entry->last_used = ++m_clock;
+                  }
+                  return entry->state == ASSET_READY ? entry : NULL;
+            }
+
+            m_stats.misses++;
+            entry = new Entry();
+            entry->state = ASSET_PENDING;
+            entry->image = NULL;
+            entry->icon_scale = 0;
+            entry->bytes = 0;
+            entry->last_used = ++m_clock;
+            m_entries[m_key] = entry;
+            submit = true;
+      }
+
+      // Outside of the lock: without threads the pool runs the job right away
+      if ( submit )
+            m_pool->Submit( new DecodeJob( this, source, href, pyramid ), priority );
+
+      wxMutexLocker lock( m_mutex );
+      return entry->state == ASSET_READY ? entry : NULL;
+}
+
+void KMLOverlayAssetCache::Preload( const std::string &source, const std::string &href, int priority )
+{
+      Lookup( source, href, true, priority );
+}
+
+const wxImage *KMLOverlayAssetCache::GetImage( const std::string &source, const std::string &href )
+{
+      Entry *entry = Lookup( source, href );
+      return entry ? entry->image : NULL;
+}
+
+const wxImage *KMLOverlayAssetCache::GetImage( const std::string &source, const std::string &href, int width, int height )
+{
+      Entry *entry = Lookup( source, href, true );
+      if ( !entry )
+            return NULL;
+      // Levels are set by the job before the entry is ready, and never change after
+      const wxImage *image = entry->image;
+      for ( size_t i = 0; i < entry->levels.size(); i++ ) {
+            if ( entry->levels[i]->GetWidth() < width || entry->levels[i]->GetHeight() < height )
+                  break;
+            image = entry->levels[i];
+      }
+      return image;
+}
+
+const wxBitmap *KMLOverlayAssetCache::GetIcon( const std::string &source, const std::string &href, double scale )
+{
+      Entry *entry = Lookup( source, href );
+      if ( !entry )
+            return NULL;
+
+      if ( entry->icon_scale != scale || !entry->icon.IsOk() )
+      {
+            // KML icons are drawn 32 pixels high at scale 1
+            int h = (int)( 32 * scale + 0.5 );
+            int w = entry->image->GetHeight() ? h * entry->image->GetWidth() / entry->image->GetHeight() : h;
+            if ( w < 1 || h < 1 )
+                  return NULL;
+
+            wxMutexLocker lock( m_mutex );
+            if ( entry->icon.IsOk() )
+                  entry->bytes -= (size_t)entry->icon.GetWidth() * entry->icon.GetHeight() * 4;
+            entry->icon = wxBitmap( entry->image->Scale( w, h, wxIMAGE_QUALITY_HIGH ) );
+            entry->icon_scale = scale;
+            entry->bytes += (size_t)w * h * 4;
+      }
+      return &entry->icon;
+}
+
+bool KMLOverlayAssetCache::ReadAsset( const std::string &source, const std::string &href, std::string *content )
+{
+      std::string path;
+      {
+            wxMutexLocker lock( m_source_mutex );
+
+            std::map<std::string, Source *>::iterator it = m_sources.find( source );
+            if ( it == m_sources.end() )
+                  return false;
+            Source *src = it->second;
+
+            if ( src->kmz )
+            {
+                  // KmzFile is not reentrant, reads are serialized by the lock
+                  if ( src->entries.find( href ) == src->entries.end() )
+                        return false;
+                  return src->kmz->ReadFile( href.c_str(), content );
+            }
+
+            // Plain KML: only local files, either relative or file:// URLs
+            if ( href.compare( 0, 7, "file://" ) == 0 )
+                  path = href.substr( 7 );
+            else if ( href.find( "://" ) != std::string::npos )
+                  return false;
+            else if ( !href.empty() && ( href[0] == '/' || href[0] == '\\' ) )
+                  path = href;
+            else
+                  path = src->basedir + href;
+      }
+      return kmlbase::File::ReadFileToString( path, content );
+}
+
+void KMLOverlayAssetCache::Decode( const std::string &source, const std::string &href, bool pyramid )
+{
+      KMLOverlayTrace::Scope trace( "image decode", href.c_str() );
+      std::string content;
+      wxImage *image = NULL;
+      if ( ReadAsset( source, href, &content ) )
+      {
+            wxMemoryInputStream is( content.c_str(), content.size() );
+            image = new wxImage( is, wxBITMAP_TYPE_ANY );
+            if ( !image->IsOk() )
+            {
+                  delete image;
+                  image = NULL;
+            }
+      }
+      std::vector<wxImage *> levels;
+      if ( image && pyramid )
+      {
+            KMLOverlayTrace::Scope trace( "image pyramid", href.c_str() );
+            BuildPyramid( image, &levels );
+      }
+
+      {
+            wxMutexLocker lock( m_mutex );
+
+            std::map<std::string, Entry *>::iterator it = m_entries.find( MakeKey( source, href ) );
+            if ( it == m_entries.end() )
+            {
+                  delete image;
+                  for ( size_t i = 0; i < levels.size(); i++ )
+                        delete levels[i];
+                  return;
+            }
+            Entry *entry = it->second;
+            m_stats.bytes_inflated += content.size();
+            if ( image )
+            {
+                  entry->image = image;
+                  entry->levels.swap( levels );
+                  entry->bytes = ImageSize( image );
+                  for ( size_t i = 0; i < entry->levels.size(); i++ )
+                        entry->bytes += ImageSize( entry->levels[i] );
+                  entry->state = ASSET_READY;
+                  m_stats.resident += entry->bytes;
+            }
+            else
+            {
+                  entry->state = ASSET_FAILED;
+                  m_stats.failures++;
+            }
+      }
+
+      if ( image && m_handler )
+      {
+            wxCommandEvent event( wxEVT_KMLOVERLAY_REFRESH );
+            wxPostEvent( m_handler, event );
+      }
+}
+
+size_t KMLOverlayAssetCache::GetMemoryUsage()
+{
+      wxMutexLocker lock( m_mutex );
+
+      size_t sz = 0;
+      for ( std::map<std::string, Entry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it )
+            sz += it->second->bytes;
+      return sz;
+}
+
+void KMLOverlayAssetCache::Trim( size_t budget )
+{
+      wxMutexLocker lock( m_mutex );
+
+      size_t sz = 0;
+      for ( std::map<std::string, Entry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it )
+            sz += it->second->bytes;
+
+      // Least recently used first, images still decoding are left alone
+      while ( sz > budget )
+      {
+            std::map<std::string, Entry *>::iterator victim = m_entries.end();
+            for ( std::map<std::string, Entry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it )
+            {
+                  if ( it->second->state != ASSET_READY )
+                        continue;
+                  if ( victim == m_entries.end() || it->second->last_used < victim->second->last_used )
+                        victim = it;
+            }
+            if ( victim == m_entries.end() )
+                  break;
+
+            sz -= victim->second->bytes;
+            m_stats.resident -= ReleaseImages( victim->second );
+            delete victim->second;
+            m_entries.erase( victim );
+      }
+}
+
+KMLOverlayAssetCache::Stats KMLOverlayAssetCache::GetStats()
+{
+      wxMutexLocker lock( m_mutex );
+      return m_stats;
+}
+
+void KMLOverlayAssetCache::LogStats()
+{
+      Stats stats = GetStats();
+      wxLogMessage( _T("KMLOverlayAssetCache: %lu hits, %lu misses, %lu failures, %llu bytes inflated, %lu bytes of decoded images"),
+                    stats.hits, stats.misses, stats.failures, stats.bytes_inflated, (unsigned long)stats.resident );
+}
@@ -0,0 +1,156 @@
+/***************************************************************************
+ * $Id: assets.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayAssets_H_
+#define _KMLOverlayAssets_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/thread.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <kml/engine.h>
+#include "workerpool.h"
+
+/*    Decoded image cache shared by all layers.
+ *
+ *    Each layer registers its source: the KMZ archive, whose entries are
+ *    indexed once, or the directory of a plain KML file. Images are
+ *    looked up by (source, href), inflated and decoded on the worker pool
+ *    on first use, then shared by every feature referencing them.
+ *    wxEVT_KMLOVERLAY_REFRESH is posted to the handler when one is ready.
+ *
+ *    Ground overlays can be preloaded as soon as their layer is, so the
+ *    first pan over a photo mosaic finds them decoded. Their job also
+ *    builds a pyramid of halved levels, drawing then scales down from the
+ *    nearest one instead of the full image.
+ *************************************************************************/
+
+class KMLOverlayAssetCache
+{
+public:
+      struct Stats
+      {
+            unsigned long      hits;
+            unsigned long      misses;
+            unsigned long      failures;
+            unsigned long long bytes_inflated;
+            size_t             resident;
+      };
+
+      KMLOverlayAssetCache( KMLOverlayWorkerPool *pool, wxEvtHandler *handler );
+      ~KMLOverlayAssetCache();
+
+      // Sources are reference counted, the same file opened by two layers is shared
+      void OpenSource( const std::string &source, const kmlengine::KmzFilePtr &kmz );
+      void CloseSource( const std::string &source );
+      // The file changed on disk: index the new archive and forget decoded images
+      void ReloadSource( const std::string &source, const kmlengine::KmzFilePtr &kmz );
+
+      // Queues the decoding of a ground overlay, higher priorities first
+      void Preload( const std::string &source, const std::string &href, int priority );
+
+      // All return NULL while the asset is not decoded yet, or if it can't be
+      const wxImage *GetImage( const std::string &source, const std::string &href );
+      // The smallest pyramid level at least width x height, for ground overlays
+      const wxImage *GetImage( const std::string &source, const std::string &href, int width, int height );
+      const wxBitmap *GetIcon( const std::string &source, const std::string &href, double scale );
+
+      // Raw content of an asset, from any thread
+      bool ReadAsset( const std::string &source, const std::string &href, std::string *content );
+
+      size_t GetMemoryUsage();
+      void Trim( size_t budget );
+      Stats GetStats();
+      void LogStats();
+
+private:
+      enum State
+      {
+            ASSET_PENDING,
+            ASSET_READY,
+            ASSET_FAILED
+      };
+
+      struct Entry
+      {
+            State          state;
+            wxImage       *image;        // owned, set once by the decoding job
+            std::vector<wxImage *> levels;   // owned, halved down from image
+            wxBitmap       icon;         // main thread only
+            double         icon_scale;
+            size_t         bytes;
+            unsigned long  last_used;
+      };
+
+      struct Source
+      {
+            kmlengine::KmzFilePtr  kmz;
+            std::set<std::string>  entries;     // archive index
+            std::string            basedir;     // for plain KML files
+            int                    refs;
+      };
+
+      class DecodeJob : public KMLOverlayWorkerPool::Job
+      {
+      public:
+            DecodeJob( KMLOverlayAssetCache *cache, const std::string &source, const std::string &href, bool pyramid )
+                  : m_cache( cache ), m_source( source ), m_href( href ), m_pyramid( pyramid ) {}
+            void Run() { m_cache->Decode( m_source, m_href, m_pyramid ); }
+      private:
+            KMLOverlayAssetCache *m_cache;
+            std::string           m_source;
+            std::string           m_href;
+            bool                  m_pyramid;
+      };
+
+      void IndexSource( Source *src, const std::string &source, const kmlengine::KmzFilePtr &kmz );
+      Entry *Lookup( const std::string &source, const std::string &href, bool pyramid = false, int priority = 0 );
+      void Decode( const std::string &source, const std::string &href, bool pyramid );
+      static size_t ReleaseImages( Entry *entry );
+
+      KMLOverlayWorkerPool           *m_pool;
+      wxEvtHandler                   *m_handler;
+
+      wxMutex                         m_mutex;          // entries and stats
+      std::map<std::string, Entry *>  m_entries;
+      std::string                     m_key;            // of the last lookup
+      unsigned long                   m_clock;
+      Stats                           m_stats;
+
+      wxMutex                         m_source_mutex;   // sources, and reads from archives
+      std::map<std::string, Source *> m_sources;
+};
+
+#endif
@@ -0,0 +1,204 @@
+/***************************************************************************
+ * $Id: backend.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include "../../../include/ocpn_plugin.h"
+#include <algorithm>
+#include "backend.h"
+#include "trace.h"
+
+void KMLOverlayGLBackend::Begin()
+{
+      glPushAttrib( GL_COLOR_BUFFER_BIT | GL_LINE_BIT | GL_HINT_BIT | GL_POLYGON_BIT | GL_CURRENT_BIT );      //Save state
+
+      glEnable( GL_LINE_SMOOTH );
+      glEnable( GL_POLYGON_SMOOTH );
+      glEnable( GL_BLEND );
+      glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+      glHint( GL_LINE_SMOOTH_HINT, GL_NICEST );
+      glHint( GL_POLYGON_SMOOTH_HINT, GL_NICEST );
+      m_has_colour = false;
+      m_width = 0;
+      // The canvas may keep clipping regions in the low bits
+      GLint bits = 0;
+      glGetIntegerv( GL_STENCIL_BITS, &bits );
+      m_stencil_bit = bits > 0 ? 1u << ( bits - 1 ) : 0;
+}
+
+void KMLOverlayGLBackend::End()
+{
+      glPopAttrib();            // restore state
+}
+
+void KMLOverlayGLBackend::SetColour( const wxColour &c )
+{
+      uint32_t colour = (uint32_t)c.Red() << 24 | c.Green() << 16 | c.Blue() << 8 | c.Alpha();
+      if ( m_has_colour && colour == m_colour )
+            return;
+      glColor4ub( c.Red(), c.Green(), c.Blue(), c.Alpha() );
+      m_colour = colour;
+      m_has_colour = true;
+}
+
+void KMLOverlayGLBackend::SetWidth( int width )
+{
+      if ( width == m_width )
+            return;
+      glLineWidth( width );
+      m_width = width;
+}
+
+void KMLOverlayGLBackend::DrawPolylines( const wxPen &pen, int n, const int counts[], wxPoint points[] )
+{
+      if( pen == wxNullPen )
+            return;
+      SetColour( pen.GetColour() );
+      SetWidth( pen.GetWidth() );
+      // Colour and width set once for the batch, each line stays a strip
+      // so its joins are drawn once
+      for ( int i = 0; i < n; points += counts[i++] ) {
+            glBegin( GL_LINE_STRIP );
+            for ( int k = 0; k < counts[i]; k++ )
+                  glVertex2i( points[k].x, points[k].y );
+            glEnd();
+      }
+}
+
+void KMLOverlayGLBackend::DrawPolygon( const wxPen &pen, const wxBrush &brush, int n, wxPoint points[] )
+{
+      if ( brush != wxNullBrush && brush.GetStyle() != wxTRANSPARENT ) {
+            SetColour( brush.GetColour() );
+            glBegin( GL_POLYGON );
+            for ( int i=0; i<n; i++ )
+                  glVertex2i( points[i].x, points[i].y );
+            glEnd();
+      }
+
+      if( pen != wxNullPen ) {
+            SetColour( pen.GetColour() );
+            SetWidth( pen.GetWidth() );
+            glBegin( GL_LINE_LOOP );
+            for ( int i=0; i<n; i++ )
+                  glVertex2i( points[i].x, points[i].y );
+            glEnd();
+      }
+}
+
+void KMLOverlayGLBackend::DrawPolyPolygon( const wxPen &pen, const wxBrush &brush, int n, int counts[], wxPoint points[] )
+{
+      if ( brush != wxNullBrush && brush.GetStyle() != wxTRANSPARENT ) {
+            if ( !m_stencil_bit ) {
+                  // Without a stencil buffer the holes are filled too
+                  DrawPolygon( wxNullPen, brush, counts[0], points );
+            } else {
+                  // Every ring fanned from the same point flips the stencil
+                  // bit of what it covers: it ends up set where the even-odd
+                  // rule fills. The cover pass then clears it as it paints.
+                  glPushAttrib( GL_STENCIL_BUFFER_BIT | GL_ENABLE_BIT );
+                  glDisable( GL_POLYGON_SMOOTH );
+                  glEnable( GL_STENCIL_TEST );
+                  glStencilMask( m_stencil_bit );
+                  glStencilFunc( GL_ALWAYS, 0, m_stencil_bit );
+                  glStencilOp( GL_KEEP, GL_KEEP, GL_INVERT );
+                  glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+                  int minx = points[0].x, maxx = points[0].x, miny = points[0].y, maxy = points[0].y;
+                  wxPoint *ring = points;
+                  for ( int i = 0; i < n; ring += counts[i++] ) {
+                        glBegin( GL_TRIANGLE_FAN );
+                        glVertex2i( points[0].x, points[0].y );
+                        for ( int k = 0; k < counts[i]; k++ ) {
+                              glVertex2i( ring[k].x, ring[k].y );
+                              minx = std::min( minx, ring[k].x );
+                              maxx = std::max( maxx, ring[k].x );
+                              miny = std::min( miny, ring[k].y );
+                              maxy = std::max( maxy, ring[k].y );
+                        }
+                        glEnd();
+                  }
+                  glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+                  glStencilFunc( GL_EQUAL, m_stencil_bit, m_stencil_bit );
+                  glStencilOp( GL_KEEP, GL_KEEP, GL_ZERO );
+                  SetColour( brush.GetColour() );
+                  glRecti( minx, miny, maxx + 1, maxy + 1 );
+                  glPopAttrib();
+            }
+      }
+
+      if( pen != wxNullPen ) {
+            SetColour( pen.GetColour() );
+            SetWidth( pen.GetWidth() );
+            for ( int i = 0; i < n; points += counts[i++] ) {
+                  glBegin( GL_LINE_LOOP );
+                  for ( int k = 0; k < counts[i]; k++ )
+                        glVertex2i( points[k].x, points[k].y );
+                  glEnd();
+            }
+      }
+}
+
+void KMLOverlayGLBackend::DrawLabels( KMLOverlayLabels *labels )
+{
+      // Glyph quads must not be smoothed, and leave the colour undefined
+      glDisable( GL_POLYGON_SMOOTH );
+      labels->Flush( NULL );
+      glEnable( GL_POLYGON_SMOOTH );
+      m_has_colour = false;
+}
+
+unsigned long long KMLOverlayGLBackend::DrawBitmap( const wxBitmap &bitmap, wxCoord x, wxCoord y, bool usemask )
+{
+      // GL doesn't draw anything if x<0 || y<0, the rows and columns
+      // before the corner are skipped instead of cropping a copy
+      int w = bitmap.GetWidth(), h = bitmap.GetHeight();
+      int dx = x < 0 ? -x : 0, dy = y < 0 ? -y : 0;
+      /* picture is out of viewport */
+      if ( w - dx <= 0 || h - dy <= 0 )
+            return 0;
+      const unsigned char *pixels = m_scratch->GetPixels( bitmap, usemask );
+      if ( !pixels )
+            return 0;
+
+      KMLOverlayTrace::Scope trace( "gl upload" );
+      glPushClientAttrib( GL_CLIENT_PIXEL_STORE_BIT );
+      glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+      glPixelStorei( GL_UNPACK_ROW_LENGTH, w );
+      glPixelStorei( GL_UNPACK_SKIP_PIXELS, dx );
+      glPixelStorei( GL_UNPACK_SKIP_ROWS, dy );
+      // Blending is on for the whole frame, RGB pixels are opaque
+      glRasterPos2i( x + dx, y + dy );
+      glPixelZoom( 1, -1 ); /* draw data from top to bottom */
+      glDrawPixels( w - dx, h - dy, usemask ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, pixels );
+      glPixelZoom( 1, 1 );
+      glPopClientAttrib();
+      return (unsigned long long)( w - dx ) * ( h - dy ) * ( usemask ? 4 : 3 );
+}
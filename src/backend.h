@@ -0,0 +1,165 @@
+/***************************************************************************
+ * $Id: backend.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayBackend_H_
+#define _KMLOverlayBackend_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include "labels.h"
+#include "scratch.h"
+
+/*    Drawing backends of the render pipeline.
+ *
+ *    Layers record their frame, KMLOverlayRenderQueue then draws the
+ *    records of all layers into one of these. It is a template over them,
+ *    so primitives are resolved at compile time instead of testing what
+ *    we draw to on every call. Begin and End enclose the whole frame.
+ *    Points are canvas pixels, DrawPolylines draws n lines of counts[i]
+ *    consecutive points. DrawPolyPolygon fills n rings the same way with
+ *    the even-odd rule: the first is the outer boundary, the others its
+ *    holes. DrawBitmap returns the bytes handed over, for the
+ *    statistics. Labels are queued with AddLabel and drawn together by
+ *    DrawLabels, once the layer is done.
+ *************************************************************************/
+
+// Any wxDC, a wxMemoryDC for software rendering
+class KMLOverlayDCBackend
+{
+public:
+      KMLOverlayDCBackend( wxDC &dc ) : m_dc( dc ) {}
+
+      void Begin() {}
+      void End() {}
+      void DrawPolylines( const wxPen &pen, int n, const int counts[], wxPoint points[] )
+      {
+            m_dc.SetPen( pen );
+            for ( int i = 0; i < n; points += counts[i++] )
+                  m_dc.DrawLines( counts[i], points );
+      }
+      void DrawPolygon( const wxPen &pen, const wxBrush &brush, int n, wxPoint points[] )
+      {
+            m_dc.SetPen( pen );
+            m_dc.SetBrush( brush );
+            m_dc.DrawPolygon( n, points );
+      }
+      void DrawPolyPolygon( const wxPen &pen, const wxBrush &brush, int n, int counts[], wxPoint points[] )
+      {
+            m_dc.SetPen( pen );
+            m_dc.SetBrush( brush );
+            m_dc.DrawPolyPolygon( n, counts, points, 0, 0, wxODDEVEN_RULE );
+      }
+      unsigned long long DrawBitmap( const wxBitmap &bitmap, wxCoord x, wxCoord y, bool usemask )
+      {
+            m_dc.DrawBitmap( bitmap, x, y, usemask );
+            return (unsigned long long)bitmap.GetWidth() * bitmap.GetHeight() * 4;
+      }
+      void AddLabel( KMLOverlayLabels *labels, const char *text, int x, int y, uint32_t colour )
+      {
+            labels->Add( text, x, y, colour );
+      }
+      void DrawLabels( KMLOverlayLabels *labels ) { labels->Flush( &m_dc ); }
+
+private:
+      wxDC &m_dc;
+};
+
+// Immediate mode OpenGL, in the canvas' current context. Blending and
+// smoothing are set up once per frame, colours and widths only when they
+// change. Bitmaps are converted once for as long as they are drawn, see
+// KMLOverlayScratch.
+class KMLOverlayGLBackend
+{
+public:
+      KMLOverlayGLBackend( KMLOverlayScratch *scratch )
+            : m_scratch( scratch ), m_has_colour( false ), m_colour( 0 ), m_width( 0 ), m_stencil_bit( 0 ) {}
+
+      void Begin();
+      void End();
+      void DrawPolylines( const wxPen &pen, int n, const int counts[], wxPoint points[] );
+      void DrawPolygon( const wxPen &pen, const wxBrush &brush, int n, wxPoint points[] );
+      void DrawPolyPolygon( const wxPen &pen, const wxBrush &brush, int n, int counts[], wxPoint points[] );
+      unsigned long long DrawBitmap( const wxBitmap &bitmap, wxCoord x, wxCoord y, bool usemask );
+      void AddLabel( KMLOverlayLabels *labels, const char *text, int x, int y, uint32_t colour )
+      {
+            labels->Add( text, x, y, colour );
+      }
+      void DrawLabels( KMLOverlayLabels *labels );
+
+private:
+      void SetColour( const wxColour &c );
+      void SetWidth( int width );
+
+      KMLOverlayScratch *m_scratch;
+      bool               m_has_colour;    // m_colour is GL's current one
+      uint32_t           m_colour;
+      int                m_width;         // 0 until set
+      unsigned int       m_stencil_bit;   // for even-odd fills, 0 without a stencil buffer
+};
+
+// Draws nothing, only counts: the cost of the traversal alone
+class KMLOverlayNullBackend
+{
+public:
+      KMLOverlayNullBackend() : m_primitives( 0 ), m_points( 0 ) {}
+
+      void Begin() {}
+      void End() {}
+      void DrawPolylines( const wxPen &, int n, const int counts[], wxPoint [] )
+      {
+            m_primitives += n;
+            for ( int i = 0; i < n; i++ )
+                  m_points += counts[i];
+      }
+      void DrawPolygon( const wxPen &, const wxBrush &, int n, wxPoint [] ) { m_primitives++; m_points += n; }
+      void DrawPolyPolygon( const wxPen &, const wxBrush &, int n, int counts[], wxPoint [] )
+      {
+            m_primitives++;
+            for ( int i = 0; i < n; i++ )
+                  m_points += counts[i];
+      }
+      unsigned long long DrawBitmap( const wxBitmap &, wxCoord, wxCoord, bool ) { m_primitives++; return 0; }
+      void AddLabel( KMLOverlayLabels *labels, const char *text, int x, int y, uint32_t colour )
+      {
+            labels->Add( text, x, y, colour );
+      }
+      void DrawLabels( KMLOverlayLabels *labels ) { labels->Discard(); }
+
+      unsigned long GetPrimitives() const { return m_primitives; }
+      unsigned long GetPoints() const { return m_points; }
+
+private:
+      unsigned long m_primitives;
+      unsigned long m_points;
+};
+
+#endif
@@ -33,15 +33,436 @@
 #endif //precompiled headers
 
 #include <iostream>
+#include <chrono>
+#include <math.h>
+#include <algorithm>
+#include <set>
 #include <kml/base/file.h>
 #include "factory.h"
+#include "kmlcompiler.h"
+#include "assets.h"
+#include "reclaimer.h"
+#include "trace.h"
+#include "backend.h"
+#include "imageops.h"
 #include <wx/mstream.h>
+#include <wx/filename.h>
+#include <wx/filefn.h>
 #include "icons.h"
 
-const wxColor KMLOverlayDefaultColor( 144, 144, 144 );
+/*    State shared between a layer and its jobs, which may outlive it.
+ *
+ *    The current scene is published through an atomic pointer: the paint
+ *    thread takes its snapshot with a single load, writers swap in a new
+ *    version and retire the old one to the reclaimer. Everything else is
+ *    bookkeeping under the mutex. A layer runs one job at a time: a
+ *    reload, a load from the binary cache or the file, the save of the
+ *    cache once unloaded, or the conversion of a shown or hidden layer.
+ *************************************************************************/
+
+struct KMLOverlayFactory::Container::SceneSlot
+{
+      std::atomic<KMLOverlayScene *> scene;
+      std::atomic<bool>         visible;
+      std::atomic<bool>         published;  // a reload finished, see reloaded and error
+      std::atomic<bool>         finished;   // a load or save finished, see loaded and failed_cache
+      KMLOverlayReclaimer      *reclaimer;
+
+      wxMutex                   mutex;
+      int                       refs;
+      bool                      orphaned;   // the layer was deleted
+      bool                      busy;       // a job is running
+      bool                      wanted;     // the file changed since the last job started
+      bool                      reloaded;   // bookkeeping left to the UI thread
+      bool                      load_wanted;   // a frame missed the scene while busy
+      bool                      loaded;     // bookkeeping left to the UI thread
+      bool                      load_failed;   // not tried again before the file changes
+      bool                      rehydrated; // loaded from the binary cache
+      bool                      cache_busy; // a job has the binary cache open, removes it once orphaned
+      KMLOverlayScene          *reading;    // published, read by the running job
+      bool                      dropped;    // reading was unpublished meanwhile, the job retires it
+      bool                      converted;  // views of the previous form left to the UI thread to drop
+      std::string               failed_cache;  // could not be read or written, gone
+      std::string               load_error;
+      KMLOverlayScene::Bounds   bounds;
+      bool                      has_assets;
+      kmlengine::KmzFilePtr     kmz;
+      size_t                    kmz_size;
+      KMLOverlayScene::Digests  digests;
+      KMLOverlayScene::Changes  changes;
+      int64_t                   time_begin, time_end;
+      double                    parse_ms;
+      size_t                    vertex_count;
+      std::string               error;
+
+      KMLOverlayScene *Acquire()
+      {
+            return scene.load( std::memory_order_acquire );
+      }
+
+      void Publish( KMLOverlayScene *next )
+      {
+            reclaimer->Retire( scene.exchange( next, std::memory_order_acq_rel ) );
+      }
+
+      // Unpublishes the scene without retiring it, for a job to finish
+      // with. Only while this thread holds busy, nothing publishes then.
+      KMLOverlayScene *Take()
+      {
+            return scene.exchange( NULL, std::memory_order_acq_rel );
+      }
+
+      // Only publishes if nothing was meanwhile, returns false otherwise
+      bool PublishIfEmpty( KMLOverlayScene *next )
+      {
+            return Replace( NULL, next );
+      }
+
+      // Only publishes over previous, a reload may have replaced it
+      // meanwhile. Returns false and retires next otherwise.
+      bool Replace( KMLOverlayScene *previous, KMLOverlayScene *next )
+      {
+            KMLOverlayScene *expected = previous;
+            if ( scene.compare_exchange_strong( expected, next, std::memory_order_acq_rel ) ) {
+                  reclaimer->Retire( previous );
+                  return true;
+            }
+            reclaimer->Retire( next );
+            return false;
+      }
+
+      void Release()
+      {
+            bool last;
+            {
+                  wxMutexLocker lock( mutex );
+                  last = --refs == 0;
+            }
+            if ( last ) {
+                  Publish( NULL );
+                  delete this;
+            }
+      }
+};
+
+static double ElapsedMs( const std::chrono::steady_clock::time_point &start )
+{
+      return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+class KMLOverlayFactory::Container::ReloadJob : public KMLOverlayWorkerPool::Job
+{
+public:
+      ReloadJob( SceneSlot *slot, const std::string &source,
+                 const KMLOverlayScene::Digests &digests, wxEvtHandler *handler )
+            : m_slot( slot ), m_source( source ), m_digests( digests ), m_handler( handler ) {}
+      ~ReloadJob() { m_slot->Release(); }
+      void Run();
+private:
+      SceneSlot                *m_slot;
+      std::string               m_source;
+      KMLOverlayScene::Digests  m_digests;
+      wxEvtHandler             *m_handler;
+};
+
+void KMLOverlayFactory::Container::ReloadJob::Run()
+{
+      KMLOverlayTrace::Scope trace( "reload", m_source.c_str() );
+      KMLOverlayScene *scene = new KMLOverlayScene();
+      kmlengine::KmzFilePtr kmz;
+      size_t kmz_size = 0;
+      std::string error;
+      KMLOverlayScene::Changes changes;
+      KMLOverlayScene::Digests digests;
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      bool ok = KMLOverlayCompiler::CompileFile( m_source, scene, &kmz, &kmz_size, &error );
+      double parse_ms = ElapsedMs( start );
+      if ( ok ) {
+            scene->Compare( m_digests, &changes );
+            // Rewritten with the same content, keep what we have
+            ok = changes.added || changes.changed || changes.removed;
+            if ( ok ) {
+                  KMLOverlayTrace::Scope trace( "index build" );
+                  scene->GetDigests( &digests );
+                  if ( !m_slot->visible.load( std::memory_order_relaxed ) )
+                        scene->Pack();
+            }
+      }
+
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            m_slot->busy = false;
+            if ( ok && !m_slot->orphaned ) {
+                  m_slot->bounds = scene->GetBounds();
+                  m_slot->has_assets = scene->HasAssets();
+                  m_slot->vertex_count = scene->GetVertexCount();
+                  scene->GetTimeExtent( &m_slot->time_begin, &m_slot->time_end );
+                  m_slot->parse_ms = parse_ms;
+                  m_slot->Publish( scene );
+                  scene = NULL;
+                  // Swapped so the archive refcount is only touched under the lock
+                  m_slot->kmz.swap( kmz );
+                  m_slot->kmz_size = kmz_size;
+                  m_slot->digests.swap( digests );
+                  m_slot->changes.added = changes.added;
+                  m_slot->changes.changed = changes.changed;
+                  m_slot->changes.removed = changes.removed;
+                  m_slot->changes.unchanged = changes.unchanged;
+                  m_slot->reloaded = true;
+            }
+            m_slot->error = error;
+            if ( m_slot->reloaded || !error.empty() )
+                  m_slot->published.store( true, std::memory_order_release );
+            // A frame is waiting to start its load
+            if ( m_slot->load_wanted ) {
+                  m_slot->load_wanted = false;
+                  ok = true;
+            }
+      }
+      delete scene;
 
-KMLOverlayFactory::KMLOverlayFactory()
+      if ( ( ok || !error.empty() ) && m_handler ) {
+            wxCommandEvent event( wxEVT_KMLOVERLAY_REFRESH );
+            wxPostEvent( m_handler, event );
+      }
+}
+
+class KMLOverlayFactory::Container::LoadJob : public KMLOverlayWorkerPool::Job
 {
+public:
+      LoadJob( SceneSlot *slot, const std::string &source, const std::string &cachefile, wxEvtHandler *handler )
+            : m_slot( slot ), m_source( source ), m_cachefile( cachefile ), m_handler( handler ), m_ran( false ) {}
+      ~LoadJob()
+      {
+            // Dropped unrun by the pool shutting down, once the layers are gone
+            if ( !m_ran && !m_cachefile.empty() )
+                  wxRemoveFile( wxString( m_cachefile.c_str(), wxConvFile ) );
+            m_slot->Release();
+      }
+      void Run();
+private:
+      SceneSlot                *m_slot;
+      std::string               m_source;
+      std::string               m_cachefile;   // empty when there is none
+      wxEvtHandler             *m_handler;
+      bool                      m_ran;
+};
+
+void KMLOverlayFactory::Container::LoadJob::Run()
+{
+      m_ran = true;
+      KMLOverlayScene *scene = new KMLOverlayScene();
+      kmlengine::KmzFilePtr kmz;
+      size_t kmz_size = 0;
+      std::string error;
+      KMLOverlayScene::Digests digests;
+      double parse_ms = 0;
+
+      // Rehydrate from the binary cache when there is one, it is much
+      // faster than parsing the KML again
+      bool rehydrated = false, cache_failed = false;
+      if ( !m_cachefile.empty() ) {
+            KMLOverlayTrace::Scope trace( "cache load", m_source.c_str() );
+            rehydrated = scene->Load( m_cachefile );
+            if ( rehydrated && scene->HasAssets() ) {
+                  std::string file_data;
+                  if ( kmlbase::File::ReadFileToString( m_source, &file_data )
+                        && kmlengine::KmzFile::IsKmz( file_data ) ) {
+                        kmz = kmlengine::KmzFile::OpenFromString( file_data );
+                        kmz_size = kmz ? file_data.size() : 0;
+                  }
+            }
+            if ( !rehydrated ) {
+                  cache_failed = true;
+                  scene->Clear();
+            }
+      }
+      bool ok = rehydrated;
+      if ( !ok ) {
+            KMLOverlayTrace::Scope trace( "load", m_source.c_str() );
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ok = KMLOverlayCompiler::CompileFile( m_source, scene, &kmz, &kmz_size, &error );
+            parse_ms = ElapsedMs( start );
+            if ( ok )
+                  scene->GetDigests( &digests );
+      }
+      if ( ok ) {
+            // Hidden layers are kept in their compressed form
+            if ( m_slot->visible.load( std::memory_order_relaxed ) )
+                  scene->Unpack();
+            else
+                  scene->Pack();
+      }
+
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            m_slot->busy = false;
+            m_slot->cache_busy = false;
+            m_slot->load_wanted = false;
+            if ( cache_failed || ( m_slot->orphaned && !m_cachefile.empty() ) )
+                  wxRemoveFile( wxString( m_cachefile.c_str(), wxConvFile ) );
+            if ( cache_failed )
+                  m_slot->failed_cache = m_cachefile;
+            if ( !ok ) {
+                  m_slot->load_failed = true;
+                  m_slot->load_error = error;
+            } else if ( !m_slot->orphaned ) {
+                  m_slot->bounds = scene->GetBounds();
+                  m_slot->has_assets = scene->HasAssets();
+                  m_slot->vertex_count = scene->GetVertexCount();
+                  scene->GetTimeExtent( &m_slot->time_begin, &m_slot->time_end );
+                  m_slot->parse_ms = parse_ms;
+                  m_slot->rehydrated = rehydrated;
+                  // Swapped so the archive refcount is only touched under the lock
+                  m_slot->kmz.swap( kmz );
+                  m_slot->kmz_size = kmz_size;
+                  m_slot->digests.swap( digests );
+                  m_slot->loaded = true;
+                  // Retired unseen when a reload won the race
+                  m_slot->PublishIfEmpty( scene );
+                  scene = NULL;
+            }
+            m_slot->finished.store( true, std::memory_order_release );
+      }
+      delete scene;
+
+      if ( m_handler ) {
+            wxCommandEvent event( wxEVT_KMLOVERLAY_REFRESH );
+            wxPostEvent( m_handler, event );
+      }
+}
+
+class KMLOverlayFactory::Container::SaveJob : public KMLOverlayWorkerPool::Job
+{
+public:
+      // Takes the unpublished scene, retired once written
+      SaveJob( SceneSlot *slot, KMLOverlayScene *scene, const std::string &cachefile, wxEvtHandler *handler )
+            : m_slot( slot ), m_scene( scene ), m_cachefile( cachefile ), m_handler( handler ) {}
+      ~SaveJob()
+      {
+            // Dropped unrun by the pool shutting down, once the layers are gone
+            if ( m_scene ) {
+                  wxRemoveFile( wxString( m_cachefile.c_str(), wxConvFile ) );
+                  m_slot->reclaimer->Retire( m_scene );
+            }
+            m_slot->Release();
+      }
+      void Run();
+private:
+      SceneSlot                *m_slot;
+      KMLOverlayScene          *m_scene;
+      std::string               m_cachefile;
+      wxEvtHandler             *m_handler;
+};
+
+void KMLOverlayFactory::Container::SaveJob::Run()
+{
+      bool ok;
+      {
+            KMLOverlayTrace::Scope trace( "cache save", m_cachefile.c_str() );
+            ok = m_scene->Save( m_cachefile );
+      }
+
+      bool refresh;
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            m_slot->busy = false;
+            m_slot->cache_busy = false;
+            // The layer doesn't remove a file in use, it is left to us
+            if ( !ok || m_slot->orphaned )
+                  wxRemoveFile( wxString( m_cachefile.c_str(), wxConvFile ) );
+            if ( !ok ) {
+                  m_slot->failed_cache = m_cachefile;
+                  m_slot->finished.store( true, std::memory_order_release );
+            }
+            refresh = m_slot->load_wanted;
+            m_slot->load_wanted = false;
+      }
+      // Frames may still be drawing it
+      m_slot->reclaimer->Retire( m_scene );
+      m_scene = NULL;
+
+      if ( refresh && m_handler ) {
+            wxCommandEvent event( wxEVT_KMLOVERLAY_REFRESH );
+            wxPostEvent( m_handler, event );
+      }
+}
+
+class KMLOverlayFactory::Container::ConvertJob : public KMLOverlayWorkerPool::Job
+{
+public:
+      // Reads the published scene, which stays published until replaced
+      ConvertJob( SceneSlot *slot, const KMLOverlayScene *scene, bool packed, wxEvtHandler *handler )
+            : m_slot( slot ), m_scene( scene ), m_packed( packed ), m_handler( handler ) {}
+      ~ConvertJob() { m_slot->Release(); }
+      void Run();
+private:
+      SceneSlot                *m_slot;
+      const KMLOverlayScene    *m_scene;
+      bool                      m_packed;
+      wxEvtHandler             *m_handler;
+};
+
+void KMLOverlayFactory::Container::ConvertJob::Run()
+{
+      KMLOverlayScene *next;
+      {
+            KMLOverlayTrace::Scope trace( m_packed ? "pack" : "unpack" );
+            next = new KMLOverlayScene( *m_scene, m_packed );
+      }
+
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            m_slot->busy = false;
+            m_slot->reading = NULL;
+            if ( m_slot->dropped ) {
+                  // Unloaded meanwhile, there is nothing left to replace
+                  m_slot->dropped = false;
+                  m_slot->reclaimer->Retire( const_cast<KMLOverlayScene *>( m_scene ) );
+                  delete next;
+            } else if ( !m_slot->orphaned ) {
+                  // Nothing else publishes while busy
+                  m_slot->Replace( const_cast<KMLOverlayScene *>( m_scene ), next );
+                  m_slot->converted = true;
+                  m_slot->finished.store( true, std::memory_order_release );
+            } else {
+                  delete next;
+            }
+            m_slot->load_wanted = false;
+      }
+
+      // Also settles the views, and a visibility changed again meanwhile
+      if ( m_handler ) {
+            wxCommandEvent event( wxEVT_KMLOVERLAY_REFRESH );
+            wxPostEvent( m_handler, event );
+      }
+}
+
+// Pixels around the cursor a line or point can be picked from
+static const int PickTolerance = 5;
+// Cells of the label collision grid, in pixels
+static const int LabelCell = 8;
+// Pixels around the view a chunk of a line may still reach into
+static const int ChunkMargin = 16;
+// Canvases a render context is kept for, see GetContext
+static const size_t MaxCanvases = 4;
+// Network links followed from a layer, they may loop back
+static const int MaxLinkDepth = 32;
+// Frames a scaled ground overlay is kept out of view, panning back and
+// forth finds it ready
+static const unsigned long KeepOverlayFrames = 32;
+
+KMLOverlayFactory::KMLOverlayFactory( wxEvtHandler *handler )
+      : m_handler( handler ), m_memory_budget( 0 ), m_frame_start( 0 ), m_stats_enabled( false ),
+      m_time_filter( false ), m_time_begin( 0 ), m_time_end( 0 ), m_has_vp( false ),
+      m_show_labels( true )
+{
+      m_reclaimer = new KMLOverlayReclaimer();
+      m_pool = new KMLOverlayWorkerPool();
+      m_assets = new KMLOverlayAssetCache( m_pool, handler );
+      m_labels = new KMLOverlayLabels();
+      m_scratch = new KMLOverlayScratch();
 }
 
 KMLOverlayFactory::~KMLOverlayFactory()
@@ -52,32 +473,142 @@ KMLOverlayFactory::~KMLOverlayFactory()
             m_Objects.Remove( cont );
             delete cont;
       }
+      for ( size_t i = 0; i < m_contexts.size(); i++ )
+            delete m_contexts[i];
+      m_assets->LogStats();
+      // Stop the workers first, jobs still queued reference the cache
+      // and publish to the reclaimer
+      delete m_pool;
+      delete m_reclaimer;
+      delete m_assets;
+      delete m_labels;
+      delete m_scratch;
 }
 
-bool KMLOverlayFactory::RenderOverlay( wxDC &dc, PlugIn_ViewPort *vp )
+KMLOverlayFactory::RenderContext::RenderContext( int w, int h )
+      : width( w ), height( h ), link_hits( MaxLinkDepth )
 {
-      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
-      {
-            m_Objects.Item( i )->Render( dc, vp );
+}
+
+size_t KMLOverlayFactory::RenderContext::GetMemoryUsage() const
+{
+      size_t sz = points.capacity() * sizeof( wxPoint ) + counts.capacity() * sizeof( int );
+      for ( std::map<const Container *, LayerState>::const_iterator it = layers.begin(); it != layers.end(); ++it )
+            sz += it->second.GetMemoryUsage();
+      return sz;
+}
+
+void KMLOverlayFactory::LayerState::TrimOverlays()
+{
+      for ( std::map<std::string, ScaledOverlay>::iterator it = overlays.begin(); it != overlays.end(); ) {
+            if ( overlay_frame - it->second.last_used >= KeepOverlayFrames )
+                  overlays.erase( it++ );
+            else
+                  ++it;
       }
-      return true;
+      overlay_frame++;
 }
 
-bool KMLOverlayFactory::RenderGLOverlay( wxGLContext *pcontext, PlugIn_ViewPort *vp )
+size_t KMLOverlayFactory::LayerState::GetMemoryUsage() const
+{
+      size_t sz = label_shown.capacity() / 8;
+      for ( std::map<std::string, ScaledOverlay>::const_iterator it = overlays.begin(); it != overlays.end(); ++it )
+            sz += (size_t)it->second.width * it->second.height * 4;
+      return sz;
+}
+
+KMLOverlayFactory::RenderContext *KMLOverlayFactory::GetContext( PlugIn_ViewPort *vp )
+{
+      for ( size_t i = 0; i < m_contexts.size(); i++ ) {
+            if ( m_contexts[i]->width == vp->pix_width && m_contexts[i]->height == vp->pix_height )
+                  return m_contexts[i];
+      }
+      if ( m_contexts.size() >= MaxCanvases ) {
+            delete m_contexts.front();
+            m_contexts.erase( m_contexts.begin() );
+      }
+      m_contexts.push_back( new RenderContext( vp->pix_width, vp->pix_height ) );
+      return m_contexts.back();
+}
+
+size_t KMLOverlayFactory::ForgetLayer( const Container *cont )
 {
+      size_t freed = 0;
+      for ( size_t i = 0; i < m_contexts.size(); i++ ) {
+            std::map<const Container *, LayerState>::iterator it = m_contexts[i]->layers.find( cont );
+            if ( it == m_contexts[i]->layers.end() )
+                  continue;
+            freed += it->second.GetMemoryUsage();
+            m_contexts[i]->layers.erase( it );
+      }
+      return freed;
+}
+
+template <class Backend>
+bool KMLOverlayFactory::RenderLayers( Backend &backend, PlugIn_ViewPort *vp )
+{
+      m_frame_start = wxGetLocalTimeMillis();
+      m_last_vp = *vp;
+      m_has_vp = true;
+      RenderContext *context = GetContext( vp );
+      // Every layer records its frame, or finds it recorded, then all are
+      // drawn in one pass with the backend set up once
+      m_queue.Clear();
       for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
       {
-            m_Objects.Item( i )->RenderGL( pcontext, vp );
+            m_Objects.Item( i )->Render( vp, *context, &m_queue, i );
       }
+      m_queue.Flush( backend, m_labels );
+      for ( size_t i = 0; i < m_queue.GetCount(); i++ )
+      {
+            const KMLOverlayRenderQueue::Item &item = m_queue.GetItem( i );
+            m_Objects.Item( item.layer )->Drawn( item );
+      }
+      m_scratch->EndFrame();
+      EnforceBudget();
+      m_reclaimer->Quiescent();
       return true;
 }
 
+bool KMLOverlayFactory::RenderOverlay( wxDC &dc, PlugIn_ViewPort *vp )
+{
+      KMLOverlayTrace::Scope trace( "render" );
+      KMLOverlayDCBackend backend( dc );
+      return RenderLayers( backend, vp );
+}
+
+bool KMLOverlayFactory::RenderGLOverlay( wxGLContext *pcontext, PlugIn_ViewPort *vp )
+{
+      KMLOverlayTrace::Scope trace( "render gl" );
+      // Drawn in the canvas' current context, where a previous factory
+      // made its label atlas
+      KMLOverlayLabels::DeleteOrphanedTextures();
+      KMLOverlayGLBackend backend( m_scratch );
+      return RenderLayers( backend, vp );
+}
+
+bool KMLOverlayFactory::RenderNullOverlay( PlugIn_ViewPort *vp, unsigned long *primitives )
+{
+      KMLOverlayTrace::Scope trace( "render null" );
+      KMLOverlayNullBackend backend;
+      bool ret = RenderLayers( backend, vp );
+      if ( primitives )
+            *primitives = backend.GetPrimitives();
+      return ret;
+}
+
 bool KMLOverlayFactory::Add( wxString filename, bool visible )
 {
-      Container *cont = new Container( filename, visible );
+      Container *cont = new Container( filename, visible, m_assets, m_labels, m_scratch, m_reclaimer, m_pool, m_handler );
+      cont->SetTimed( m_stats_enabled );
+      cont->SetTileBudget( GetTileBudget() );
+      cont->SetTimeWindow( m_time_filter, m_time_begin, m_time_end );
+      cont->SetLabelsEnabled( m_show_labels );
       if ( cont->Parse() )
       {
             m_Objects.Add( cont );
+            m_watcher.Add( filename );
+            EnforceBudget();
             RequestRefresh( GetOCPNCanvasWindow() );
             return true;
       }
@@ -90,7 +621,12 @@ bool KMLOverlayFactory::Add( wxString filename, bool visible )
 
 void KMLOverlayFactory::SetVisibility( int idx, bool visible )
 {
-      m_Objects.Item( idx )->SetVisibility( visible );
+      Container *cont = m_Objects.Item( idx );
+      cont->SetVisibility( visible );
+      // A layer hidden to stay within budget is saved packed anyway, only
+      // one still loaded is converted
+      EnforceBudget();
+      cont->StartConvert();
       RequestRefresh( GetOCPNCanvasWindow() );
 }
 
@@ -98,6 +634,8 @@ void KMLOverlayFactory::Delete( int idx )
 {
       Container *cont = m_Objects.Item( idx );
       m_Objects.Remove( cont );
+      m_watcher.Remove( cont->GetFilename() );
+      ForgetLayer( cont );
       delete cont;
       RequestRefresh( GetOCPNCanvasWindow() );
 }
@@ -117,530 +655,1325 @@ int KMLOverlayFactory::GetCount()
       return m_Objects.GetCount();
 }
 
-KMLOverlayFactory::Container::Container( wxString filename, bool visible )
-     : m_ready( false ), m_filename( filename ), m_visible( visible ),
-      m_kmz_file( NULL), m_kml_file( NULL ), m_root( NULL )
+void KMLOverlayFactory::SetMemoryBudget( size_t budget )
 {
+      m_memory_budget = budget;
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            m_Objects.Item( i )->SetTileBudget( GetTileBudget() );
+      }
+      EnforceBudget();
 }
 
-bool KMLOverlayFactory::Container::Parse()
+size_t KMLOverlayFactory::GetTileBudget()
+{
+      // Per layer, for the documents of super-overlays. Their images
+      // count against the asset cache.
+      return m_memory_budget ? m_memory_budget / 4 : 64 * 1024 * 1024;
+}
+
+void KMLOverlayFactory::SetReloadInterval( int minutes )
+{
+      m_watcher.SetInterval( minutes );
+}
+
+bool KMLOverlayFactory::CheckReload()
 {
-      std::string _filename( m_filename.mb_str() );
-      std::string file_data;
-      if ( !kmlbase::File::ReadFileToString( _filename, &file_data ) ) {
-            wxLogMessage( _T("KMLOverlayFactory::Container::Parse Failed to read file content") );
+      wxArrayString changed;
+      m_watcher.Poll( &changed );
+
+      bool updated = false;
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            Container *cont = m_Objects.Item( i );
+            if ( changed.Index( cont->GetFilename() ) != wxNOT_FOUND )
+                  cont->RequestReload();
+            if ( cont->AdoptLoad() )
+                  updated = true;
+            cont->StartReload( m_pool, m_handler );
+            if ( cont->AdoptReload() )
+                  updated = true;
+            cont->StartConvert();
+      }
+      if ( updated )
+            EnforceBudget();
+      // No scene is referenced between events, also frees what was
+      // replaced while the chart isn't being drawn
+      m_reclaimer->Quiescent();
+      return updated;
+}
+
+void KMLOverlayFactory::SetStatsEnabled( bool enabled )
+{
+      m_stats_enabled = enabled;
+      m_queue.SetTimed( enabled );
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            m_Objects.Item( i )->SetTimed( enabled );
+      }
+}
+
+void KMLOverlayFactory::SetTimeWindow( bool enabled, int64_t begin, int64_t end )
+{
+      if ( enabled == m_time_filter && ( !enabled || ( begin == m_time_begin && end == m_time_end ) ) )
+            return;
+      m_time_filter = enabled;
+      m_time_begin = begin;
+      m_time_end = end;
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            m_Objects.Item( i )->SetTimeWindow( enabled, begin, end );
+      }
+      RequestRefresh( GetOCPNCanvasWindow() );
+}
+
+void KMLOverlayFactory::SetLabelsEnabled( bool enabled )
+{
+      if ( enabled == m_show_labels )
+            return;
+      m_show_labels = enabled;
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            m_Objects.Item( i )->SetLabelsEnabled( enabled );
+      }
+      RequestRefresh( GetOCPNCanvasWindow() );
+}
+
+bool KMLOverlayFactory::GetTimeExtent( int64_t *begin, int64_t *end )
+{
+      *begin = KMLOverlayScene::TimeMax;
+      *end = KMLOverlayScene::TimeMin;
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            int64_t b, e;
+            if ( m_Objects.Item( i )->GetTimeExtent( &b, &e ) ) {
+                  *begin = std::min( *begin, b );
+                  *end = std::max( *end, e );
+            }
+      }
+      return *begin <= *end;
+}
+
+bool KMLOverlayFactory::Pick( double lat, double lon, wxString *name, wxString *description )
+{
+      if ( !m_has_vp )
             return false;
+
+      KMLOverlayTrace::Scope trace( "pick" );
+      wxPoint pt;
+      GetCanvasPixLL( &m_last_vp, &pt, lat, lon );
+      RenderContext *context = GetContext( &m_last_vp );
+      bool found = false;
+      double best = 0;
+      // Top layer first, it wins ties
+      for ( size_t i = m_Objects.GetCount(); i-- > 0; )
+      {
+            double score;
+            wxString n, d;
+            if ( m_Objects.Item( i )->Pick( &m_last_vp, *context, pt, PickTolerance, &score, &n, &d ) && ( !found || score < best ) ) {
+                  found = true;
+                  best = score;
+                  *name = n;
+                  *description = d;
+            }
       }
+      return found;
+}
 
-      std::string kml;
-      if ( kmlengine::KmzFile::IsKmz( file_data ) ) {
-            m_kmz_file = kmlengine::KmzFile::OpenFromString( file_data );
-            if ( !m_kmz_file.get() ) {
-                  wxLogMessage( _T("KMLOverlayFactory::Container::Parse Failed opening KMZ file") );
-                  return false;
+std::string KMLOverlayFactory::Query( const std::string &request )
+{
+      KMLOverlayTrace::Scope trace( "query" );
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      KMLOverlayQuery::Request req;
+      std::string error, response;
+      if ( !KMLOverlayQuery::ParseRequest( request, &req, &error ) ) {
+            response = "{\"id\":" + req.id + ",\"status\":\"error\",\"error\":";
+            KMLOverlayQuery::AppendString( &response, error.c_str() );
+            response += "}";
+            return response;
+      }
+
+      response = "{\"id\":" + req.id + ",\"status\":\"ok\",\"results\":[";
+      std::string unloaded;
+      size_t found = 0;
+      bool truncated = false;
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            Container *cont = m_Objects.Item( i );
+            std::string filename( cont->GetFilename().ToUTF8() );
+            if ( !req.layers.empty() && std::find( req.layers.begin(), req.layers.end(), filename ) == req.layers.end() )
+                  continue;
+            const KMLOverlayScene *scene = cont->GetLoadedScene();
+            if ( !scene ) {
+                  if ( !unloaded.empty() )
+                        unloaded += ",";
+                  KMLOverlayQuery::AppendString( &unloaded, filename.c_str() );
+                  continue;
             }
-            if ( !m_kmz_file->ReadKml( &kml ) ) {
-                  wxLogMessage( _T("KMLOverlayFactory::Container::Parse Failed to read KML from KMZ") );
-                  return false;
+            // One more than allowed tells whether the answer is complete
+            m_query.Run( *scene, req, req.limit - found + 1, &m_query_hits );
+            if ( found + m_query_hits.size() > req.limit ) {
+                  m_query_hits.resize( req.limit - found );
+                  truncated = true;
             }
-      } else {
-            kml = file_data;
+            for ( size_t j = 0; j < m_query_hits.size(); j++ ) {
+                  uint32_t feature = m_query_hits[j];
+                  response += found++ ? ",{\"layer\":" : "{\"layer\":";
+                  KMLOverlayQuery::AppendString( &response, filename.c_str() );
+                  char text[64];
+                  snprintf( text, sizeof( text ), ",\"feature\":%u,\"name\":", feature );
+                  response += text;
+                  const char *name = scene->GetFeatureName( feature );
+                  KMLOverlayQuery::AppendString( &response, name ? name : "" );
+                  response += ",\"geometry\":\"";
+                  response += KMLOverlayQuery::GetGeometryName( *scene, feature );
+                  response += "\"}";
+            }
+            if ( truncated )
+                  break;
       }
+      char text[96];
+      snprintf( text, sizeof( text ), "],\"truncated\":%s,\"elapsed_us\":%.0f,\"unloaded\":[",
+                truncated ? "true" : "false", ElapsedMs( start ) * 1000 );
+      response += text;
+      response += unloaded;
+      response += "]}";
+      return response;
+}
 
-      std::string errors;
-      m_kml_file = kmlengine::KmlFile::CreateFromParse( kml, &errors );
-      if ( !m_kml_file ) {
-            // TODO: display error message
+bool KMLOverlayFactory::GetStats( int idx, LayerStats *stats )
+{
+      if ( idx < 0 || idx >= (int)m_Objects.GetCount() )
             return false;
+      m_Objects.Item( idx )->GetStats( stats );
+      return true;
+}
+
+void KMLOverlayFactory::LogStats()
+{
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            Container *cont = m_Objects.Item( i );
+            LayerStats stats;
+            cont->GetStats( &stats );
+            wxLogMessage( _T("KMLOverlayFactory::LogStats %s: parsed in %.1f ms, %s, %lu bytes, render %.2f ms last, %.2f ms average over %lu frames, %lu vertices drawn, %lu culled, %llu image bytes uploaded, %lu image hits, %lu misses, %lu rehydrations, %lu view cache hits"),
+                          cont->GetFilename().c_str(), stats.parse_ms, stats.loaded ? _T("loaded") : _T("unloaded"),
+                          (unsigned long)stats.memory, stats.last_render_ms, stats.avg_render_ms, stats.frames,
+                          stats.vertices_drawn, stats.vertices_culled, stats.image_bytes,
+                          stats.image_hits, stats.image_misses, stats.rehydrations, stats.view_hits );
+            if ( stats.tiles )
+                  wxLogMessage( _T("KMLOverlayFactory::LogStats %s: %lu linked documents cached"),
+                                cont->GetFilename().c_str(), stats.tiles );
+      }
+      m_assets->LogStats();
+}
+
+void KMLOverlayFactory::EnforceBudget()
+{
+      if ( !m_memory_budget )
+            return;
+
+      // Decoded images are shared and cheap to decode again, they may
+      // use up to half of the budget.
+      m_assets->Trim( m_memory_budget / 2 );
+
+      size_t total = m_assets->GetMemoryUsage() + m_scratch->GetMemoryUsage();
+      for ( size_t i = 0; i < m_contexts.size(); i++ )
+      {
+            total += m_contexts[i]->GetMemoryUsage();
+      }
+      for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+      {
+            total += m_Objects.Item( i )->GetMemoryUsage();
       }
 
-/*
-      kmldom::ElementPtr element = m_kml_file->get_root();
-      const kmldom::KmlPtr kml = kmldom::AsKml( element );
-      m_root = kml->get_feature();
-*/
-      m_root = kmlengine::GetRootFeature( m_kml_file->get_root() );
+      // Evict hidden layers first, then the least recently viewed ones.
+      // Layers drawn during the current frame are never evicted.
+      while ( total > m_memory_budget )
+      {
+            Container *victim = NULL;
+            for ( size_t i = 0; i < m_Objects.GetCount(); i++ )
+            {
+                  Container *cont = m_Objects.Item( i );
+                  if ( !cont->IsLoaded() )
+                        continue;
+                  if ( cont->GetVisibility() && cont->GetLastViewed() >= m_frame_start )
+                        continue;
+                  if ( !victim
+                        || ( !cont->GetVisibility() && victim->GetVisibility() )
+                        || ( cont->GetVisibility() == victim->GetVisibility()
+                             && cont->GetLastViewed() < victim->GetLastViewed() ) )
+                        victim = cont;
+            }
+            if ( !victim )
+                  break;
+
+            wxLogMessage( _T("KMLOverlayFactory::EnforceBudget Unloading %s"), victim->GetFilename().c_str() );
+            total -= victim->GetMemoryUsage() + ForgetLayer( victim );
+            victim->Unload();
+      }
+}
 
+KMLOverlayFactory::Container::Container( wxString filename, bool visible,
+                                         KMLOverlayAssetCache *assets, KMLOverlayLabels *labels, KMLOverlayScratch *scratch,
+                                         KMLOverlayReclaimer *reclaimer, KMLOverlayWorkerPool *pool, wxEvtHandler *handler )
+     : m_ready( false ), m_filename( filename ), m_visible( visible ),
+      m_source( filename.mb_str() ), m_assets( assets ), m_assets_open( false ), m_preload( false ),
+      m_kmz_size( 0 ), m_last_viewed( 0 ), m_vertex_count( 0 ),
+      m_timed( false ), m_total_render_ms( 0 ), m_tile_budget( 0 ),
+      m_time_filter( false ), m_time_begin( 0 ), m_time_end( 0 ),
+      m_extent_begin( KMLOverlayScene::TimeMax ), m_extent_end( KMLOverlayScene::TimeMin ),
+      m_labels( labels ), m_show_labels( true ), m_generation( 0 ), m_scratch( scratch )
+{
+      m_pool = pool;
+      m_handler = handler;
+      m_tiles = new KMLOverlaySuperOverlay( m_source, assets, pool, reclaimer, handler );
+      m_views = new KMLOverlayViewCache();
+      memset( &m_stats, 0, sizeof( m_stats ) );
+      m_slot = new SceneSlot();
+      m_slot->scene.store( NULL );
+      m_slot->visible.store( visible );
+      m_slot->published.store( false );
+      m_slot->finished.store( false );
+      m_slot->reclaimer = reclaimer;
+      m_slot->refs = 1;
+      m_slot->orphaned = false;
+      m_slot->busy = false;
+      m_slot->wanted = false;
+      m_slot->reloaded = false;
+      m_slot->load_wanted = false;
+      m_slot->loaded = false;
+      m_slot->load_failed = false;
+      m_slot->rehydrated = false;
+      m_slot->cache_busy = false;
+      m_slot->reading = NULL;
+      m_slot->dropped = false;
+      m_slot->converted = false;
+      m_slot->has_assets = false;
+      m_slot->kmz_size = 0;
+      m_slot->parse_ms = 0;
+      m_slot->vertex_count = 0;
+      m_slot->time_begin = KMLOverlayScene::TimeMax;
+      m_slot->time_end = KMLOverlayScene::TimeMin;
+}
+
+KMLOverlayFactory::Container::~Container()
+{
+      // A running job keeps the slot alive and drops its result. The scene
+      // itself goes to the reclaimer, it is never freed here.
+      bool cache_busy;
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            m_slot->orphaned = true;
+            cache_busy = m_slot->cache_busy;
+      }
+      m_slot->Release();
+      m_tiles->Release();
+      delete m_views;
+      CloseAssets();
+      if ( !m_cachefile.IsEmpty() && !cache_busy )
+            wxRemoveFile( m_cachefile );
+}
+
+bool KMLOverlayFactory::Container::Parse()
+{
+      kmlengine::KmzFilePtr kmz_file;
+      size_t kmz_size = 0;
+      std::string error;
+      KMLOverlayScene *scene = new KMLOverlayScene();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      if ( !KMLOverlayCompiler::CompileFile( m_source, scene, &kmz_file, &kmz_size, &error ) ) {
+            wxLogMessage( _T("KMLOverlayFactory::Container::Parse %s"), wxString( error.c_str(), wxConvUTF8 ).c_str() );
+            delete scene;
+            return false;
+      }
+
+      m_stats.parse_ms = ElapsedMs( start );
+      m_vertex_count = scene->GetVertexCount();
+      scene->GetTimeExtent( &m_extent_begin, &m_extent_end );
+
+      if ( !m_visible )
+            scene->Pack();
+      m_bounds = scene->GetBounds();
+      {
+            KMLOverlayTrace::Scope trace( "index build" );
+            scene->GetDigests( &m_digests );
+      }
+
+      // The archive is indexed now while we have it at hand. Ground
+      // overlays are decoded ahead from the first frame, which knows what
+      // is in view, other images when first drawn.
+      if ( scene->HasAssets() )
+            OpenAssets( kmz_file, kmz_size );
+      m_preload = scene->GetGroundOverlayCount() > 0;
+
+      // A reload may have been published while we were parsing
+      m_slot->PublishIfEmpty( scene );
       m_ready = true;
       return true;
 }
 
-const kmldom::StylePtr KMLOverlayFactory::Container::GetFeatureStylePtr( const kmldom::FeaturePtr& feature )
+void KMLOverlayFactory::Container::OpenAssets( const kmlengine::KmzFilePtr &kmz_file, size_t kmz_size )
+{
+      if ( m_assets_open )
+            return;
+      m_assets->OpenSource( m_source, kmz_file );
+      m_assets_open = true;
+      m_kmz_size = kmz_size;
+}
+
+void KMLOverlayFactory::Container::CloseAssets()
 {
-      kmldom::StylePtr style = kmlengine::CreateResolvedStyle( feature, m_kml_file, kmldom::STYLESTATE_NORMAL );
+      if ( !m_assets_open )
+            return;
+      m_assets->CloseSource( m_source );
+      m_assets_open = false;
+      m_kmz_size = 0;
+      m_preload = false;
+}
 
-      // Some inline styles are not found by CreateResolvedStyle
-      // Try to find them directly
-      if ( style->get_id().empty() && feature->has_styleurl() ) {
-            std::string style_id;  // fragment
-            if ( kmlengine::SplitUriFragment( feature->get_styleurl(), &style_id ) ) {
-                  const kmldom::ObjectPtr object = m_kml_file->GetObjectById( style_id );
-                  if ( style = kmldom::AsStyle( object ) ) {
-                        return style;
-                  }
+void KMLOverlayFactory::Container::PreloadOverlays( const KMLOverlayScene *scene, PlugIn_ViewPort *vp )
+{
+      if ( !m_assets_open )
+            return;
+      // Those in view along with what the frame asks for, the others
+      // below, nearest first. Overlays under a Region are levels of a
+      // pyramid, only decoded once their level is drawn.
+      std::vector<std::pair<double, size_t> > order;
+      size_t regioned_end = 0;
+      for ( size_t idx = 0; idx < scene->GetFeatureCount(); idx++ ) {
+            const KMLOverlayScene::Feature &feature = scene->GetFeature( idx );
+            if ( feature.region != KMLOverlayScene::NoRegion && idx >= regioned_end )
+                  regioned_end = feature.end;
+            if ( feature.type != KMLOverlayScene::FEATURE_GROUNDOVERLAY || idx < regioned_end )
+                  continue;
+            size_t i = feature.first_part;
+            const KMLOverlayScene::GroundOverlay &overlay = scene->GetGroundOverlay( i );
+            if ( overlay.south <= vp->lat_max && overlay.north >= vp->lat_min
+                  && overlay.west <= vp->lon_max && overlay.east >= vp->lon_min ) {
+                  m_assets->Preload( m_source, overlay.href, 0 );
+            } else {
+                  double dlat = ( overlay.north + overlay.south ) / 2 - vp->clat;
+                  double dlon = ( overlay.east + overlay.west ) / 2 - vp->clon;
+                  order.push_back( std::make_pair( dlat * dlat + dlon * dlon, i ) );
             }
       }
+      std::sort( order.begin(), order.end() );
+      for ( size_t i = 0; i < order.size(); i++ )
+            m_assets->Preload( m_source, scene->GetGroundOverlay( order[i].second ).href, -1 );
+}
 
-      return style;
+bool KMLOverlayFactory::Container::Load()
+{
+      // Settle finished jobs first, a reload invalidates the binary cache
+      AdoptLoad();
+      AdoptReload();
+      if ( m_slot->Acquire() )
+            return true;
+      StartLoad();
+      // Already done when the pool has no thread to run it on
+      return AdoptLoad() && m_slot->Acquire();
 }
 
-void KMLOverlayFactory::Container::DoDrawCircle( wxPen pen, wxBrush brush, wxPoint pt, int radius )
+void KMLOverlayFactory::Container::StartLoad()
 {
-      if ( m_pdc ) {
-            m_pdc->SetPen( pen );
-            m_pdc->SetBrush( brush );
-            m_pdc->DrawCircle( pt, radius );
-      } else {
-            glPushAttrib( GL_COLOR_BUFFER_BIT | GL_LINE_BIT | GL_HINT_BIT );      //Save state
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            // One job at a time, the running one asks for a refresh when done
+            if ( m_slot->busy ) {
+                  m_slot->load_wanted = true;
+                  return;
+            }
+            if ( m_slot->loaded || m_slot->reloaded || m_slot->load_failed )
+                  return;
+            m_slot->busy = true;
+            m_slot->cache_busy = !m_cachefile.IsEmpty();
+            m_slot->refs++;
+      }
+      // Above image decoding, the layer is missing from the chart until then
+      m_pool->Submit( new LoadJob( m_slot, m_source, std::string( m_cachefile.mb_str() ), m_handler ), 1 );
+}
 
-            glEnable( GL_LINE_SMOOTH );
-            glEnable( GL_BLEND );
-            glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-            glHint( GL_LINE_SMOOTH_HINT, GL_NICEST );
+bool KMLOverlayFactory::Container::AdoptLoad()
+{
+      // Cheap enough for every frame: a single atomic load when idle
+      if ( !m_slot->finished.load( std::memory_order_acquire ) )
+            return false;
 
-            if ( brush != wxNullBrush && brush.GetStyle() != wxTRANSPARENT ) {
-                  wxColor c = brush.GetColour();
-                  glColor4ub( c.Red(), c.Green(), c.Blue(), c.Alpha() );
-                  glBegin( GL_TRIANGLE_FAN );
-                  glVertex2d( pt.x, pt.y );
-                  for ( double a = 0; a <= 2*M_PI; a+=2*M_PI/20 )
-                        glVertex2d( pt.x + radius*sin(a), pt.y + radius*cos(a) );
-                  glEnd();
+      kmlengine::KmzFilePtr kmz_file;
+      size_t kmz_size;
+      bool has_assets;
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            m_slot->finished.store( false, std::memory_order_relaxed );
+            // Recorded with the previous form, which the reclaimer frees
+            if ( m_slot->converted ) {
+                  m_slot->converted = false;
+                  m_views->Clear();
+            }
+            if ( !m_slot->load_error.empty() ) {
+                  wxLogMessage( _T("KMLOverlayFactory::Container::AdoptLoad %s: %s"),
+                                m_filename.c_str(), wxString( m_slot->load_error.c_str(), wxConvUTF8 ).c_str() );
+                  m_slot->load_error.clear();
             }
+            // Already removed by the job
+            if ( !m_slot->failed_cache.empty() ) {
+                  wxLogMessage( _T("KMLOverlayFactory::Container::AdoptLoad %s: failed to read or write the binary cache"),
+                                m_filename.c_str() );
+                  if ( m_slot->failed_cache == std::string( m_cachefile.mb_str() ) )
+                        m_cachefile = wxEmptyString;
+                  m_slot->failed_cache.clear();
+            }
+            if ( !m_slot->loaded )
+                  return false;
+            m_slot->loaded = false;
+            kmz_file.swap( m_slot->kmz );
+            kmz_size = m_slot->kmz_size;
+            has_assets = m_slot->has_assets;
+            m_bounds = m_slot->bounds;
+            m_vertex_count = m_slot->vertex_count;
+            m_extent_begin = m_slot->time_begin;
+            m_extent_end = m_slot->time_end;
+            if ( m_slot->rehydrated ) {
+                  m_stats.rehydrations++;
+            } else {
+                  m_digests.swap( m_slot->digests );
+                  m_stats.parse_ms = m_slot->parse_ms;
+            }
+      }
+
+      m_views->Clear();
+      if ( has_assets )
+            OpenAssets( kmz_file, kmz_size );
+      m_preload = has_assets;
+      // Hidden or shown while the job ran
+      StartConvert();
+      return true;
+}
 
-            if( pen != wxNullPen ) {
-                  wxColor c = pen.GetColour();
-                  int width = pen.GetWidth();
-                  glColor4ub( c.Red(), c.Green(), c.Blue(), c.Alpha() );
-                  glLineWidth( width );
-                  glBegin( GL_LINE_STRIP );
-                  for ( double a = 0; a <= 2*M_PI; a+=2*M_PI/200 )
-                        glVertex2d( pt.x + radius*sin(a), pt.y + radius*cos(a) );
-                  glEnd();
+void KMLOverlayFactory::Container::Unload()
+{
+      AdoptLoad();
+      AdoptReload();
+      KMLOverlayScene *scene = m_slot->Acquire();
+      if ( !scene )
+            return;
+
+      // The binary cache is written by a job, which holds the scene until
+      // then. A layer busy with another job is parsed again instead.
+      bool save = false;
+      if ( m_cachefile.IsEmpty() ) {
+            wxString cachefile = wxFileName::CreateTempFileName( _T("kmloverlay") );
+            {
+                  wxMutexLocker lock( m_slot->mutex );
+                  if ( !cachefile.IsEmpty() && !m_slot->busy ) {
+                        m_slot->busy = true;
+                        m_slot->cache_busy = true;
+                        m_slot->refs++;
+                        save = true;
+                  }
+            }
+            if ( save )
+                  m_cachefile = cachefile;
+            else if ( !cachefile.IsEmpty() )
+                  wxRemoveFile( cachefile );
+      }
+      if ( save ) {
+            m_pool->Submit( new SaveJob( m_slot, m_slot->Take(), std::string( m_cachefile.mb_str() ), m_handler ), -1 );
+      } else {
+            // Nothing else writes the slot from this thread, but a reload job
+            // may publish meanwhile: the next AdoptReload drops our cache then.
+            // A scene a job is reading is left to it to retire.
+            wxMutexLocker lock( m_slot->mutex );
+            if ( m_slot->reading && m_slot->reading == m_slot->Acquire() ) {
+                  m_slot->Take();
+                  m_slot->dropped = true;
+            } else {
+                  m_slot->Publish( NULL );
             }
+      }
+      m_tiles->Clear();
+      m_views->Clear();
+      m_generation++;
+      CloseAssets();
+}
 
-            glPopAttrib();            // restore state
+void KMLOverlayFactory::Container::RequestReload()
+{
+      wxMutexLocker lock( m_slot->mutex );
+      m_slot->wanted = true;
+      // The new version may load
+      m_slot->load_failed = false;
+}
+
+void KMLOverlayFactory::Container::StartReload( KMLOverlayWorkerPool *pool, wxEvtHandler *handler )
+{
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            // One job at a time, a change seen meanwhile starts the next one.
+            // A load not settled yet shares the bookkeeping.
+            if ( !m_slot->wanted || m_slot->busy || m_slot->loaded )
+                  return;
+            m_slot->wanted = false;
+            m_slot->busy = true;
+            m_slot->refs++;
       }
+      // Below image decoding, which keeps the chart responsive
+      pool->Submit( new ReloadJob( m_slot, m_source, m_digests, handler ), -1 );
 }
 
-void KMLOverlayFactory::Container::DoDrawLines( wxPen pen, int n, wxPoint points[] )
+bool KMLOverlayFactory::Container::AdoptReload()
 {
-      if ( m_pdc ) {
-            m_pdc->SetPen( pen );
-            m_pdc->DrawLines( n, points );
-      } else {
-            glPushAttrib( GL_COLOR_BUFFER_BIT | GL_LINE_BIT | GL_HINT_BIT );      //Save state
+      // Cheap enough for every frame: a single atomic load when idle
+      if ( !m_slot->published.load( std::memory_order_acquire ) )
+            return false;
+
+      kmlengine::KmzFilePtr kmz_file;
+      size_t kmz_size;
+      KMLOverlayScene::Changes changes;
+      bool has_assets;
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            m_slot->published.store( false, std::memory_order_relaxed );
+            if ( !m_slot->error.empty() ) {
+                  wxLogMessage( _T("KMLOverlayFactory::Container::AdoptReload %s: %s, keeping the previous version"),
+                                m_filename.c_str(), wxString( m_slot->error.c_str(), wxConvUTF8 ).c_str() );
+                  m_slot->error.clear();
+            }
+            if ( !m_slot->reloaded )
+                  return false;
+            m_slot->reloaded = false;
+            kmz_file.swap( m_slot->kmz );
+            kmz_size = m_slot->kmz_size;
+            m_digests.swap( m_slot->digests );
+            m_bounds = m_slot->bounds;
+            has_assets = m_slot->has_assets;
+            changes = m_slot->changes;
+            m_vertex_count = m_slot->vertex_count;
+            m_extent_begin = m_slot->time_begin;
+            m_extent_end = m_slot->time_end;
+            m_stats.parse_ms = m_slot->parse_ms;
+      }
 
-            glEnable( GL_LINE_SMOOTH );
-            glEnable( GL_BLEND );
-            glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-            glHint( GL_LINE_SMOOTH_HINT, GL_NICEST );
+      wxLogMessage( _T("KMLOverlayFactory::Container::AdoptReload %s: %lu added, %lu changed, %lu removed, %lu unchanged"),
+                    m_filename.c_str(), (unsigned long)changes.added, (unsigned long)changes.changed,
+                    (unsigned long)changes.removed, (unsigned long)changes.unchanged );
+
+      // The scene is replaced as a whole, nothing drawn from the previous
+      // one is kept. Linked documents may have changed along.
+      m_tiles->Clear();
+      m_views->Clear();
+      m_generation++;
+      m_preload = true;
+
+      // The binary cache holds the previous version
+      if ( !m_cachefile.IsEmpty() ) {
+            wxRemoveFile( m_cachefile );
+            m_cachefile = wxEmptyString;
+      }
 
-            if( pen != wxNullPen ) {
-                  wxColor c = pen.GetColour();
-                  int width = pen.GetWidth();
-                  glColor4ub( c.Red(), c.Green(), c.Blue(), c.Alpha() );
-                  glLineWidth( width );
-                  glBegin( GL_LINE_STRIP );
-                  for ( int i=0; i<n; i++ )
-                        glVertex2i( points[i].x, points[i].y );
-                  glEnd();
+      // The new scene is already published, it may even have been
+      // unloaded since: only the assets are left to settle.
+      if ( has_assets ) {
+            if ( m_assets_open ) {
+                  m_assets->ReloadSource( m_source, kmz_file );
+                  m_kmz_size = kmz_size;
+            } else if ( m_slot->Acquire() ) {
+                  OpenAssets( kmz_file, kmz_size );
             }
-            glPopAttrib();            // restore state
+      } else {
+            CloseAssets();
       }
+      return true;
 }
 
-void KMLOverlayFactory::Container::DoDrawPolygon( wxPen pen, wxBrush brush, int n, wxPoint points[] )
+bool KMLOverlayFactory::Container::IsLoaded()
 {
-      if ( m_pdc ) {
-            m_pdc->SetPen( pen );
-            m_pdc->SetBrush( brush );
-            m_pdc->DrawPolygon( n, points );
-      } else {
-            glPushAttrib( GL_COLOR_BUFFER_BIT | GL_LINE_BIT | GL_HINT_BIT | GL_POLYGON_BIT );      //Save state
+      return m_slot->Acquire() != NULL;
+}
 
-            glEnable( GL_LINE_SMOOTH );
-            glEnable( GL_POLYGON_SMOOTH );
-            glEnable( GL_BLEND );
-            glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-            glHint( GL_LINE_SMOOTH_HINT, GL_NICEST );
-            glHint( GL_POLYGON_SMOOTH_HINT, GL_NICEST );
+size_t KMLOverlayFactory::Container::GetMemoryUsage()
+{
+      size_t sz = 0;
+      if ( KMLOverlayScene *scene = m_slot->Acquire() )
+            sz += scene->GetMemoryUsage();
+      return sz + m_kmz_size + m_views->GetMemoryUsage();
+}
 
-            if ( brush != wxNullBrush && brush.GetStyle() != wxTRANSPARENT ) {
-                  wxColor c = brush.GetColour();
-                  glColor4ub( c.Red(), c.Green(), c.Blue(), c.Alpha() );
-                  glBegin( GL_POLYGON );
-                  for ( int i=0; i<n; i++ )
-                        glVertex2i( points[i].x, points[i].y );
-                  glEnd();
-            }
+wxLongLong KMLOverlayFactory::Container::GetLastViewed()
+{
+      return m_last_viewed;
+}
 
-            if( pen != wxNullPen ) {
-                  wxColor c = pen.GetColour();
-                  int width = pen.GetWidth();
-                  glColor4ub( c.Red(), c.Green(), c.Blue(), c.Alpha() );
-                  glLineWidth( width );
-                  glBegin( GL_LINE_LOOP );
-                  for ( int i=0; i<n; i++ )
-                        glVertex2i( points[i].x, points[i].y );
-                  glEnd();
-            }
-            glPopAttrib();
+static bool IsBoundsInView( const KMLOverlayScene::Bounds &bounds, PlugIn_ViewPort *vp )
+{
+      if ( bounds.IsEmpty() )
+            return false;
+
+      if ( KMLOverlayScene::FromFixed( bounds.south ) > vp->lat_max
+            || KMLOverlayScene::FromFixed( bounds.north ) < vp->lat_min )
+            return false;
+
+      // Only reject on longitude when neither the viewport nor the bounds
+      // wrap around
+      if ( vp->lon_min < vp->lon_max && vp->lon_min >= -180. && vp->lon_max <= 180.
+            && bounds.west <= bounds.east ) {
+            if ( KMLOverlayScene::FromFixed( bounds.west ) > vp->lon_max
+                  || KMLOverlayScene::FromFixed( bounds.east ) < vp->lon_min )
+                  return false;
       }
+      return true;
 }
 
-void KMLOverlayFactory::Container::DoDrawBitmap( const wxBitmap &bitmap, wxCoord x, wxCoord y, bool usemask )
+bool KMLOverlayFactory::Container::IsInView( PlugIn_ViewPort *vp )
 {
-      if ( m_pdc ) {
-            m_pdc->DrawBitmap( bitmap, x, y, usemask );
-      } else {
-            // GL doesn't draw anything if x<0 || y<0 so we must crop image first
-            wxBitmap bmp;
-            if ( x < 0 || y < 0 ) {
-                  int dx = (x < 0 ? -x : 0);
-                  int dy = (y < 0 ? -y : 0);
-                  int w = bitmap.GetWidth()-dx;
-                  int h = bitmap.GetHeight()-dy;
-                  /* picture is out of viewport */
-                  if ( w <= 0 || h <= 0 )
+      return IsBoundsInView( m_bounds, vp );
+}
+
+bool KMLOverlayFactory::Container::IsRegionActive( PlugIn_ViewPort *vp, const KMLOverlayScene::Region &region )
+{
+      return IsBoundsInView( region.box, vp ) && IsLodActive( vp, region );
+}
+
+bool KMLOverlayFactory::Container::IsLodActive( PlugIn_ViewPort *vp, const KMLOverlayScene::Region &region )
+{
+      if ( region.min_lod <= 0 && region.max_lod < 0 )
+            return true;
+
+      // The Lod is compared with the square root of the projected area
+      wxPoint nw, se;
+      GetCanvasPixLL( vp, &nw, KMLOverlayScene::FromFixed( region.box.north ), KMLOverlayScene::FromFixed( region.box.west ) );
+      GetCanvasPixLL( vp, &se, KMLOverlayScene::FromFixed( region.box.south ), KMLOverlayScene::FromFixed( region.box.east ) );
+      double pixels = sqrt( fabs( (double)( se.x - nw.x ) * ( se.y - nw.y ) ) );
+      if ( pixels < region.min_lod )
+            return false;
+      return region.max_lod < 0 || pixels <= region.max_lod;
+}
+
+template <class Backend>
+void KMLOverlayFactory::Container::RenderPoint( Backend &backend, Frame &frame, const KMLOverlayScene::Part& part,
+                                                const KMLOverlayScene::Style& style, const char *label )
+{
+      wxPoint pt;
+      double lat, lon;
+
+      KMLOverlayScene::CoordReader coords( *frame.scene, part );
+      if ( coords.Next( &lat, &lon ) ) {
+            GetCanvasPixLL( frame.vp,  &pt, lat, lon );
+
+            // Labels go right of the icon, drawn once the layer is done
+            if ( style.icon != KMLOverlayScene::NoIcon ) {
+                  if ( label )
+                        backend.AddLabel( m_labels, label, pt.x + (int)( 16 * style.icon_scale ) + 2, pt.y, style.label_colour );
+                  const wxBitmap *icon = m_assets->GetIcon( m_source, frame.scene->GetIcon( style.icon ), style.icon_scale );
+                  if ( icon ) {
+                        frame.image_hits++;
+                        backend.DrawBitmap( *icon, pt.x-icon->GetWidth()/2, pt.y-icon->GetHeight()/2, true );
                         return;
-                  wxBitmap newBitmap = bitmap.GetSubBitmap( wxRect( dx, dy, w, h ) );
-                  x += dx;
-                  y += dy;
-                  bmp = newBitmap;
-            } else {
-                  bmp = bitmap;
-            }
-            wxImage image = bmp.ConvertToImage();
-            int w = image.GetWidth(), h = image.GetHeight();
-
-            if ( usemask ) {
-                  unsigned char *d = image.GetData();
-                  unsigned char *a = image.GetAlpha();
-
-                  unsigned char mr, mg, mb;
-                  if( !image.GetOrFindMaskColour( &mr, &mg, &mb ) && !a )
-                        printf("trying to use mask to draw a bitmap without alpha or mask\n");
-
-                  unsigned char *e = new unsigned char[4*w*h];
-                  //               int w = image.GetWidth(), h = image.GetHeight();
-                  int sb = w*h;
-                  unsigned char r, g, b;
-                  for ( int i=0 ; i<sb ; i++ ) {
-                        r = d[i*3 + 0];
-                        g = d[i*3 + 1];
-                        b = d[i*3 + 2];
-
-                        e[i*4 + 0] = r;
-                        e[i*4 + 1] = g;
-                        e[i*4 + 2] = b;
-
-                        e[i*4 + 3] = a ? a[i] :
-                        ((r==mr)&&(g==mg)&&(b==mb) ? 0 : 255);
                   }
-
-                  glColor4f( 1, 1, 1, 1 );
-                  glEnable( GL_BLEND );
-                  glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-                  glRasterPos2i( x, y );
-                  glPixelZoom( 1, -1 );
-                  glDrawPixels( w, h, GL_RGBA, GL_UNSIGNED_BYTE, e );
-                  glPixelZoom( 1, 1 );
-                  glDisable( GL_BLEND );
-                  free( e );
-            } else {
-                  glRasterPos2i( x, y );
-                  glPixelZoom( 1, -1 ); /* draw data from top to bottom */
-                  glDrawPixels( w, h, GL_RGB, GL_UNSIGNED_BYTE, image.GetData() );
-                  glPixelZoom( 1, 1 );
+                  frame.image_misses++;
+            } else if ( label ) {
+                  backend.AddLabel( m_labels, label, pt.x + 18, pt.y - 16, style.label_colour );
             }
+            backend.DrawBitmap( *_img_point, pt.x-16, pt.y-32, true );
       }
 }
 
-void KMLOverlayFactory::Container::RenderPoint( const kmldom::PointPtr& point, const kmldom::StylePtr& style )
+static double MercatorY( double lat )
 {
-      if ( point->has_coordinates() ) {
-            wxPoint pt;
+      if ( lat > 85. )
+            lat = 85.;
+      if ( lat < -85. )
+            lat = -85.;
+      return log( tan( M_PI/4 + lat * M_PI/360 ) ) * 180 / M_PI;
+}
 
-            kmldom::CoordinatesPtr coord = point->get_coordinates();
-            if ( coord->get_coordinates_array_size() != 1 )
-            {
-                  // TODO: log error: a point should have only one coord
-                  return;
+/*    Labels are laid out once per zoom band, an octave of view scale, in
+ *    document order against a grid of screen cells. The layout is done at
+ *    the lowest scale of the band: zooming in within it only moves labels
+ *    apart, so they never overlap and panning never changes the choice.
+ */
+void KMLOverlayFactory::Container::LayoutLabels( LayerState &state, const KMLOverlayScene *scene, int band )
+{
+      KMLOverlayTrace::Scope trace( "label layout", m_source.c_str() );
+      state.label_scene = scene;
+      state.label_band = band;
+      state.label_shown.assign( scene->GetFeatureCount(), false );
+
+      // Pixels per degree at the band's scale, as for view_scale_ppm
+      double ppd = ldexp( 1., band ) * 111319.490793;
+      int height = m_labels->GetHeight();
+      std::set<uint64_t> used;
+      for ( size_t i = 0; i < scene->GetFeatureCount(); i++ ) {
+            const KMLOverlayScene::Feature &f = scene->GetFeature( i );
+            if ( f.type != KMLOverlayScene::FEATURE_PLACEMARK || !f.part_count )
+                  continue;
+            const KMLOverlayScene::Part &part = scene->GetPart( f.first_part );
+            const KMLOverlayScene::Style &style = scene->GetStyle( f.style );
+            const char *name = scene->GetFeatureName( i );
+            if ( part.type != KMLOverlayScene::PART_POINT || !name || style.label_scale <= 0 || !( style.label_colour & 0xff ) )
+                  continue;
+
+            double lat, lon;
+            KMLOverlayScene::CoordReader coords( *scene, part );
+            if ( !coords.Next( &lat, &lon ) )
+                  continue;
+            // Same placement as RenderPoint
+            double x = lon * ppd, y = -MercatorY( lat ) * ppd;
+            if ( style.icon != KMLOverlayScene::NoIcon ) {
+                  x += (int)( 16 * style.icon_scale ) + 2;
+            } else {
+                  x += 18;
+                  y -= 16;
             }
-            kmlbase::Vec3 vec = coord->get_coordinates_array_at( 0 );
-            GetCanvasPixLL( m_pvp,  &pt, vec.get_latitude(), vec.get_longitude() );
+            int64_t x0 = (int64_t)floor( x / LabelCell ), x1 = (int64_t)floor( ( x + m_labels->Measure( name ) ) / LabelCell );
+            int64_t y0 = (int64_t)floor( ( y - height / 2 ) / LabelCell ), y1 = (int64_t)floor( ( y + height / 2 ) / LabelCell );
+
+            bool free = true;
+            for ( int64_t cy = y0; cy <= y1 && free; cy++ )
+                  for ( int64_t cx = x0; cx <= x1 && free; cx++ )
+                        free = used.find( (uint64_t)cx << 32 ^ (uint32_t)cy ) == used.end();
+            if ( !free )
+                  continue;
+            for ( int64_t cy = y0; cy <= y1; cy++ )
+                  for ( int64_t cx = x0; cx <= x1; cx++ )
+                        used.insert( (uint64_t)cx << 32 ^ (uint32_t)cy );
+            state.label_shown[i] = true;
+      }
+}
 
-            DoDrawBitmap( *_img_point, pt.x-16, pt.y-32, true );
+// Last coordinate of chunk k, the first of the next one
+static uint32_t ChunkEnd( const KMLOverlayScene::Chunk *chunks, uint32_t count, uint32_t k,
+                          const KMLOverlayScene::Part &part )
+{
+      return k+1 < count ? chunks[k+1].first : part.count - 1;
+}
+
+// Coordinates [from, to] of a part, decoded from the chunk holding from
+static void ProjectRange( const KMLOverlayScene &scene, PlugIn_ViewPort *vp, const KMLOverlayScene::Part &part,
+                          const KMLOverlayScene::Chunk &chunk, uint32_t from, uint32_t to, wxPoint *pts )
+{
+      double lat, lon;
+      KMLOverlayScene::CoordReader coords( scene, part, chunk );
+      coords.Skip( from - chunk.first );
+      for ( uint32_t i = 0; i <= to - from && coords.Next( &lat, &lon ); ++i ) {
+            GetCanvasPixLL( vp, &pts[i], lat, lon );
       }
 }
 
-void KMLOverlayFactory::Container::RenderLineString( const kmldom::LineStringPtr& linestring, const kmldom::StylePtr& style )
+/*    Coordinates [first, last) of a line. Long parts are drawn by chunks:
+ *    those out of view are skipped, consecutive ones in view go out as a
+ *    single polyline so the joins between them are left untouched.
+ */
+template <class Backend>
+void KMLOverlayFactory::Container::RenderPolyline( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                   uint32_t first, uint32_t last, const wxPen &pen )
 {
-      if ( linestring->has_coordinates() ) {
-            kmldom::CoordinatesPtr coord = linestring->get_coordinates();
-            wxPoint *pts;
-            size_t sz = coord->get_coordinates_array_size();
-            pts = new wxPoint[sz];
-            for ( size_t i = 0; i < sz; ++i ) {
-                  kmlbase::Vec3 vec = coord->get_coordinates_array_at( i );
-                  GetCanvasPixLL( m_pvp,  &pts[i], vec.get_latitude(), vec.get_longitude() );
+      uint32_t count;
+      const KMLOverlayScene::Chunk *chunks = frame.scene->GetChunks( idx, &count );
+      if ( !chunks ) {
+            size_t sz = last - first;
+            wxPoint *pts = frame.context->GetPoints( sz );
+            double lat, lon;
+            KMLOverlayScene::CoordReader coords( *frame.scene, part );
+            coords.Skip( first );
+            for ( size_t i = 0; i < sz && coords.Next( &lat, &lon ); ++i ) {
+                  GetCanvasPixLL( frame.vp,  &pts[i], lat, lon );
             }
+            backend.DrawLines( pen, sz, pts );
+            frame.vertices_drawn += sz;
+            return;
+      }
 
-            wxPen pen( KMLOverlayDefaultColor, 2 );
-            if ( style->has_linestyle() ) {
-                  const kmldom::LineStylePtr& linestyle = style->get_linestyle();
-/* TODO: Implement colormode=random
- * see http://code.google.com/apis/kml/documentation/kmlreference.html#colorstyle
-                  has_colormode
-                  int get_colormode()
-                     COLORMODE_NORMAL = 0,
-                     COLORMODE_RANDOM
-*/
-                  if ( linestyle->has_color() ) {
-                        kmlbase::Color32 col32 = linestyle->get_color();
-
-                        pen = wxPen( wxColor( col32.get_red(), col32.get_green(), col32.get_blue(), col32.get_alpha() ),
-                                     linestyle->get_width() );
+      uint32_t drawn = 0, run_chunk = 0, run_from = 0, run_to = 0;
+      bool in_run = false;
+      for ( uint32_t k = 0; k < count; k++ ) {
+            uint32_t from = std::max( chunks[k].first, first );
+            uint32_t to = std::min( ChunkEnd( chunks, count, k, part ), last - 1 );
+            bool visible = from < to && IsBoundsInView( chunks[k].box, &frame.chunk_vp );
+            if ( visible ) {
+                  if ( !in_run ) {
+                        run_chunk = k;
+                        run_from = from;
+                        in_run = true;
                   }
+                  run_to = to;
+            }
+            if ( in_run && ( !visible || k+1 == count ) ) {
+                  size_t sz = run_to - run_from + 1;
+                  wxPoint *pts = frame.context->GetPoints( sz );
+                  ProjectRange( *frame.scene, frame.vp, part, chunks[run_chunk], run_from, run_to, pts );
+                  backend.DrawLines( pen, sz, pts );
+                  drawn += sz;
+                  in_run = false;
             }
-            DoDrawLines( pen, coord->get_coordinates_array_size(), pts );
-            delete [] pts;
-            pts = NULL;
       }
+      frame.vertices_drawn += drawn;
+      frame.vertices_culled += last - first - drawn;
 }
 
-void KMLOverlayFactory::Container::RenderLinearRing( const kmldom::LinearRingPtr& linearring, const kmldom::StylePtr& style )
+template <class Backend>
+void KMLOverlayFactory::Container::RenderLineString( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                     const KMLOverlayScene::Style& style )
 {
-      if ( linearring->has_coordinates() ) {
-            kmldom::CoordinatesPtr coord = linearring->get_coordinates();
-            wxPoint *pts;
-            size_t sz = coord->get_coordinates_array_size();
-            pts = new wxPoint[sz];
-            for ( size_t i = 0; i < sz; ++i ) {
-                  kmlbase::Vec3 vec = coord->get_coordinates_array_at( i );
-                  GetCanvasPixLL( m_pvp,  &pts[i], vec.get_latitude(), vec.get_longitude() );
-            }
-
-            wxPen pen( KMLOverlayDefaultColor, 2 );
-            wxBrush brush( *wxTRANSPARENT_BRUSH );
-            if ( style->has_polystyle() ) {
-                  const kmldom::PolyStylePtr polystyle = style->get_polystyle();
-                  if ( !polystyle->has_fill() || polystyle->get_fill() ) {
-                        if ( polystyle->has_color() ) {
-                              kmlbase::Color32 col32 = polystyle->get_color();
+      RenderPolyline( backend, frame, idx, part, 0, part.count, m_scratch->GetPen( style.line_colour, style.line_width ) );
+}
 
-                              if ( col32.get_alpha() ) {
-                                    brush = wxBrush( wxColor( col32.get_red(), col32.get_green(), col32.get_blue(), col32.get_alpha() ) );
-                              }
-                        }
-                  }
-                  if ( !polystyle->has_outline() || polystyle->get_outline() ) {
-                        if ( style->has_linestyle() ) {
-                              const kmldom::LineStylePtr& linestyle = style->get_linestyle();
-/*
-                  has_colormode
-                  int get_colormode()
-                     COLORMODE_NORMAL = 0,
-                     COLORMODE_RANDOM
-*/
-                              if ( linestyle->has_color() ) {
-                                    kmlbase::Color32 col32 = linestyle->get_color();
-
-                                    if ( col32.get_alpha() ) {
-                                          pen = wxPen( wxColor( col32.get_red(), col32.get_green(), col32.get_blue(), col32.get_alpha() ),
-                                                       linestyle->get_width() );
-                                    } else {
-                                          pen = *wxTRANSPARENT_PEN;
-                                    }
-                              }
-                        }
+/*    An outer ring and the inner rings following it, filled with the
+ *    even-odd rule as picking and queries test them.
+ */
+template <class Backend>
+void KMLOverlayFactory::Container::RenderLinearRing( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                     uint32_t holes, const KMLOverlayScene::Style& style )
+{
+      const wxPen &pen = style.ring_stroke ? m_scratch->GetPen( style.ring_colour, style.ring_width ) : *wxTRANSPARENT_PEN;
+      const wxBrush &brush = style.ring_fill ? m_scratch->GetBrush( style.fill_colour ) : *wxTRANSPARENT_BRUSH;
+
+      size_t total = part.count;
+      for ( uint32_t h = 1; h <= holes; h++ )
+            total += frame.scene->GetPart( idx + h ).count;
+
+      // A fill needs the whole ring, as soon as its bounds meet the view.
+      // A stroke alone is only drawn by the chunks in view, unless all are.
+      // Holes are within the outer ring's bounds.
+      uint32_t count;
+      const KMLOverlayScene::Chunk *chunks = frame.scene->GetChunks( idx, &count );
+      if ( chunks ) {
+            KMLOverlayScene::Bounds box;
+            bool all = true, any = false;
+            for ( uint32_t k = 0; k < count; k++ ) {
+                  bool visible = IsBoundsInView( chunks[k].box, &frame.chunk_vp );
+                  all = all && visible;
+                  any = any || visible;
+                  box.Extend( chunks[k].box );
+            }
+            if ( style.ring_fill ? !IsBoundsInView( box, &frame.chunk_vp ) : !any || !style.ring_stroke ) {
+                  frame.vertices_culled += total;
+                  return;
+            }
+            if ( !style.ring_fill && !all ) {
+                  RenderPolyline( backend, frame, idx, part, 0, part.count, pen );
+                  for ( uint32_t h = 1; h <= holes; h++ ) {
+                        const KMLOverlayScene::Part &hole = frame.scene->GetPart( idx + h );
+                        RenderPolyline( backend, frame, idx + h, hole, 0, hole.count, pen );
                   }
+                  return;
             }
+      }
 
-            DoDrawPolygon( pen, brush, coord->get_coordinates_array_size(), pts );
-            delete [] pts;
-            pts = NULL;
+      wxPoint *pts = frame.context->GetPoints( total );
+      int *counts = frame.context->GetCounts( holes + 1 );
+      size_t sz = 0;
+      double lat, lon;
+      for ( uint32_t h = 0; h <= holes; h++ ) {
+            KMLOverlayScene::CoordReader coords( *frame.scene, h ? frame.scene->GetPart( idx + h ) : part );
+            size_t first = sz;
+            while ( sz < total && coords.Next( &lat, &lon ) )
+                  GetCanvasPixLL( frame.vp,  &pts[sz++], lat, lon );
+            counts[h] = sz - first;
       }
+
+      if ( holes )
+            backend.DrawPolyPolygon( pen, brush, holes + 1, counts, pts );
+      else
+            backend.DrawPolygon( pen, brush, sz, pts );
+      frame.vertices_drawn += sz;
 }
 
-void KMLOverlayFactory::Container::RenderPolygon( const kmldom::PolygonPtr& polygon, const kmldom::StylePtr& style )
+template <class Backend>
+void KMLOverlayFactory::Container::RenderTrack( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                const KMLOverlayScene::Style& style )
 {
-      if ( polygon->has_outerboundaryis() ) {
-            kmldom::OuterBoundaryIsPtr bound = polygon->get_outerboundaryis();
-            if ( bound->has_linearring() ) {
-                  RenderLinearRing( bound->get_linearring(), style );
-            }
-// TODO: handle inner boundary (array)
+      // Samples are sorted by time, the window is found by binary search
+      uint32_t first = 0, last = part.count;
+      if ( m_time_filter )
+            frame.scene->GetTrackRange( idx, m_time_begin, m_time_end, &first, &last );
+      frame.vertices_culled += part.count - ( last - first );
+      if ( last - first < 2 ) {
+            frame.vertices_drawn += last - first;
+            return;
       }
+
+      RenderPolyline( backend, frame, idx, part, first, last, m_scratch->GetPen( style.line_colour, style.line_width ) );
 }
 
-void KMLOverlayFactory::Container::RenderGroundOverlay( const kmldom::GroundOverlayPtr& groundoverlay )
+bool KMLOverlayFactory::Container::IsInTime( Frame &frame, size_t idx )
 {
-      int alpha = 255;
-      if ( groundoverlay->has_color() ) {
-            kmlbase::Color32 col32 = groundoverlay->get_color();
-            alpha = col32.get_alpha();
+      // Hits are sorted and features visited in increasing order, one
+      // pass over the hits per frame
+      while ( frame.next_hit < frame.hits->size() && (*frame.hits)[frame.next_hit] < idx )
+            frame.next_hit++;
+      return frame.next_hit < frame.hits->size() && (*frame.hits)[frame.next_hit] == idx;
+}
+
+void KMLOverlayFactory::Container::ProjectPart( const KMLOverlayScene *scene, PlugIn_ViewPort *vp, size_t idx,
+                                                const KMLOverlayScene::Part &part, std::vector<wxPoint> *points )
+{
+      uint32_t first = 0, last = part.count;
+      if ( part.type == KMLOverlayScene::PART_TRACK && m_time_filter )
+            scene->GetTrackRange( idx, m_time_begin, m_time_end, &first, &last );
+      points->resize( last - first );
+      double lat, lon;
+      KMLOverlayScene::CoordReader coords( *scene, part );
+      coords.Skip( first );
+      for ( size_t i = 0; i < points->size() && coords.Next( &lat, &lon ); ++i ) {
+            GetCanvasPixLL( vp, &(*points)[i], lat, lon );
       }
+}
 
-/* TODO
- should we handle <gx:LatLonQuad> (Used for nonrectangular quadrilateral ground overlays.)
-   has_gx_latlonquad get_gx_latlonquad
-      CoordinatesPtr& latlonquad.get_coordinates
- */
-      if ( groundoverlay->has_latlonbox() ) {
-            const kmldom::LatLonBoxPtr latlonbox = groundoverlay->get_latlonbox();
-            wxPoint ptNW, ptSE;
-            GetCanvasPixLL( m_pvp,  &ptNW, latlonbox->get_north(), latlonbox->get_west() );
-            GetCanvasPixLL( m_pvp,  &ptSE, latlonbox->get_south(), latlonbox->get_east() );
-
-/* TODO:
-has_refreshmode
-get_refreshmode
-has_refreshinterval
-get_refreshinterval
-has_httpquery
-get_httpquery
-*/
-            std::string href;
-            if ( kmlengine::GetIconParentHref( groundoverlay, &href ) ) {
-                  //kml_cache->FetchDataRelative(kml_file->get_url(), href, data);
-
-                  std::string content;
-                  //if ( kmlengine::FetchIcon( m_kml_file, groundoverlay, &content ) ) {
-                  if ( m_kmz_file && m_kmz_file->ReadFile( href.c_str(), &content ) ) {
-                        wxMemoryInputStream is( content.c_str(), content.size() );
-                        wxImage image( is, wxBITMAP_TYPE_ANY );
-                        if ( image.IsOk() ) {
-                              if ( latlonbox->has_rotation() ) {
-                                    latlonbox->get_rotation();
-                              }
-                              int dx = ptSE.x - ptNW.x + 1;
-                              int dy = ptSE.y - ptNW.y + 1;
-                              if ( dx < 32 || dy < 32 ) {
-                                    // Overlay is very small, let's draw a default KML picture instead
-                                    DoDrawBitmap( *_img_undersized, ptNW.x, ptNW.y, false );
-                                    return;
-                              }
-                              image.Rescale( dx, dy );
-                              image.InitAlpha();
-                              int size = image.GetWidth() * image.GetHeight();
-                              unsigned char *alphad = (unsigned char *)malloc ( size * sizeof ( unsigned char ) );
-                              unsigned char *a = alphad;
-                              for ( int i=0 ; i<size; i++ ) {
-                                    *a++ = ( unsigned char )alpha;
-                              }
-                              image.SetAlpha( alphad );
-                              wxBitmap bitmap( image );
-                              DoDrawBitmap( bitmap, ptNW.x, ptNW.y, true );
-                        }
+static double BoxDistance( wxPoint pt, int cx, int cy, int half )
+{
+      double dx = std::max( abs( pt.x - cx ) - half, 0 );
+      double dy = std::max( abs( pt.y - cy ) - half, 0 );
+      return sqrt( dx * dx + dy * dy );
+}
+
+static double SegmentDistance( wxPoint pt, wxPoint a, wxPoint b )
+{
+      double dx = b.x - a.x, dy = b.y - a.y;
+      double len = dx * dx + dy * dy;
+      double t = len > 0 ? ( ( pt.x - a.x ) * dx + ( pt.y - a.y ) * dy ) / len : 0;
+      t = std::max( 0., std::min( 1., t ) );
+      double ex = a.x + t * dx - pt.x, ey = a.y + t * dy - pt.y;
+      return sqrt( ex * ex + ey * ey );
+}
+
+static double LineDistance( wxPoint pt, const std::vector<wxPoint> &points, bool closed )
+{
+      double d = points.size() == 1 ? SegmentDistance( pt, points[0], points[0] ) : HUGE_VAL;
+      for ( size_t i = 1; i < points.size(); i++ )
+            d = std::min( d, SegmentDistance( pt, points[i-1], points[i] ) );
+      if ( closed && points.size() > 2 )
+            d = std::min( d, SegmentDistance( pt, points.back(), points[0] ) );
+      return d;
+}
+
+// Even-odd rule, as the rings of a polygon and its holes are drawn
+static bool IsInRing( wxPoint pt, const std::vector<wxPoint> &ring )
+{
+      bool inside = false;
+      for ( size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++ ) {
+            if ( ( ring[i].y > pt.y ) != ( ring[j].y > pt.y )
+                  && pt.x < (double)( ring[j].x - ring[i].x ) * ( pt.y - ring[i].y ) / ( ring[j].y - ring[i].y ) + ring[i].x )
+                  inside = !inside;
+      }
+      return inside;
+}
+
+double KMLOverlayFactory::Container::PickFeature( const KMLOverlayScene *scene, PlugIn_ViewPort *vp,
+                                                 const KMLOverlayScene::Feature &feature, const KMLOverlayScene::Bounds &box,
+                                                 wxPoint pt, int tolerance, std::vector<wxPoint> *points )
+{
+      const KMLOverlayScene::Style &style = scene->GetStyle( feature.style );
+      double best = HUGE_VAL;
+      bool inside = false;
+      for ( uint32_t i = 0; i < feature.part_count; i++ ) {
+            const KMLOverlayScene::Part &part = scene->GetPart( feature.first_part + i );
+            uint32_t count;
+            const KMLOverlayScene::Chunk *chunks = scene->GetChunks( feature.first_part + i, &count );
+            if ( chunks && ( part.type == KMLOverlayScene::PART_LINESTRING || part.type == KMLOverlayScene::PART_TRACK ) ) {
+                  // Only the chunks around the cursor
+                  uint32_t first = 0, last = part.count;
+                  if ( part.type == KMLOverlayScene::PART_TRACK && m_time_filter )
+                        scene->GetTrackRange( feature.first_part + i, m_time_begin, m_time_end, &first, &last );
+                  for ( uint32_t k = 0; k < count; k++ ) {
+                        const KMLOverlayScene::Bounds &b = chunks[k].box;
+                        uint32_t from = std::max( chunks[k].first, first );
+                        uint32_t to = std::min( ChunkEnd( chunks, count, k, part ), last - 1 );
+                        if ( from >= to || b.south > box.north || b.north < box.south || b.west > box.east || b.east < box.west )
+                              continue;
+                        points->resize( to - from + 1 );
+                        ProjectRange( *scene, vp, part, chunks[k], from, to, &(*points)[0] );
+                        best = std::min( best, LineDistance( pt, *points, false ) );
                   }
+                  continue;
+            }
+            ProjectPart( scene, vp, feature.first_part + i, part, points );
+            if ( points->empty() )
+                  continue;
+            switch ( part.type ) {
+            case KMLOverlayScene::PART_POINT:
+                  // Over the icon, see RenderPoint
+                  if ( style.icon != KMLOverlayScene::NoIcon )
+                        best = std::min( best, BoxDistance( pt, (*points)[0].x, (*points)[0].y, (int)( 16 * style.icon_scale ) ) );
+                  else
+                        best = std::min( best, BoxDistance( pt, (*points)[0].x, (*points)[0].y - 16, 16 ) );
+            break;
+            case KMLOverlayScene::PART_LINESTRING:
+            case KMLOverlayScene::PART_TRACK:
+                  best = std::min( best, LineDistance( pt, *points, false ) );
+            break;
+            case KMLOverlayScene::PART_LINEARRING:
+            case KMLOverlayScene::PART_INNERRING:
+                  best = std::min( best, LineDistance( pt, *points, true ) );
+                  if ( IsInRing( pt, *points ) )
+                        inside = !inside;
+            break;
+            default:
+            break;
             }
       }
+      if ( best <= tolerance )
+            return best;
+      if ( inside && style.ring_fill )
+            return tolerance;
+      return -1;
 }
 
-void KMLOverlayFactory::Container::RenderGeometry( const kmldom::GeometryPtr& geometry, const kmldom::StylePtr& style )
+const KMLOverlayScene *KMLOverlayFactory::Container::GetLoadedScene()
 {
-      if ( !geometry ) {
-            return;
+      // The reclaimer only runs after frames, see Pick
+      if ( !m_ready )
+            return NULL;
+      return m_slot->Acquire();
+}
+
+bool KMLOverlayFactory::Container::Pick( PlugIn_ViewPort *vp, RenderContext &context, wxPoint pt, int tolerance, double *score,
+                                         wxString *name, wxString *description )
+{
+      if ( !m_ready || !m_visible || !IsInView( vp ) )
+            return false;
+      // Never loads anything: an unloaded layer isn't drawn either. The
+      // snapshot stays valid as the reclaimer only runs after frames, on
+      // this same thread.
+      const KMLOverlayScene *scene = m_slot->Acquire();
+      if ( !scene )
+            return false;
+
+      // Corners of the cursor's neighbourhood, the view may be rotated.
+      // Icons reach 32 pixels above their point.
+      int margin = tolerance + 32;
+      KMLOverlayScene::Bounds box;
+      for ( int i = 0; i < 4; i++ ) {
+            double lat, lon;
+            wxPoint corner( pt.x + ( i & 1 ? margin : -margin ), pt.y + ( i & 2 ? margin : -margin ) );
+            GetCanvasLLPix( vp, corner, &lat, &lon );
+            box.Extend( KMLOverlayScene::ToFixed( lat ), KMLOverlayScene::ToFixed( lon ) );
       }
 
-      switch ( geometry->Type() ) {
-      case kmldom::Type_Point:
-      {
-            if ( const kmldom::PointPtr point = kmldom::AsPoint( geometry ) ) {
-                  RenderPoint( point, style );
+      std::vector<const KMLOverlayScene::PickItem *> &items = context.pick_items;
+      scene->QueryBounds( box, &items );
+      const KMLOverlayScene::PickItem *best = NULL;
+      double best_score = 0;
+      for ( size_t i = 0; i < items.size(); i++ ) {
+            const KMLOverlayScene::PickItem *item = items[i];
+            // Only what the last frame drew
+            if ( item->region != KMLOverlayScene::NoRegion && !IsRegionActive( vp, scene->GetRegion( item->region ) ) )
+                  continue;
+            if ( item->time != KMLOverlayScene::NoTime && m_time_filter ) {
+                  const KMLOverlayScene::TimeInterval &t = scene->GetPickTime( item->time );
+                  if ( t.end < m_time_begin || t.begin > m_time_end )
+                        continue;
             }
-      }
-      break;
-      case kmldom::Type_LineString:
-      {
-            if ( const kmldom::LineStringPtr linestring = kmldom::AsLineString( geometry ) ) {
-                  RenderLineString( linestring, style );
+            double s = PickFeature( scene, vp, scene->GetFeature( item->feature ), box, pt, tolerance, &context.pick_points );
+            if ( s < 0 )
+                  continue;
+            // Later features are drawn on top
+            if ( !best || s < best_score || ( s == best_score && item->feature > best->feature ) ) {
+                  best = item;
+                  best_score = s;
             }
       }
-      break;
-      case kmldom::Type_LinearRing:
-      {
-            if ( const kmldom::LinearRingPtr linearring = kmldom::AsLinearRing( geometry ) ) {
-                  RenderLinearRing( linearring, style );
-            }
+      if ( !best )
+            return false;
+
+      std::string n, d;
+      scene->GetFeatureText( best->feature, &n, &d );
+      *name = wxString::FromUTF8( n.c_str() );
+      *description = wxString::FromUTF8( d.c_str() );
+      *score = best_score;
+      return true;
+}
+
+template <class Backend>
+void KMLOverlayFactory::Container::RenderGroundOverlay( Backend &backend, Frame &frame,
+                                                        const KMLOverlayScene::GroundOverlay& groundoverlay )
+{
+      wxPoint ptNW, ptSE;
+      GetCanvasPixLL( frame.vp,  &ptNW, groundoverlay.north, groundoverlay.west );
+      GetCanvasPixLL( frame.vp,  &ptSE, groundoverlay.south, groundoverlay.east );
+
+      int dx = ptSE.x - ptNW.x + 1;
+      int dy = ptSE.y - ptNW.y + 1;
+      // Not decoded yet, we will be asked to refresh once it is. Scaled
+      // from the nearest level of its pyramid.
+      const wxImage *original = m_assets->GetImage( m_source, groundoverlay.href, dx, dy );
+      if ( !original ) {
+            frame.image_misses++;
+            return;
       }
-      break;
-      case kmldom::Type_Polygon:
-      {
-            if ( const kmldom::PolygonPtr polygon = kmldom::AsPolygon( geometry ) ) {
-                  RenderPolygon( polygon, style );
-            }
+      frame.image_hits++;
+
+      if ( dx < 32 || dy < 32 ) {
+            // Overlay is very small, let's draw a default KML picture instead
+            backend.DrawBitmap( *_img_undersized, ptNW.x, ptNW.y, false );
+            return;
       }
-      break;
-      case kmldom::Type_MultiGeometry:
-      {
-            if ( const kmldom::MultiGeometryPtr multigeometry = kmldom::AsMultiGeometry( geometry ) )
-            {
-                  for ( size_t i = 0; i < multigeometry->get_geometry_array_size(); ++i ) {
-                        RenderGeometry( multigeometry->get_geometry_array_at( i ), style );
-                  }
+      // Scaled once per size: panning draws the same bitmap again
+      ScaledOverlay &scaled = frame.state->overlays[groundoverlay.href];
+      scaled.last_used = frame.state->overlay_frame;
+      if ( scaled.source != original || scaled.width != dx || scaled.height != dy
+            || scaled.alpha != groundoverlay.alpha || !scaled.bitmap.IsOk() ) {
+            wxImage image = KMLOverlayImageOps::Resample( *original, dx, dy );
+            size_t size = (size_t)image.GetWidth() * image.GetHeight();
+            // The overlay's colour scales the image's own transparency
+            if ( image.HasAlpha() || image.HasMask() ) {
+                  if ( !image.HasAlpha() )
+                        image.InitAlpha();
+                  KMLOverlayImageOps::ScaleAlpha( image.GetAlpha(), groundoverlay.alpha, size );
+            } else {
+                  image.SetAlpha();
+                  KMLOverlayImageOps::FillAlpha( image.GetAlpha(), groundoverlay.alpha, size );
             }
+            scaled.source = original;
+            scaled.width = dx;
+            scaled.height = dy;
+            scaled.alpha = groundoverlay.alpha;
+            scaled.bitmap = wxBitmap( image );
       }
-      break;
-      case kmldom::Type_Model:
-      break;
-      default:  // KML has 6 types of Geometry.
-      break;
-      }
+      backend.DrawBitmap( scaled.bitmap, ptNW.x, ptNW.y, true );
 }
 
-void KMLOverlayFactory::Container::RenderFeature( const kmldom::FeaturePtr& feature)
+template <class Backend>
+void KMLOverlayFactory::Container::RenderLink( Backend &backend, Frame &frame, const KMLOverlayScene::Feature& feature )
 {
-      if ( !feature )
-      {
+      // Links may loop back, no tile pyramid is that deep
+      if ( frame.link_depth >= MaxLinkDepth )
             return;
-      }
-      if ( !feature->get_visibility() )
-      {
+      // Drawn on a later frame once loaded
+      const KMLOverlayScene *child = m_tiles->Get( frame.scene->GetLink( feature.first_part ) );
+      if ( !child ) {
+            frame.complete = false;
             return;
       }
 
-/* Can we do something with name?
-      if ( feature->has_name() ) {
-            std::cout << "Render " << feature->get_name() << std::endl;
+      const KMLOverlayScene *parent = frame.scene;
+      const std::vector<uint32_t> *parent_hits = frame.hits;
+      size_t parent_next_hit = frame.next_hit;
+      // One buffer per depth, kept from frame to frame
+      std::vector<uint32_t> &hits = frame.context->link_hits[frame.link_depth];
+      hits.clear();
+      if ( m_time_filter && child->HasTime() )
+            child->QueryTime( m_time_begin, m_time_end, &hits );
+      frame.scene = child;
+      frame.hits = &hits;
+      frame.next_hit = 0;
+      frame.link_depth++;
+      for ( size_t i = 0; i < child->GetFeatureCount(); ) {
+            i = RenderFeature( backend, frame, i );
       }
- */
+      frame.link_depth--;
+      frame.scene = parent;
+      frame.hits = parent_hits;
+      frame.next_hit = parent_next_hit;
+}
 
-      switch ( feature->Type() ) {
-      case kmldom::Type_Document:
-            // Document is a container, handled below.
-      break;
-      case kmldom::Type_Folder:
-            // Folder is a container, handled below.
-      break;
-      case kmldom::Type_GroundOverlay:
-      {
-            if ( const kmldom::GroundOverlayPtr groundoverlay = kmldom::AsGroundOverlay( feature ) ) {
-                  RenderGroundOverlay( groundoverlay );
+void KMLOverlayFactory::Container::UpdatePrefetch( Frame &frame )
+{
+      // The context is the canvas', each pans on its own. A new scale is
+      // zooming, not panning.
+      LayerState &last = *frame.state;
+      frame.prefetch = false;
+      double dlat = frame.vp->clat - last.clat;
+      double dlon = frame.vp->clon - last.clon;
+      if ( last.has_centre && last.scale == frame.vp->view_scale_ppm && ( dlat || dlon ) ) {
+            // Half a screen ahead in the direction of panning
+            double len = sqrt( dlat * dlat + dlon * dlon );
+            double olat = dlat / len * ( frame.vp->lat_max - frame.vp->lat_min ) / 2;
+            double olon = dlon / len * ( frame.vp->lon_max - frame.vp->lon_min ) / 2;
+            frame.prefetch_vp = *frame.vp;
+            frame.prefetch_vp.clat += olat;
+            frame.prefetch_vp.lat_min += olat;
+            frame.prefetch_vp.lat_max += olat;
+            frame.prefetch_vp.clon += olon;
+            frame.prefetch_vp.lon_min += olon;
+            frame.prefetch_vp.lon_max += olon;
+            frame.prefetch = true;
+      }
+      last.has_centre = true;
+      last.scale = frame.vp->view_scale_ppm;
+      last.clat = frame.vp->clat;
+      last.clon = frame.vp->clon;
+}
+
+template <class Backend>
+size_t KMLOverlayFactory::Container::RenderFeature( Backend &backend, Frame &frame, size_t idx )
+{
+      const KMLOverlayScene::Feature &feature = frame.scene->GetFeature( idx );
+      if ( feature.timed && m_time_filter && !IsInTime( frame, idx ) )
+            return feature.end;
+      // An inactive region hides the whole subtree, never walk into it
+      if ( feature.region != KMLOverlayScene::NoRegion ) {
+            const KMLOverlayScene::Region &region = frame.scene->GetRegion( feature.region );
+            if ( !IsRegionActive( frame.vp, region ) ) {
+                  // Prefetch the links the panning is heading to
+                  if ( feature.type == KMLOverlayScene::FEATURE_NETWORKLINK && frame.prefetch
+                        && IsBoundsInView( region.box, &frame.prefetch_vp ) && IsLodActive( frame.vp, region ) )
+                        m_tiles->Prefetch( frame.scene->GetLink( feature.first_part ) );
+                  frame.vertices_culled += region.vertices;
+                  return feature.end;
             }
       }
+
+      switch ( feature.type ) {
+      case KMLOverlayScene::FEATURE_GROUNDOVERLAY:
+            RenderGroundOverlay( backend, frame, frame.scene->GetGroundOverlay( feature.first_part ) );
       break;
-      case kmldom::Type_Placemark:
+      case KMLOverlayScene::FEATURE_NETWORKLINK:
+            RenderLink( backend, frame, feature );
+      break;
+      case KMLOverlayScene::FEATURE_PLACEMARK:
       {
-            if ( const kmldom::PlacemarkPtr placemark = kmldom::AsPlacemark( feature ) ) {
-                  RenderGeometry( placemark->get_geometry(), GetFeatureStylePtr( feature ) );
+            const KMLOverlayScene::Style &style = frame.scene->GetStyle( feature.style );
+            // Only the layer's own placemarks are laid out, not linked ones.
+            // Another viewport may have laid them out for its own scale since.
+            const char *label = NULL;
+            if ( frame.label_band >= 0 && frame.label_band == frame.state->label_band && frame.scene == frame.state->label_scene
+                  && idx < frame.state->label_shown.size() && frame.state->label_shown[idx] )
+                  label = frame.scene->GetFeatureName( idx );
+            for ( uint32_t i = 0; i < feature.part_count; i++ ) {
+                  const KMLOverlayScene::Part &part = frame.scene->GetPart( feature.first_part + i );
+                  // Lines and rings count what they cull themselves. Inner
+                  // rings are drawn with their outer ring, one without is
+                  // only counted as culled.
+                  if ( part.type == KMLOverlayScene::PART_POINT )
+                        frame.vertices_drawn += part.count;
+                  else if ( part.type == KMLOverlayScene::PART_INNERRING )
+                        frame.vertices_culled += part.count;
+                  switch ( part.type ) {
+                  case KMLOverlayScene::PART_POINT:
+                        RenderPoint( backend, frame, part, style, i == 0 ? label : NULL );
+                  break;
+                  case KMLOverlayScene::PART_LINESTRING:
+                        RenderLineString( backend, frame, feature.first_part + i, part, style );
+                  break;
+                  case KMLOverlayScene::PART_LINEARRING:
+                  {
+                        // Its holes follow it
+                        uint32_t holes = 0;
+                        while ( i + holes + 1 < feature.part_count
+                              && frame.scene->GetPart( feature.first_part + i + holes + 1 ).type == KMLOverlayScene::PART_INNERRING )
+                              holes++;
+                        RenderLinearRing( backend, frame, feature.first_part + i, part, holes, style );
+                        i += holes;
+                  }
+                  break;
+                  case KMLOverlayScene::PART_TRACK:
+                        RenderTrack( backend, frame, feature.first_part + i, part, style );
+                  break;
+                  default:
+                  break;
+                  }
             }
       }
       break;
       default:
       break;
       }
-
-      if ( const kmldom::ContainerPtr container = kmldom::AsContainer( feature ) ) {
-            for ( size_t i = 0; i < container->get_feature_array_size(); ++i ) {
-                  RenderFeature( container->get_feature_array_at( i ) );
-            }
-      }
+      return idx + 1;
 }
 
-bool KMLOverlayFactory::Container::DoRender()
+bool KMLOverlayFactory::Container::Render( PlugIn_ViewPort *vp, RenderContext &context, KMLOverlayRenderQueue *queue, int layer )
 {
       if ( !m_ready )
             return false;
@@ -648,29 +1981,204 @@ bool KMLOverlayFactory::Container::DoRender()
       if ( !m_visible )
             return true;
 
-      RenderFeature( m_root );
+      if ( !IsInView( vp ) ) {
+            m_stats.vertices_drawn = 0;
+            m_stats.vertices_culled = m_vertex_count;
+            m_stats.complete = true;
+            return true;
+      }
+
+      KMLOverlayTrace::Scope trace( "render layer", m_source.c_str() );
+      // Two clock reads per layer and frame, only while someone is looking
+      std::chrono::steady_clock::time_point start;
+      if ( m_timed )
+            start = std::chrono::steady_clock::now();
+
+      m_last_viewed = wxGetLocalTimeMillis();
+      // Drawn once a job loaded it, which asks for a refresh then
+      if ( !Load() ) {
+            m_stats.vertices_drawn = 0;
+            m_stats.vertices_culled = 0;
+            m_stats.complete = false;
+            return true;
+      }
+
+      // One snapshot for the whole frame, a reload published meanwhile
+      // is picked up by the next one.
+      const KMLOverlayScene *scene = m_slot->Acquire();
+      if ( scene && m_preload ) {
+            PreloadOverlays( scene, vp );
+            m_preload = false;
+      }
+      KMLOverlayViewCache::Entry *entry = scene ? m_views->Find( scene, *vp ) : NULL;
+      if ( entry ) {
+            // Another canvas, or the same view again: draw what was recorded
+            queue->Add( entry, layer );
+            m_stats.vertices_drawn = entry->vertices_drawn;
+            m_stats.vertices_culled = entry->vertices_culled;
+            m_stats.complete = true;
+      } else {
+            RenderFrame( vp, context, scene, queue, layer );
+      }
+      m_stats.view_hits = m_views->GetHits();
+      if ( m_timed ) {
+            m_stats.last_render_ms = ElapsedMs( start );
+            m_total_render_ms += m_stats.last_render_ms;
+            m_stats.frames++;
+      }
       return true;
 }
 
-bool KMLOverlayFactory::Container::Render( wxDC &dc, PlugIn_ViewPort *vp )
+void KMLOverlayFactory::Container::RenderFrame( PlugIn_ViewPort *vp, RenderContext &context, const KMLOverlayScene *scene,
+                                                KMLOverlayRenderQueue *queue, int layer )
 {
-      m_pdc = &dc;
-      m_pcontext = NULL;
-      m_pvp = vp;
-      return DoRender();
-}
+      // What the canvas kept of an older scene is of no use
+      LayerState &state = context.layers[this];
+      if ( state.generation != m_generation ) {
+            state.overlays.clear();
+            state.label_scene = NULL;
+            std::vector<bool>().swap( state.label_shown );
+            state.generation = m_generation;
+      }
 
-bool KMLOverlayFactory::Container::RenderGL( wxGLContext *pcontext, PlugIn_ViewPort *vp )
-{
-      m_pdc = NULL;
-      m_pcontext = pcontext;
-      m_pvp = vp;
-      return DoRender();
+      Frame frame;
+      frame.vp = vp;
+      frame.context = &context;
+      frame.state = &state;
+      // Chunks are culled against the view widened by a thick stroke
+      frame.chunk_vp = *vp;
+      if ( vp->view_scale_ppm > 0 ) {
+            double margin = ChunkMargin / ( vp->view_scale_ppm * 111319.490793 );
+            double lon_margin = margin / std::max( cos( vp->clat * M_PI / 180 ), 0.01 );
+            frame.chunk_vp.lat_min -= margin;
+            frame.chunk_vp.lat_max += margin;
+            frame.chunk_vp.lon_min -= lon_margin;
+            frame.chunk_vp.lon_max += lon_margin;
+      }
+      frame.link_depth = 0;
+      frame.label_band = -1;
+      frame.complete = true;
+      frame.vertices_drawn = 0;
+      frame.vertices_culled = 0;
+      frame.image_hits = 0;
+      frame.image_misses = 0;
+      frame.scene = scene;
+      if ( frame.scene ) {
+            UpdatePrefetch( frame );
+            m_tiles->BeginFrame();
+            // The time index is queried once, features then only check
+            // whether they are among the hits
+            std::vector<uint32_t> &hits = context.time_hits;
+            hits.clear();
+            if ( m_time_filter && frame.scene->HasTime() )
+                  frame.scene->QueryTime( m_time_begin, m_time_end, &hits );
+            frame.hits = &hits;
+            frame.next_hit = 0;
+            if ( m_show_labels ) {
+                  int band = (int)floor( log( vp->view_scale_ppm ) / log( 2. ) );
+                  if ( frame.scene != state.label_scene || band != state.label_band )
+                        LayoutLabels( state, frame.scene, band );
+                  frame.label_band = band;
+            } else if ( state.label_scene ) {
+                  state.label_scene = NULL;
+                  std::vector<bool>().swap( state.label_shown );
+            }
+            // Recorded, then drawn with the other layers
+            KMLOverlayViewCache::Entry *entry = m_views->Begin( frame.scene, *vp );
+            KMLOverlayViewCache::Recorder recorder( entry );
+            for ( size_t i = 0; i < frame.scene->GetFeatureCount(); ) {
+                  i = RenderFeature( recorder, frame, i );
+            }
+            m_tiles->Trim( m_tile_budget );
+            entry->vertices_drawn = frame.vertices_drawn;
+            entry->vertices_culled = frame.vertices_culled;
+            // Images still decoding or links still loading: drawn again
+            entry->complete = frame.complete && !frame.image_misses;
+            queue->Add( entry, layer );
+            state.TrimOverlays();
+      }
+
+      m_stats.vertices_drawn = frame.vertices_drawn;
+      m_stats.vertices_culled = frame.vertices_culled;
+      m_stats.image_hits += frame.image_hits;
+      m_stats.image_misses += frame.image_misses;
+      m_stats.complete = frame.scene && frame.complete && !frame.image_misses;
 }
 
 void KMLOverlayFactory::Container::SetVisibility( bool visible )
 {
       m_visible = visible;
+      m_slot->visible.store( visible, std::memory_order_relaxed );
+}
+
+void KMLOverlayFactory::Container::StartConvert()
+{
+      // Hidden layers are kept in their compressed form. The published
+      // scene may still be drawn, a job makes the copy that replaces it.
+      KMLOverlayScene *scene = m_slot->Acquire();
+      if ( !scene || scene->IsPacked() == !m_visible )
+            return;
+      {
+            wxMutexLocker lock( m_slot->mutex );
+            // One job at a time, the next refresh tries again
+            if ( m_slot->busy || m_slot->loaded || m_slot->reloaded )
+                  return;
+            m_slot->busy = true;
+            m_slot->reading = scene;
+            m_slot->refs++;
+      }
+      // Below image decoding, the layer is drawn meanwhile
+      m_pool->Submit( new ConvertJob( m_slot, scene, !m_visible, m_handler ), -1 );
+}
+
+void KMLOverlayFactory::Container::Drawn( const KMLOverlayRenderQueue::Item &item )
+{
+      m_views->End( item.entry );
+      m_stats.image_bytes += item.image_bytes;
+      if ( m_timed ) {
+            m_stats.last_render_ms += item.ms;
+            m_total_render_ms += item.ms;
+      }
+}
+
+void KMLOverlayFactory::Container::SetTimed( bool timed )
+{
+      m_timed = timed;
+}
+
+void KMLOverlayFactory::Container::SetTileBudget( size_t budget )
+{
+      m_tile_budget = budget;
+}
+
+void KMLOverlayFactory::Container::SetLabelsEnabled( bool enabled )
+{
+      m_show_labels = enabled;
+      m_views->Clear();
+}
+
+void KMLOverlayFactory::Container::SetTimeWindow( bool enabled, int64_t begin, int64_t end )
+{
+      m_time_filter = enabled;
+      m_time_begin = begin;
+      m_time_end = end;
+      m_views->Clear();
+}
+
+bool KMLOverlayFactory::Container::GetTimeExtent( int64_t *begin, int64_t *end )
+{
+      *begin = m_extent_begin;
+      *end = m_extent_end;
+      return m_extent_begin <= m_extent_end;
+}
+
+void KMLOverlayFactory::Container::GetStats( LayerStats *stats )
+{
+      *stats = m_stats;
+      stats->loaded = IsLoaded();
+      stats->memory = GetMemoryUsage() + m_tiles->GetMemoryUsage();
+      stats->tiles = m_tiles->GetTileCount();
+      stats->avg_render_ms = m_stats.frames ? m_total_render_ms / m_stats.frames : 0;
 }
 
 wxString KMLOverlayFactory::Container::GetFilename()
@@ -37,15 +37,48 @@
 
 #include <kml/engine.h>
 #include "../../../include/ocpn_plugin.h"
+#include "scene.h"
+#include "assets.h"
+#include "filewatcher.h"
+#include "reclaimer.h"
+#include "superoverlay.h"
+#include "labels.h"
+#include "viewcache.h"
+#include "query.h"
+#include "scratch.h"
+#include "renderqueue.h"
+#include <atomic>
 
 class KMLOverlayFactory
 {
 public:
-      KMLOverlayFactory();
+      struct LayerStats
+      {
+            double             parse_ms;         // last parse or reload
+            size_t             memory;           // scene and archive, 0 once unloaded
+            bool               loaded;
+            double             last_render_ms;   // only timed while enabled
+            double             avg_render_ms;
+            unsigned long      frames;
+            unsigned long      vertices_drawn;   // during the last frame
+            unsigned long      vertices_culled;
+            unsigned long long image_bytes;      // handed to the DC or GL, in total
+            unsigned long      image_hits;       // decoded images found ready
+            unsigned long      image_misses;     // still decoding, or failed
+            unsigned long      rehydrations;     // loaded back from the binary cache
+            unsigned long      tiles;            // linked documents cached
+            unsigned long      view_hits;        // frames replayed from the view cache
+            bool               complete;         // the last frame had nothing left loading
+      };
+
+      KMLOverlayFactory( wxEvtHandler *handler );
       ~KMLOverlayFactory();
 
       bool RenderOverlay( wxDC &dc, PlugIn_ViewPort *vp );
       bool RenderGLOverlay( wxGLContext *pcontext, PlugIn_ViewPort *vp );
+      // Walks the layers without drawing anything, as a benchmark baseline.
+      // Primitives that would have been drawn are counted when not NULL.
+      bool RenderNullOverlay( PlugIn_ViewPort *vp, unsigned long *primitives );
 
       bool Add( wxString filename, bool visible );
       void SetVisibility( int idx, bool visible );
@@ -53,47 +86,261 @@ public:
       wxString GetFilename( int idx );
       bool GetVisibility( int idx );
       int GetCount();
+      void SetMemoryBudget( size_t budget );
+      // minutes < 0 disables reloading files changed on disk
+      void SetReloadInterval( int minutes );
+      // Starts reloading changed files and swaps in the finished ones,
+      // returns true when a layer was updated
+      bool CheckReload();
+      // Render times are only measured while enabled, the counters are
+      // always kept as they cost a few additions per frame.
+      void SetStatsEnabled( bool enabled );
+      // Only draws timed features and track samples within [begin, end]
+      void SetTimeWindow( bool enabled, int64_t begin, int64_t end );
+      // Over all layers, false when none has time data
+      bool GetTimeExtent( int64_t *begin, int64_t *end );
+      // Placemark names, where they don't collide
+      void SetLabelsEnabled( bool enabled );
+      bool GetStats( int idx, LayerStats *stats );
+      void LogStats();
+      // Topmost placemark under the cursor, as drawn in the last frame,
+      // false when there is none
+      bool Pick( double lat, double lon, wxString *name, wxString *description );
+      // Answers a spatial query from another plugin, UTF-8 JSON both
+      // ways, see query.h. Only layers already loaded are searched.
+      std::string Query( const std::string &request );
 
 private:
+      class Container;
+
+      // A ground overlay as last drawn, reused while neither the pyramid
+      // level nor the size on screen change
+      struct ScaledOverlay
+      {
+            ScaledOverlay() : source( NULL ), width( 0 ), height( 0 ), alpha( 0 ), last_used( 0 ) {}
+
+            const wxImage         *source;
+            int                    width, height;
+            uint8_t                alpha;
+            unsigned long          last_used;
+            wxBitmap               bitmap;
+      };
+
+      // What a canvas keeps of one layer from frame to frame
+      struct LayerState
+      {
+            LayerState() : generation( 0 ), overlay_frame( 0 ), label_scene( NULL ), label_band( 0 ),
+                  has_centre( false ), scale( 0 ), clat( 0 ), clon( 0 ) {}
+            // Lets go of the overlays not drawn for a while
+            void TrimOverlays();
+            size_t GetMemoryUsage() const;
+
+            unsigned long          generation;        // of the layer's scene it was kept for
+            std::map<std::string, ScaledOverlay> overlays;   // by href
+            unsigned long          overlay_frame;
+            const KMLOverlayScene *label_scene;       // laid out for
+            int                    label_band;
+            std::vector<bool>      label_shown;       // by feature
+            bool                   has_centre;        // the last view, for the direction of panning
+            double                 scale;
+            double                 clat, clon;
+      };
+
+      /*    The working state of the frames drawn to one canvas. Layers keep
+       *    none of it, the caller passes it down: each canvas pans and lays
+       *    out its labels on its own, and whoever draws from elsewhere
+       *    brings its own context. Canvases are told apart by their size.
+       */
+      struct RenderContext
+      {
+            RenderContext( int w, int h );
+            // Room for n points, valid until the next call
+            wxPoint *GetPoints( size_t n )
+            {
+                  if ( points.size() < n )
+                        points.resize( n );
+                  return points.empty() ? NULL : &points[0];
+            }
+            // Room for the point counts of n rings, valid until the next call
+            int *GetCounts( size_t n )
+            {
+                  if ( counts.size() < n )
+                        counts.resize( n );
+                  return counts.empty() ? NULL : &counts[0];
+            }
+            size_t GetMemoryUsage() const;
+
+            int                    width, height;
+            std::vector<wxPoint>   points;            // projected, grown to the largest part
+            std::vector<int>       counts;
+            std::vector<uint32_t>  time_hits;         // of the layer being drawn
+            std::vector<std::vector<uint32_t> > link_hits;   // by link depth
+            std::vector<const KMLOverlayScene::PickItem *> pick_items;
+            std::vector<wxPoint>   pick_points;
+            std::map<const Container *, LayerState> layers;
+      };
+
+      void EnforceBudget();
+      size_t GetTileBudget();
+      RenderContext *GetContext( PlugIn_ViewPort *vp );
+      // Drops what the canvases kept of a layer, returns the bytes freed
+      size_t ForgetLayer( const Container *cont );
+      template <class Backend> bool RenderLayers( Backend &backend, PlugIn_ViewPort *vp );
+
       class Container
       {
       public:
-            Container(wxString filename, bool visible);
+            Container( wxString filename, bool visible, KMLOverlayAssetCache *assets, KMLOverlayLabels *labels,
+                       KMLOverlayScratch *scratch, KMLOverlayReclaimer *reclaimer, KMLOverlayWorkerPool *pool, wxEvtHandler *handler );
+            ~Container();
             bool Parse();
-            bool Render( wxDC &dc, PlugIn_ViewPort *vp );
-            bool RenderGL( wxGLContext *pcontext, PlugIn_ViewPort *vp );
+            // Queues the layer's frame, tagged with layer. Frame state
+            // stays on the stack or in the caller's context, a layer may be
+            // drawn to several viewports.
+            bool Render( PlugIn_ViewPort *vp, RenderContext &context, KMLOverlayRenderQueue *queue, int layer );
+            // Once the queue drew it
+            void Drawn( const KMLOverlayRenderQueue::Item &item );
             void SetVisibility( bool visible );
+            // Packs a hidden layer, unpacks a shown one, in a job
+            void StartConvert();
             wxString GetFilename();
             bool GetVisibility();
+            size_t GetMemoryUsage();
+            bool IsLoaded();
+            void Unload();
+            wxLongLong GetLastViewed();
+            void RequestReload();
+            void StartReload( KMLOverlayWorkerPool *pool, wxEvtHandler *handler );
+            bool AdoptReload();
+            // Settles a finished load, returns true when a scene came in
+            bool AdoptLoad();
+            void SetTimed( bool timed );
+            void SetTileBudget( size_t budget );
+            void SetTimeWindow( bool enabled, int64_t begin, int64_t end );
+            bool GetTimeExtent( int64_t *begin, int64_t *end );
+            void SetLabelsEnabled( bool enabled );
+            void GetStats( LayerStats *stats );
+            // Placemark within tolerance pixels of pt, scored by distance,
+            // the inside of polygons last
+            bool Pick( PlugIn_ViewPort *vp, RenderContext &context, wxPoint pt, int tolerance, double *score,
+                       wxString *name, wxString *description );
+            // The scene as drawn, NULL while not loaded. Never loads
+            // anything, valid until the next frame.
+            const KMLOverlayScene *GetLoadedScene();
 
       private:
-            const kmldom::StylePtr GetFeatureStylePtr( const kmldom::FeaturePtr& feature );
-            void DoDrawCircle( wxPen pen, wxBrush brush, wxPoint pt, int radius );
-            void DoDrawLines( wxPen pen, int n, wxPoint points[] );
-            void DoDrawPolygon( wxPen pen, wxBrush brush, int n, wxPoint points[] );
-            void DoDrawBitmap( const wxBitmap &bitmap, wxCoord x, wxCoord y, bool usemask );
-            void RenderPoint( const kmldom::PointPtr& point, const kmldom::StylePtr& style );
-            void RenderLineString( const kmldom::LineStringPtr& linestring, const kmldom::StylePtr& style );
-            void RenderLinearRing( const kmldom::LinearRingPtr& linearring, const kmldom::StylePtr& style );
-            void RenderPolygon( const kmldom::PolygonPtr& polygon, const kmldom::StylePtr& style );
-            void RenderGroundOverlay( const kmldom::GroundOverlayPtr& groundoverlay );
-            void RenderGeometry( const kmldom::GeometryPtr& geometry, const kmldom::StylePtr& style );
-            void RenderFeature( const kmldom::FeaturePtr& feature );
-            bool DoRender();
-            wxDC            *m_pdc;
-            wxGLContext     *m_pcontext;
-            PlugIn_ViewPort *m_pvp;
+            struct SceneSlot;
+            class ReloadJob;
+            class LoadJob;
+            class SaveJob;
+            class ConvertJob;
+
+            // One traversal of the layer
+            struct Frame
+            {
+                  PlugIn_ViewPort       *vp;
+                  RenderContext         *context;           // the caller's
+                  LayerState            *state;             // this layer's, in context
+                  const KMLOverlayScene *scene;             // snapshot, or a linked document
+                  const std::vector<uint32_t> *hits;        // of the scene being drawn
+                  size_t                 next_hit;
+                  int                    link_depth;
+                  bool                   prefetch;          // panning, see prefetch_vp
+                  PlugIn_ViewPort        prefetch_vp;       // the view shifted ahead of panning
+                  PlugIn_ViewPort        chunk_vp;          // the view widened by a stroke, for chunks
+                  int                    label_band;        // -1 without labels
+                  bool                   complete;          // nothing left loading, may be replayed
+                  unsigned long          vertices_drawn;
+                  unsigned long          vertices_culled;
+                  unsigned long          image_hits;
+                  unsigned long          image_misses;
+            };
+
+            // False until a job published the scene, which it starts
+            bool Load();
+            void StartLoad();
+            void OpenAssets( const kmlengine::KmzFilePtr &kmz_file, size_t kmz_size );
+            void CloseAssets();
+            void PreloadOverlays( const KMLOverlayScene *scene, PlugIn_ViewPort *vp );
+            bool IsInView( PlugIn_ViewPort *vp );
+            bool IsRegionActive( PlugIn_ViewPort *vp, const KMLOverlayScene::Region &region );
+            bool IsLodActive( PlugIn_ViewPort *vp, const KMLOverlayScene::Region &region );
+            void UpdatePrefetch( Frame &frame );
+            void RenderFrame( PlugIn_ViewPort *vp, RenderContext &context, const KMLOverlayScene *scene,
+                              KMLOverlayRenderQueue *queue, int layer );
+            void LayoutLabels( LayerState &state, const KMLOverlayScene *scene, int band );
+            template <class Backend> void RenderPoint( Backend &backend, Frame &frame, const KMLOverlayScene::Part& part,
+                                                       const KMLOverlayScene::Style& style, const char *label );
+            template <class Backend> void RenderPolyline( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                          uint32_t first, uint32_t last, const wxPen &pen );
+            template <class Backend> void RenderLineString( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                            const KMLOverlayScene::Style& style );
+            template <class Backend> void RenderLinearRing( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                            uint32_t holes, const KMLOverlayScene::Style& style );
+            template <class Backend> void RenderTrack( Backend &backend, Frame &frame, size_t idx, const KMLOverlayScene::Part& part,
+                                                       const KMLOverlayScene::Style& style );
+            bool IsInTime( Frame &frame, size_t idx );
+            template <class Backend> void RenderGroundOverlay( Backend &backend, Frame &frame,
+                                                               const KMLOverlayScene::GroundOverlay& groundoverlay );
+            template <class Backend> void RenderLink( Backend &backend, Frame &frame, const KMLOverlayScene::Feature& feature );
+            template <class Backend> size_t RenderFeature( Backend &backend, Frame &frame, size_t idx );
+            double PickFeature( const KMLOverlayScene *scene, PlugIn_ViewPort *vp, const KMLOverlayScene::Feature &feature,
+                                const KMLOverlayScene::Bounds &box, wxPoint pt, int tolerance,
+                                std::vector<wxPoint> *points );
+            void ProjectPart( const KMLOverlayScene *scene, PlugIn_ViewPort *vp, size_t idx, const KMLOverlayScene::Part &part,
+                              std::vector<wxPoint> *points );
             bool       m_ready;
             wxString   m_filename;
             bool       m_visible;
-            kmlengine::KmzFilePtr m_kmz_file;
-            kmlengine::KmlFilePtr m_kml_file;
-            kmldom::FeaturePtr m_root;
-
+            std::string m_source;
+            KMLOverlayAssetCache *m_assets;
+            bool       m_assets_open;
+            bool       m_preload;             // ground overlays of a new scene
+            size_t     m_kmz_size;
+            KMLOverlayScene::Bounds m_bounds;     // still known once unloaded
+            wxString   m_cachefile;
+            wxLongLong m_last_viewed;
+            KMLOverlayScene::Digests m_digests;   // to diff reloads against
+            SceneSlot *m_slot;
+            KMLOverlayWorkerPool *m_pool;
+            wxEvtHandler *m_handler;
+            size_t     m_vertex_count;
+            bool       m_timed;
+            double     m_total_render_ms;
+            LayerStats m_stats;
+            KMLOverlaySuperOverlay *m_tiles;
+            size_t     m_tile_budget;
+            bool       m_time_filter;
+            int64_t    m_time_begin, m_time_end;
+            int64_t    m_extent_begin, m_extent_end;  // still known once unloaded
+            KMLOverlayLabels *m_labels;
+            bool       m_show_labels;
+            unsigned long m_generation;           // bumped when the scene is replaced or unloaded
+            KMLOverlayViewCache *m_views;
+            KMLOverlayScratch *m_scratch;
       };
       WX_DEFINE_ARRAY(Container *, ContainerArray);
 
       ContainerArray m_Objects;
+      KMLOverlayWorkerPool *m_pool;
+      KMLOverlayAssetCache *m_assets;
+      KMLOverlayLabels     *m_labels;
+      KMLOverlayReclaimer  *m_reclaimer;
+      KMLOverlayScratch    *m_scratch;
+      std::vector<RenderContext *> m_contexts;   // by canvas, oldest first
+      wxEvtHandler  *m_handler;
+      KMLOverlayFileWatcher m_watcher;
+      size_t         m_memory_budget;
+      wxLongLong     m_frame_start;
+      bool           m_stats_enabled;
+      bool           m_time_filter;
+      int64_t        m_time_begin, m_time_end;
+      PlugIn_ViewPort m_last_vp;           // picking matches the last frame
+      bool           m_has_vp;
+      bool           m_show_labels;
+      KMLOverlayRenderQueue m_queue;        // of the frame being drawn
+      KMLOverlayQuery m_query;
+      std::vector<uint32_t> m_query_hits;  // kept to spare allocations
 
 };
 
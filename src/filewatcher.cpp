@@ -0,0 +1,206 @@
+/***************************************************************************
+ * $Id: filewatcher.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/filename.h>
+#include <wx/filefn.h>
+#include "filewatcher.h"
+
+#ifdef __linux__
+  #include <sys/inotify.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <errno.h>
+#endif
+
+KMLOverlayFileWatcher::KMLOverlayFileWatcher()
+      : m_interval( -1 ), m_next_poll( 0 ), m_inotify( -1 )
+{
+#ifdef __linux__
+      m_inotify = inotify_init();
+      if ( m_inotify != -1 ) {
+            fcntl( m_inotify, F_SETFL, fcntl( m_inotify, F_GETFL ) | O_NONBLOCK );
+            fcntl( m_inotify, F_SETFD, FD_CLOEXEC );
+      } else {
+            wxLogMessage( _T("KMLOverlayFileWatcher: inotify unavailable, polling only") );
+      }
+#endif
+}
+
+KMLOverlayFileWatcher::~KMLOverlayFileWatcher()
+{
+#ifdef __linux__
+      if ( m_inotify != -1 )
+            close( m_inotify );
+#endif
+}
+
+void KMLOverlayFileWatcher::SetInterval( int minutes )
+{
+      m_interval = minutes;
+      m_next_poll = 0;
+}
+
+bool KMLOverlayFileWatcher::Stat( const wxString &path, time_t *mtime, wxULongLong *size )
+{
+      if ( !wxFileExists( path ) )
+            return false;
+      *mtime = wxFileModificationTime( path );
+      *size = wxFileName( path ).GetSize();
+      return true;
+}
+
+void KMLOverlayFileWatcher::Add( const wxString &path )
+{
+      std::map<wxString, Watch>::iterator it = m_files.find( path );
+      if ( it != m_files.end() ) {
+            it->second.refs++;
+            return;
+      }
+
+      Watch &watch = m_files[path];
+      watch.refs = 1;
+      watch.wd = -1;
+      if ( !Stat( path, &watch.mtime, &watch.size ) ) {
+            watch.mtime = 0;
+            watch.size = 0;
+      }
+      AddWatch( path, &watch );
+}
+
+void KMLOverlayFileWatcher::Remove( const wxString &path )
+{
+      std::map<wxString, Watch>::iterator it = m_files.find( path );
+      if ( it == m_files.end() )
+            return;
+      if ( --it->second.refs == 0 ) {
+            RemoveWatch( &it->second );
+            m_files.erase( it );
+      }
+}
+
+void KMLOverlayFileWatcher::AddWatch( const wxString &path, Watch *watch )
+{
+#ifdef __linux__
+      if ( m_inotify == -1 )
+            return;
+
+      // Watch the directory rather than the file: tools often write a new
+      // file and rename it over the old one, which a file watch would miss.
+      wxString dir = wxFileName( path ).GetPath();
+      int wd = inotify_add_watch( m_inotify, dir.mb_str(), IN_CLOSE_WRITE | IN_MOVED_TO );
+      if ( wd == -1 ) {
+            wxLogMessage( _T("KMLOverlayFileWatcher: can't watch %s, polling only"), dir.c_str() );
+            return;
+      }
+      // inotify returns the same descriptor for a directory watched twice
+      std::map<int, std::pair<wxString, int> >::iterator it = m_dirs.find( wd );
+      if ( it != m_dirs.end() )
+            it->second.second++;
+      else
+            m_dirs[wd] = std::make_pair( dir, 1 );
+      watch->wd = wd;
+#endif
+}
+
+void KMLOverlayFileWatcher::RemoveWatch( Watch *watch )
+{
+#ifdef __linux__
+      std::map<int, std::pair<wxString, int> >::iterator it = m_dirs.find( watch->wd );
+      if ( it == m_dirs.end() )
+            return;
+      if ( --it->second.second == 0 ) {
+            inotify_rm_watch( m_inotify, watch->wd );
+            m_dirs.erase( it );
+      }
+      watch->wd = -1;
+#endif
+}
+
+void KMLOverlayFileWatcher::ReadEvents( wxArrayString *changed )
+{
+#ifdef __linux__
+      if ( m_inotify == -1 )
+            return;
+
+      char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+      for ( ;; ) {
+            ssize_t len = read( m_inotify, buf, sizeof( buf ) );
+            if ( len <= 0 )
+                  break;
+            for ( char *p = buf; p < buf + len; ) {
+                  const struct inotify_event *event = (const struct inotify_event *)p;
+                  p += sizeof( struct inotify_event ) + event->len;
+
+                  std::map<int, std::pair<wxString, int> >::iterator dir = m_dirs.find( event->wd );
+                  if ( dir == m_dirs.end() || !event->len )
+                        continue;
+                  wxString path = dir->second.first + wxFileName::GetPathSeparator()
+                        + wxString( event->name, wxConvFile );
+                  std::map<wxString, Watch>::iterator it = m_files.find( path );
+                  if ( it == m_files.end() )
+                        continue;
+                  // Keep the polling below from reporting it a second time
+                  Stat( path, &it->second.mtime, &it->second.size );
+                  if ( m_interval >= 0 && changed->Index( path ) == wxNOT_FOUND )
+                        changed->Add( path );
+            }
+      }
+#endif
+}
+
+void KMLOverlayFileWatcher::Poll( wxArrayString *changed )
+{
+      // Events are drained even when disabled so the queue can't overflow
+      ReadEvents( changed );
+      if ( m_interval < 0 )
+            return;
+
+      wxLongLong now = wxGetLocalTimeMillis();
+      if ( now < m_next_poll )
+            return;
+      m_next_poll = now + (wxLongLong)m_interval * 60 * 1000;
+
+      for ( std::map<wxString, Watch>::iterator it = m_files.begin(); it != m_files.end(); ++it ) {
+            time_t mtime;
+            wxULongLong size;
+            if ( !Stat( it->first, &mtime, &size ) )
+                  continue;
+            if ( mtime == it->second.mtime && size == it->second.size )
+                  continue;
+            it->second.mtime = mtime;
+            it->second.size = size;
+            if ( changed->Index( it->first ) == wxNOT_FOUND )
+                  changed->Add( it->first );
+      }
+}
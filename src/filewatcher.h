@@ -0,0 +1,84 @@
+/***************************************************************************
+ * $Id: filewatcher.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayFileWatcher_H_
+#define _KMLOverlayFileWatcher_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <map>
+
+/*    Detects changes to the overlay files.
+ *
+ *    On Linux the directory of each file is watched with inotify, so a
+ *    rewritten file is reported on the next Poll. Everywhere, and as a
+ *    fallback for filesystems inotify doesn't see, modification time and
+ *    size are compared every interval minutes.
+ *************************************************************************/
+
+class KMLOverlayFileWatcher
+{
+public:
+      KMLOverlayFileWatcher();
+      ~KMLOverlayFileWatcher();
+
+      // minutes < 0 disables change detection
+      void SetInterval( int minutes );
+      void Add( const wxString &path );
+      void Remove( const wxString &path );
+      // Appends the files changed since the last call
+      void Poll( wxArrayString *changed );
+
+private:
+      struct Watch
+      {
+            time_t    mtime;
+            wxULongLong size;
+            int       refs;
+            int       wd;
+      };
+
+      bool Stat( const wxString &path, time_t *mtime, wxULongLong *size );
+      void AddWatch( const wxString &path, Watch *watch );
+      void RemoveWatch( Watch *watch );
+      void ReadEvents( wxArrayString *changed );
+
+      std::map<wxString, Watch> m_files;
+      int                       m_interval;
+      wxLongLong                m_next_poll;
+
+      // inotify descriptor, and watched directories by watch descriptor
+      int                       m_inotify;
+      std::map<int, std::pair<wxString, int> > m_dirs;
+};
+
+#endif
@@ -0,0 +1,546 @@
+/***************************************************************************
+ * $Id: geojsonloader.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <zlib.h>
+#include "geojsonloader.h"
+#include "jsonreader.h"
+#include "kmlcompiler.h"
+#include "trace.h"
+
+namespace {
+
+enum GeometryType
+{
+      GEOMETRY_UNKNOWN,
+      GEOMETRY_POINT,
+      GEOMETRY_MULTIPOINT,
+      GEOMETRY_LINESTRING,
+      GEOMETRY_MULTILINESTRING,
+      GEOMETRY_POLYGON,
+      GEOMETRY_MULTIPOLYGON
+};
+
+static GeometryType GetGeometryType( const std::string &type )
+{
+      if ( type == "Point" )
+            return GEOMETRY_POINT;
+      if ( type == "MultiPoint" )
+            return GEOMETRY_MULTIPOINT;
+      if ( type == "LineString" )
+            return GEOMETRY_LINESTRING;
+      if ( type == "MultiLineString" )
+            return GEOMETRY_MULTILINESTRING;
+      if ( type == "Polygon" )
+            return GEOMETRY_POLYGON;
+      if ( type == "MultiPolygon" )
+            return GEOMETRY_MULTIPOLYGON;
+      return GEOMETRY_UNKNOWN;
+}
+
+// "#rgb" or "#rrggbb", as simplestyle has them
+static bool ParseHexColour( const std::string &text, double opacity, uint32_t *colour )
+{
+      std::string hex = text.size() && text[0] == '#' ? text.substr( 1 ) : text;
+      if ( hex.size() == 3 )
+            hex = std::string() + hex[0] + hex[0] + hex[1] + hex[1] + hex[2] + hex[2];
+      if ( hex.size() != 6 || hex.find_first_not_of( "0123456789abcdefABCDEF" ) != std::string::npos )
+            return false;
+      unsigned long rgb = strtoul( hex.c_str(), NULL, 16 );
+      if ( opacity < 0 )
+            opacity = 0;
+      if ( opacity > 1 )
+            opacity = 1;
+      *colour = KMLOverlayScene::MakeColour( rgb >> 16 & 0xff, rgb >> 8 & 0xff, rgb & 0xff, (uint8_t)( opacity * 255 + 0.5 ) );
+      return true;
+}
+
+// A feature being read. Kept by nesting depth and reused, its buffers
+// grow to the largest feature and are then no longer allocated.
+struct Feature
+{
+      // Positions are numbered in coords, each closing array deeper than
+      // a position leaves a mark: level 1 ends a line or ring, level 2 a
+      // polygon, as their type says how to read them
+      struct Mark
+      {
+            uint32_t end;
+            uint32_t level;
+      };
+      struct Geometry
+      {
+            GeometryType type;
+            size_t first_coord, end_coord;
+            size_t first_mark, end_mark;
+      };
+
+      std::string id;
+      std::string name, title, description;
+      std::string stroke, fill;
+      double stroke_width, stroke_opacity, fill_opacity;
+      bool timed;
+      int64_t begin, end;
+      std::vector<double> coords;            // lat, lon pairs
+      std::vector<Mark> marks;
+      std::vector<Geometry> geometries;
+
+      void Clear()
+      {
+            id.clear();
+            name.clear();
+            title.clear();
+            description.clear();
+            stroke.clear();
+            fill.clear();
+            stroke_width = -1;
+            stroke_opacity = 1;
+            fill_opacity = 0.6;                // simplestyle's default
+            timed = false;
+            begin = KMLOverlayScene::TimeMin;
+            end = KMLOverlayScene::TimeMax;
+            coords.clear();
+            marks.clear();
+            geometries.clear();
+      }
+};
+
+class GeoJsonParser
+{
+public:
+      GeoJsonParser( KMLOverlayJsonReader &reader, KMLOverlayScene *scene )
+            : m_reader( reader ), m_scene( scene ), m_features( KMLOverlayJsonReader::MaxDepth+2 ),
+              m_count( 0 ), m_last_style( 0 ), m_has_style( false )
+      {
+            m_default_style = KMLOverlayCompiler::GetDefaultStyle();
+      }
+
+      bool Parse();
+
+private:
+      bool ParseObject( size_t slot, int depth );
+      bool ParseProperties( Feature &f, int depth );
+      int  ParseCoordinates( Feature &f, int depth );
+      void Emit( Feature &f );
+      void EmitGeometry( const Feature &f, const Feature::Geometry &g );
+      void EmitPart( const Feature &f, KMLOverlayScene::PartType type, size_t first, size_t end );
+      uint32_t GetStyle( const Feature &f );
+
+      KMLOverlayJsonReader           &m_reader;
+      KMLOverlayScene      *m_scene;
+      std::vector<Feature>  m_features;      // by depth
+      uint64_t              m_root_key;
+      size_t                m_count;         // placemarks so far
+      KMLOverlayScene::Style m_default_style;
+      KMLOverlayScene::Style m_style;        // last one added, most features share it
+      uint32_t              m_last_style;
+      bool                  m_has_style;
+      std::string           m_key;
+      std::string           m_text;
+};
+
+bool GeoJsonParser::Parse()
+{
+      // A byte order mark is tolerated
+      if ( m_reader.Peek() == 0xef ) {
+            m_reader.Get();
+            if ( m_reader.Get() != 0xbb || m_reader.Get() != 0xbf )
+                  return m_reader.Fail( "bad byte order mark" );
+      }
+
+      m_root_key = KMLOverlayCompiler::MakeFeatureKey( 0, 0, KMLOverlayScene::FEATURE_CONTAINER );
+      size_t root = m_scene->BeginFeature( KMLOverlayScene::FEATURE_CONTAINER, 0, m_root_key );
+      if ( m_reader.PeekToken() != '{' )
+            return m_reader.Fail( "expected a GeoJSON object" );
+      m_features[0].Clear();
+      if ( !ParseObject( 0, 0 ) )
+            return false;
+      // A single Feature, or a bare geometry
+      Emit( m_features[0] );
+      m_scene->EndFeature( root );
+      if ( m_reader.PeekToken() != -1 )
+            return m_reader.Fail( "trailing content" );
+      return true;
+}
+
+// Geometries are read into the feature in slot, nested features into the
+// next slot
+bool GeoJsonParser::ParseObject( size_t slot, int depth )
+{
+      if ( depth > KMLOverlayJsonReader::MaxDepth )
+            return m_reader.Fail( "too deeply nested" );
+      Feature &f = m_features[slot];
+      GeometryType type = GEOMETRY_UNKNOWN;
+      Feature::Geometry own;
+      bool has_coordinates = false;
+
+      if ( !m_reader.Expect( '{' ) )
+            return false;
+      if ( m_reader.PeekToken() == '}' ) {
+            m_reader.GetToken();
+            return true;
+      }
+      for ( ;; ) {
+            if ( !m_reader.ReadString( &m_key ) || !m_reader.Expect( ':' ) )
+                  return false;
+            int c = m_reader.PeekToken();
+            if ( m_key == "type" && c == '"' ) {
+                  if ( !m_reader.ReadString( &m_text ) )
+                        return false;
+                  type = GetGeometryType( m_text );
+            } else if ( m_key == "coordinates" && c == '[' ) {
+                  own.first_coord = f.coords.size() / 2;
+                  own.first_mark = f.marks.size();
+                  if ( ParseCoordinates( f, depth+1 ) < 0 )
+                        return false;
+                  own.end_coord = f.coords.size() / 2;
+                  own.end_mark = f.marks.size();
+                  has_coordinates = true;
+            } else if ( m_key == "geometry" && c == '{' ) {
+                  // Shares the feature's buffers
+                  if ( !ParseObject( slot, depth+1 ) )
+                        return false;
+            } else if ( m_key == "geometries" && c == '[' ) {
+                  m_reader.GetToken();
+                  if ( m_reader.PeekToken() == ']' ) {
+                        m_reader.GetToken();
+                  } else {
+                        for ( ;; ) {
+                              if ( m_reader.PeekToken() == '{' ) {
+                                    if ( !ParseObject( slot, depth+1 ) )
+                                          return false;
+                              } else if ( !m_reader.SkipValue( depth+1 ) ) {
+                                    return false;
+                              }
+                              int next = m_reader.GetToken();
+                              if ( next == ']' )
+                                    break;
+                              if ( next != ',' )
+                                    return m_reader.Fail( "expected ',' or ']'" );
+                        }
+                  }
+            } else if ( m_key == "features" && c == '[' ) {
+                  // Each feature is compiled once read, then forgotten
+                  m_reader.GetToken();
+                  if ( m_reader.PeekToken() == ']' ) {
+                        m_reader.GetToken();
+                  } else {
+                        for ( ;; ) {
+                              if ( m_reader.PeekToken() == '{' ) {
+                                    if ( depth+1 > KMLOverlayJsonReader::MaxDepth )
+                                          return m_reader.Fail( "too deeply nested" );
+                                    m_features[slot+1].Clear();
+                                    if ( !ParseObject( slot+1, depth+1 ) )
+                                          return false;
+                                    Emit( m_features[slot+1] );
+                              } else if ( !m_reader.SkipValue( depth+1 ) ) {
+                                    return false;
+                              }
+                              int next = m_reader.GetToken();
+                              if ( next == ']' )
+                                    break;
+                              if ( next != ',' )
+                                    return m_reader.Fail( "expected ',' or ']'" );
+                        }
+                  }
+            } else if ( m_key == "properties" && c == '{' ) {
+                  if ( !ParseProperties( f, depth+1 ) )
+                        return false;
+            } else if ( m_key == "id" && ( c == '"' || c == '-' || ( c >= '0' && c <= '9' ) ) ) {
+                  if ( c == '"' ) {
+                        if ( !m_reader.ReadString( &f.id ) )
+                              return false;
+                  } else {
+                        double v;
+                        if ( !m_reader.ReadNumber( &v ) )
+                              return false;
+                        char text[32];
+                        snprintf( text, sizeof( text ), "%.17g", v );
+                        f.id = text;
+                  }
+            } else if ( !m_reader.SkipValue( depth+1 ) ) {
+                  return false;
+            }
+
+            int next = m_reader.GetToken();
+            if ( next == '}' )
+                  break;
+            if ( next != ',' )
+                  return m_reader.Fail( "expected ',' or '}'" );
+      }
+
+      // "type" may come after "coordinates"
+      if ( has_coordinates && type != GEOMETRY_UNKNOWN ) {
+            own.type = type;
+            f.geometries.push_back( own );
+      }
+      return true;
+}
+
+bool GeoJsonParser::ParseProperties( Feature &f, int depth )
+{
+      if ( !m_reader.Expect( '{' ) )
+            return false;
+      if ( m_reader.PeekToken() == '}' ) {
+            m_reader.GetToken();
+            return true;
+      }
+      for ( ;; ) {
+            if ( !m_reader.ReadString( &m_key ) || !m_reader.Expect( ':' ) )
+                  return false;
+            int c = m_reader.PeekToken();
+            bool ok = true;
+            if ( c == '"' ) {
+                  std::string *target = NULL;
+                  if ( m_key == "name" )
+                        target = &f.name;
+                  else if ( m_key == "title" )
+                        target = &f.title;
+                  else if ( m_key == "description" )
+                        target = &f.description;
+                  else if ( m_key == "stroke" )
+                        target = &f.stroke;
+                  else if ( m_key == "fill" )
+                        target = &f.fill;
+                  if ( target ) {
+                        ok = m_reader.ReadString( target );
+                  } else {
+                        ok = m_reader.ReadString( &m_text );
+                        int64_t when;
+                        if ( ok && ( m_key == "time" || m_key == "timestamp" || m_key == "when" ) &&
+                             KMLOverlayCompiler::ParseTime( m_text, &when ) ) {
+                              f.begin = f.end = when;
+                              f.timed = true;
+                        } else if ( ok && m_key == "begin" && KMLOverlayCompiler::ParseTime( m_text, &when ) ) {
+                              // Either end may be left open
+                              f.begin = when;
+                              f.timed = true;
+                        } else if ( ok && m_key == "end" && KMLOverlayCompiler::ParseTime( m_text, &when ) ) {
+                              f.end = when;
+                              f.timed = true;
+                        }
+                  }
+            } else if ( c == '-' || ( c >= '0' && c <= '9' ) ) {
+                  double v;
+                  ok = m_reader.ReadNumber( &v );
+                  if ( m_key == "stroke-width" )
+                        f.stroke_width = v;
+                  else if ( m_key == "stroke-opacity" )
+                        f.stroke_opacity = v;
+                  else if ( m_key == "fill-opacity" )
+                        f.fill_opacity = v;
+            } else {
+                  ok = m_reader.SkipValue( depth+1 );
+            }
+            if ( !ok )
+                  return false;
+
+            int next = m_reader.GetToken();
+            if ( next == '}' )
+                  return true;
+            if ( next != ',' )
+                  return m_reader.Fail( "expected ',' or '}'" );
+      }
+}
+
+// Returns the nesting level of the array read, 0 for a position, or -1
+// on error
+int GeoJsonParser::ParseCoordinates( Feature &f, int depth )
+{
+      if ( depth > KMLOverlayJsonReader::MaxDepth ) {
+            m_reader.Fail( "too deeply nested" );
+            return -1;
+      }
+      if ( !m_reader.Expect( '[' ) )
+            return -1;
+      int c = m_reader.PeekToken();
+      if ( c == ']' ) {
+            // Empty, taken as a line to be skipped
+            m_reader.GetToken();
+            Feature::Mark mark = { (uint32_t)( f.coords.size() / 2 ), 1 };
+            f.marks.push_back( mark );
+            return 1;
+      }
+      if ( c == '-' || ( c >= '0' && c <= '9' ) ) {
+            // [lon, lat] then altitude or measures, ignored
+            double lon, lat;
+            if ( !m_reader.ReadNumber( &lon ) || !m_reader.Expect( ',' ) || !m_reader.ReadNumber( &lat ) )
+                  return -1;
+            for ( ;; ) {
+                  int next = m_reader.GetToken();
+                  if ( next == ']' )
+                        break;
+                  double v;
+                  if ( next != ',' || !m_reader.ReadNumber( &v ) ) {
+                        m_reader.Fail( "bad position" );
+                        return -1;
+                  }
+            }
+            f.coords.push_back( lat );
+            f.coords.push_back( lon );
+            return 0;
+      }
+      int level = 1;
+      for ( ;; ) {
+            int child = ParseCoordinates( f, depth+1 );
+            if ( child < 0 )
+                  return -1;
+            level = std::max( level, child+1 );
+            int next = m_reader.GetToken();
+            if ( next == ']' )
+                  break;
+            if ( next != ',' ) {
+                  m_reader.Fail( "expected ',' or ']'" );
+                  return -1;
+            }
+      }
+      Feature::Mark mark = { (uint32_t)( f.coords.size() / 2 ), (uint32_t)level };
+      f.marks.push_back( mark );
+      return level;
+}
+
+uint32_t GeoJsonParser::GetStyle( const Feature &f )
+{
+      KMLOverlayScene::Style s = m_default_style;
+      uint32_t colour;
+      if ( !f.stroke.empty() && ParseHexColour( f.stroke, f.stroke_opacity, &colour ) ) {
+            s.line_colour = colour;
+            s.ring_colour = colour;
+            if ( !( colour & 0xff ) )
+                  s.ring_stroke = false;
+      }
+      if ( f.stroke_width >= 0 ) {
+            s.line_width = f.stroke_width;
+            s.ring_width = f.stroke_width;
+      }
+      if ( !f.fill.empty() && ParseHexColour( f.fill, f.fill_opacity, &colour ) && ( colour & 0xff ) ) {
+            s.fill_colour = colour;
+            s.ring_fill = true;
+      }
+      if ( m_has_style && !( s < m_style ) && !( m_style < s ) )
+            return m_last_style;
+      m_style = s;
+      m_last_style = m_scene->AddStyle( s );
+      m_has_style = true;
+      return m_last_style;
+}
+
+void GeoJsonParser::EmitPart( const Feature &f, KMLOverlayScene::PartType type, size_t first, size_t end )
+{
+      if ( end - first < ( type == KMLOverlayScene::PART_POINT ? 1 : 2 ) )
+            return;
+      m_scene->BeginPart( type );
+      for ( size_t i = first; i < end; i++ )
+            m_scene->AddCoord( f.coords[2*i], f.coords[2*i+1] );
+      m_scene->EndPart();
+}
+
+void GeoJsonParser::EmitGeometry( const Feature &f, const Feature::Geometry &g )
+{
+      switch ( g.type ) {
+      case GEOMETRY_POINT:
+      case GEOMETRY_MULTIPOINT:
+            for ( size_t i = g.first_coord; i < g.end_coord; i++ )
+                  EmitPart( f, KMLOverlayScene::PART_POINT, i, i+1 );
+            break;
+      case GEOMETRY_LINESTRING:
+      case GEOMETRY_MULTILINESTRING:
+      case GEOMETRY_POLYGON:
+      case GEOMETRY_MULTIPOLYGON:
+      {
+            // Lines end at level 1 marks, the first ring of a polygon is
+            // its outer one
+            bool polygon = g.type == GEOMETRY_POLYGON || g.type == GEOMETRY_MULTIPOLYGON;
+            size_t start = g.first_coord;
+            bool outer = true;
+            for ( size_t i = g.first_mark; i < g.end_mark; i++ ) {
+                  const Feature::Mark &mark = f.marks[i];
+                  if ( mark.level == 1 ) {
+                        if ( !polygon )
+                              EmitPart( f, KMLOverlayScene::PART_LINESTRING, start, mark.end );
+                        else
+                              EmitPart( f, outer ? KMLOverlayScene::PART_LINEARRING : KMLOverlayScene::PART_INNERRING,
+                                        start, mark.end );
+                        outer = false;
+                  } else if ( mark.level == 2 ) {
+                        outer = true;
+                  }
+                  start = mark.end;
+            }
+      }
+      break;
+      default:
+            break;
+      }
+}
+
+void GeoJsonParser::Emit( Feature &f )
+{
+      if ( f.geometries.empty() )
+            return;
+      uint64_t key = f.id.empty() ? KMLOverlayCompiler::MakeFeatureKey( m_root_key, m_count, KMLOverlayScene::FEATURE_PLACEMARK )
+                                  : KMLOverlayCompiler::MakeFeatureKey( f.id, KMLOverlayScene::FEATURE_PLACEMARK );
+      m_count++;
+      size_t idx = m_scene->BeginFeature( KMLOverlayScene::FEATURE_PLACEMARK, GetStyle( f ), key );
+      for ( size_t i = 0; i < f.geometries.size(); i++ )
+            EmitGeometry( f, f.geometries[i] );
+      m_scene->EndFeature( idx );
+      if ( f.timed )
+            m_scene->SetFeatureTime( idx, f.begin, f.end );
+      m_scene->SetFeatureText( idx, f.name.empty() ? f.title : f.name, f.description );
+      f.geometries.clear();
+}
+
+} // namespace
+
+bool KMLOverlayGeoJsonLoader::LoadFile( const std::string &path, KMLOverlayScene *scene, std::string *error )
+{
+      KMLOverlayTrace::Scope trace( "geojson parse", path.c_str() );
+      // gzread passes files without a gzip header through as they are
+      gzFile gz = gzopen( path.c_str(), "rb" );
+      if ( !gz ) {
+            *error = "Failed to read file content";
+            return false;
+      }
+      gzbuffer( gz, BufferSize );
+
+      KMLOverlayJsonReader reader( gz, BufferSize );
+      GeoJsonParser parser( reader, scene );
+      bool ok = parser.Parse();
+      gzclose( gz );
+      if ( !ok ) {
+            *error = "GeoJSON: " + reader.GetError();
+            return false;
+      }
+      scene->Shrink();
+      return true;
+}
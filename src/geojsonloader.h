@@ -0,0 +1,56 @@
+/***************************************************************************
+ * $Id: geojsonloader.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayGeoJsonLoader_H_
+#define _KMLOverlayGeoJsonLoader_H_
+
+#include <string>
+#include "scene.h"
+
+/*    Loads GeoJSON (RFC 7946) straight into a KMLOverlayScene.
+ *
+ *    The file is read and inflated a buffer at a time by a pull parser,
+ *    each feature being compiled as soon as its object closes: what is
+ *    held besides the scene is one buffer and the coordinates of one
+ *    feature. Features become placemarks under a single container, drawn
+ *    with the default style unless their properties carry simplestyle
+ *    keys (stroke, stroke-width, stroke-opacity, fill, fill-opacity).
+ *    name or title and description are shown when picked, time or
+ *    begin and end make a feature timed.
+ *************************************************************************/
+
+class KMLOverlayGeoJsonLoader
+{
+public:
+      static const size_t BufferSize = 64 * 1024;
+
+      // .geojson or .json, gzip compressed or not
+      static bool LoadFile( const std::string &path, KMLOverlayScene *scene, std::string *error );
+};
+
+#endif
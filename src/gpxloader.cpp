@@ -0,0 +1,327 @@
+/***************************************************************************
+ * $Id: gpxloader.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <zlib.h>
+#include <kml/base/expat_handler.h>
+#include <kml/base/expat_parser.h>
+#include "gpxloader.h"
+#include "kmlcompiler.h"
+#include "trace.h"
+
+namespace {
+
+// xsd:decimal, whatever the locale
+static double ParseDegrees( const std::string &text )
+{
+      const char *p = text.c_str();
+      while ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' )
+            p++;
+      bool negative = *p == '-';
+      if ( *p == '-' || *p == '+' )
+            p++;
+      double value = 0;
+      for ( ; *p >= '0' && *p <= '9'; p++ )
+            value = value * 10 + ( *p - '0' );
+      if ( *p == '.' ) {
+            double scale = 1;
+            for ( p++; *p >= '0' && *p <= '9'; p++ ) {
+                  value = value * 10 + ( *p - '0' );
+                  scale *= 10;
+            }
+            value /= scale;
+      }
+      return negative ? -value : value;
+}
+
+// Expat callbacks, compiling each waypoint, route and track as it closes
+class GpxHandler : public kmlbase::ExpatHandler
+{
+public:
+      GpxHandler( KMLOverlayScene *scene )
+            : m_scene( scene ), m_root( false ), m_root_idx( 0 ), m_count( 0 ), m_feature( NONE ),
+              m_idx( 0 ), m_in_point( false ), m_point_timed( false ), m_capture( NULL ), m_all_timed( false ),
+              m_begin( 0 ), m_end( 0 ), m_timed( false )
+      {
+            m_style = m_scene->AddStyle( KMLOverlayCompiler::GetDefaultStyle() );
+      }
+
+      virtual void StartElement( const std::string &name, const kmlbase::StringVector &atts );
+      virtual void EndElement( const std::string &name );
+      virtual void CharData( const std::string &data )
+      {
+            if ( m_capture )
+                  m_capture->append( data );
+      }
+      virtual void StartNamespace( const std::string &prefix, const std::string &uri ) {}
+      virtual void EndNamespace( const std::string &prefix ) {}
+
+      // Closes the root container, false if there was none
+      bool Finish()
+      {
+            if ( !m_root )
+                  return false;
+            m_scene->EndFeature( m_root_idx );
+            return true;
+      }
+
+private:
+      enum FeatureKind
+      {
+            NONE,
+            WAYPOINT,
+            ROUTE,
+            TRACK
+      };
+
+      struct Sample
+      {
+            int64_t when;
+            double  lat, lon;
+      };
+
+      static const char *LocalName( const std::string &name )
+      {
+            size_t sep = name.find( ':' );
+            return name.c_str() + ( sep == std::string::npos ? 0 : sep+1 );
+      }
+      static bool SampleLess( const Sample &a, const Sample &b ) { return a.when < b.when; }
+      static bool GetLatLon( const kmlbase::StringVector &atts, double *lat, double *lon );
+      void BeginPlacemark( FeatureKind kind );
+      void EndPlacemark();
+      void EndSegment();
+
+      KMLOverlayScene   *m_scene;
+      uint32_t           m_style;
+      bool               m_root;
+      size_t             m_root_idx;
+      uint64_t           m_root_key;
+      size_t             m_count;        // placemarks so far
+      FeatureKind        m_feature;      // open one
+      size_t             m_idx;
+      bool               m_in_point;     // trkpt or rtept
+      bool               m_point_timed;
+      std::string       *m_capture;      // element text being kept
+      std::string        m_name, m_description, m_time;
+      std::vector<Sample> m_samples;     // of the open segment or route
+      bool               m_all_timed;
+      int64_t            m_begin, m_end; // of the open track
+      bool               m_timed;
+};
+
+bool GpxHandler::GetLatLon( const kmlbase::StringVector &atts, double *lat, double *lon )
+{
+      // Name and value pairs. Both are decimal degrees in any locale.
+      int found = 0;
+      for ( size_t i = 0; i+1 < atts.size(); i += 2 ) {
+            const char *name = LocalName( atts[i] );
+            if ( !strcmp( name, "lat" ) ) {
+                  *lat = ParseDegrees( atts[i+1] );
+                  found |= 1;
+            } else if ( !strcmp( name, "lon" ) ) {
+                  *lon = ParseDegrees( atts[i+1] );
+                  found |= 2;
+            }
+      }
+      return found == 3;
+}
+
+void GpxHandler::BeginPlacemark( FeatureKind kind )
+{
+      m_feature = kind;
+      m_name.clear();
+      m_description.clear();
+      m_timed = false;
+      m_begin = KMLOverlayScene::TimeMax;
+      m_end = KMLOverlayScene::TimeMin;
+      m_idx = m_scene->BeginFeature( KMLOverlayScene::FEATURE_PLACEMARK, m_style,
+                                     KMLOverlayCompiler::MakeFeatureKey( m_root_key, m_count++, KMLOverlayScene::FEATURE_PLACEMARK ) );
+}
+
+void GpxHandler::EndPlacemark()
+{
+      m_scene->EndFeature( m_idx );
+      if ( m_timed )
+            m_scene->SetFeatureTime( m_idx, m_begin, m_end );
+      m_scene->SetFeatureText( m_idx, m_name, m_description );
+      m_feature = NONE;
+}
+
+void GpxHandler::EndSegment()
+{
+      if ( m_samples.size() < 2 ) {
+            m_samples.clear();
+            return;
+      }
+      if ( m_feature == TRACK && m_all_timed ) {
+            // As a gx:Track, the placemark then lasts as long as its samples
+            std::stable_sort( m_samples.begin(), m_samples.end(), SampleLess );
+            m_scene->BeginPart( KMLOverlayScene::PART_TRACK );
+            for ( size_t i = 0; i < m_samples.size(); i++ )
+                  m_scene->AddTrackSample( m_samples[i].when, m_samples[i].lat, m_samples[i].lon );
+            m_begin = std::min( m_begin, m_samples.front().when );
+            m_end = std::max( m_end, m_samples.back().when );
+            m_timed = true;
+      } else {
+            m_scene->BeginPart( KMLOverlayScene::PART_LINESTRING );
+            for ( size_t i = 0; i < m_samples.size(); i++ )
+                  m_scene->AddCoord( m_samples[i].lat, m_samples[i].lon );
+      }
+      m_scene->EndPart();
+      m_samples.clear();
+}
+
+void GpxHandler::StartElement( const std::string &qname, const kmlbase::StringVector &atts )
+{
+      const char *name = LocalName( qname );
+      m_capture = NULL;
+      if ( !m_root ) {
+            if ( strcmp( name, "gpx" ) )
+                  return;
+            m_root = true;
+            m_root_key = KMLOverlayCompiler::MakeFeatureKey( 0, 0, KMLOverlayScene::FEATURE_CONTAINER );
+            m_root_idx = m_scene->BeginFeature( KMLOverlayScene::FEATURE_CONTAINER, 0, m_root_key );
+            return;
+      }
+
+      double lat, lon;
+      if ( m_feature == NONE ) {
+            if ( !strcmp( name, "wpt" ) ) {
+                  if ( !GetLatLon( atts, &lat, &lon ) )
+                        return;
+                  BeginPlacemark( WAYPOINT );
+                  m_scene->BeginPart( KMLOverlayScene::PART_POINT );
+                  m_scene->AddCoord( lat, lon );
+                  m_scene->EndPart();
+            } else if ( !strcmp( name, "rte" ) ) {
+                  BeginPlacemark( ROUTE );
+                  m_all_timed = false;
+            } else if ( !strcmp( name, "trk" ) ) {
+                  BeginPlacemark( TRACK );
+            }
+            return;
+      }
+
+      if ( !strcmp( name, "trkseg" ) ) {
+            m_samples.clear();
+            m_all_timed = true;
+      } else if ( !strcmp( name, "trkpt" ) || !strcmp( name, "rtept" ) ) {
+            if ( GetLatLon( atts, &lat, &lon ) ) {
+                  Sample sample = { 0, lat, lon };
+                  m_samples.push_back( sample );
+                  m_in_point = true;
+                  m_point_timed = false;
+            }
+      } else if ( !strcmp( name, "time" ) ) {
+            m_time.clear();
+            m_capture = &m_time;
+      } else if ( !m_in_point && !strcmp( name, "name" ) ) {
+            m_name.clear();
+            m_capture = &m_name;
+      } else if ( !m_in_point && !strcmp( name, "desc" ) ) {
+            m_description.clear();
+            m_capture = &m_description;
+      }
+}
+
+void GpxHandler::EndElement( const std::string &qname )
+{
+      const char *name = LocalName( qname );
+      m_capture = NULL;
+      if ( m_feature == NONE )
+            return;
+
+      if ( !strcmp( name, "time" ) ) {
+            int64_t when;
+            bool valid = KMLOverlayCompiler::ParseTime( m_time, &when );
+            if ( m_in_point ) {
+                  if ( valid )
+                        m_samples.back().when = when;
+                  m_point_timed = valid;
+            } else if ( m_feature == WAYPOINT && valid ) {
+                  m_begin = m_end = when;
+                  m_timed = true;
+            }
+      } else if ( !strcmp( name, "trkpt" ) || !strcmp( name, "rtept" ) ) {
+            if ( m_in_point && !m_point_timed )
+                  m_all_timed = false;
+            m_in_point = false;
+      } else if ( !strcmp( name, "trkseg" ) ) {
+            EndSegment();
+      } else if ( ( m_feature == WAYPOINT && !strcmp( name, "wpt" ) ) ||
+                  ( m_feature == ROUTE && !strcmp( name, "rte" ) ) ||
+                  ( m_feature == TRACK && !strcmp( name, "trk" ) ) ) {
+            if ( m_feature == ROUTE )
+                  EndSegment();
+            EndPlacemark();
+      }
+}
+
+} // namespace
+
+bool KMLOverlayGpxLoader::LoadFile( const std::string &path, KMLOverlayScene *scene, std::string *error )
+{
+      KMLOverlayTrace::Scope trace( "gpx parse", path.c_str() );
+      // gzread passes files without a gzip header through as they are
+      gzFile gz = gzopen( path.c_str(), "rb" );
+      if ( !gz ) {
+            *error = "Failed to read file content";
+            return false;
+      }
+      gzbuffer( gz, BufferSize );
+
+      GpxHandler handler( scene );
+      kmlbase::ExpatParser parser( &handler, false );
+      for ( ;; ) {
+            char *buffer = static_cast<char *>( parser.GetInternalBuffer( BufferSize ) );
+            int len = buffer ? gzread( gz, buffer, BufferSize ) : -1;
+            if ( len < 0 ) {
+                  int errnum;
+                  *error = buffer ? gzerror( gz, &errnum ) : "Out of memory";
+                  gzclose( gz );
+                  return false;
+            }
+            if ( !parser.ParseInternalBuffer( len, error, len == 0 ) ) {
+                  gzclose( gz );
+                  return false;
+            }
+            if ( len == 0 )
+                  break;
+      }
+      gzclose( gz );
+      if ( !handler.Finish() ) {
+            *error = "No GPX root element";
+            return false;
+      }
+      scene->Shrink();
+      return true;
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+ * $Id: gpxloader.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayGpxLoader_H_
+#define _KMLOverlayGpxLoader_H_
+
+#include <string>
+#include "scene.h"
+
+/*    Loads GPX 1.0 and 1.1 straight into a KMLOverlayScene.
+ *
+ *    The file is read, inflated and parsed by expat a buffer at a time,
+ *    no DOM is built. Waypoints become point placemarks, routes line
+ *    strings, and each track one placemark with a part per segment: a
+ *    time track when every point of the segment has a time, as a
+ *    gx:Track would be, a line string otherwise. All are drawn with the
+ *    default style under a single container.
+ *************************************************************************/
+
+class KMLOverlayGpxLoader
+{
+public:
+      static const size_t BufferSize = 64 * 1024;
+
+      // GPX file, gzip compressed or not
+      static bool LoadFile( const std::string &path, KMLOverlayScene *scene, std::string *error );
+};
+
+#endif
@@ -0,0 +1,433 @@
+/***************************************************************************
+ * $Id: imageops.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "imageops.h"
+
+// Never more than the compiler was told the target has, the plugin ships
+// for the host's baseline: SSE2 on x86-64, NEON on arm64.
+#if defined(__AVX2__)
+  #define KMLOVERLAY_AVX2
+  #define KMLOVERLAY_SSSE3
+  #define KMLOVERLAY_SSE2
+#elif defined(__SSSE3__)
+  #define KMLOVERLAY_SSSE3
+  #define KMLOVERLAY_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+  #define KMLOVERLAY_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #define KMLOVERLAY_NEON
+#endif
+
+#if defined(KMLOVERLAY_AVX2)
+  #include <immintrin.h>
+#elif defined(KMLOVERLAY_SSSE3)
+  #include <tmmintrin.h>
+#elif defined(KMLOVERLAY_SSE2)
+  #include <emmintrin.h>
+#elif defined(KMLOVERLAY_NEON)
+  #include <arm_neon.h>
+#endif
+
+static inline unsigned char MulDiv255( unsigned a, unsigned b )
+{
+      unsigned t = a * b + 128;
+      return (unsigned char)( ( t + ( t >> 8 ) ) >> 8 );
+}
+
+// Rounded up, as pavgb and vrhadd do
+static inline unsigned char Average( unsigned a, unsigned b )
+{
+      return (unsigned char)( ( a + b + 1 ) >> 1 );
+}
+
+void KMLOverlayImageOps::ToRGBA( const unsigned char *rgb, const unsigned char *alpha, const unsigned char mask[3],
+                                 unsigned char *rgba, size_t count )
+{
+      size_t i = 0;
+#if defined(KMLOVERLAY_AVX2)
+      // Two groups of four pixels, one per lane. The second load reads
+      // 16 bytes from pixel i+4, hence the margin.
+      const __m256i spread = _mm256_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                               0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+      if ( alpha ) {
+            for ( ; i + 10 <= count; i += 8 ) {
+                  __m256i px = _mm256_inserti128_si256( _mm256_castsi128_si256(
+                                     _mm_loadu_si128( (const __m128i *)( rgb + 3*i ) ) ),
+                                     _mm_loadu_si128( (const __m128i *)( rgb + 3*i + 12 ) ), 1 );
+                  px = _mm256_shuffle_epi8( px, spread );
+                  __m256i a = _mm256_slli_epi32( _mm256_cvtepu8_epi32(
+                                     _mm_loadl_epi64( (const __m128i *)( alpha + i ) ) ), 24 );
+                  _mm256_storeu_si256( (__m256i *)( rgba + 4*i ), _mm256_or_si256( px, a ) );
+            }
+      } else {
+            const __m256i key = _mm256_set1_epi32( mask[0] | mask[1] << 8 | mask[2] << 16 );
+            const __m256i opaque = _mm256_set1_epi32( (int)0xFF000000 );
+            for ( ; i + 10 <= count; i += 8 ) {
+                  __m256i px = _mm256_inserti128_si256( _mm256_castsi128_si256(
+                                     _mm_loadu_si128( (const __m128i *)( rgb + 3*i ) ) ),
+                                     _mm_loadu_si128( (const __m128i *)( rgb + 3*i + 12 ) ), 1 );
+                  px = _mm256_shuffle_epi8( px, spread );
+                  __m256i a = _mm256_andnot_si256( _mm256_cmpeq_epi32( px, key ), opaque );
+                  _mm256_storeu_si256( (__m256i *)( rgba + 4*i ), _mm256_or_si256( px, a ) );
+            }
+      }
+#elif defined(KMLOVERLAY_SSSE3)
+      const __m128i spread = _mm_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+      if ( alpha ) {
+            const __m128i place = _mm_setr_epi8( -1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3 );
+            for ( ; i + 6 <= count; i += 4 ) {
+                  __m128i px = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( rgb + 3*i ) ), spread );
+                  int a4;
+                  memcpy( &a4, alpha + i, 4 );
+                  __m128i a = _mm_shuffle_epi8( _mm_cvtsi32_si128( a4 ), place );
+                  _mm_storeu_si128( (__m128i *)( rgba + 4*i ), _mm_or_si128( px, a ) );
+            }
+      } else {
+            const __m128i key = _mm_set1_epi32( mask[0] | mask[1] << 8 | mask[2] << 16 );
+            const __m128i opaque = _mm_set1_epi32( (int)0xFF000000 );
+            for ( ; i + 6 <= count; i += 4 ) {
+                  __m128i px = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)( rgb + 3*i ) ), spread );
+                  __m128i a = _mm_andnot_si128( _mm_cmpeq_epi32( px, key ), opaque );
+                  _mm_storeu_si128( (__m128i *)( rgba + 4*i ), _mm_or_si128( px, a ) );
+            }
+      }
+#elif defined(KMLOVERLAY_SSE2)
+      // No byte shuffle: each pixel is a 4 byte load, the fourth byte
+      // belongs to the next pixel and is masked off.
+      const __m128i low = _mm_set1_epi32( 0x00FFFFFF );
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i key = _mm_set1_epi32( mask ? ( mask[0] | mask[1] << 8 | mask[2] << 16 ) : 0 );
+      const __m128i opaque = _mm_set1_epi32( (int)0xFF000000 );
+      for ( ; i + 5 <= count; i += 4 ) {
+            int p[4];
+            memcpy( p, rgb + 3*i, 4 );
+            memcpy( p + 1, rgb + 3*i + 3, 4 );
+            memcpy( p + 2, rgb + 3*i + 6, 4 );
+            memcpy( p + 3, rgb + 3*i + 9, 4 );
+            __m128i px = _mm_and_si128( _mm_loadu_si128( (const __m128i *)p ), low );
+            __m128i a;
+            if ( alpha ) {
+                  int a4;
+                  memcpy( &a4, alpha + i, 4 );
+                  a = _mm_unpacklo_epi8( _mm_cvtsi32_si128( a4 ), zero );
+                  a = _mm_slli_epi32( _mm_unpacklo_epi16( a, zero ), 24 );
+            } else {
+                  a = _mm_andnot_si128( _mm_cmpeq_epi32( px, key ), opaque );
+            }
+            _mm_storeu_si128( (__m128i *)( rgba + 4*i ), _mm_or_si128( px, a ) );
+      }
+#elif defined(KMLOVERLAY_NEON)
+      if ( alpha ) {
+            for ( ; i + 16 <= count; i += 16 ) {
+                  uint8x16x3_t px = vld3q_u8( rgb + 3*i );
+                  uint8x16x4_t out;
+                  out.val[0] = px.val[0];
+                  out.val[1] = px.val[1];
+                  out.val[2] = px.val[2];
+                  out.val[3] = vld1q_u8( alpha + i );
+                  vst4q_u8( rgba + 4*i, out );
+            }
+      } else {
+            const uint8x16_t mr = vdupq_n_u8( mask[0] ), mg = vdupq_n_u8( mask[1] ), mb = vdupq_n_u8( mask[2] );
+            for ( ; i + 16 <= count; i += 16 ) {
+                  uint8x16x3_t px = vld3q_u8( rgb + 3*i );
+                  uint8x16x4_t out;
+                  out.val[0] = px.val[0];
+                  out.val[1] = px.val[1];
+                  out.val[2] = px.val[2];
+                  out.val[3] = vmvnq_u8( vandq_u8( vandq_u8( vceqq_u8( px.val[0], mr ), vceqq_u8( px.val[1], mg ) ),
+                                                   vceqq_u8( px.val[2], mb ) ) );
+                  vst4q_u8( rgba + 4*i, out );
+            }
+      }
+#endif
+      for ( ; i < count; i++ ) {
+            unsigned char r = rgb[3*i], g = rgb[3*i + 1], b = rgb[3*i + 2];
+            rgba[4*i] = r;
+            rgba[4*i + 1] = g;
+            rgba[4*i + 2] = b;
+            rgba[4*i + 3] = alpha ? alpha[i] : ( r == mask[0] && g == mask[1] && b == mask[2] ? 0 : 255 );
+      }
+}
+
+void KMLOverlayImageOps::FillAlpha( unsigned char *alpha, unsigned char value, size_t count )
+{
+      // The C library already has the widest stores for this
+      memset( alpha, value, count );
+}
+
+void KMLOverlayImageOps::ScaleAlpha( unsigned char *alpha, unsigned char value, size_t count )
+{
+      if ( value == 255 )
+            return;
+      size_t i = 0;
+#if defined(KMLOVERLAY_AVX2)
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i v = _mm256_set1_epi16( value );
+      const __m256i half = _mm256_set1_epi16( 128 );
+      for ( ; i + 32 <= count; i += 32 ) {
+            __m256i a = _mm256_loadu_si256( (const __m256i *)( alpha + i ) );
+            __m256i lo = _mm256_add_epi16( _mm256_mullo_epi16( _mm256_unpacklo_epi8( a, zero ), v ), half );
+            __m256i hi = _mm256_add_epi16( _mm256_mullo_epi16( _mm256_unpackhi_epi8( a, zero ), v ), half );
+            lo = _mm256_srli_epi16( _mm256_add_epi16( lo, _mm256_srli_epi16( lo, 8 ) ), 8 );
+            hi = _mm256_srli_epi16( _mm256_add_epi16( hi, _mm256_srli_epi16( hi, 8 ) ), 8 );
+            // Unpacking and packing both work within lanes, the order is kept
+            _mm256_storeu_si256( (__m256i *)( alpha + i ), _mm256_packus_epi16( lo, hi ) );
+      }
+#elif defined(KMLOVERLAY_SSE2)
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i v = _mm_set1_epi16( value );
+      const __m128i half = _mm_set1_epi16( 128 );
+      for ( ; i + 16 <= count; i += 16 ) {
+            __m128i a = _mm_loadu_si128( (const __m128i *)( alpha + i ) );
+            __m128i lo = _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( a, zero ), v ), half );
+            __m128i hi = _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( a, zero ), v ), half );
+            lo = _mm_srli_epi16( _mm_add_epi16( lo, _mm_srli_epi16( lo, 8 ) ), 8 );
+            hi = _mm_srli_epi16( _mm_add_epi16( hi, _mm_srli_epi16( hi, 8 ) ), 8 );
+            _mm_storeu_si128( (__m128i *)( alpha + i ), _mm_packus_epi16( lo, hi ) );
+      }
+#elif defined(KMLOVERLAY_NEON)
+      const uint8x8_t v = vdup_n_u8( value );
+      const uint16x8_t half = vdupq_n_u16( 128 );
+      for ( ; i + 16 <= count; i += 16 ) {
+            uint8x16_t a = vld1q_u8( alpha + i );
+            uint16x8_t lo = vaddq_u16( vmull_u8( vget_low_u8( a ), v ), half );
+            uint16x8_t hi = vaddq_u16( vmull_u8( vget_high_u8( a ), v ), half );
+            lo = vsraq_n_u16( lo, lo, 8 );
+            hi = vsraq_n_u16( hi, hi, 8 );
+            vst1q_u8( alpha + i, vcombine_u8( vshrn_n_u16( lo, 8 ), vshrn_n_u16( hi, 8 ) ) );
+      }
+#endif
+      for ( ; i < count; i++ )
+            alpha[i] = MulDiv255( alpha[i], value );
+}
+
+// dst[i] = average of a[i] and b[i]
+static void AverageRows( const unsigned char *a, const unsigned char *b, unsigned char *dst, size_t count )
+{
+      size_t i = 0;
+#if defined(KMLOVERLAY_AVX2)
+      for ( ; i + 32 <= count; i += 32 )
+            _mm256_storeu_si256( (__m256i *)( dst + i ),
+                                 _mm256_avg_epu8( _mm256_loadu_si256( (const __m256i *)( a + i ) ),
+                                                  _mm256_loadu_si256( (const __m256i *)( b + i ) ) ) );
+#elif defined(KMLOVERLAY_SSE2)
+      for ( ; i + 16 <= count; i += 16 )
+            _mm_storeu_si128( (__m128i *)( dst + i ),
+                              _mm_avg_epu8( _mm_loadu_si128( (const __m128i *)( a + i ) ),
+                                            _mm_loadu_si128( (const __m128i *)( b + i ) ) ) );
+#elif defined(KMLOVERLAY_NEON)
+      for ( ; i + 16 <= count; i += 16 )
+            vst1q_u8( dst + i, vrhaddq_u8( vld1q_u8( a + i ), vld1q_u8( b + i ) ) );
+#endif
+      for ( ; i < count; i++ )
+            dst[i] = Average( a[i], b[i] );
+}
+
+void KMLOverlayImageOps::HalveBox( const unsigned char *src, int width, int height, int channels, unsigned char *dst )
+{
+      int dw = width / 2, dh = height / 2;
+      size_t stride = (size_t)width * channels;
+      std::vector<unsigned char> row( (size_t)dw * 2 * channels );
+      for ( int y = 0; y < dh; y++ ) {
+            // Rows first, then neighbouring pixels within the averaged row
+            AverageRows( src + 2*y * stride, src + ( 2*y + 1 ) * stride, &row[0], row.size() );
+            unsigned char *out = dst + (size_t)y * dw * channels;
+            size_t x = 0;
+#if defined(KMLOVERLAY_SSE2)
+            if ( channels == 1 ) {
+                  // Even bytes against odd ones, 16 outputs at a time
+                  const __m128i even = _mm_set1_epi16( 0x00FF );
+                  for ( ; x + 16 <= (size_t)dw; x += 16 ) {
+                        __m128i a = _mm_loadu_si128( (const __m128i *)( &row[2*x] ) );
+                        __m128i b = _mm_loadu_si128( (const __m128i *)( &row[2*x + 16] ) );
+                        __m128i e = _mm_packus_epi16( _mm_and_si128( a, even ), _mm_and_si128( b, even ) );
+                        __m128i o = _mm_packus_epi16( _mm_srli_epi16( a, 8 ), _mm_srli_epi16( b, 8 ) );
+                        _mm_storeu_si128( (__m128i *)( out + x ), _mm_avg_epu8( e, o ) );
+                  }
+            }
+#elif defined(KMLOVERLAY_NEON)
+            if ( channels == 1 ) {
+                  for ( ; x + 16 <= (size_t)dw; x += 16 ) {
+                        uint8x16x2_t p = vld2q_u8( &row[2*x] );
+                        vst1q_u8( out + x, vrhaddq_u8( p.val[0], p.val[1] ) );
+                  }
+            }
+#endif
+            for ( size_t i = x * channels; i < (size_t)dw * channels; i++ ) {
+                  size_t px = i / channels, c = i % channels;
+                  out[i] = Average( row[2*px*channels + c], row[( 2*px + 1 )*channels + c] );
+            }
+      }
+}
+
+// Source coordinate of each destination pixel, as an integer part and 8 bits of fraction
+static void BilinearTable( int size, int dst_size, std::vector<int> *index, std::vector<int> *weight )
+{
+      index->resize( dst_size );
+      weight->resize( dst_size );
+      double ratio = (double)size / dst_size;
+      for ( int i = 0; i < dst_size; i++ ) {
+            double s = ( i + 0.5 ) * ratio - 0.5;
+            if ( s < 0 )
+                  s = 0;
+            if ( s > size - 1 )
+                  s = size - 1;
+            int s0 = (int)s;
+            (*index)[i] = s0;
+            (*weight)[i] = (int)( ( s - s0 ) * 256 + 0.5 );
+            if ( (*weight)[i] == 256 ) {
+                  (*index)[i] = s0 + 1 < size ? s0 + 1 : s0;
+                  (*weight)[i] = 0;
+            }
+      }
+}
+
+// dst[i] = a[i] * (256 - w) + b[i] * w, 16 bits wide
+static void BlendRows( const unsigned char *a, const unsigned char *b, int w, uint16_t *dst, size_t count )
+{
+      size_t i = 0;
+#if defined(KMLOVERLAY_SSE2)
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i wa = _mm_set1_epi16( (short)( 256 - w ) );
+      const __m128i wb = _mm_set1_epi16( (short)w );
+      for ( ; i + 16 <= count; i += 16 ) {
+            __m128i va = _mm_loadu_si128( (const __m128i *)( a + i ) );
+            __m128i vb = _mm_loadu_si128( (const __m128i *)( b + i ) );
+            // At most 255 * 256, the sums fit unsigned 16 bits
+            __m128i lo = _mm_add_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( va, zero ), wa ),
+                                        _mm_mullo_epi16( _mm_unpacklo_epi8( vb, zero ), wb ) );
+            __m128i hi = _mm_add_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( va, zero ), wa ),
+                                        _mm_mullo_epi16( _mm_unpackhi_epi8( vb, zero ), wb ) );
+            _mm_storeu_si128( (__m128i *)( dst + i ), lo );
+            _mm_storeu_si128( (__m128i *)( dst + i + 8 ), hi );
+      }
+#elif defined(KMLOVERLAY_NEON)
+      const uint8x8_t wa = vdup_n_u8( (uint8_t)( 256 - w ) ), wb = vdup_n_u8( (uint8_t)w );
+      if ( w > 0 ) {
+            for ( ; i + 16 <= count; i += 16 ) {
+                  uint8x16_t va = vld1q_u8( a + i ), vb = vld1q_u8( b + i );
+                  vst1q_u16( dst + i, vmlal_u8( vmull_u8( vget_low_u8( va ), wa ), vget_low_u8( vb ), wb ) );
+                  vst1q_u16( dst + i + 8, vmlal_u8( vmull_u8( vget_high_u8( va ), wa ), vget_high_u8( vb ), wb ) );
+            }
+      }
+#endif
+      for ( ; i < count; i++ )
+            dst[i] = (uint16_t)( a[i] * ( 256 - w ) + b[i] * w );
+}
+
+void KMLOverlayImageOps::ScaleBilinear( const unsigned char *src, int width, int height, int channels,
+                                        unsigned char *dst, int dst_width, int dst_height )
+{
+      std::vector<int> xi, xw, yi, yw;
+      BilinearTable( width, dst_width, &xi, &xw );
+      BilinearTable( height, dst_height, &yi, &yw );
+      size_t stride = (size_t)width * channels;
+      std::vector<uint16_t> row( stride );
+      for ( int y = 0; y < dst_height; y++ ) {
+            const unsigned char *r0 = src + yi[y] * stride;
+            const unsigned char *r1 = yi[y] + 1 < height ? r0 + stride : r0;
+            BlendRows( r0, r1, yw[y], &row[0], stride );
+            unsigned char *out = dst + (size_t)y * dst_width * channels;
+            for ( int x = 0; x < dst_width; x++ ) {
+                  const uint16_t *p0 = &row[xi[x] * channels];
+                  const uint16_t *p1 = xi[x] + 1 < width ? p0 + channels : p0;
+                  int w = xw[x];
+                  for ( int c = 0; c < channels; c++ )
+                        *out++ = (unsigned char)( ( p0[c] * ( 256 - w ) + p1[c] * w + 32768 ) >> 16 );
+            }
+      }
+}
+
+wxImage KMLOverlayImageOps::Resample( const wxImage &image, int width, int height )
+{
+      int sw = image.GetWidth(), sh = image.GetHeight();
+      if ( width <= 0 || height <= 0 || sw <= 0 || sh <= 0 )
+            return wxImage();
+      // Averaging would blend the mask colour into its neighbours
+      if ( image.HasMask() )
+            return image.Scale( width, height );
+      if ( sw == width && sh == height )
+            return image.Copy();
+
+      const unsigned char *rgb = image.GetData();
+      const unsigned char *alpha = image.HasAlpha() ? image.GetAlpha() : NULL;
+      std::vector<unsigned char> rgb_half[2], alpha_half[2];
+      int half = 0;
+      while ( sw >= 2 * width && sh >= 2 * height ) {
+            rgb_half[half].resize( (size_t)( sw / 2 ) * ( sh / 2 ) * 3 );
+            HalveBox( rgb, sw, sh, 3, &rgb_half[half][0] );
+            rgb = &rgb_half[half][0];
+            if ( alpha ) {
+                  alpha_half[half].resize( (size_t)( sw / 2 ) * ( sh / 2 ) );
+                  HalveBox( alpha, sw, sh, 1, &alpha_half[half][0] );
+                  alpha = &alpha_half[half][0];
+            }
+            sw /= 2;
+            sh /= 2;
+            half = 1 - half;
+      }
+
+      wxImage scaled( width, height, false );
+      if ( sw == width && sh == height )
+            memcpy( scaled.GetData(), rgb, (size_t)width * height * 3 );
+      else
+            ScaleBilinear( rgb, sw, sh, 3, scaled.GetData(), width, height );
+      if ( alpha ) {
+            scaled.SetAlpha();
+            if ( sw == width && sh == height )
+                  memcpy( scaled.GetAlpha(), alpha, (size_t)width * height );
+            else
+                  ScaleBilinear( alpha, sw, sh, 1, scaled.GetAlpha(), width, height );
+      }
+      return scaled;
+}
+
+const char *KMLOverlayImageOps::GetKernelName()
+{
+#if defined(KMLOVERLAY_AVX2)
+      return "avx2";
+#elif defined(KMLOVERLAY_SSSE3)
+      return "ssse3";
+#elif defined(KMLOVERLAY_SSE2)
+      return "sse2";
+#elif defined(KMLOVERLAY_NEON)
+      return "neon";
+#else
+      return "scalar";
+#endif
+}
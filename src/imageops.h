@@ -0,0 +1,72 @@
+/***************************************************************************
+ * $Id: imageops.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayImageOps_H_
+#define _KMLOverlayImageOps_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <stddef.h>
+
+/*    Pixel kernels of the image paths: GL uploads and ground overlays.
+ *
+ *    Each kernel has a scalar version and, picked at compile time, SSE2,
+ *    SSSE3, AVX2 or NEON ones for the bulk of a row. They all give the
+ *    same result to the bit, which bench/imagebench.cpp checks along with
+ *    the timings against the loops they replace.
+ *************************************************************************/
+
+class KMLOverlayImageOps
+{
+public:
+      // count RGB pixels to RGBA. Alpha comes from the alpha plane, or when
+      // it is NULL from the mask colour: 0 where it matches, 255 elsewhere.
+      static void ToRGBA( const unsigned char *rgb, const unsigned char *alpha, const unsigned char mask[3],
+                          unsigned char *rgba, size_t count );
+      static void FillAlpha( unsigned char *alpha, unsigned char value, size_t count );
+      // alpha = alpha * value / 255, rounded
+      static void ScaleAlpha( unsigned char *alpha, unsigned char value, size_t count );
+      // Halves in both directions, averaging 2x2 blocks. dst is
+      // (width/2)x(height/2), channels bytes per pixel.
+      static void HalveBox( const unsigned char *src, int width, int height, int channels, unsigned char *dst );
+      // Bilinear, pixel centres aligned
+      static void ScaleBilinear( const unsigned char *src, int width, int height, int channels,
+                                 unsigned char *dst, int dst_width, int dst_height );
+      // To width x height, alpha plane included. Halved by 2x2 boxes
+      // while at least twice too large, bilinear for the rest. Masked
+      // images are scaled as wxImage::Scale does, so the mask survives.
+      static wxImage Resample( const wxImage &image, int width, int height );
+      // Of the kernels compiled in: "avx2", "ssse3", "sse2", "neon" or "scalar"
+      static const char *GetKernelName();
+};
+
+#endif
@@ -0,0 +1,278 @@
+/***************************************************************************
+ * $Id: jsonreader.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <stdio.h>
+#include "jsonreader.h"
+
+KMLOverlayJsonReader::KMLOverlayJsonReader( gzFile gz, size_t buffer_size )
+      : m_gz( gz ), m_buffer( buffer_size ), m_data( &m_buffer[0] ), m_pos( 0 ), m_end( 0 ),
+        m_offset( 0 ), m_eof( false ), m_failed( false )
+{
+}
+
+KMLOverlayJsonReader::KMLOverlayJsonReader( const std::string &text )
+      : m_gz( NULL ), m_data( text.data() ), m_pos( 0 ), m_end( text.size() ),
+        m_offset( 0 ), m_eof( false ), m_failed( false )
+{
+}
+
+bool KMLOverlayJsonReader::Fill()
+{
+      if ( m_eof || !m_gz ) {
+            m_eof = true;
+            return false;
+      }
+      m_offset += m_end;
+      m_pos = m_end = 0;
+      int len = gzread( m_gz, &m_buffer[0], m_buffer.size() );
+      if ( len < 0 ) {
+            int errnum;
+            m_read_error = gzerror( m_gz, &errnum );
+            len = 0;
+      }
+      if ( len == 0 ) {
+            m_eof = true;
+            return false;
+      }
+      m_end = len;
+      return true;
+}
+
+bool KMLOverlayJsonReader::Fail( const std::string &what )
+{
+      if ( !m_failed ) {
+            char offset[32];
+            snprintf( offset, sizeof( offset ), " at byte %llu", (unsigned long long)( m_offset + m_pos ) );
+            m_error = m_read_error.empty() ? what + offset : m_read_error;
+            m_failed = true;
+      }
+      return false;
+}
+
+
+void KMLOverlayJsonReader::AppendUtf8( std::string *s, uint32_t cp )
+{
+      if ( cp < 0x80 ) {
+            s->push_back( cp );
+      } else if ( cp < 0x800 ) {
+            s->push_back( 0xc0 | cp >> 6 );
+            s->push_back( 0x80 | ( cp & 0x3f ) );
+      } else if ( cp < 0x10000 ) {
+            s->push_back( 0xe0 | cp >> 12 );
+            s->push_back( 0x80 | ( cp >> 6 & 0x3f ) );
+            s->push_back( 0x80 | ( cp & 0x3f ) );
+      } else {
+            s->push_back( 0xf0 | cp >> 18 );
+            s->push_back( 0x80 | ( cp >> 12 & 0x3f ) );
+            s->push_back( 0x80 | ( cp >> 6 & 0x3f ) );
+            s->push_back( 0x80 | ( cp & 0x3f ) );
+      }
+}
+
+bool KMLOverlayJsonReader::ReadHex4( uint32_t *cp )
+{
+      *cp = 0;
+      for ( int i = 0; i < 4; i++ ) {
+            int c = Get();
+            if ( c >= '0' && c <= '9' )
+                  c -= '0';
+            else if ( c >= 'a' && c <= 'f' )
+                  c -= 'a' - 10;
+            else if ( c >= 'A' && c <= 'F' )
+                  c -= 'A' - 10;
+            else
+                  return Fail( "bad \\u escape" );
+            *cp = *cp << 4 | c;
+      }
+      return true;
+}
+
+bool KMLOverlayJsonReader::ReadString( std::string *s )
+{
+      s->clear();
+      if ( !Expect( '"' ) )
+            return false;
+      for ( ;; ) {
+            // Runs without quotes nor escapes are copied at once
+            size_t start = m_pos;
+            while ( m_pos < m_end && m_data[m_pos] != '"' && m_data[m_pos] != '\\' )
+                  m_pos++;
+            s->append( m_data + start, m_pos - start );
+            int c = Get();
+            if ( c == '"' )
+                  return true;
+            if ( c < 0 )
+                  return Fail( "unterminated string" );
+            if ( c != '\\' ) {
+                  // The buffer ran out within the run
+                  s->push_back( c );
+                  continue;
+            }
+            c = Get();
+            switch ( c ) {
+            case '"': case '\\': case '/': s->push_back( c ); break;
+            case 'b': s->push_back( '\b' ); break;
+            case 'f': s->push_back( '\f' ); break;
+            case 'n': s->push_back( '\n' ); break;
+            case 'r': s->push_back( '\r' ); break;
+            case 't': s->push_back( '\t' ); break;
+            case 'u':
+            {
+                  uint32_t cp;
+                  if ( !ReadHex4( &cp ) )
+                        return false;
+                  if ( cp >= 0xd800 && cp < 0xdc00 ) {
+                        // High surrogate, its pair follows
+                        uint32_t low;
+                        if ( Get() != '\\' || Get() != 'u' || !ReadHex4( &low ) || low < 0xdc00 || low >= 0xe000 )
+                              return Fail( "bad surrogate pair" );
+                        cp = 0x10000 + ( ( cp - 0xd800 ) << 10 ) + ( low - 0xdc00 );
+                  }
+                  AppendUtf8( s, cp );
+            }
+            break;
+            default:
+                  return Fail( "bad escape" );
+            }
+      }
+}
+
+bool KMLOverlayJsonReader::ReadNumber( double *value )
+{
+      // Locale independent, exact for up to 19 significant digits and
+      // exponents within the table, which covers coordinates
+      static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+      PeekToken();
+      bool negative = false;
+      if ( Peek() == '-' ) {
+            negative = true;
+            m_pos++;
+      }
+      uint64_t mantissa = 0;
+      int digits = 0, exponent = 0;
+      int c = Peek();
+      if ( c < '0' || c > '9' )
+            return Fail( "expected a value" );
+      while ( ( c = Peek() ) >= '0' && c <= '9' ) {
+            if ( digits < 19 ) {
+                  mantissa = mantissa * 10 + ( c - '0' );
+                  if ( mantissa )
+                        digits++;
+            } else {
+                  exponent++;
+            }
+            m_pos++;
+      }
+      if ( c == '.' ) {
+            m_pos++;
+            while ( ( c = Peek() ) >= '0' && c <= '9' ) {
+                  if ( digits < 19 ) {
+                        mantissa = mantissa * 10 + ( c - '0' );
+                        if ( mantissa )
+                              digits++;
+                        exponent--;
+                  }
+                  m_pos++;
+            }
+      }
+      if ( c == 'e' || c == 'E' ) {
+            m_pos++;
+            bool negative_exp = false;
+            c = Peek();
+            if ( c == '-' || c == '+' ) {
+                  negative_exp = c == '-';
+                  m_pos++;
+            }
+            int e = 0;
+            if ( ( c = Peek() ) < '0' || c > '9' )
+                  return Fail( "bad exponent" );
+            while ( ( c = Peek() ) >= '0' && c <= '9' ) {
+                  if ( e < 10000 )
+                        e = e * 10 + ( c - '0' );
+                  m_pos++;
+            }
+            exponent += negative_exp ? -e : e;
+      }
+      double v = (double)mantissa;
+      if ( exponent < 0 ) {
+            for ( ; exponent < -22; exponent += 22 )
+                  v /= powers[22];
+            v /= powers[-exponent];
+      } else {
+            for ( ; exponent > 22; exponent -= 22 )
+                  v *= powers[22];
+            v *= powers[exponent];
+      }
+      *value = negative ? -v : v;
+      return true;
+}
+
+bool KMLOverlayJsonReader::SkipValue( int depth )
+{
+      if ( depth > MaxDepth )
+            return Fail( "too deeply nested" );
+      int c = PeekToken();
+      if ( c == '"' ) {
+            std::string s;
+            return ReadString( &s );
+      }
+      if ( c == '{' || c == '[' ) {
+            char close = c == '{' ? '}' : ']';
+            m_pos++;
+            if ( PeekToken() == close ) {
+                  m_pos++;
+                  return true;
+            }
+            for ( ;; ) {
+                  if ( c == '{' ) {
+                        std::string key;
+                        if ( !ReadString( &key ) || !Expect( ':' ) )
+                              return false;
+                  }
+                  if ( !SkipValue( depth+1 ) )
+                        return false;
+                  int next = GetToken();
+                  if ( next == close )
+                        return true;
+                  if ( next != ',' )
+                        return Fail( "expected ',' or '" + std::string( 1, close ) + "'" );
+            }
+      }
+      if ( c == '-' || ( c >= '0' && c <= '9' ) ) {
+            double v;
+            return ReadNumber( &v );
+      }
+      // true, false or null
+      int n = 0;
+      while ( ( c = Peek() ) >= 'a' && c <= 'z' ) {
+            m_pos++;
+            n++;
+      }
+      return n ? true : Fail( "expected a value" );
+}
@@ -0,0 +1,117 @@
+/***************************************************************************
+ * $Id: jsonreader.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayJsonReader_H_
+#define _KMLOverlayJsonReader_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/*    Pull tokenizer for JSON, over a file read a buffer at a time or over
+ *    text in memory. Nothing is built: the caller walks the values it
+ *    wants and skips the others, strings are decoded to UTF-8.
+ *************************************************************************/
+
+class KMLOverlayJsonReader
+{
+public:
+      static const int MaxDepth = 64;
+
+      // Reads the file through buffers of buffer_size bytes
+      KMLOverlayJsonReader( gzFile gz, size_t buffer_size );
+      // Reads text in place, which must outlive the reader
+      KMLOverlayJsonReader( const std::string &text );
+
+      // Next byte without consuming it, -1 at the end
+      int Peek()
+      {
+            if ( m_pos == m_end && !Fill() )
+                  return -1;
+            return (unsigned char)m_data[m_pos];
+      }
+      int Get()
+      {
+            if ( m_pos == m_end && !Fill() )
+                  return -1;
+            return (unsigned char)m_data[m_pos++];
+      }
+      // Next byte after white space
+      int PeekToken()
+      {
+            for ( ;; ) {
+                  int c = Peek();
+                  if ( c != ' ' && c != '\n' && c != '\r' && c != '\t' )
+                        return c;
+                  m_pos++;
+            }
+      }
+      // Consumes it
+      int GetToken()
+      {
+            int c = PeekToken();
+            if ( c >= 0 )
+                  m_pos++;
+            return c;
+      }
+      bool Expect( char c )
+      {
+            if ( PeekToken() != (unsigned char)c )
+                  return Fail( "expected '" + std::string( 1, c ) + "'" );
+            m_pos++;
+            return true;
+      }
+
+      bool ReadString( std::string *s );
+      // Locale independent
+      bool ReadNumber( double *value );
+      // Any value, nested depth deep
+      bool SkipValue( int depth );
+
+      // Always returns false, only the first error is kept
+      bool Fail( const std::string &what );
+      const std::string &GetError() const { return m_error; }
+
+private:
+      bool Fill();
+      void AppendUtf8( std::string *s, uint32_t cp );
+      bool ReadHex4( uint32_t *cp );
+
+      gzFile             m_gz;           // NULL when reading text
+      std::vector<char>  m_buffer;
+      const char        *m_data;         // the buffer, or the text
+      size_t             m_pos, m_end;
+      uint64_t           m_offset;       // of the buffer in the input
+      bool               m_eof;
+      bool               m_failed;
+      std::string        m_error;
+      std::string        m_read_error;
+};
+
+#endif
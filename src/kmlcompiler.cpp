@@ -0,0 +1,667 @@
+/***************************************************************************
+ * $Id: kmlcompiler.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <kml/base/file.h>
+#include "kmlcompiler.h"
+#include "kmlstream.h"
+#include "geojsonloader.h"
+#include "gpxloader.h"
+#include "tilepyramid.h"
+#include "trace.h"
+
+// Same as wxColor( 144, 144, 144 ) used for undecorated geometries
+static const uint32_t KMLOverlayDefaultColour = KMLOverlayScene::MakeColour( 144, 144, 144, 255 );
+
+static uint32_t ToColour( const kmlbase::Color32 &col32 )
+{
+      return KMLOverlayScene::MakeColour( col32.get_red(), col32.get_green(), col32.get_blue(), col32.get_alpha() );
+}
+
+KMLOverlayCompiler::KMLOverlayCompiler( const kmlengine::KmlFilePtr &kml_file, KMLOverlayScene *scene,
+                                        const std::string &base )
+      : m_kml_file( kml_file ), m_scene( scene ), m_base( base ),
+      m_track_begin( KMLOverlayScene::TimeMax ), m_track_end( KMLOverlayScene::TimeMin )
+{
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar
+static int64_t DaysFromCivil( int64_t y, unsigned m, unsigned d )
+{
+      y -= m <= 2;
+      int64_t era = ( y >= 0 ? y : y - 399 ) / 400;
+      unsigned yoe = (unsigned)( y - era * 400 );
+      unsigned doy = ( 153 * ( m > 2 ? m - 3 : m + 9 ) + 2 ) / 5 + d - 1;
+      unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+      return era * 146097 + (int64_t)doe - 719468;
+}
+
+bool KMLOverlayCompiler::ParseTime( const std::string &text, int64_t *time )
+{
+      // YYYY[-MM[-DD[Thh:mm[:ss[.s]][Z|+hh:mm|-hh:mm]]]]
+      int year = 0, month = 1, day = 1, hour = 0, minute = 0, tzh = 0, tzm = 0;
+      double second = 0;
+      const char *p = text.c_str();
+      while ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' )
+            p++;
+      int n = 0;
+      if ( sscanf( p, "%4d%n", &year, &n ) != 1 || n != 4 )
+            return false;
+      p += n;
+      if ( *p == '-' ) {
+            if ( sscanf( p, "-%2d%n", &month, &n ) != 1 || n != 3 )
+                  return false;
+            p += n;
+            if ( *p == '-' ) {
+                  if ( sscanf( p, "-%2d%n", &day, &n ) != 1 || n != 3 )
+                        return false;
+                  p += n;
+                  if ( *p == 'T' ) {
+                        if ( sscanf( p, "T%2d:%2d%n", &hour, &minute, &n ) != 2 )
+                              return false;
+                        p += n;
+                        if ( *p == ':' ) {
+                              if ( sscanf( p, ":%lf%n", &second, &n ) != 1 )
+                                    return false;
+                              p += n;
+                        }
+                        if ( *p == '+' || *p == '-' ) {
+                              int sign = *p == '-' ? -1 : 1;
+                              if ( sscanf( p + 1, "%2d:%2d", &tzh, &tzm ) != 2 )
+                                    return false;
+                              tzh *= sign;
+                              tzm *= sign;
+                        }
+                  }
+            }
+      }
+      if ( month < 1 || month > 12 || day < 1 || day > 31 || hour > 24 || minute > 59 )
+            return false;
+
+      *time = DaysFromCivil( year, month, day ) * 86400 + hour * 3600 + minute * 60 + (int64_t)second
+            - tzh * 3600 - tzm * 60;
+      return true;
+}
+
+std::string KMLOverlayCompiler::ResolveHref( const std::string &base, const std::string &href )
+{
+      // URLs and absolute paths are left alone
+      if ( base.empty() || href.empty() || href.find( "://" ) != std::string::npos
+            || href[0] == '/' || href[0] == '\\' || ( href.size() > 1 && href[1] == ':' ) )
+            return href;
+
+      // Collapse . and .. so a tile pyramid names each file one way only
+      std::vector<std::string> parts;
+      std::string path = base + href;
+      std::string resolved;
+      if ( path.compare( 0, 7, "file://" ) == 0 ) {
+            resolved = "file://";
+            path.erase( 0, 7 );
+      }
+      if ( !path.empty() && ( path[0] == '/' || path[0] == '\\' ) )
+            resolved += '/';
+      size_t start = 0;
+      while ( start <= path.size() ) {
+            size_t sep = path.find_first_of( "/\\", start );
+            if ( sep == std::string::npos )
+                  sep = path.size();
+            std::string part = path.substr( start, sep - start );
+            if ( part == ".." && !parts.empty() && parts.back() != ".." )
+                  parts.pop_back();
+            else if ( !part.empty() && part != "." )
+                  parts.push_back( part );
+            start = sep + 1;
+      }
+
+      for ( size_t i = 0; i < parts.size(); i++ ) {
+            if ( i )
+                  resolved += '/';
+            resolved += parts[i];
+      }
+      return resolved;
+}
+
+void KMLOverlayCompiler::Compile( const kmldom::FeaturePtr &root )
+{
+      CompileFeature( root, 0, 0 );
+      m_scene->Shrink();
+}
+
+// Case insensitive, a trailing .gz aside
+static bool HasExtension( const std::string &path, const char *ext )
+{
+      std::string name = path;
+      std::transform( name.begin(), name.end(), name.begin(), ::tolower );
+      if ( name.size() > 3 && name.compare( name.size()-3, 3, ".gz" ) == 0 )
+            name.resize( name.size()-3 );
+      size_t len = strlen( ext );
+      return name.size() > len && name.compare( name.size()-len, len, ext ) == 0;
+}
+
+bool KMLOverlayCompiler::CompileFile( const std::string &path, KMLOverlayScene *scene,
+                                      kmlengine::KmzFilePtr *kmz_file, size_t *kmz_size, std::string *error )
+{
+      KMLOverlayTrace::Scope file_trace( "compile file", path.c_str() );
+      kmlengine::KmlFilePtr kml_file;
+      *kmz_size = 0;
+      // Neither has assets, nor a DOM to go through
+      if ( HasExtension( path, ".geojson" ) || HasExtension( path, ".json" ) )
+            return KMLOverlayGeoJsonLoader::LoadFile( path, scene, error );
+      if ( HasExtension( path, ".gpx" ) )
+            return KMLOverlayGpxLoader::LoadFile( path, scene, error );
+      // Tiles are read as assets from the index' directory
+      if ( HasExtension( path, ".kmltiles" ) )
+            return KMLOverlayTilePyramid::LoadFile( path, scene, error );
+      if ( KMLOverlayKmlStream::IsKmzFile( path ) ) {
+            // The archive is kept whole for its assets, the document is
+            // inflated as it is parsed
+            std::string file_data;
+            {
+                  KMLOverlayTrace::Scope trace( "file read" );
+                  if ( !kmlbase::File::ReadFileToString( path, &file_data ) ) {
+                        *error = "Failed to read file content";
+                        return false;
+                  }
+            }
+            *kmz_file = kmlengine::KmzFile::OpenFromString( file_data );
+            if ( !kmz_file->get() ) {
+                  *error = "Failed opening KMZ file";
+                  return false;
+            }
+            *kmz_size = file_data.size();
+            bool unsupported;
+            kml_file = KMLOverlayKmlStream::ParseKmz( file_data, &unsupported, error );
+            std::string().swap( file_data );
+            if ( !kml_file && !unsupported )
+                  return false;
+            if ( !kml_file ) {
+                  // What can't be streamed is inflated whole by libkml, a
+                  // damaged archive or bad XML is reported as is
+                  KMLOverlayTrace::Scope trace( "kmz inflate" );
+                  std::string kml;
+                  if ( !(*kmz_file)->ReadKml( &kml ) ) {
+                        *error = "Failed to read KML from KMZ";
+                        return false;
+                  }
+                  KMLOverlayTrace::Scope parse( "xml parse" );
+                  error->clear();
+                  kml_file = kmlengine::KmlFile::CreateFromParse( kml, error );
+                  if ( !kml_file )
+                        return false;
+            }
+      } else {
+            // Plain or gzip compressed
+            kml_file = KMLOverlayKmlStream::ParseFile( path, error );
+            if ( !kml_file )
+                  return false;
+      }
+
+      // The DOM is dropped on return: it costs about four times the
+      // memory of the compiled scene.
+      KMLOverlayTrace::Scope compile( "compile" );
+      KMLOverlayCompiler compiler( kml_file, scene );
+      compiler.Compile( kmlengine::GetRootFeature( kml_file->get_root() ) );
+      return true;
+}
+
+bool KMLOverlayCompiler::CompileLinked( const std::string &kml, const std::string &href,
+                                        KMLOverlayScene *scene, std::string *error )
+{
+      kmlengine::KmlFilePtr kml_file;
+      {
+            KMLOverlayTrace::Scope trace( "xml parse", href.c_str() );
+            kml_file = kmlengine::KmlFile::CreateFromParse( kml, error );
+            if ( !kml_file ) {
+                  return false;
+            }
+      }
+
+      KMLOverlayTrace::Scope compile( "compile" );
+      size_t sep = href.find_last_of( "/\\" );
+      KMLOverlayCompiler compiler( kml_file, scene, sep == std::string::npos ? std::string() : href.substr( 0, sep+1 ) );
+      compiler.Compile( kmlengine::GetRootFeature( kml_file->get_root() ) );
+      return true;
+}
+
+const kmldom::StylePtr KMLOverlayCompiler::GetFeatureStylePtr( const kmldom::FeaturePtr& feature )
+{
+      KMLOverlayTrace::Scope trace( "style resolve" );
+      kmldom::StylePtr style = kmlengine::CreateResolvedStyle( feature, m_kml_file, kmldom::STYLESTATE_NORMAL );
+
+      // Some inline styles are not found by CreateResolvedStyle
+      // Try to find them directly
+      if ( style->get_id().empty() && feature->has_styleurl() ) {
+            std::string style_id;  // fragment
+            if ( kmlengine::SplitUriFragment( feature->get_styleurl(), &style_id ) ) {
+                  const kmldom::ObjectPtr object = m_kml_file->GetObjectById( style_id );
+                  if ( style = kmldom::AsStyle( object ) ) {
+                        return style;
+                  }
+            }
+      }
+
+      return style;
+}
+
+KMLOverlayScene::Style KMLOverlayCompiler::GetDefaultStyle()
+{
+      KMLOverlayScene::Style s;
+      s.line_colour = KMLOverlayDefaultColour;
+      s.line_width = 2;
+      s.ring_colour = KMLOverlayDefaultColour;
+      s.ring_width = 2;
+      s.fill_colour = 0;
+      s.ring_stroke = true;
+      s.ring_fill = false;
+      s.icon = KMLOverlayScene::NoIcon;
+      s.icon_scale = 1;
+      s.label_colour = KMLOverlayScene::MakeColour( 255, 255, 255, 255 );
+      s.label_scale = 1;
+      return s;
+}
+
+uint32_t KMLOverlayCompiler::CompileStyle( const kmldom::StylePtr& style )
+{
+      KMLOverlayScene::Style s = GetDefaultStyle();
+
+      if ( style->has_iconstyle() ) {
+            const kmldom::IconStylePtr& iconstyle = style->get_iconstyle();
+            if ( iconstyle->has_icon() && iconstyle->get_icon()->has_href() ) {
+                  s.icon = m_scene->AddIcon( ResolveHref( m_base, iconstyle->get_icon()->get_href() ) );
+            }
+            if ( iconstyle->has_scale() ) {
+                  s.icon_scale = iconstyle->get_scale();
+            }
+      }
+
+      if ( style->has_labelstyle() ) {
+            const kmldom::LabelStylePtr& labelstyle = style->get_labelstyle();
+            if ( labelstyle->has_color() ) {
+                  s.label_colour = ToColour( labelstyle->get_color() );
+            }
+            if ( labelstyle->has_scale() ) {
+                  s.label_scale = labelstyle->get_scale();
+            }
+      }
+
+/* TODO: Implement colormode=random
+ * see http://code.google.com/apis/kml/documentation/kmlreference.html#colorstyle
+*/
+      if ( style->has_linestyle() ) {
+            const kmldom::LineStylePtr& linestyle = style->get_linestyle();
+            if ( linestyle->has_color() ) {
+                  s.line_colour = ToColour( linestyle->get_color() );
+                  s.line_width = linestyle->get_width();
+            }
+      }
+
+      if ( style->has_polystyle() ) {
+            const kmldom::PolyStylePtr polystyle = style->get_polystyle();
+            if ( !polystyle->has_fill() || polystyle->get_fill() ) {
+                  if ( polystyle->has_color() ) {
+                        kmlbase::Color32 col32 = polystyle->get_color();
+                        if ( col32.get_alpha() ) {
+                              s.fill_colour = ToColour( col32 );
+                              s.ring_fill = true;
+                        }
+                  }
+            }
+            if ( !polystyle->has_outline() || polystyle->get_outline() ) {
+                  if ( style->has_linestyle() ) {
+                        const kmldom::LineStylePtr& linestyle = style->get_linestyle();
+                        if ( linestyle->has_color() ) {
+                              kmlbase::Color32 col32 = linestyle->get_color();
+                              if ( col32.get_alpha() ) {
+                                    s.ring_colour = ToColour( col32 );
+                                    s.ring_width = linestyle->get_width();
+                              } else {
+                                    s.ring_stroke = false;
+                              }
+                        }
+                  }
+            }
+      }
+
+      return m_scene->AddStyle( s );
+}
+
+void KMLOverlayCompiler::CompileCoordinates( const kmldom::CoordinatesPtr& coord, KMLOverlayScene::PartType type )
+{
+      size_t sz = coord->get_coordinates_array_size();
+      m_scene->BeginPart( type );
+      for ( size_t i = 0; i < sz; ++i ) {
+            kmlbase::Vec3 vec = coord->get_coordinates_array_at( i );
+            m_scene->AddCoord( vec.get_latitude(), vec.get_longitude() );
+      }
+      m_scene->EndPart();
+}
+
+void KMLOverlayCompiler::CompileGroundOverlay( const kmldom::GroundOverlayPtr& groundoverlay, uint64_t key, uint32_t region )
+{
+/* TODO
+ should we handle <gx:LatLonQuad> (Used for nonrectangular quadrilateral ground overlays.)
+ */
+      if ( !groundoverlay->has_latlonbox() )
+            return;
+
+      KMLOverlayScene::GroundOverlay overlay;
+      if ( !kmlengine::GetIconParentHref( groundoverlay, &overlay.href ) )
+            return;
+      overlay.href = ResolveHref( m_base, overlay.href );
+
+      overlay.alpha = 255;
+      if ( groundoverlay->has_color() ) {
+            overlay.alpha = groundoverlay->get_color().get_alpha();
+      }
+      const kmldom::LatLonBoxPtr latlonbox = groundoverlay->get_latlonbox();
+      overlay.north = latlonbox->get_north();
+      overlay.south = latlonbox->get_south();
+      overlay.east = latlonbox->get_east();
+      overlay.west = latlonbox->get_west();
+
+      size_t idx = m_scene->BeginFeature( KMLOverlayScene::FEATURE_GROUNDOVERLAY, 0, key, region );
+      m_scene->AddGroundOverlay( overlay );
+      m_scene->EndFeature( idx );
+      CompileTime( groundoverlay, idx );
+}
+
+void KMLOverlayCompiler::CompileGeometry( const kmldom::GeometryPtr& geometry )
+{
+      if ( !geometry ) {
+            return;
+      }
+
+      switch ( geometry->Type() ) {
+      case kmldom::Type_Point:
+      {
+            if ( const kmldom::PointPtr point = kmldom::AsPoint( geometry ) ) {
+                  // A point should have only one coord
+                  if ( point->has_coordinates() && point->get_coordinates()->get_coordinates_array_size() == 1 ) {
+                        CompileCoordinates( point->get_coordinates(), KMLOverlayScene::PART_POINT );
+                  }
+            }
+      }
+      break;
+      case kmldom::Type_LineString:
+      {
+            if ( const kmldom::LineStringPtr linestring = kmldom::AsLineString( geometry ) ) {
+                  if ( linestring->has_coordinates() ) {
+                        CompileCoordinates( linestring->get_coordinates(), KMLOverlayScene::PART_LINESTRING );
+                  }
+            }
+      }
+      break;
+      case kmldom::Type_LinearRing:
+      {
+            if ( const kmldom::LinearRingPtr linearring = kmldom::AsLinearRing( geometry ) ) {
+                  if ( linearring->has_coordinates() ) {
+                        CompileCoordinates( linearring->get_coordinates(), KMLOverlayScene::PART_LINEARRING );
+                  }
+            }
+      }
+      break;
+      case kmldom::Type_Polygon:
+      {
+            if ( const kmldom::PolygonPtr polygon = kmldom::AsPolygon( geometry ) ) {
+                  if ( polygon->has_outerboundaryis() ) {
+                        kmldom::OuterBoundaryIsPtr bound = polygon->get_outerboundaryis();
+                        if ( bound->has_linearring() && bound->get_linearring()->has_coordinates() ) {
+                              CompileCoordinates( bound->get_linearring()->get_coordinates(), KMLOverlayScene::PART_LINEARRING );
+                        }
+                  }
+                  for ( size_t i = 0; i < polygon->get_innerboundaryis_array_size(); ++i ) {
+                        kmldom::InnerBoundaryIsPtr bound = polygon->get_innerboundaryis_array_at( i );
+                        if ( bound->has_linearring() && bound->get_linearring()->has_coordinates() ) {
+                              CompileCoordinates( bound->get_linearring()->get_coordinates(), KMLOverlayScene::PART_INNERRING );
+                        }
+                  }
+            }
+      }
+      break;
+      case kmldom::Type_MultiGeometry:
+      {
+            if ( const kmldom::MultiGeometryPtr multigeometry = kmldom::AsMultiGeometry( geometry ) )
+            {
+                  for ( size_t i = 0; i < multigeometry->get_geometry_array_size(); ++i ) {
+                        CompileGeometry( multigeometry->get_geometry_array_at( i ) );
+                  }
+            }
+      }
+      break;
+      case kmldom::Type_GxTrack:
+      {
+            if ( const kmldom::GxTrackPtr track = kmldom::AsGxTrack( geometry ) ) {
+                  CompileTrack( track );
+            }
+      }
+      break;
+      case kmldom::Type_GxMultiTrack:
+      {
+            if ( const kmldom::GxMultiTrackPtr multitrack = kmldom::AsGxMultiTrack( geometry ) ) {
+                  for ( size_t i = 0; i < multitrack->get_gx_track_array_size(); ++i ) {
+                        CompileTrack( multitrack->get_gx_track_array_at( i ) );
+                  }
+            }
+      }
+      break;
+      case kmldom::Type_Model:
+      break;
+      default:  // KML has 6 types of Geometry.
+      break;
+      }
+}
+
+static bool SampleLess( const std::pair<int64_t, kmlbase::Vec3> &a, const std::pair<int64_t, kmlbase::Vec3> &b )
+{
+      return a.first < b.first;
+}
+
+void KMLOverlayCompiler::CompileTrack( const kmldom::GxTrackPtr& track )
+{
+      // Samples without a valid time can't be placed, they are dropped
+      std::vector< std::pair<int64_t, kmlbase::Vec3> > samples;
+      size_t sz = std::min( track->get_when_array_size(), track->get_gx_coord_array_size() );
+      samples.reserve( sz );
+      for ( size_t i = 0; i < sz; ++i ) {
+            int64_t when;
+            if ( ParseTime( track->get_when_array_at( i ), &when ) )
+                  samples.push_back( std::make_pair( when, track->get_gx_coord_array_at( i ) ) );
+      }
+      if ( samples.empty() )
+            return;
+      std::stable_sort( samples.begin(), samples.end(), SampleLess );
+
+      m_scene->BeginPart( KMLOverlayScene::PART_TRACK );
+      for ( size_t i = 0; i < samples.size(); ++i ) {
+            m_scene->AddTrackSample( samples[i].first, samples[i].second.get_latitude(), samples[i].second.get_longitude() );
+      }
+      m_scene->EndPart();
+      m_track_begin = std::min( m_track_begin, samples.front().first );
+      m_track_end = std::max( m_track_end, samples.back().first );
+}
+
+void KMLOverlayCompiler::CompileTime( const kmldom::FeaturePtr& feature, size_t idx )
+{
+      int64_t begin = KMLOverlayScene::TimeMin, end = KMLOverlayScene::TimeMax;
+      bool timed = false;
+      if ( feature->has_timeprimitive() ) {
+            const kmldom::TimePrimitivePtr &primitive = feature->get_timeprimitive();
+            if ( const kmldom::TimeStampPtr stamp = kmldom::AsTimeStamp( primitive ) ) {
+                  timed = stamp->has_when() && ParseTime( stamp->get_when(), &begin );
+                  end = begin;
+            } else if ( const kmldom::TimeSpanPtr span = kmldom::AsTimeSpan( primitive ) ) {
+                  // Either end may be left open
+                  timed = span->has_begin() && ParseTime( span->get_begin(), &begin );
+                  if ( span->has_end() && ParseTime( span->get_end(), &end ) )
+                        timed = true;
+                  if ( !timed ) {
+                        begin = KMLOverlayScene::TimeMin;
+                        end = KMLOverlayScene::TimeMax;
+                  }
+            }
+      }
+      // A track without a TimePrimitive lasts as long as its samples
+      if ( !timed && m_track_begin <= m_track_end ) {
+            begin = m_track_begin;
+            end = m_track_end;
+            timed = true;
+      }
+      if ( timed )
+            m_scene->SetFeatureTime( idx, begin, end );
+}
+
+uint64_t KMLOverlayCompiler::MakeFeatureKey( uint64_t parent, size_t index, int type )
+{
+      uint64_t key = KMLOverlayScene::Hash( &parent, sizeof( parent ) );
+      key = KMLOverlayScene::Hash( &index, sizeof( index ), key );
+      return KMLOverlayScene::Hash( &type, sizeof( type ), key );
+}
+
+uint64_t KMLOverlayCompiler::MakeFeatureKey( const std::string &id, int type )
+{
+      return KMLOverlayScene::Hash( id.data(), id.size(), KMLOverlayScene::Hash( &type, sizeof( type ) ) );
+}
+
+uint64_t KMLOverlayCompiler::GetFeatureKey( const kmldom::FeaturePtr& feature, uint64_t parent, size_t index )
+{
+      // Features are matched across reloads by their id, or by their
+      // position in the document when they have none.
+      int type = feature->Type();
+      if ( feature->has_id() )
+            return MakeFeatureKey( feature->get_id(), type );
+      return MakeFeatureKey( parent, index, type );
+}
+
+void KMLOverlayCompiler::CompileNetworkLink( const kmldom::NetworkLinkPtr& networklink, uint64_t key, uint32_t region )
+{
+      // Only local documents are followed, loaded when their region
+      // first becomes active
+      if ( !networklink->has_link() || !networklink->get_link()->has_href() )
+            return;
+      std::string href = networklink->get_link()->get_href();
+      if ( href.find( "://" ) != std::string::npos && href.compare( 0, 7, "file://" ) != 0 )
+            return;
+
+      size_t idx = m_scene->BeginFeature( KMLOverlayScene::FEATURE_NETWORKLINK, 0, key, region );
+      m_scene->AddLink( ResolveHref( m_base, href ) );
+      m_scene->EndFeature( idx );
+      CompileTime( networklink, idx );
+}
+
+uint32_t KMLOverlayCompiler::CompileRegion( const kmldom::FeaturePtr& feature )
+{
+      // A Region without its LatLonAltBox is invalid, KML ignores it
+      if ( !feature->has_region() )
+            return KMLOverlayScene::NoRegion;
+      const kmldom::RegionPtr region = feature->get_region();
+      if ( !region->has_latlonaltbox() )
+            return KMLOverlayScene::NoRegion;
+
+      const kmldom::LatLonAltBoxPtr box = region->get_latlonaltbox();
+      KMLOverlayScene::Region r;
+      // Kept as is, west > east when crossing the antimeridian
+      r.box.south = KMLOverlayScene::ToFixed( box->get_south() );
+      r.box.west = KMLOverlayScene::ToFixed( box->get_west() );
+      r.box.north = KMLOverlayScene::ToFixed( box->get_north() );
+      r.box.east = KMLOverlayScene::ToFixed( box->get_east() );
+      if ( r.box.IsEmpty() )
+            return KMLOverlayScene::NoRegion;
+      // Defaults from the KML reference: always active
+      r.min_lod = 0;
+      r.max_lod = -1;
+      if ( region->has_lod() ) {
+            const kmldom::LodPtr lod = region->get_lod();
+            r.min_lod = lod->get_minlodpixels();
+            r.max_lod = lod->get_maxlodpixels();
+      }
+      return m_scene->AddRegion( r );
+}
+
+void KMLOverlayCompiler::CompileFeature( const kmldom::FeaturePtr& feature, uint64_t parent, size_t index )
+{
+      if ( !feature )
+      {
+            return;
+      }
+      // Hidden features are never drawn, don't keep them around
+      if ( !feature->get_visibility() )
+      {
+            return;
+      }
+
+      uint64_t key = GetFeatureKey( feature, parent, index );
+      uint32_t region = CompileRegion( feature );
+      m_track_begin = KMLOverlayScene::TimeMax;
+      m_track_end = KMLOverlayScene::TimeMin;
+      switch ( feature->Type() ) {
+      case kmldom::Type_GroundOverlay:
+      {
+            if ( const kmldom::GroundOverlayPtr groundoverlay = kmldom::AsGroundOverlay( feature ) ) {
+                  CompileGroundOverlay( groundoverlay, key, region );
+            }
+      }
+      break;
+      case kmldom::Type_NetworkLink:
+      {
+            if ( const kmldom::NetworkLinkPtr networklink = kmldom::AsNetworkLink( feature ) ) {
+                  CompileNetworkLink( networklink, key, region );
+            }
+      }
+      break;
+      case kmldom::Type_Placemark:
+      {
+            if ( const kmldom::PlacemarkPtr placemark = kmldom::AsPlacemark( feature ) ) {
+                  size_t idx = m_scene->BeginFeature( KMLOverlayScene::FEATURE_PLACEMARK,
+                                                      CompileStyle( GetFeatureStylePtr( feature ) ), key, region );
+                  CompileGeometry( placemark->get_geometry() );
+                  m_scene->EndFeature( idx );
+                  CompileTime( feature, idx );
+                  // Only shown when picked
+                  m_scene->SetFeatureText( idx, feature->get_name(), feature->get_description() );
+            }
+      }
+      break;
+      default:
+      break;
+      }
+
+      if ( const kmldom::ContainerPtr container = kmldom::AsContainer( feature ) ) {
+            size_t idx = m_scene->BeginFeature( KMLOverlayScene::FEATURE_CONTAINER, 0, key, region );
+            for ( size_t i = 0; i < container->get_feature_array_size(); ++i ) {
+                  CompileFeature( container->get_feature_array_at( i ), key, i );
+            }
+            m_scene->EndFeature( idx );
+            // The tracks of its placemarks don't make it timed
+            m_track_begin = KMLOverlayScene::TimeMax;
+            m_track_end = KMLOverlayScene::TimeMin;
+            CompileTime( feature, idx );
+      }
+}
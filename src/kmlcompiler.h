@@ -0,0 +1,89 @@
+/***************************************************************************
+ * $Id: kmlcompiler.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayCompiler_H_
+#define _KMLOverlayCompiler_H_
+
+#include <kml/engine.h>
+#include "scene.h"
+
+/*    Walks a parsed KML DOM once and fills a KMLOverlayScene with
+ *    resolved styles and fixed-point geometry, so the DOM can be dropped.
+ *************************************************************************/
+
+class KMLOverlayCompiler
+{
+public:
+      // Relative hrefs are resolved against base, the directory of the
+      // document within its source, so every asset is named from the source
+      KMLOverlayCompiler( const kmlengine::KmlFilePtr &kml_file, KMLOverlayScene *scene,
+                          const std::string &base = std::string() );
+
+      void Compile( const kmldom::FeaturePtr &root );
+
+      // Reads a KML, gzip compressed KML or KMZ file and compiles it, safe
+      // to call from a worker thread. The KMZ archive, if any, is returned
+      // for its assets. GeoJSON and GPX files and tile pyramid indexes,
+      // known by their extension, are handed to their own loaders.
+      static bool CompileFile( const std::string &path, KMLOverlayScene *scene,
+                               kmlengine::KmzFilePtr *kmz_file, size_t *kmz_size, std::string *error );
+      // Compiles a document reached through a NetworkLink, href being its
+      // resolved location within the source
+      static bool CompileLinked( const std::string &kml, const std::string &href,
+                                 KMLOverlayScene *scene, std::string *error );
+      static std::string ResolveHref( const std::string &base, const std::string &href );
+      // xsd:dateTime, date, gYearMonth or gYear, to seconds since the epoch
+      static bool ParseTime( const std::string &text, int64_t *time );
+      // What features without a style are drawn with, for every loader
+      static KMLOverlayScene::Style GetDefaultStyle();
+      // Key of a feature without an id, by its position under its parent
+      static uint64_t MakeFeatureKey( uint64_t parent, size_t index, int type );
+      // Key of a feature by its id
+      static uint64_t MakeFeatureKey( const std::string &id, int type );
+
+private:
+      const kmldom::StylePtr GetFeatureStylePtr( const kmldom::FeaturePtr& feature );
+      uint32_t CompileStyle( const kmldom::StylePtr& style );
+      void CompileCoordinates( const kmldom::CoordinatesPtr& coord, KMLOverlayScene::PartType type );
+      void CompileGroundOverlay( const kmldom::GroundOverlayPtr& groundoverlay, uint64_t key, uint32_t region );
+      uint32_t CompileRegion( const kmldom::FeaturePtr& feature );
+      void CompileNetworkLink( const kmldom::NetworkLinkPtr& networklink, uint64_t key, uint32_t region );
+      void CompileGeometry( const kmldom::GeometryPtr& geometry );
+      void CompileTrack( const kmldom::GxTrackPtr& track );
+      void CompileTime( const kmldom::FeaturePtr& feature, size_t idx );
+      uint64_t GetFeatureKey( const kmldom::FeaturePtr& feature, uint64_t parent, size_t index );
+      void CompileFeature( const kmldom::FeaturePtr& feature, uint64_t parent, size_t index );
+
+      kmlengine::KmlFilePtr m_kml_file;
+      KMLOverlayScene      *m_scene;
+      std::string           m_base;
+      int64_t               m_track_begin;      // samples of the current placemark
+      int64_t               m_track_end;
+};
+
+#endif
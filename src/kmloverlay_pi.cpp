@@ -35,6 +35,7 @@
 #include "kmloverlay_pi.h"
 #include "icons.h"
 #include "prefdlg.h"
+#include "trace.h"
 
 // the class factories, used to create and destroy instances of the PlugIn
 
@@ -64,6 +65,9 @@ kmloverlay_pi::kmloverlay_pi(void *ppimgr)
 int kmloverlay_pi::Init(void)
 {
       m_puserinput = NULL;
+      m_interval = -1;
+      m_memory_budget = 0;
+      m_labels = true;
 
       AddLocaleCatalog( _T("opencpn-kmloverlay_pi") );
 
@@ -86,10 +90,12 @@ int kmloverlay_pi::Init(void)
       return (
            WANTS_OVERLAY_CALLBACK    |
            WANTS_OPENGL_OVERLAY_CALLBACK |
+           WANTS_CURSOR_LATLON       |
            WANTS_TOOLBAR_CALLBACK    |
            INSTALLS_TOOLBAR_TOOL     |
-// nothing yet //           WANTS_PREFERENCES         |
-           WANTS_CONFIG
+           WANTS_PREFERENCES         |
+           WANTS_CONFIG              |
+           WANTS_PLUGIN_MESSAGING
             );
 }
 
@@ -103,6 +109,8 @@ bool kmloverlay_pi::DeInit(void)
             m_puserinput->Destroy();
             m_puserinput = NULL;
       }
+      // Once the workers are gone
+      KMLOverlayTrace::Stop();
 
       return true;
 }
@@ -192,9 +200,26 @@ bool kmloverlay_pi::RenderGLOverlay( wxGLContext *pcontext, PlugIn_ViewPort *vp
       return false;
 }
 
+void kmloverlay_pi::SetCursorLatLon( double lat, double lon )
+{
+      if ( m_puserinput )
+      {
+            m_puserinput->SetCursorLatLon( lat, lon );
+      }
+}
+
+void kmloverlay_pi::SetPluginMessage( wxString &message_id, wxString &message_body )
+{
+      // Answered right away, our own responses come back here too
+      if ( m_puserinput && message_id == wxString::FromUTF8( KMLOverlayQuery::MessageId ) )
+      {
+            SendPluginMessage( wxString::FromUTF8( KMLOverlayQuery::ResponseId ), m_puserinput->Query( message_body ) );
+      }
+}
+
 void kmloverlay_pi::ShowPreferencesDialog( wxWindow* parent )
 {
-      KMLOverlayPreferencesDialog *dialog = new KMLOverlayPreferencesDialog( parent, wxID_ANY, m_interval );
+      KMLOverlayPreferencesDialog *dialog = new KMLOverlayPreferencesDialog( parent, wxID_ANY, m_interval, m_memory_budget, m_labels );
 
       if ( dialog->ShowModal() == wxID_OK )
       {
@@ -203,6 +228,8 @@ void kmloverlay_pi::ShowPreferencesDialog( wxWindow* parent )
             dialog->SaveKMLOverlayConfig();
 
             m_interval = dialog->m_interval;
+            m_memory_budget = dialog->m_memory_budget;
+            m_labels = dialog->m_labels;
             SaveConfig();
             ApplyConfig();
       }
@@ -218,6 +245,13 @@ bool kmloverlay_pi::LoadConfig(void)
             pConf->SetPath( _T("/PlugIns/KMLOverlay") );
 
             pConf->Read( _T("Interval"), &m_interval, -1 );
+            pConf->Read( _T("MemoryBudget"), &m_memory_budget, 0 );
+            pConf->Read( _T("ShowLabels"), &m_labels, true );
+            // Before the files are parsed, the environment comes first
+            wxString trace;
+            if ( !wxGetEnv( _T("KMLOVERLAY_TRACE"), &trace ) )
+                  pConf->Read( _T("TraceFile"), &trace, _T("") );
+            KMLOverlayTrace::Start( trace );
             int d_cnt;
             pConf->Read( _T("FileCount"), &d_cnt, -1 );
             for ( int i = 0; i < d_cnt; i++ )
@@ -244,6 +278,8 @@ bool kmloverlay_pi::SaveConfig(void)
             pConf->SetPath( _T("/PlugIns/KMLOverlay") );
 
             pConf->Write( _T("Interval"), m_interval );
+            pConf->Write( _T("MemoryBudget"), m_memory_budget );
+            pConf->Write( _T("ShowLabels"), m_labels );
             pConf->Write( _T("FileCount" ), m_puserinput->GetCount() );
             for ( int i = 0; i < m_puserinput->GetCount(); i++ )
             {
@@ -260,8 +296,8 @@ bool kmloverlay_pi::SaveConfig(void)
 
 void kmloverlay_pi::ApplyConfig(void)
 {
-      if ( m_interval != -1 )
-      {
-      }
+      m_puserinput->SetReloadInterval( m_interval );
+      m_puserinput->SetMemoryBudget( m_memory_budget );
+      m_puserinput->SetLabelsEnabled( m_labels );
 }
 
@@ -74,6 +74,8 @@ public:
       void SetColorScheme( PI_ColorScheme cs );
       bool RenderOverlay( wxDC &dc, PlugIn_ViewPort *vp );
       bool RenderGLOverlay( wxGLContext *pcontext, PlugIn_ViewPort *vp );
+      void SetCursorLatLon( double lat, double lon );
+      void SetPluginMessage( wxString &message_id, wxString &message_body );
 
       void ShowPreferencesDialog( wxWindow* parent );
 
@@ -87,6 +89,8 @@ private:
       int              m_toolbar_item_id;
       KMLOverlayUI    *m_puserinput;
       int              m_interval;
+      int              m_memory_budget;      // MB, 0 for unlimited
+      bool             m_labels;
 
 };
 
@@ -0,0 +1,270 @@
+/***************************************************************************
+ * $Id: kmlstream.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <zlib.h>
+#include <kml/base/expat_parser.h>
+#include <kml/dom/kml_handler.h>
+#include "kmlstream.h"
+#include "trace.h"
+
+// The DOM builder fed by expat, buffer by buffer
+class KMLOverlayKmlSink
+{
+public:
+      KMLOverlayKmlSink()
+            : m_handler( m_observers ), m_parser( &m_handler, false ) {}
+
+      // Up to BufferSize bytes to fill, then handed to Parse
+      char *GetBuffer()
+      {
+            return static_cast<char *>( m_parser.GetInternalBuffer( KMLOverlayKmlStream::BufferSize ) );
+      }
+      bool Parse( size_t len, bool last, std::string *error )
+      {
+            return m_parser.ParseInternalBuffer( len, error, last );
+      }
+      kmlengine::KmlFilePtr Finish( std::string *error )
+      {
+            kmldom::ElementPtr root = m_handler.PopRoot();
+            if ( !root ) {
+                  *error = "No KML root element";
+                  return kmlengine::KmlFilePtr();
+            }
+            // Duplicate ids are kept, as when parsing from a string
+            kmlengine::KmlFilePtr kml_file = kmlengine::KmlFile::CreateFromImportLax( root );
+            if ( !kml_file )
+                  *error = "Failed to index the KML document";
+            return kml_file;
+      }
+
+private:
+      kmldom::parser_observer_vector_t m_observers;
+      kmldom::KmlHandler               m_handler;
+      kmlbase::ExpatParser             m_parser;
+};
+
+bool KMLOverlayKmlStream::IsKmzFile( const std::string &path )
+{
+      FILE *f = fopen( path.c_str(), "rb" );
+      if ( !f )
+            return false;
+      unsigned char magic[4];
+      bool kmz = fread( magic, 1, 4, f ) == 4 && magic[0] == 'P' && magic[1] == 'K' && magic[2] == 3 && magic[3] == 4;
+      fclose( f );
+      return kmz;
+}
+
+kmlengine::KmlFilePtr KMLOverlayKmlStream::ParseFile( const std::string &path, std::string *error )
+{
+      KMLOverlayTrace::Scope trace( "xml parse", path.c_str() );
+      // gzread passes files without a gzip header through as they are
+      gzFile gz = gzopen( path.c_str(), "rb" );
+      if ( !gz ) {
+            *error = "Failed to read file content";
+            return kmlengine::KmlFilePtr();
+      }
+      gzbuffer( gz, BufferSize );
+
+      KMLOverlayKmlSink sink;
+      for ( ;; ) {
+            char *buffer = sink.GetBuffer();
+            int len = buffer ? gzread( gz, buffer, BufferSize ) : -1;
+            if ( len < 0 ) {
+                  int errnum;
+                  *error = buffer ? gzerror( gz, &errnum ) : "Out of memory";
+                  gzclose( gz );
+                  return kmlengine::KmlFilePtr();
+            }
+            if ( !sink.Parse( len, len == 0, error ) ) {
+                  gzclose( gz );
+                  return kmlengine::KmlFilePtr();
+            }
+            if ( len == 0 )
+                  break;
+      }
+      gzclose( gz );
+      return sink.Finish( error );
+}
+
+static uint32_t ReadLE32( const unsigned char *p )
+{
+      return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t ReadLE16( const unsigned char *p )
+{
+      return p[0] | p[1] << 8;
+}
+
+static bool IsKmlName( const unsigned char *name, size_t len )
+{
+      if ( len < 4 )
+            return false;
+      const unsigned char *ext = name + len - 4;
+      return ext[0] == '.' && tolower( ext[1] ) == 'k' && tolower( ext[2] ) == 'm' && tolower( ext[3] ) == 'l';
+}
+
+kmlengine::KmlFilePtr KMLOverlayKmlStream::ParseKmz( const std::string &archive, bool *unsupported, std::string *error )
+{
+      *unsupported = false;
+      KMLOverlayTrace::Scope trace( "kmz stream" );
+      const unsigned char *data = reinterpret_cast<const unsigned char *>( archive.data() );
+      size_t size = archive.size();
+
+      // End of central directory, followed by at most a 64k comment
+      size_t eocd = size;
+      if ( size >= 22 ) {
+            size_t lowest = size > 22 + 65535 ? size - 22 - 65535 : 0;
+            for ( size_t i = size - 21; i-- > lowest; ) {
+                  if ( ReadLE32( data + i ) == 0x06054b50 ) {
+                        eocd = i;
+                        break;
+                  }
+            }
+      }
+      if ( eocd == size ) {
+            *error = "No ZIP directory in KMZ";
+            return kmlengine::KmlFilePtr();
+      }
+
+      // The first .kml in archive order is the document, as for KmzFile::ReadKml
+      size_t entries = ReadLE16( data + eocd + 10 );
+      size_t pos = ReadLE32( data + eocd + 16 );
+      if ( entries == 0xFFFF || pos == 0xFFFFFFFF ) {
+            *error = "ZIP64 KMZ";
+            *unsupported = true;
+            return kmlengine::KmlFilePtr();
+      }
+      const unsigned char *entry = NULL;
+      for ( size_t i = 0; i < entries; i++ ) {
+            if ( pos + 46 > size || ReadLE32( data + pos ) != 0x02014b50 ) {
+                  *error = "Bad ZIP directory in KMZ";
+                  return kmlengine::KmlFilePtr();
+            }
+            size_t name_len = ReadLE16( data + pos + 28 );
+            if ( pos + 46 + name_len > size )
+                  break;
+            if ( IsKmlName( data + pos + 46, name_len ) ) {
+                  entry = data + pos;
+                  break;
+            }
+            pos += 46 + name_len + ReadLE16( data + pos + 30 ) + ReadLE16( data + pos + 32 );
+      }
+      if ( !entry ) {
+            *error = "No KML in KMZ";
+            return kmlengine::KmlFilePtr();
+      }
+
+      uint16_t flags = ReadLE16( entry + 8 );
+      uint16_t method = ReadLE16( entry + 10 );
+      uint32_t crc = ReadLE32( entry + 16 );
+      uint32_t compressed = ReadLE32( entry + 20 );
+      size_t local = ReadLE32( entry + 42 );
+      if ( ( flags & 1 ) || ( method != 0 && method != 8 ) || compressed == 0xFFFFFFFF || local == 0xFFFFFFFF ) {
+            *error = "Unsupported KML entry in KMZ";
+            *unsupported = true;
+            return kmlengine::KmlFilePtr();
+      }
+      if ( local + 30 > size || ReadLE32( data + local ) != 0x04034b50 ) {
+            *error = "Bad ZIP entry in KMZ";
+            return kmlengine::KmlFilePtr();
+      }
+      size_t start = local + 30 + ReadLE16( data + local + 26 ) + ReadLE16( data + local + 28 );
+      if ( start + compressed > size ) {
+            *error = "Truncated KMZ";
+            return kmlengine::KmlFilePtr();
+      }
+
+      KMLOverlayKmlSink sink;
+      uLong check = crc32( 0, Z_NULL, 0 );
+      if ( method == 0 ) {
+            for ( size_t done = 0; ; ) {
+                  char *buffer = sink.GetBuffer();
+                  if ( !buffer ) {
+                        *error = "Out of memory";
+                        return kmlengine::KmlFilePtr();
+                  }
+                  size_t len = std::min( (size_t)BufferSize, compressed - done );
+                  memcpy( buffer, data + start + done, len );
+                  check = crc32( check, reinterpret_cast<const Bytef *>( buffer ), len );
+                  done += len;
+                  if ( !sink.Parse( len, done == compressed, error ) )
+                        return kmlengine::KmlFilePtr();
+                  if ( done == compressed )
+                        break;
+            }
+      } else {
+            z_stream zs;
+            memset( &zs, 0, sizeof( zs ) );
+            // Raw deflate, ZIP has no zlib header
+            if ( inflateInit2( &zs, -MAX_WBITS ) != Z_OK ) {
+                  *error = "Failed to inflate KMZ";
+                  return kmlengine::KmlFilePtr();
+            }
+            zs.next_in = const_cast<Bytef *>( data + start );
+            zs.avail_in = compressed;
+            for ( int ret = Z_OK; ret != Z_STREAM_END; ) {
+                  char *buffer = sink.GetBuffer();
+                  if ( !buffer ) {
+                        inflateEnd( &zs );
+                        *error = "Out of memory";
+                        return kmlengine::KmlFilePtr();
+                  }
+                  zs.next_out = reinterpret_cast<Bytef *>( buffer );
+                  zs.avail_out = BufferSize;
+                  ret = inflate( &zs, Z_NO_FLUSH );
+                  if ( ret != Z_OK && ret != Z_STREAM_END ) {
+                        inflateEnd( &zs );
+                        *error = "Failed to inflate KMZ";
+                        return kmlengine::KmlFilePtr();
+                  }
+                  size_t len = BufferSize - zs.avail_out;
+                  check = crc32( check, reinterpret_cast<const Bytef *>( buffer ), len );
+                  if ( !sink.Parse( len, ret == Z_STREAM_END, error ) ) {
+                        inflateEnd( &zs );
+                        return kmlengine::KmlFilePtr();
+                  }
+                  if ( ret == Z_OK && len == 0 && zs.avail_in == 0 ) {
+                        inflateEnd( &zs );
+                        *error = "Truncated KMZ";
+                        return kmlengine::KmlFilePtr();
+                  }
+            }
+            inflateEnd( &zs );
+      }
+      if ( check != crc ) {
+            *error = "Bad checksum of KML in KMZ";
+            return kmlengine::KmlFilePtr();
+      }
+      return sink.Finish( error );
+}
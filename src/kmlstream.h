@@ -0,0 +1,59 @@
+/***************************************************************************
+ * $Id: kmlstream.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayKmlStream_H_
+#define _KMLOverlayKmlStream_H_
+
+#include <string>
+#include <kml/engine.h>
+
+/*    Parses KML as it is read and inflated.
+ *
+ *    Compressed input, a .kml.gz file or the document of a KMZ archive,
+ *    is inflated a buffer at a time straight into expat's own buffer, so
+ *    the uncompressed text never exists whole: what is held is the DOM
+ *    being built and BufferSize bytes of text. Plain KML is read the same
+ *    way, sparing a copy of the file.
+ *************************************************************************/
+
+class KMLOverlayKmlStream
+{
+public:
+      static const size_t BufferSize = 64 * 1024;
+
+      // KML file, gzip compressed or not
+      static kmlengine::KmlFilePtr ParseFile( const std::string &path, std::string *error );
+      // The first .kml of a KMZ archive held in memory, stored or deflated.
+      // Fails on bad XML or a damaged archive, and with unsupported set on
+      // what it can't stream (ZIP64, encryption, other methods).
+      static kmlengine::KmlFilePtr ParseKmz( const std::string &archive, bool *unsupported, std::string *error );
+      // Whether the file starts as a ZIP archive does
+      static bool IsKmzFile( const std::string &path );
+};
+
+#endif
@@ -0,0 +1,367 @@
+/***************************************************************************
+ * $Id: labels.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/dcmemory.h>
+#include <wx/image.h>
+#include <algorithm>
+#include "../../../include/ocpn_plugin.h"
+#include "labels.h"
+
+static const int AtlasSize = 1024;
+static const int Halo = 1;
+// Label bitmaps kept for DC drawing
+static const size_t MaxBitmaps = 2048;
+
+// Text coverage of white on black, and a halo one pixel around it
+static void ComputeCoverage( const unsigned char *rgb, int w, int h,
+                             std::vector<unsigned char> *text, std::vector<unsigned char> *halo )
+{
+      text->resize( (size_t)w * h );
+      halo->resize( (size_t)w * h );
+      for ( int i = 0; i < w * h; i++ )
+            (*text)[i] = rgb[i*3];
+      for ( int y = 0; y < h; y++ ) {
+            for ( int x = 0; x < w; x++ ) {
+                  unsigned char v = 0;
+                  for ( int dy = std::max( y-Halo, 0 ); dy <= std::min( y+Halo, h-1 ); dy++ )
+                        for ( int dx = std::max( x-Halo, 0 ); dx <= std::min( x+Halo, w-1 ); dx++ )
+                              v = std::max( v, (*text)[dy*w + dx] );
+                  (*halo)[y*w + x] = v;
+            }
+      }
+}
+
+KMLOverlayLabels::KMLOverlayLabels()
+      : m_font( 9, wxFONTFAMILY_SWISS, wxFONTSTYLE_NORMAL, wxFONTWEIGHT_BOLD ),
+      m_height( 0 ), m_atlas( (size_t)AtlasSize * AtlasSize * 2, 0 ),
+      m_shelf_x( 0 ), m_shelf_y( 0 ), m_shelf_height( 0 ), m_atlas_full( false ),
+      m_dirty( true ), m_texture( 0 ), m_clock( 0 )
+{
+      for ( int i = 0; i < 128; i++ )
+            m_ascii_ready[i] = false;
+
+      wxBitmap probe( 1, 1 );
+      wxMemoryDC dc;
+      dc.SelectObject( probe );
+      dc.SetFont( m_font );
+      wxCoord w, h;
+      dc.GetTextExtent( _T("Ag"), &w, &h );
+      dc.SelectObject( wxNullBitmap );
+      m_height = h;
+}
+
+std::vector<unsigned int> KMLOverlayLabels::s_orphaned_textures;
+
+KMLOverlayLabels::~KMLOverlayLabels()
+{
+      // No GL context may be current here, the next GL frame deletes it
+      if ( m_texture )
+            s_orphaned_textures.push_back( m_texture );
+}
+
+void KMLOverlayLabels::DeleteOrphanedTextures()
+{
+      if ( s_orphaned_textures.empty() )
+            return;
+      glDeleteTextures( s_orphaned_textures.size(), &s_orphaned_textures[0] );
+      s_orphaned_textures.clear();
+}
+
+void KMLOverlayLabels::Rasterize( const char *seq, size_t len, Glyph *glyph )
+{
+      wxString ch = wxString::FromUTF8( seq, len );
+      glyph->x = glyph->y = 0;
+      glyph->width = glyph->height = 0;
+      glyph->advance = 0;
+
+      wxBitmap probe( 1, 1 );
+      wxMemoryDC dc;
+      dc.SelectObject( probe );
+      dc.SetFont( m_font );
+      wxCoord w, h;
+      dc.GetTextExtent( ch, &w, &h );
+      glyph->advance = w;
+      if ( w <= 0 || ch == _T(" ") ) {
+            dc.SelectObject( wxNullBitmap );
+            return;
+      }
+
+      // Shelf packing, glyphs all have the line's height
+      int cw = w + 2 * Halo, ch_height = m_height + 2 * Halo;
+      if ( m_shelf_x + cw > AtlasSize ) {
+            m_shelf_x = 0;
+            m_shelf_y += m_shelf_height;
+            m_shelf_height = 0;
+      }
+      if ( cw > AtlasSize || m_shelf_y + ch_height > AtlasSize ) {
+            if ( !m_atlas_full )
+                  wxLogMessage( _T("KMLOverlayLabels::Rasterize glyph atlas full, some characters are left blank") );
+            m_atlas_full = true;
+            dc.SelectObject( wxNullBitmap );
+            return;
+      }
+
+      wxBitmap bitmap( cw, ch_height );
+      dc.SelectObject( bitmap );
+      dc.SetBackground( *wxBLACK_BRUSH );
+      dc.Clear();
+      dc.SetTextForeground( *wxWHITE );
+      dc.DrawText( ch, Halo, Halo );
+      dc.SelectObject( wxNullBitmap );
+
+      wxImage image = bitmap.ConvertToImage();
+      std::vector<unsigned char> text, halo;
+      ComputeCoverage( image.GetData(), cw, ch_height, &text, &halo );
+      for ( int y = 0; y < ch_height; y++ ) {
+            unsigned char *row = &m_atlas[( (size_t)( m_shelf_y + y ) * AtlasSize + m_shelf_x ) * 2];
+            for ( int x = 0; x < cw; x++ ) {
+                  row[x*2] = text[y*cw + x];
+                  row[x*2 + 1] = halo[y*cw + x];
+            }
+      }
+
+      glyph->x = m_shelf_x;
+      glyph->y = m_shelf_y;
+      glyph->width = cw;
+      glyph->height = ch_height;
+      m_shelf_x += cw;
+      m_shelf_height = std::max( m_shelf_height, ch_height );
+      m_dirty = true;
+}
+
+const KMLOverlayLabels::Glyph &KMLOverlayLabels::GetGlyph( const char **text )
+{
+      const unsigned char *p = (const unsigned char *)*text;
+      if ( *p < 0x80 ) {
+            (*text)++;
+            if ( !m_ascii_ready[*p] ) {
+                  Rasterize( (const char *)p, 1, &m_ascii[*p] );
+                  m_ascii_ready[*p] = true;
+            }
+            return m_ascii[*p];
+      }
+
+      // Keyed by the bytes of the UTF-8 sequence, never decoded
+      size_t len = *p >= 0xf0 ? 4 : *p >= 0xe0 ? 3 : *p >= 0xc0 ? 2 : 1;
+      uint32_t key = 0;
+      size_t i = 0;
+      for ( ; i < len && p[i]; i++ )
+            key = key << 8 | p[i];
+      *text += i;
+      std::map<uint32_t, Glyph>::iterator it = m_glyphs.find( key );
+      if ( it != m_glyphs.end() )
+            return it->second;
+      Glyph &glyph = m_glyphs[key];
+      Rasterize( (const char *)p, i, &glyph );
+      return glyph;
+}
+
+int KMLOverlayLabels::Measure( const char *text )
+{
+      int w = 0;
+      while ( *text )
+            w += GetGlyph( &text ).advance;
+      return w + 2 * Halo;
+}
+
+void KMLOverlayLabels::Add( const char *text, int x, int y, uint32_t colour )
+{
+      if ( !*text )
+            return;
+      Label label;
+      label.text = text;
+      label.x = x;
+      label.y = y;
+      label.colour = colour;
+      m_queue.push_back( label );
+}
+
+void KMLOverlayLabels::Flush( wxDC *dc )
+{
+      if ( m_queue.empty() )
+            return;
+      if ( dc )
+            FlushDC( dc );
+      else
+            FlushGL();
+      m_queue.clear();
+}
+
+void KMLOverlayLabels::FlushGL()
+{
+      // Glyphs first: the atlas must be complete before it is uploaded
+      m_vertices.clear();
+      m_colours.clear();
+      for ( size_t i = 0; i < m_queue.size(); i++ ) {
+            const Label &label = m_queue[i];
+            unsigned char c[4] = { (unsigned char)( label.colour >> 24 ), (unsigned char)( label.colour >> 16 ),
+                                   (unsigned char)( label.colour >> 8 ), (unsigned char)label.colour };
+            const char *text = label.text;
+            float x = label.x, y = label.y - ( m_height + 2 * Halo ) / 2;
+            while ( *text ) {
+                  const Glyph &g = GetGlyph( &text );
+                  if ( g.width ) {
+                        float u0 = (float)g.x / AtlasSize, u1 = (float)( g.x + g.width ) / AtlasSize;
+                        float v0 = (float)g.y / AtlasSize, v1 = (float)( g.y + g.height ) / AtlasSize;
+                        float quad[16] = { x, y, u0, v0,  x + g.width, y, u1, v0,
+                                           x + g.width, y + g.height, u1, v1,  x, y + g.height, u0, v1 };
+                        m_vertices.insert( m_vertices.end(), quad, quad + 16 );
+                        for ( int k = 0; k < 4; k++ )
+                              m_colours.insert( m_colours.end(), c, c + 4 );
+                  }
+                  x += g.advance;
+            }
+      }
+      if ( m_vertices.empty() )
+            return;
+
+      glPushAttrib( GL_COLOR_BUFFER_BIT | GL_ENABLE_BIT | GL_TEXTURE_BIT );
+      glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT | GL_CLIENT_PIXEL_STORE_BIT );
+      if ( !m_texture ) {
+            GLuint texture;
+            glGenTextures( 1, &texture );
+            m_texture = texture;
+            m_dirty = true;
+      }
+      glEnable( GL_TEXTURE_2D );
+      glBindTexture( GL_TEXTURE_2D, m_texture );
+      if ( m_dirty ) {
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+            glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+            glTexImage2D( GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, AtlasSize, AtlasSize, 0,
+                          GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, &m_atlas[0] );
+            m_dirty = false;
+      }
+      // Colour scaled by the text, alpha by the halo: text over a dark outline
+      glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE );
+      glEnable( GL_BLEND );
+      glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+      glEnableClientState( GL_VERTEX_ARRAY );
+      glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+      glEnableClientState( GL_COLOR_ARRAY );
+      glVertexPointer( 2, GL_FLOAT, 4 * sizeof( float ), &m_vertices[0] );
+      glTexCoordPointer( 2, GL_FLOAT, 4 * sizeof( float ), &m_vertices[2] );
+      glColorPointer( 4, GL_UNSIGNED_BYTE, 0, &m_colours[0] );
+      glDrawArrays( GL_QUADS, 0, m_vertices.size() / 4 );
+
+      glPopClientAttrib();
+      glPopAttrib();
+}
+
+const wxBitmap &KMLOverlayLabels::GetBitmap( const char *text, uint32_t colour )
+{
+      m_key.assign( text );
+      m_key.append( (const char *)&colour, sizeof( colour ) );
+      std::map<std::string, Cached>::iterator it = m_bitmaps.find( m_key );
+      if ( it != m_bitmaps.end() ) {
+            it->second.last_used = m_clock;
+            return it->second.bitmap;
+      }
+
+      wxString str = wxString::FromUTF8( text );
+      wxBitmap probe( 1, 1 );
+      wxMemoryDC dc;
+      dc.SelectObject( probe );
+      dc.SetFont( m_font );
+      wxCoord w, h;
+      dc.GetTextExtent( str, &w, &h );
+      int bw = w + 2 * Halo, bh = h + 2 * Halo;
+      wxBitmap bitmap( bw, bh );
+      dc.SelectObject( bitmap );
+      dc.SetBackground( *wxBLACK_BRUSH );
+      dc.Clear();
+      dc.SetTextForeground( *wxWHITE );
+      dc.DrawText( str, Halo, Halo );
+      dc.SelectObject( wxNullBitmap );
+
+      wxImage image = bitmap.ConvertToImage();
+      std::vector<unsigned char> coverage, halo;
+      ComputeCoverage( image.GetData(), bw, bh, &coverage, &halo );
+      image.InitAlpha();
+      unsigned char *d = image.GetData();
+      unsigned char *a = image.GetAlpha();
+      unsigned int r = colour >> 24, g = ( colour >> 16 ) & 0xff, b = ( colour >> 8 ) & 0xff, alpha = colour & 0xff;
+      for ( int i = 0; i < bw * bh; i++ ) {
+            d[i*3] = r * coverage[i] / 255;
+            d[i*3 + 1] = g * coverage[i] / 255;
+            d[i*3 + 2] = b * coverage[i] / 255;
+            a[i] = halo[i] * alpha / 255;
+      }
+
+      Cached &cached = m_bitmaps[m_key];
+      cached.bitmap = wxBitmap( image );
+      cached.last_used = m_clock;
+      return cached.bitmap;
+}
+
+void KMLOverlayLabels::FlushDC( wxDC *dc )
+{
+      for ( size_t i = 0; i < m_queue.size(); i++ ) {
+            const Label &label = m_queue[i];
+            const wxBitmap &bitmap = GetBitmap( label.text, label.colour );
+            dc->DrawBitmap( bitmap, label.x, label.y - bitmap.GetHeight() / 2, true );
+      }
+      m_clock++;
+      TrimBitmaps();
+}
+
+void KMLOverlayLabels::TrimBitmaps()
+{
+      if ( m_bitmaps.size() <= MaxBitmaps )
+            return;
+
+      // Drop the older half, what the last frame drew always stays
+      std::vector<unsigned long> ages;
+      ages.reserve( m_bitmaps.size() );
+      for ( std::map<std::string, Cached>::iterator it = m_bitmaps.begin(); it != m_bitmaps.end(); ++it )
+            ages.push_back( it->second.last_used );
+      std::nth_element( ages.begin(), ages.begin() + ages.size() / 2, ages.end() );
+      unsigned long limit = std::min( ages[ages.size() / 2], m_clock - 1 );
+      for ( std::map<std::string, Cached>::iterator it = m_bitmaps.begin(); it != m_bitmaps.end(); ) {
+            if ( it->second.last_used < limit )
+                  m_bitmaps.erase( it++ );
+            else
+                  ++it;
+      }
+}
+
+size_t KMLOverlayLabels::GetMemoryUsage()
+{
+      size_t sz = m_atlas.capacity();
+      for ( std::map<std::string, Cached>::iterator it = m_bitmaps.begin(); it != m_bitmaps.end(); ++it )
+            sz += it->first.capacity() + (size_t)it->second.bitmap.GetWidth() * it->second.bitmap.GetHeight() * 4;
+      return sz;
+}
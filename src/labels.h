@@ -0,0 +1,120 @@
+/***************************************************************************
+ * $Id: labels.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayLabels_H_
+#define _KMLOverlayLabels_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*    Placemark labels, shared by all layers.
+ *
+ *    Glyphs are rasterized once into an atlas, with a one pixel dark halo
+ *    so labels stay readable over any chart, and measured from there.
+ *    Labels are queued while a layer draws its features, then flushed:
+ *    GL draws them all from the atlas texture in a single batch of quads,
+ *    a DC gets one cached bitmap per text and colour instead. Texts are
+ *    UTF-8, straight from the scene, and must outlive the flush.
+ *************************************************************************/
+
+class KMLOverlayLabels
+{
+public:
+      KMLOverlayLabels();
+      ~KMLOverlayLabels();
+
+      int GetHeight() const { return m_height; }
+      int Measure( const char *text );
+      // The label's left edge at x, vertically centred on y. Colour is 0xRRGGBBAA.
+      void Add( const char *text, int x, int y, uint32_t colour );
+      // Draws the queued labels on dc, or with GL when NULL
+      void Flush( wxDC *dc );
+      // Drops the queued labels without drawing them
+      void Discard() { m_queue.clear(); }
+      // Deletes the atlas textures of destroyed instances, with the GL
+      // context they were made in current
+      static void DeleteOrphanedTextures();
+      size_t GetMemoryUsage();
+
+private:
+      struct Glyph
+      {
+            int x, y;               // in the atlas, halo included
+            int width, height;      // 0 when blank or the atlas is full
+            int advance;
+      };
+
+      struct Label
+      {
+            const char *text;
+            int         x, y;
+            uint32_t    colour;
+      };
+
+      struct Cached
+      {
+            wxBitmap      bitmap;
+            unsigned long last_used;
+      };
+
+      const Glyph &GetGlyph( const char **text );
+      void Rasterize( const char *seq, size_t len, Glyph *glyph );
+      void FlushDC( wxDC *dc );
+      void FlushGL();
+      const wxBitmap &GetBitmap( const char *text, uint32_t colour );
+      void TrimBitmaps();
+
+      wxFont                      m_font;
+      int                         m_height;
+      std::vector<unsigned char>  m_atlas;        // luminance: text, alpha: halo
+      int                         m_shelf_x, m_shelf_y, m_shelf_height;
+      bool                        m_atlas_full;
+      bool                        m_dirty;        // to upload before drawing
+      unsigned int                m_texture;
+      Glyph                       m_ascii[128];
+      bool                        m_ascii_ready[128];
+      std::map<uint32_t, Glyph>   m_glyphs;       // other code points, by UTF-8 bytes
+      std::vector<Label>          m_queue;
+      std::vector<float>          m_vertices;     // GL batch, x y u v per vertex
+      std::vector<unsigned char>  m_colours;
+      std::map<std::string, Cached> m_bitmaps;
+      std::string                 m_key;          // of the last lookup, keeps its capacity
+      unsigned long               m_clock;
+
+      static std::vector<unsigned int> s_orphaned_textures;
+};
+
+#endif
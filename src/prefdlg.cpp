@@ -38,7 +38,7 @@
  *
  *************************************************************************/
 
-KMLOverlayPreferencesDialog::KMLOverlayPreferencesDialog( wxWindow *parent, wxWindowID id, int interval )
+KMLOverlayPreferencesDialog::KMLOverlayPreferencesDialog( wxWindow *parent, wxWindowID id, int interval, int memory_budget, bool labels )
       :wxDialog( parent, id, _("KML overlay preferences"), wxDefaultPosition, wxDefaultSize, wxDEFAULT_DIALOG_STYLE )
 {
       Connect( wxEVT_CLOSE_WINDOW, wxCloseEventHandler( KMLOverlayPreferencesDialog::OnCloseDialog ), NULL, this );
@@ -54,12 +54,32 @@ KMLOverlayPreferencesDialog::KMLOverlayPreferencesDialog( wxWindow *parent, wxWi
       itemFlexGridSizer01->AddGrowableCol(1);
       itemStaticBoxSizer01->Add( itemFlexGridSizer01, 0, wxGROW|wxALL, 2 );
 
+      itemFlexGridSizer01->AddSpacer( 0 );
+      m_interval = interval;
+      m_pReload = new wxCheckBox( this, wxID_ANY, _("Reload files changed on disk") );
+      m_pReload->SetValue( interval > 0 );
+      itemFlexGridSizer01->Add( m_pReload, 1, wxALIGN_LEFT|wxALL, 2 );
+      Connect( m_pReload->GetId(), wxEVT_COMMAND_CHECKBOX_CLICKED, wxCommandEventHandler( KMLOverlayPreferencesDialog::OnReloadClicked ), NULL, this );
+
       wxStaticText* itemStaticText01 = new wxStaticText( this, wxID_ANY, _("Interval (minutes):"), wxDefaultPosition, wxDefaultSize, 0 );
       itemFlexGridSizer01->Add( itemStaticText01, 0, wxEXPAND|wxALL, 2 );
-      m_interval = interval;
-      m_pInterval = new wxSpinCtrl( this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxDefaultSize, wxSP_ARROW_KEYS, 1, 60, interval );
+      // Only read while reloading is enabled, -1 stays out of its range
+      m_pInterval = new wxSpinCtrl( this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxDefaultSize, wxSP_ARROW_KEYS, 1, 60, interval > 0 ? interval : 1 );
+      m_pInterval->Enable( interval > 0 );
       itemFlexGridSizer01->Add( m_pInterval, 1, wxALIGN_LEFT|wxALL, 2 );
 
+      wxStaticText* itemStaticText02 = new wxStaticText( this, wxID_ANY, _("Memory budget (MB, 0 for unlimited):"), wxDefaultPosition, wxDefaultSize, 0 );
+      itemFlexGridSizer01->Add( itemStaticText02, 0, wxEXPAND|wxALL, 2 );
+      m_memory_budget = memory_budget;
+      m_pMemoryBudget = new wxSpinCtrl( this, wxID_ANY, wxEmptyString, wxDefaultPosition, wxDefaultSize, wxSP_ARROW_KEYS, 0, 65536, memory_budget );
+      itemFlexGridSizer01->Add( m_pMemoryBudget, 1, wxALIGN_LEFT|wxALL, 2 );
+
+      itemFlexGridSizer01->AddSpacer( 0 );
+      m_labels = labels;
+      m_pLabels = new wxCheckBox( this, wxID_ANY, _("Show placemark labels") );
+      m_pLabels->SetValue( labels );
+      itemFlexGridSizer01->Add( m_pLabels, 1, wxALIGN_LEFT|wxALL, 2 );
+
       wxStdDialogButtonSizer* DialogButtonSizer = CreateStdDialogButtonSizer(wxOK|wxCANCEL);
       itemBoxSizerMainPanel->Add(DialogButtonSizer, 0, wxALIGN_RIGHT|wxALL, 5);
 
@@ -73,9 +93,16 @@ void KMLOverlayPreferencesDialog::OnCloseDialog(wxCloseEvent& event)
       event.Skip();
 }
 
+void KMLOverlayPreferencesDialog::OnReloadClicked(wxCommandEvent& event)
+{
+      m_pInterval->Enable( m_pReload->IsChecked() );
+}
+
 void KMLOverlayPreferencesDialog::SaveKMLOverlayConfig()
 {
 //      m_filename = m_pFilename->GetPath();
-      m_interval = m_pInterval->GetValue();
+      m_interval = m_pReload->IsChecked() ? m_pInterval->GetValue() : -1;
+      m_memory_budget = m_pMemoryBudget->GetValue();
+      m_labels = m_pLabels->IsChecked();
 }
 
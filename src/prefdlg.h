@@ -40,14 +40,20 @@
 class KMLOverlayPreferencesDialog : public wxDialog
 {
 public:
-      KMLOverlayPreferencesDialog( wxWindow *pparent, wxWindowID id, int interval );
+      KMLOverlayPreferencesDialog( wxWindow *pparent, wxWindowID id, int interval, int memory_budget, bool labels );
       ~KMLOverlayPreferencesDialog() {}
 
       void OnCloseDialog(wxCloseEvent& event);
+      void OnReloadClicked(wxCommandEvent& event);
       void SaveKMLOverlayConfig();
 
+      wxCheckBox       *m_pReload;
       wxSpinCtrl       *m_pInterval;
-      int m_interval;
+      wxSpinCtrl       *m_pMemoryBudget;
+      wxCheckBox       *m_pLabels;
+      int m_interval;       // -1 when files aren't reloaded
+      int m_memory_budget;
+      bool m_labels;
 
 private:
 };
@@ -0,0 +1,479 @@
+/***************************************************************************
+ * $Id: query.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "query.h"
+#include "jsonreader.h"
+
+const char *KMLOverlayQuery::MessageId = "KMLOVERLAY_QUERY";
+const char *KMLOverlayQuery::ResponseId = "KMLOVERLAY_QUERY_RESPONSE";
+
+typedef KMLOverlayScene::Bounds Bounds;
+typedef KMLOverlayScene::Coord Coord;
+
+static bool Overlaps( const Bounds &a, const Bounds &b )
+{
+      return a.south <= b.north && a.north >= b.south && a.west <= b.east && a.east >= b.west;
+}
+
+static bool IsInBox( Coord c, const Bounds &box )
+{
+      return c.lat >= box.south && c.lat <= box.north && c.lon >= box.west && c.lon <= box.east;
+}
+
+static bool IsRing( const KMLOverlayScene::Part &part )
+{
+      return part.type == KMLOverlayScene::PART_LINEARRING || part.type == KMLOverlayScene::PART_INNERRING;
+}
+
+// Sign of the turn from ab to ac. Fixed-point degrees are planar enough
+// at the scale of a route leg.
+static int Orientation( Coord a, Coord b, Coord c )
+{
+      double v = (double)( b.lon - a.lon ) * ( c.lat - a.lat ) - (double)( b.lat - a.lat ) * ( c.lon - a.lon );
+      return v > 0 ? 1 : v < 0 ? -1 : 0;
+}
+
+static bool IsOnSegment( Coord a, Coord b, Coord c )
+{
+      return std::min( a.lat, b.lat ) <= c.lat && c.lat <= std::max( a.lat, b.lat ) &&
+             std::min( a.lon, b.lon ) <= c.lon && c.lon <= std::max( a.lon, b.lon );
+}
+
+// Touching counts
+static bool SegmentsCross( Coord a, Coord b, Coord c, Coord d )
+{
+      int o1 = Orientation( a, b, c ), o2 = Orientation( a, b, d );
+      int o3 = Orientation( c, d, a ), o4 = Orientation( c, d, b );
+      if ( o1 != o2 && o3 != o4 )
+            return true;
+      return ( !o1 && IsOnSegment( a, b, c ) ) || ( !o2 && IsOnSegment( a, b, d ) ) ||
+             ( !o3 && IsOnSegment( c, d, a ) ) || ( !o4 && IsOnSegment( c, d, b ) );
+}
+
+namespace {
+
+struct BoxTest
+{
+      const Bounds &box;
+      bool operator()( Coord a, Coord b ) const
+      {
+            if ( IsInBox( a, box ) || IsInBox( b, box ) )
+                  return true;
+            Coord sw = { box.south, box.west }, nw = { box.north, box.west };
+            Coord se = { box.south, box.east }, ne = { box.north, box.east };
+            return SegmentsCross( a, b, sw, nw ) || SegmentsCross( a, b, nw, ne ) ||
+                   SegmentsCross( a, b, ne, se ) || SegmentsCross( a, b, se, sw );
+      }
+};
+
+struct SegmentTest
+{
+      Coord  c, d;
+      Bounds leg;       // of cd, rejects most segments before any product
+      bool operator()( Coord a, Coord b ) const
+      {
+            if ( std::max( a.lat, b.lat ) < leg.south || std::min( a.lat, b.lat ) > leg.north ||
+                 std::max( a.lon, b.lon ) < leg.west || std::min( a.lon, b.lon ) > leg.east )
+                  return false;
+            return SegmentsCross( a, b, c, d );
+      }
+};
+
+// Even-odd rule, a ray towards the east
+struct RayTest
+{
+      Coord pt;
+      bool  inside;
+      bool operator()( Coord a, Coord b )
+      {
+            if ( ( a.lat > pt.lat ) != ( b.lat > pt.lat ) &&
+                 pt.lon < (double)( b.lon - a.lon ) * ( pt.lat - a.lat ) / ( b.lat - a.lat ) + a.lon )
+                  inside = !inside;
+            return false;
+      }
+};
+
+}
+
+// Calls test on the segments of a part, only decoding the chunks meeting
+// box, until it returns true. Rings are closed as the formats require.
+template <class Test>
+static bool AnySegment( const KMLOverlayScene &scene, size_t idx, const KMLOverlayScene::Part &part,
+                        const Bounds &box, Test &test )
+{
+      if ( part.count < 2 )
+            return false;
+      Coord a, b;
+      uint32_t count;
+      const KMLOverlayScene::Chunk *chunks = scene.GetChunks( idx, &count );
+      if ( !chunks ) {
+            KMLOverlayScene::CoordReader coords( scene, part );
+            coords.NextFixed( &a.lat, &a.lon );
+            while ( coords.NextFixed( &b.lat, &b.lon ) ) {
+                  if ( test( a, b ) )
+                        return true;
+                  a = b;
+            }
+            return false;
+      }
+      for ( uint32_t k = 0; k < count; k++ ) {
+            if ( !Overlaps( chunks[k].box, box ) )
+                  continue;
+            uint32_t last = k+1 < count ? chunks[k+1].first : part.count - 1;
+            KMLOverlayScene::CoordReader coords( scene, part, chunks[k] );
+            coords.NextFixed( &a.lat, &a.lon );
+            for ( uint32_t i = chunks[k].first; i < last && coords.NextFixed( &b.lat, &b.lon ); i++ ) {
+                  if ( test( a, b ) )
+                        return true;
+                  a = b;
+            }
+      }
+      return false;
+}
+
+static bool ItemLess( const KMLOverlayScene::PickItem *a, const KMLOverlayScene::PickItem *b )
+{
+      return a->feature < b->feature;
+}
+
+static Coord FirstCoord( const KMLOverlayScene &scene, const KMLOverlayScene::Part &part )
+{
+      Coord c = { 0, 0 };
+      KMLOverlayScene::CoordReader coords( scene, part );
+      coords.NextFixed( &c.lat, &c.lon );
+      return c;
+}
+
+bool KMLOverlayQuery::MatchPoint( const KMLOverlayScene &scene, const KMLOverlayScene::Feature &feature, Coord pt )
+{
+      // Over all the rings, as polygons and their holes are drawn
+      RayTest test = { pt, false };
+      Bounds ray;
+      ray.Extend( pt.lat, pt.lon );
+      ray.east = INT32_MAX;
+      for ( uint32_t i = 0; i < feature.part_count; i++ ) {
+            const KMLOverlayScene::Part &part = scene.GetPart( feature.first_part + i );
+            if ( IsRing( part ) )
+                  AnySegment( scene, feature.first_part + i, part, ray, test );
+      }
+      return test.inside;
+}
+
+bool KMLOverlayQuery::MatchBox( const KMLOverlayScene &scene, const KMLOverlayScene::Feature &feature, const Bounds &box )
+{
+      BoxTest test = { box };
+      bool rings = false;
+      for ( uint32_t i = 0; i < feature.part_count; i++ ) {
+            const KMLOverlayScene::Part &part = scene.GetPart( feature.first_part + i );
+            if ( !part.count )
+                  continue;
+            if ( part.type == KMLOverlayScene::PART_POINT || part.count == 1 ) {
+                  if ( IsInBox( FirstCoord( scene, part ), box ) )
+                        return true;
+                  continue;
+            }
+            if ( AnySegment( scene, feature.first_part + i, part, box, test ) )
+                  return true;
+            rings |= IsRing( part );
+      }
+      // No edge reaches the box, which may still lie inside a polygon
+      Coord corner = { box.south, box.west };
+      return rings && MatchPoint( scene, feature, corner );
+}
+
+bool KMLOverlayQuery::MatchLine( const KMLOverlayScene &scene, const KMLOverlayScene::PickItem &item, const Request &request )
+{
+      const KMLOverlayScene::Feature &feature = scene.GetFeature( item.feature );
+      bool rings = false;
+      for ( uint32_t i = 0; i < feature.part_count; i++ ) {
+            const KMLOverlayScene::Part &part = scene.GetPart( feature.first_part + i );
+            if ( part.type == KMLOverlayScene::PART_POINT || part.count < 2 )
+                  continue;
+            rings |= IsRing( part );
+            for ( size_t j = 1; j < request.points.size(); j++ ) {
+                  SegmentTest test;
+                  test.c = request.points[j-1];
+                  test.d = request.points[j];
+                  test.leg.Extend( test.c.lat, test.c.lon );
+                  test.leg.Extend( test.d.lat, test.d.lon );
+                  // Only the legs passing by the placemark
+                  if ( Overlaps( test.leg, item.box ) && AnySegment( scene, feature.first_part + i, part, test.leg, test ) )
+                        return true;
+            }
+      }
+      // Crossing no edge, the line is either all inside or all outside
+      return rings && MatchPoint( scene, feature, request.points[0] );
+}
+
+void KMLOverlayQuery::Run( const KMLOverlayScene &scene, const Request &request, size_t limit, std::vector<uint32_t> *features )
+{
+      features->clear();
+      if ( !Overlaps( scene.GetBounds(), request.box ) )
+            return;
+
+      // A leg at a time for lines, a diagonal route has a large box
+      m_candidates.clear();
+      if ( request.type == QUERY_LINE ) {
+            for ( size_t j = 1; j < request.points.size(); j++ ) {
+                  Bounds leg;
+                  leg.Extend( request.points[j-1].lat, request.points[j-1].lon );
+                  leg.Extend( request.points[j].lat, request.points[j].lon );
+                  scene.QueryBounds( leg, &m_items );
+                  m_candidates.insert( m_candidates.end(), m_items.begin(), m_items.end() );
+            }
+      } else {
+            scene.QueryBounds( request.box, &m_candidates );
+      }
+      // Placemarks have one item each, answered by increasing index
+      std::sort( m_candidates.begin(), m_candidates.end(), ItemLess );
+      m_candidates.erase( std::unique( m_candidates.begin(), m_candidates.end() ), m_candidates.end() );
+
+      for ( size_t i = 0; i < m_candidates.size() && features->size() < limit; i++ ) {
+            const KMLOverlayScene::PickItem &item = *m_candidates[i];
+            const KMLOverlayScene::Feature &feature = scene.GetFeature( item.feature );
+            bool match = false;
+            switch ( request.type ) {
+            case QUERY_BBOX:
+                  match = MatchBox( scene, feature, request.box );
+            break;
+            case QUERY_POINT:
+                  match = MatchPoint( scene, feature, request.points[0] );
+            break;
+            case QUERY_LINE:
+                  match = MatchLine( scene, item, request );
+            break;
+            }
+            if ( match )
+                  features->push_back( item.feature );
+      }
+}
+
+const char *KMLOverlayQuery::GetGeometryName( const KMLOverlayScene &scene, uint32_t feature )
+{
+      const KMLOverlayScene::Feature &f = scene.GetFeature( feature );
+      const char *name = NULL;
+      for ( uint32_t i = 0; i < f.part_count; i++ ) {
+            const KMLOverlayScene::Part &part = scene.GetPart( f.first_part + i );
+            const char *part_name = part.type == KMLOverlayScene::PART_POINT ? "point" : IsRing( part ) ? "polygon" : "line";
+            if ( name && strcmp( name, part_name ) )
+                  return "mixed";
+            name = part_name;
+      }
+      return name ? name : "mixed";
+}
+
+void KMLOverlayQuery::AppendString( std::string *json, const char *text )
+{
+      json->push_back( '"' );
+      for ( const char *p = text; *p; p++ ) {
+            unsigned char c = *p;
+            if ( c == '"' || c == '\\' ) {
+                  json->push_back( '\\' );
+                  json->push_back( c );
+            } else if ( c < 0x20 ) {
+                  char escape[8];
+                  snprintf( escape, sizeof( escape ), "\\u%04x", c );
+                  *json += escape;
+            } else {
+                  json->push_back( c );
+            }
+      }
+      json->push_back( '"' );
+}
+
+// {"lat": ..., "lon": ...}
+static bool ReadLatLon( KMLOverlayJsonReader &reader, Coord *coord )
+{
+      std::string key;
+      double lat = 0, lon = 0;
+      int found = 0;
+      if ( !reader.Expect( '{' ) )
+            return false;
+      if ( reader.PeekToken() == '}' )
+            return reader.Fail( "expected lat and lon" );
+      for ( ;; ) {
+            if ( !reader.ReadString( &key ) || !reader.Expect( ':' ) )
+                  return false;
+            bool ok;
+            if ( key == "lat" ) {
+                  ok = reader.ReadNumber( &lat );
+                  found |= 1;
+            } else if ( key == "lon" ) {
+                  ok = reader.ReadNumber( &lon );
+                  found |= 2;
+            } else {
+                  ok = reader.SkipValue( 2 );
+            }
+            if ( !ok )
+                  return false;
+            int next = reader.GetToken();
+            if ( next == '}' )
+                  break;
+            if ( next != ',' )
+                  return reader.Fail( "expected ',' or '}'" );
+      }
+      if ( found != 3 || lat < -90 || lat > 90 || lon < -180 || lon > 180 )
+            return reader.Fail( "expected lat and lon within range" );
+      coord->lat = KMLOverlayScene::ToFixed( lat );
+      coord->lon = KMLOverlayScene::ToFixed( lon );
+      return true;
+}
+
+static bool ReadBox( KMLOverlayJsonReader &reader, Bounds *box )
+{
+      std::string key;
+      double v[4];
+      int found = 0;
+      static const char *names[4] = { "south", "west", "north", "east" };
+      if ( !reader.Expect( '{' ) )
+            return false;
+      if ( reader.PeekToken() == '}' )
+            return reader.Fail( "expected south, west, north and east" );
+      for ( ;; ) {
+            if ( !reader.ReadString( &key ) || !reader.Expect( ':' ) )
+                  return false;
+            int i = 0;
+            while ( i < 4 && key != names[i] )
+                  i++;
+            if ( !( i < 4 ? reader.ReadNumber( &v[i] ) : reader.SkipValue( 2 ) ) )
+                  return false;
+            if ( i < 4 )
+                  found |= 1 << i;
+            int next = reader.GetToken();
+            if ( next == '}' )
+                  break;
+            if ( next != ',' )
+                  return reader.Fail( "expected ',' or '}'" );
+      }
+      // No wrapping across the antimeridian, as for the scenes' bounds
+      if ( found != 15 || v[0] > v[2] || v[1] > v[3] )
+            return reader.Fail( "expected south <= north and west <= east" );
+      box->Extend( KMLOverlayScene::ToFixed( v[0] ), KMLOverlayScene::ToFixed( v[1] ) );
+      box->Extend( KMLOverlayScene::ToFixed( v[2] ), KMLOverlayScene::ToFixed( v[3] ) );
+      return true;
+}
+
+bool KMLOverlayQuery::ParseRequest( const std::string &json, Request *request, std::string *error )
+{
+      KMLOverlayJsonReader reader( json );
+      std::string key, type;
+      request->id = "null";
+      request->box = Bounds();
+      request->points.clear();
+      request->layers.clear();
+      request->limit = DefaultLimit;
+
+      bool ok = reader.Expect( '{' );
+      if ( ok && reader.PeekToken() == '}' )
+            ok = reader.Fail( "empty request" );
+      while ( ok ) {
+            if ( !reader.ReadString( &key ) || !reader.Expect( ':' ) ) {
+                  ok = false;
+                  break;
+            }
+            int c = reader.PeekToken();
+            if ( key == "id" && c == '"' ) {
+                  std::string id;
+                  ok = reader.ReadString( &id );
+                  request->id.clear();
+                  AppendString( &request->id, id.c_str() );
+            } else if ( key == "id" && ( c == '-' || ( c >= '0' && c <= '9' ) ) ) {
+                  double v;
+                  ok = reader.ReadNumber( &v );
+                  char text[32];
+                  snprintf( text, sizeof( text ), "%.17g", v );
+                  request->id = text;
+            } else if ( key == "type" ) {
+                  ok = reader.ReadString( &type );
+            } else if ( key == "bbox" ) {
+                  ok = ReadBox( reader, &request->box );
+            } else if ( key == "point" ) {
+                  Coord pt;
+                  ok = ReadLatLon( reader, &pt );
+                  request->points.assign( 1, pt );
+            } else if ( key == "line" ) {
+                  request->points.clear();
+                  ok = reader.Expect( '[' );
+                  while ( ok && reader.PeekToken() != ']' ) {
+                        Coord pt;
+                        ok = ReadLatLon( reader, &pt );
+                        request->points.push_back( pt );
+                        if ( ok && reader.PeekToken() == ',' )
+                              reader.GetToken();
+                  }
+                  ok = ok && reader.Expect( ']' );
+            } else if ( key == "layers" ) {
+                  ok = reader.Expect( '[' );
+                  while ( ok && reader.PeekToken() != ']' ) {
+                        std::string layer;
+                        ok = reader.ReadString( &layer );
+                        request->layers.push_back( layer );
+                        if ( ok && reader.PeekToken() == ',' )
+                              reader.GetToken();
+                  }
+                  ok = ok && reader.Expect( ']' );
+            } else if ( key == "limit" ) {
+                  double v;
+                  ok = reader.ReadNumber( &v );
+                  request->limit = v < 0 ? 0 : v > 1e9 ? 1000000000 : (size_t)v;
+            } else {
+                  ok = reader.SkipValue( 1 );
+            }
+            if ( !ok )
+                  break;
+            int next = reader.GetToken();
+            if ( next == '}' )
+                  break;
+            if ( next != ',' )
+                  ok = reader.Fail( "expected ',' or '}'" );
+      }
+      if ( !ok ) {
+            *error = reader.GetError();
+            return false;
+      }
+
+      if ( type == "bbox" && !request->box.IsEmpty() ) {
+            request->type = QUERY_BBOX;
+      } else if ( type == "point" && request->points.size() == 1 ) {
+            request->type = QUERY_POINT;
+            request->box = Bounds();
+            request->box.Extend( request->points[0].lat, request->points[0].lon );
+      } else if ( type == "line" && request->points.size() >= 2 ) {
+            request->type = QUERY_LINE;
+            request->box = Bounds();
+            for ( size_t i = 0; i < request->points.size(); i++ )
+                  request->box.Extend( request->points[i].lat, request->points[i].lon );
+      } else {
+            *error = "expected a bbox, point or line query with its geometry";
+            return false;
+      }
+      return true;
+}
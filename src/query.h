@@ -0,0 +1,103 @@
+/***************************************************************************
+ * $Id: query.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayQuery_H_
+#define _KMLOverlayQuery_H_
+
+#include <string>
+#include <vector>
+#include "scene.h"
+
+/*    Spatial queries from other plugins, over the loaded layers.
+ *
+ *    Requests come as JSON through OpenCPN's plugin messages (see
+ *    MessageId) and are answered the same way, ResponseId carrying the
+ *    request's "id" back:
+ *
+ *      {"id": 1, "type": "bbox", "bbox": {"south": 47, "west": -5, "north": 48, "east": -4}}
+ *      {"id": 2, "type": "point", "point": {"lat": 47.5, "lon": -4.5}}
+ *      {"id": 3, "type": "line", "line": [{"lat": 47.5, "lon": -4.5}, {"lat": 47.6, "lon": -4.2}]}
+ *
+ *    with optional "layers", an array of file names to restrict the
+ *    query to, and "limit", the most placemarks returned (DefaultLimit).
+ *    A bbox matches placemarks with any part in the box, a point the
+ *    polygons containing it, a line those whose lines or ring edges it
+ *    crosses and the polygons it lies in.
+ *
+ *    Candidates come from each scene's spatial index, then only the
+ *    chunks of their parts near the query are decoded: nothing is copied
+ *    and a query over indexed layers takes microseconds. Layers unloaded
+ *    to save memory are named in the answer rather than loaded.
+ *************************************************************************/
+
+class KMLOverlayQuery
+{
+public:
+      static const char *MessageId;
+      static const char *ResponseId;
+      static const size_t DefaultLimit = 1000;
+
+      enum Type
+      {
+            QUERY_BBOX,
+            QUERY_POINT,
+            QUERY_LINE
+      };
+
+      struct Request
+      {
+            std::string              id;        // as JSON, echoed back
+            Type                     type;
+            KMLOverlayScene::Bounds  box;       // of the whole query
+            std::vector<KMLOverlayScene::Coord> points;   // the point, or the line's vertices
+            std::vector<std::string> layers;    // UTF-8 file names, all when empty
+            size_t                   limit;
+      };
+
+      // False with error set when the request is malformed
+      static bool ParseRequest( const std::string &json, Request *request, std::string *error );
+
+      // Placemarks of scene matching the request, by increasing index,
+      // no more than limit. Scratch space is kept from one call to the next.
+      void Run( const KMLOverlayScene &scene, const Request &request, size_t limit, std::vector<uint32_t> *features );
+
+      // JSON string literal of UTF-8 text
+      static void AppendString( std::string *json, const char *text );
+      // "point", "line", "polygon" or "mixed"
+      static const char *GetGeometryName( const KMLOverlayScene &scene, uint32_t feature );
+
+private:
+      bool MatchBox( const KMLOverlayScene &scene, const KMLOverlayScene::Feature &feature, const KMLOverlayScene::Bounds &box );
+      bool MatchPoint( const KMLOverlayScene &scene, const KMLOverlayScene::Feature &feature, KMLOverlayScene::Coord pt );
+      bool MatchLine( const KMLOverlayScene &scene, const KMLOverlayScene::PickItem &item, const Request &request );
+
+      std::vector<const KMLOverlayScene::PickItem *> m_items;
+      std::vector<const KMLOverlayScene::PickItem *> m_candidates;
+};
+
+#endif
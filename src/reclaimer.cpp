@@ -0,0 +1,124 @@
+/***************************************************************************
+ * $Id: reclaimer.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include "reclaimer.h"
+
+KMLOverlayReclaimer::KMLOverlayReclaimer()
+      : m_cond( m_mutex ), m_stop( false )
+{
+      m_thread = new Thread( this );
+      if ( m_thread->Create() != wxTHREAD_NO_ERROR || m_thread->Run() != wxTHREAD_NO_ERROR )
+      {
+            wxLogMessage( _T("KMLOverlayReclaimer: failed to start thread, scenes are freed by the UI thread") );
+            delete m_thread;
+            m_thread = NULL;
+      }
+}
+
+KMLOverlayReclaimer::~KMLOverlayReclaimer()
+{
+      if ( m_thread )
+      {
+            {
+                  wxMutexLocker lock( m_mutex );
+                  m_stop = true;
+                  m_cond.Signal();
+            }
+            m_thread->Wait();
+            delete m_thread;
+      }
+      for ( size_t i = 0; i < m_retired.size(); i++ )
+            delete m_retired[i];
+      for ( size_t i = 0; i < m_ready.size(); i++ )
+            delete m_ready[i];
+}
+
+void KMLOverlayReclaimer::Retire( KMLOverlayScene *scene )
+{
+      if ( !scene )
+            return;
+
+      wxMutexLocker lock( m_mutex );
+      m_retired.push_back( scene );
+}
+
+void KMLOverlayReclaimer::Quiescent()
+{
+      std::vector<KMLOverlayScene *> ready;
+      {
+            wxMutexLocker lock( m_mutex );
+
+            m_ready.insert( m_ready.end(), m_retired.begin(), m_retired.end() );
+            m_retired.clear();
+
+            if ( m_ready.empty() )
+                  return;
+            if ( m_thread )
+            {
+                  m_cond.Signal();
+                  return;
+            }
+            ready.swap( m_ready );
+      }
+      for ( size_t i = 0; i < ready.size(); i++ )
+            delete ready[i];
+}
+
+bool KMLOverlayReclaimer::WaitReady( std::vector<KMLOverlayScene *> *ready )
+{
+      wxMutexLocker lock( m_mutex );
+      while ( !m_stop && m_ready.empty() )
+            m_cond.Wait();
+      ready->swap( m_ready );
+      return !m_stop;
+}
+
+KMLOverlayReclaimer::Thread::Thread( KMLOverlayReclaimer *reclaimer )
+      : wxThread( wxTHREAD_JOINABLE ), m_reclaimer( reclaimer )
+{
+}
+
+wxThread::ExitCode KMLOverlayReclaimer::Thread::Entry()
+{
+      std::vector<KMLOverlayScene *> ready;
+      bool more;
+      do
+      {
+            more = m_reclaimer->WaitReady( &ready );
+            for ( size_t i = 0; i < ready.size(); i++ )
+                  delete ready[i];
+            ready.clear();
+      } while ( more );
+      return 0;
+}
@@ -0,0 +1,84 @@
+/***************************************************************************
+ * $Id: reclaimer.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayReclaimer_H_
+#define _KMLOverlayReclaimer_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/thread.h>
+#include <vector>
+#include "scene.h"
+
+/*    Deferred reclamation of scenes replaced while they may be drawn.
+ *
+ *    Scenes are published through an atomic pointer and read by the UI
+ *    thread without locking. A replaced scene is retired here, from any
+ *    thread, and freed on our own thread once the UI thread, the only
+ *    reader, has reported a quiescent state: it holds no scene pointer
+ *    across that call, so anything retired before can't be in use.
+ *    Freeing a large scene then never stalls a paint.
+ *************************************************************************/
+
+class KMLOverlayReclaimer
+{
+public:
+      KMLOverlayReclaimer();
+      // Frees whatever is left, no reader may remain
+      ~KMLOverlayReclaimer();
+
+      void Retire( KMLOverlayScene *scene );
+      // UI thread only, outside of any use of a scene snapshot
+      void Quiescent();
+
+private:
+      class Thread : public wxThread
+      {
+      public:
+            Thread( KMLOverlayReclaimer *reclaimer );
+      protected:
+            ExitCode Entry();
+      private:
+            KMLOverlayReclaimer *m_reclaimer;
+      };
+
+      bool WaitReady( std::vector<KMLOverlayScene *> *ready );
+
+      wxMutex                        m_mutex;
+      wxCondition                    m_cond;
+      std::vector<KMLOverlayScene *> m_retired;     // waiting for a grace period
+      std::vector<KMLOverlayScene *> m_ready;       // safe to free
+      bool                           m_stop;
+      Thread                        *m_thread;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/***************************************************************************
+ * $Id: renderqueue.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayRenderQueue_H_
+#define _KMLOverlayRenderQueue_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <vector>
+#include <chrono>
+#include "viewcache.h"
+#include "labels.h"
+
+/*    One frame of all layers, drawn in a single pass.
+ *
+ *    Layers record their frame, or find it in their view cache, and queue
+ *    it here instead of drawing it. Once every layer is queued, the
+ *    backend sets its state up once and the records are drawn in layer
+ *    order, each with its labels on top. Consecutive lines of a layer
+ *    sharing a pen go to the backend as a single batch. Icons and labels
+ *    are drawn from what all layers share: the glyph atlas of
+ *    KMLOverlayLabels and the pixels kept by KMLOverlayScratch.
+ *************************************************************************/
+
+class KMLOverlayRenderQueue
+{
+public:
+      struct Item
+      {
+            KMLOverlayViewCache::Entry *entry;
+            int                         layer;          // the caller's, to hand the results back
+            unsigned long long          image_bytes;    // once drawn
+            double                      ms;             // drawing time, when timed
+      };
+
+      KMLOverlayRenderQueue() : m_timed( false ) {}
+
+      void Clear() { m_items.clear(); }
+      // Drawn after the records already queued
+      void Add( KMLOverlayViewCache::Entry *entry, int layer );
+      // Drawing times are only measured while enabled
+      void SetTimed( bool timed ) { m_timed = timed; }
+      template <class Backend> void Flush( Backend &backend, KMLOverlayLabels *labels );
+      size_t GetCount() const { return m_items.size(); }
+      const Item &GetItem( size_t i ) const { return m_items[i]; }
+
+private:
+      template <class Backend> unsigned long long Draw( KMLOverlayViewCache::Entry &entry, Backend &backend,
+                                                        KMLOverlayLabels *labels );
+
+      std::vector<Item> m_items;
+      std::vector<int>  m_counts;     // of a batch of lines, kept to spare allocations
+      bool              m_timed;
+};
+
+template <class Backend>
+void KMLOverlayRenderQueue::Flush( Backend &backend, KMLOverlayLabels *labels )
+{
+      if ( m_items.empty() )
+            return;
+      backend.Begin();
+      for ( size_t i = 0; i < m_items.size(); i++ ) {
+            Item &item = m_items[i];
+            std::chrono::steady_clock::time_point start;
+            if ( m_timed )
+                  start = std::chrono::steady_clock::now();
+            item.image_bytes = Draw( *item.entry, backend, labels );
+            if ( m_timed )
+                  item.ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+      }
+      backend.End();
+}
+
+template <class Backend>
+unsigned long long KMLOverlayRenderQueue::Draw( KMLOverlayViewCache::Entry &entry, Backend &backend,
+                                                KMLOverlayLabels *labels )
+{
+      typedef KMLOverlayViewCache::Primitive Primitive;
+      unsigned long long bytes = 0;
+      size_t n = entry.primitives.size();
+      for ( size_t i = 0; i < n; ) {
+            const Primitive &p = entry.primitives[i];
+            switch ( p.op ) {
+            case Primitive::LINES: {
+                  // Recorded one after the other, so are their points
+                  uint32_t next = p.first + p.count;
+                  m_counts.clear();
+                  m_counts.push_back( p.count );
+                  while ( ++i < n && entry.primitives[i].op == Primitive::LINES && entry.primitives[i].first == next
+                        && entry.primitives[i].pen == p.pen ) {
+                        m_counts.push_back( entry.primitives[i].count );
+                        next += entry.primitives[i].count;
+                  }
+                  backend.DrawPolylines( p.pen, m_counts.size(), &m_counts[0], &entry.points[p.first] );
+                  continue;
+            }
+            case Primitive::POLYGON:
+                  backend.DrawPolygon( p.pen, p.brush, p.count, &entry.points[p.first] );
+            break;
+            case Primitive::POLYPOLYGON:
+                  backend.DrawPolyPolygon( p.pen, p.brush, p.count, &entry.counts[p.rings], &entry.points[p.first] );
+            break;
+            case Primitive::BITMAP:
+                  bytes += backend.DrawBitmap( entry.bitmaps[p.first], p.x, p.y, p.usemask );
+            break;
+            }
+            i++;
+      }
+      // Above the layer's features, under the next layers
+      for ( size_t i = 0; i < entry.labels.size(); i++ ) {
+            const KMLOverlayViewCache::Label &l = entry.labels[i];
+            backend.AddLabel( labels, l.text, l.x, l.y, l.colour );
+      }
+      backend.DrawLabels( labels );
+      return bytes;
+}
+
+#endif
@@ -0,0 +1,1119 @@
+/***************************************************************************
+ * $Id: scene.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "scene.h"
+
+const double KMLOverlayScene::CoordScale = 1e7;
+
+// Children per node of the spatial index
+static const size_t PickNodeSize = 16;
+
+static void WriteVarint( std::vector<uint8_t> &out, uint32_t v )
+{
+      while ( v >= 0x80 ) {
+            out.push_back( (uint8_t)(v | 0x80) );
+            v >>= 7;
+      }
+      out.push_back( (uint8_t)v );
+}
+
+// Chunks of a part of count coordinates, none when it has no more than
+// two chunks' worth of segments
+static uint32_t ChunkCount( uint32_t count )
+{
+      const uint32_t size = KMLOverlayScene::ChunkSize;
+      return count > 2 * size ? ( count - 2 ) / size + 1 : 0;
+}
+
+static uint32_t EncodeZigZag( int32_t v )
+{
+      return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+bool KMLOverlayScene::Style::operator<( const Style &other ) const
+{
+      if ( line_colour != other.line_colour ) return line_colour < other.line_colour;
+      if ( line_width != other.line_width ) return line_width < other.line_width;
+      if ( ring_colour != other.ring_colour ) return ring_colour < other.ring_colour;
+      if ( ring_width != other.ring_width ) return ring_width < other.ring_width;
+      if ( fill_colour != other.fill_colour ) return fill_colour < other.fill_colour;
+      if ( ring_stroke != other.ring_stroke ) return ring_stroke < other.ring_stroke;
+      if ( ring_fill != other.ring_fill ) return ring_fill < other.ring_fill;
+      if ( icon != other.icon ) return icon < other.icon;
+      if ( icon_scale != other.icon_scale ) return icon_scale < other.icon_scale;
+      if ( label_colour != other.label_colour ) return label_colour < other.label_colour;
+      return label_scale < other.label_scale;
+}
+
+int32_t KMLOverlayScene::ToFixed( double deg )
+{
+      // Longitudes may come slightly out of [-180,180], clamp to int32 range
+      double v = floor( deg * CoordScale + 0.5 );
+      if ( v > 2147483647.0 ) v = 2147483647.0;
+      if ( v < -2147483648.0 ) v = -2147483648.0;
+      return (int32_t)v;
+}
+
+KMLOverlayScene::KMLOverlayScene()
+      : m_vertex_count( 0 ), m_packed( false )
+{
+}
+
+KMLOverlayScene::KMLOverlayScene( const KMLOverlayScene &other, bool packed )
+      : m_features( other.m_features ), m_parts( other.m_parts ), m_styles( other.m_styles ),
+      m_overlays( other.m_overlays ), m_regions( other.m_regions ), m_icons( other.m_icons ),
+      m_links( other.m_links ), m_times( other.m_times ), m_time_max( other.m_time_max ),
+      m_sample_times( other.m_sample_times ), m_tracks( other.m_tracks ), m_chunks( other.m_chunks ),
+      m_chunked( other.m_chunked ), m_pick_items( other.m_pick_items ), m_pick_nodes( other.m_pick_nodes ),
+      m_pick_levels( other.m_pick_levels ), m_pick_times( other.m_pick_times ), m_texts( other.m_texts ),
+      m_text_index( other.m_text_index ), m_style_index( other.m_style_index ), m_open( other.m_open ),
+      m_bounds( other.m_bounds ), m_vertex_count( other.m_vertex_count ), m_packed( packed )
+{
+      if ( packed == other.m_packed ) {
+            m_coords = other.m_coords;
+            m_bytes = other.m_bytes;
+      } else if ( packed ) {
+            PackFrom( other.m_coords );
+      } else {
+            UnpackFrom( other );
+      }
+}
+
+uint32_t KMLOverlayScene::AddStyle( const Style &style )
+{
+      std::map<Style, uint32_t>::const_iterator it = m_style_index.find( style );
+      if ( it != m_style_index.end() )
+            return it->second;
+
+      uint32_t idx = m_styles.size();
+      m_styles.push_back( style );
+      m_style_index[style] = idx;
+      return idx;
+}
+
+uint32_t KMLOverlayScene::AddIcon( const std::string &href )
+{
+      for ( size_t i = 0; i < m_icons.size(); i++ )
+            if ( m_icons[i] == href )
+                  return i;
+      m_icons.push_back( href );
+      return m_icons.size()-1;
+}
+
+uint64_t KMLOverlayScene::Hash( const void *data, size_t len, uint64_t seed )
+{
+      // FNV-1a
+      const uint8_t *p = (const uint8_t *)data;
+      uint64_t h = seed;
+      for ( size_t i = 0; i < len; i++ ) {
+            h ^= p[i];
+            h *= 1099511628211ULL;
+      }
+      return h;
+}
+
+uint32_t KMLOverlayScene::AddRegion( const Region &region )
+{
+      m_regions.push_back( region );
+      m_regions.back().vertices = 0;
+      return m_regions.size()-1;
+}
+
+size_t KMLOverlayScene::BeginFeature( FeatureType type, uint32_t style, uint64_t key, uint32_t region )
+{
+      Feature f;
+      f.type = type;
+      f.timed = 0;
+      f.end = 0;
+      f.first_part = m_parts.size();
+      f.part_count = 0;
+      f.style = style;
+      f.region = region;
+      f.key = key;
+      f.digest = 0;
+      // Counted up to here, EndFeature turns it into the subtree count
+      if ( region != NoRegion )
+            m_regions[region].vertices = m_vertex_count;
+      m_features.push_back( f );
+      m_open.push_back( m_features.size()-1 );
+      return m_features.size()-1;
+}
+
+void KMLOverlayScene::EndFeature( size_t idx )
+{
+      Feature &f = m_features[idx];
+      f.end = m_features.size();
+      if ( f.type != FEATURE_GROUNDOVERLAY && f.type != FEATURE_NETWORKLINK )
+            f.part_count = m_parts.size() - f.first_part;
+
+      if ( f.type == FEATURE_PLACEMARK ) {
+            const Style &s = m_styles[f.style];
+            uint64_t h = Hash( &s.line_colour, sizeof( s.line_colour ) );
+            h = Hash( &s.line_width, sizeof( s.line_width ), h );
+            h = Hash( &s.ring_colour, sizeof( s.ring_colour ), h );
+            h = Hash( &s.ring_width, sizeof( s.ring_width ), h );
+            h = Hash( &s.fill_colour, sizeof( s.fill_colour ), h );
+            h = Hash( &s.ring_stroke, sizeof( s.ring_stroke ), h );
+            h = Hash( &s.ring_fill, sizeof( s.ring_fill ), h );
+            h = Hash( &s.icon_scale, sizeof( s.icon_scale ), h );
+            h = Hash( &s.label_colour, sizeof( s.label_colour ), h );
+            h = Hash( &s.label_scale, sizeof( s.label_scale ), h );
+            if ( s.icon != NoIcon )
+                  h = Hash( m_icons[s.icon].data(), m_icons[s.icon].size(), h );
+            for ( uint32_t i = 0; i < f.part_count; i++ ) {
+                  const Part &p = m_parts[f.first_part + i];
+                  h = Hash( &p.type, sizeof( p.type ), h );
+                  h = Hash( &p.count, sizeof( p.count ), h );
+                  if ( p.count )
+                        h = Hash( &m_coords[p.first], p.count * sizeof( Coord ), h );
+                  if ( p.type == PART_TRACK && p.count )
+                        h = Hash( GetTrackTimes( f.first_part + i ), p.count * sizeof( int64_t ), h );
+            }
+            f.digest = h;
+      }
+      if ( f.region != NoRegion ) {
+            Region &r = m_regions[f.region];
+            r.vertices = m_vertex_count - r.vertices;
+            uint64_t h = Hash( &r.box, sizeof( r.box ), f.digest );
+            h = Hash( &r.min_lod, sizeof( r.min_lod ), h );
+            f.digest = Hash( &r.max_lod, sizeof( r.max_lod ), h );
+      }
+      if ( !m_open.empty() && m_open.back() == idx )
+            m_open.pop_back();
+}
+
+size_t KMLOverlayScene::AddGroundOverlay( const GroundOverlay &overlay )
+{
+      m_overlays.push_back( overlay );
+      m_bounds.Extend( ToFixed( overlay.south ), ToFixed( overlay.west ) );
+      m_bounds.Extend( ToFixed( overlay.north ), ToFixed( overlay.east ) );
+      if ( !m_open.empty() ) {
+            Feature &f = m_features[m_open.back()];
+            f.first_part = m_overlays.size()-1;
+            uint64_t h = Hash( &overlay.north, sizeof( double ) * 4 );
+            h = Hash( &overlay.alpha, sizeof( overlay.alpha ), h );
+            f.digest = Hash( overlay.href.data(), overlay.href.size(), h );
+      }
+      return m_overlays.size()-1;
+}
+
+size_t KMLOverlayScene::AddLink( const std::string &href )
+{
+      m_links.push_back( href );
+      if ( !m_open.empty() ) {
+            Feature &f = m_features[m_open.back()];
+            f.first_part = m_links.size()-1;
+            f.digest = Hash( href.data(), href.size() );
+      }
+      return m_links.size()-1;
+}
+
+void KMLOverlayScene::BeginPart( PartType type )
+{
+      // Builder always works on the plain form
+      if ( m_packed )
+            Unpack();
+      if ( type == PART_TRACK )
+            m_tracks.push_back( std::make_pair( (uint32_t)m_parts.size(), (uint32_t)m_sample_times.size() ) );
+      Part p;
+      p.type = type;
+      p.count = 0;
+      p.first = m_coords.size();
+      m_parts.push_back( p );
+}
+
+void KMLOverlayScene::AddCoord( double lat, double lon )
+{
+      Coord c;
+      c.lat = ToFixed( lat );
+      c.lon = ToFixed( lon );
+      m_coords.push_back( c );
+      m_bounds.Extend( c.lat, c.lon );
+      m_parts.back().count++;
+      m_vertex_count++;
+}
+
+void KMLOverlayScene::AddTrackSample( int64_t when, double lat, double lon )
+{
+      m_sample_times.push_back( when );
+      AddCoord( lat, lon );
+}
+
+void KMLOverlayScene::EndPart()
+{
+      size_t idx = m_parts.size()-1;
+      const Part &p = m_parts[idx];
+      uint32_t n = ChunkCount( p.count );
+      if ( !n || p.type == PART_POINT )
+            return;
+
+      // Bounds only, where to resume decoding is known once packed
+      m_chunked.push_back( std::make_pair( (uint32_t)idx, (uint32_t)m_chunks.size() ) );
+      const Coord *c = &m_coords[p.first];
+      for ( uint32_t i = 0; i < n; i++ ) {
+            Chunk chunk;
+            chunk.first = i * ChunkSize;
+            chunk.offset = 0;
+            chunk.base.lat = 0;
+            chunk.base.lon = 0;
+            uint32_t last = std::min( chunk.first + ChunkSize, p.count - 1 );
+            for ( uint32_t j = chunk.first; j <= last; j++ )
+                  chunk.box.Extend( c[j].lat, c[j].lon );
+            m_chunks.push_back( chunk );
+      }
+}
+
+const KMLOverlayScene::Chunk *KMLOverlayScene::GetChunks( size_t part, uint32_t *count ) const
+{
+      *count = ChunkCount( m_parts[part].count );
+      if ( !*count )
+            return NULL;
+      std::vector< std::pair<uint32_t, uint32_t> >::const_iterator it =
+            std::lower_bound( m_chunked.begin(), m_chunked.end(), std::make_pair( (uint32_t)part, (uint32_t)0 ) );
+      if ( it == m_chunked.end() || it->first != part ) {
+            *count = 0;
+            return NULL;
+      }
+      return &m_chunks[it->second];
+}
+
+void KMLOverlayScene::SetFeatureTime( size_t idx, int64_t begin, int64_t end )
+{
+      Feature &f = m_features[idx];
+      TimeInterval t;
+      t.begin = begin;
+      t.end = end;
+      t.feature = idx;
+      m_times.push_back( t );
+      f.timed = 1;
+      f.digest = Hash( &begin, sizeof( begin ), f.digest );
+      f.digest = Hash( &end, sizeof( end ), f.digest );
+}
+
+void KMLOverlayScene::SetFeatureText( size_t idx, const std::string &name, const std::string &description )
+{
+      if ( name.empty() && description.empty() )
+            return;
+      m_text_index.push_back( std::make_pair( (uint32_t)idx, (uint32_t)m_texts.size() ) );
+      m_texts.insert( m_texts.end(), name.begin(), name.end() );
+      m_texts.push_back( 0 );
+      m_texts.insert( m_texts.end(), description.begin(), description.end() );
+      m_texts.push_back( 0 );
+      Feature &f = m_features[idx];
+      f.digest = Hash( name.data(), name.size(), f.digest );
+      f.digest = Hash( description.data(), description.size(), f.digest );
+}
+
+bool KMLOverlayScene::GetFeatureText( size_t idx, std::string *name, std::string *description ) const
+{
+      std::vector< std::pair<uint32_t, uint32_t> >::const_iterator it =
+            std::lower_bound( m_text_index.begin(), m_text_index.end(), std::make_pair( (uint32_t)idx, (uint32_t)0 ) );
+      if ( it == m_text_index.end() || it->first != idx )
+            return false;
+      const char *text = &m_texts[it->second];
+      name->assign( text );
+      description->assign( text + name->size() + 1 );
+      return true;
+}
+
+const char *KMLOverlayScene::GetFeatureName( size_t idx ) const
+{
+      std::vector< std::pair<uint32_t, uint32_t> >::const_iterator it =
+            std::lower_bound( m_text_index.begin(), m_text_index.end(), std::make_pair( (uint32_t)idx, (uint32_t)0 ) );
+      if ( it == m_text_index.end() || it->first != idx || !m_texts[it->second] )
+            return NULL;
+      return &m_texts[it->second];
+}
+
+const int64_t *KMLOverlayScene::GetTrackTimes( size_t part ) const
+{
+      std::vector< std::pair<uint32_t, uint32_t> >::const_iterator it =
+            std::lower_bound( m_tracks.begin(), m_tracks.end(), std::make_pair( (uint32_t)part, (uint32_t)0 ) );
+      if ( it == m_tracks.end() || it->first != part || m_sample_times.empty() )
+            return NULL;
+      return &m_sample_times[it->second];
+}
+
+void KMLOverlayScene::GetTrackRange( size_t part, int64_t begin, int64_t end, uint32_t *first, uint32_t *last ) const
+{
+      const int64_t *times = GetTrackTimes( part );
+      uint32_t count = m_parts[part].count;
+      if ( !times ) {
+            *first = 0;
+            *last = count;
+            return;
+      }
+      *first = std::lower_bound( times, times + count, begin ) - times;
+      *last = std::upper_bound( times, times + count, end ) - times;
+      if ( *last < *first )
+            *last = *first;
+}
+
+static bool TimeIntervalLess( const KMLOverlayScene::TimeInterval &a, const KMLOverlayScene::TimeInterval &b )
+{
+      return a.begin < b.begin;
+}
+
+/*    Static interval tree: intervals sorted by begin form an implicit
+ *    binary tree, the middle of each range being its root, and every node
+ *    knows the latest end below it. A query only walks into subtrees
+ *    that can still hold a match, in O(log n + k).
+ */
+void KMLOverlayScene::BuildTimeIndex()
+{
+      std::sort( m_times.begin(), m_times.end(), TimeIntervalLess );
+      m_time_max.resize( m_times.size() );
+      BuildTimeNode( 0, m_times.size() );
+}
+
+int64_t KMLOverlayScene::BuildTimeNode( size_t lo, size_t hi )
+{
+      if ( lo >= hi )
+            return TimeMin;
+      size_t mid = lo + ( hi - lo ) / 2;
+      int64_t max = m_times[mid].end;
+      max = std::max( max, BuildTimeNode( lo, mid ) );
+      max = std::max( max, BuildTimeNode( mid + 1, hi ) );
+      m_time_max[mid] = max;
+      return max;
+}
+
+void KMLOverlayScene::QueryTimeNode( size_t lo, size_t hi, int64_t begin, int64_t end, std::vector<uint32_t> *features ) const
+{
+      if ( lo >= hi )
+            return;
+      size_t mid = lo + ( hi - lo ) / 2;
+      // Everything below ends before the window
+      if ( m_time_max[mid] < begin )
+            return;
+      QueryTimeNode( lo, mid, begin, end, features );
+      // The right side only begins later
+      if ( m_times[mid].begin > end )
+            return;
+      if ( m_times[mid].end >= begin )
+            features->push_back( m_times[mid].feature );
+      QueryTimeNode( mid + 1, hi, begin, end, features );
+}
+
+void KMLOverlayScene::QueryTime( int64_t begin, int64_t end, std::vector<uint32_t> *features ) const
+{
+      features->clear();
+      QueryTimeNode( 0, m_times.size(), begin, end, features );
+      std::sort( features->begin(), features->end() );
+}
+
+bool KMLOverlayScene::GetTimeExtent( int64_t *begin, int64_t *end ) const
+{
+      // Open ends don't extend the range, they would make it endless
+      *begin = TimeMax;
+      *end = TimeMin;
+      for ( size_t i = 0; i < m_times.size(); i++ ) {
+            const TimeInterval &t = m_times[i];
+            if ( t.begin != TimeMin ) {
+                  *begin = std::min( *begin, t.begin );
+                  *end = std::max( *end, t.begin );
+            }
+            if ( t.end != TimeMax ) {
+                  *begin = std::min( *begin, t.end );
+                  *end = std::max( *end, t.end );
+            }
+      }
+      return *begin <= *end;
+}
+
+static bool Overlaps( const KMLOverlayScene::Bounds &a, const KMLOverlayScene::Bounds &b )
+{
+      return a.south <= b.north && a.north >= b.south && a.west <= b.east && a.east >= b.west;
+}
+
+// Position along a Hilbert curve over a 65536x65536 grid
+static uint32_t HilbertIndex( uint32_t x, uint32_t y )
+{
+      const uint32_t n = 1 << 16;
+      uint32_t d = 0;
+      for ( uint32_t s = n / 2; s > 0; s /= 2 ) {
+            uint32_t rx = ( x & s ) ? 1 : 0;
+            uint32_t ry = ( y & s ) ? 1 : 0;
+            d += s * s * ( ( 3 * rx ) ^ ry );
+            if ( ry == 0 ) {
+                  if ( rx == 1 ) {
+                        x = n - 1 - x;
+                        y = n - 1 - y;
+                  }
+                  std::swap( x, y );
+            }
+      }
+      return d;
+}
+
+static uint32_t GridPosition( int32_t v, int32_t lo, int32_t hi )
+{
+      if ( hi <= lo )
+            return 0;
+      return (uint32_t)( ( (int64_t)v - lo ) * 65535 / ( (int64_t)hi - lo ) );
+}
+
+/*    Packed R-tree: placemarks are sorted along a Hilbert curve so
+ *    neighbours share nodes, then grouped by PickNodeSize level after
+ *    level up to a single root. Nothing but bounds is stored above the
+ *    items, a child's position is implied by its parent's.
+ */
+void KMLOverlayScene::BuildPickIndex()
+{
+      m_pick_items.clear();
+      m_pick_nodes.clear();
+      m_pick_levels.clear();
+      m_pick_times.clear();
+
+      std::vector< std::pair<uint32_t, uint32_t> > timed;     // feature, index in times
+      timed.reserve( m_times.size() );
+      for ( size_t i = 0; i < m_times.size(); i++ )
+            timed.push_back( std::make_pair( m_times[i].feature, (uint32_t)i ) );
+      std::sort( timed.begin(), timed.end() );
+
+      // What hides a placemark may be set on any container above it
+      struct Open
+      {
+            uint32_t end;
+            uint32_t region;
+            uint32_t time;
+      };
+      std::vector<Open> open;
+      std::vector<PickItem> items;
+      for ( size_t i = 0; i < m_features.size(); i++ ) {
+            while ( !open.empty() && open.back().end <= i )
+                  open.pop_back();
+            const Feature &f = m_features[i];
+            Open o;
+            o.end = f.end;
+            o.region = f.region != NoRegion || open.empty() ? f.region : open.back().region;
+            o.time = open.empty() ? NoTime : open.back().time;
+            if ( f.timed ) {
+                  std::vector< std::pair<uint32_t, uint32_t> >::const_iterator it =
+                        std::lower_bound( timed.begin(), timed.end(), std::make_pair( (uint32_t)i, (uint32_t)0 ) );
+                  TimeInterval t = m_times[it->second];
+                  if ( o.time != NoTime ) {
+                        t.begin = std::max( t.begin, m_pick_times[o.time].begin );
+                        t.end = std::min( t.end, m_pick_times[o.time].end );
+                  }
+                  m_pick_times.push_back( t );
+                  o.time = m_pick_times.size() - 1;
+            }
+            open.push_back( o );
+            if ( f.type != FEATURE_PLACEMARK )
+                  continue;
+
+            PickItem item;
+            item.feature = i;
+            item.region = o.region;
+            item.time = o.time;
+            for ( uint32_t j = 0; j < f.part_count; j++ ) {
+                  CoordReader rd( *this, m_parts[f.first_part + j] );
+                  int32_t lat, lon;
+                  while ( rd.NextFixed( &lat, &lon ) )
+                        item.box.Extend( lat, lon );
+            }
+            if ( !item.box.IsEmpty() )
+                  items.push_back( item );
+      }
+
+      std::vector< std::pair<uint32_t, uint32_t> > order;   // Hilbert index, item
+      order.reserve( items.size() );
+      for ( size_t i = 0; i < items.size(); i++ ) {
+            const Bounds &b = items[i].box;
+            uint32_t x = GridPosition( b.west / 2 + b.east / 2, m_bounds.west, m_bounds.east );
+            uint32_t y = GridPosition( b.south / 2 + b.north / 2, m_bounds.south, m_bounds.north );
+            order.push_back( std::make_pair( HilbertIndex( x, y ), (uint32_t)i ) );
+      }
+      std::sort( order.begin(), order.end() );
+      m_pick_items.reserve( items.size() );
+      for ( size_t i = 0; i < order.size(); i++ )
+            m_pick_items.push_back( items[order[i].second] );
+      if ( m_pick_items.empty() )
+            return;
+
+      size_t count = m_pick_items.size(), first = 0;
+      bool leaves = true;
+      do {
+            size_t begin = m_pick_nodes.size();
+            m_pick_levels.push_back( begin );
+            for ( size_t j = 0; j < count; j += PickNodeSize ) {
+                  Bounds b;
+                  for ( size_t k = j; k < std::min( j + PickNodeSize, count ); k++ )
+                        b.Extend( leaves ? m_pick_items[k].box : m_pick_nodes[first + k] );
+                  m_pick_nodes.push_back( b );
+            }
+            leaves = false;
+            first = begin;
+            count = m_pick_nodes.size() - begin;
+      } while ( count > 1 );
+      m_pick_levels.push_back( m_pick_nodes.size() );
+}
+
+void KMLOverlayScene::QueryPickNode( size_t level, size_t idx, const Bounds &box, std::vector<const PickItem *> *items ) const
+{
+      if ( !Overlaps( m_pick_nodes[m_pick_levels[level] + idx], box ) )
+            return;
+      size_t first = idx * PickNodeSize;
+      if ( level == 0 ) {
+            size_t last = std::min( first + PickNodeSize, m_pick_items.size() );
+            for ( size_t k = first; k < last; k++ ) {
+                  if ( Overlaps( m_pick_items[k].box, box ) )
+                        items->push_back( &m_pick_items[k] );
+            }
+            return;
+      }
+      size_t last = std::min( first + PickNodeSize, (size_t)( m_pick_levels[level] - m_pick_levels[level-1] ) );
+      for ( size_t k = first; k < last; k++ )
+            QueryPickNode( level - 1, k, box, items );
+}
+
+void KMLOverlayScene::QueryBounds( const Bounds &box, std::vector<const PickItem *> *items ) const
+{
+      items->clear();
+      if ( m_pick_levels.size() < 2 )
+            return;
+      size_t top = m_pick_levels.size() - 2;
+      size_t count = m_pick_levels[top+1] - m_pick_levels[top];
+      for ( size_t i = 0; i < count; i++ )
+            QueryPickNode( top, i, box, items );
+}
+
+void KMLOverlayScene::Shrink()
+{
+      BuildTimeIndex();
+      BuildPickIndex();
+      std::vector<char>( m_texts ).swap( m_texts );
+      std::vector<Feature>( m_features ).swap( m_features );
+      std::vector<Region>( m_regions ).swap( m_regions );
+      std::vector<Part>( m_parts ).swap( m_parts );
+      std::vector<Chunk>( m_chunks ).swap( m_chunks );
+      std::vector<Coord>( m_coords ).swap( m_coords );
+      std::vector<uint8_t>( m_bytes ).swap( m_bytes );
+}
+
+void KMLOverlayScene::Clear()
+{
+      std::vector<Feature>().swap( m_features );
+      std::vector<Part>().swap( m_parts );
+      std::vector<Style>().swap( m_styles );
+      std::vector<GroundOverlay>().swap( m_overlays );
+      std::vector<Region>().swap( m_regions );
+      std::vector<std::string>().swap( m_icons );
+      std::vector<std::string>().swap( m_links );
+      std::vector<TimeInterval>().swap( m_times );
+      std::vector<int64_t>().swap( m_time_max );
+      std::vector<int64_t>().swap( m_sample_times );
+      m_tracks.clear();
+      std::vector<Chunk>().swap( m_chunks );
+      m_chunked.clear();
+      std::vector<PickItem>().swap( m_pick_items );
+      std::vector<Bounds>().swap( m_pick_nodes );
+      m_pick_levels.clear();
+      std::vector<TimeInterval>().swap( m_pick_times );
+      std::vector<char>().swap( m_texts );
+      std::vector< std::pair<uint32_t, uint32_t> >().swap( m_text_index );
+      std::vector<Coord>().swap( m_coords );
+      std::vector<uint8_t>().swap( m_bytes );
+      m_style_index.clear();
+      m_open.clear();
+      m_bounds = Bounds();
+      m_vertex_count = 0;
+      m_packed = false;
+}
+
+void KMLOverlayScene::Pack()
+{
+      if ( m_packed )
+            return;
+
+      PackFrom( m_coords );
+      std::vector<Coord>().swap( m_coords );
+      m_packed = true;
+}
+
+void KMLOverlayScene::PackFrom( const std::vector<Coord> &coords )
+{
+      std::vector<uint8_t> bytes;
+      bytes.reserve( coords.size() * 4 );
+      size_t next_chunked = 0;
+      for ( size_t i = 0; i < m_parts.size(); i++ ) {
+            Part &p = m_parts[i];
+            const Coord *c = coords.empty() ? NULL : &coords[p.first];
+            p.first = bytes.size();
+            Chunk *chunks = NULL;
+            uint32_t chunk_count = 0;
+            if ( next_chunked < m_chunked.size() && m_chunked[next_chunked].first == i ) {
+                  chunks = &m_chunks[m_chunked[next_chunked++].second];
+                  chunk_count = ChunkCount( p.count );
+            }
+            int32_t lat = 0, lon = 0;
+            for ( uint32_t j = 0; j < p.count; j++ ) {
+                  if ( chunks && j % ChunkSize == 0 && j / ChunkSize < chunk_count ) {
+                        Chunk &chunk = chunks[j / ChunkSize];
+                        chunk.offset = bytes.size() - p.first;
+                        chunk.base.lat = lat;
+                        chunk.base.lon = lon;
+                  }
+                  // A jump across the antimeridian overflows int32, let it wrap
+                  WriteVarint( bytes, EncodeZigZag( (int32_t)( (uint32_t)c[j].lat - (uint32_t)lat ) ) );
+                  WriteVarint( bytes, EncodeZigZag( (int32_t)( (uint32_t)c[j].lon - (uint32_t)lon ) ) );
+                  lat = c[j].lat;
+                  lon = c[j].lon;
+            }
+      }
+      m_bytes.swap( bytes );
+      std::vector<uint8_t>( m_bytes ).swap( m_bytes );
+}
+
+void KMLOverlayScene::Unpack()
+{
+      if ( !m_packed )
+            return;
+
+      UnpackFrom( *this );
+      std::vector<uint8_t>().swap( m_bytes );
+      m_packed = false;
+}
+
+void KMLOverlayScene::UnpackFrom( const KMLOverlayScene &source )
+{
+      std::vector<Coord> coords;
+      coords.reserve( m_vertex_count );
+      for ( size_t i = 0; i < m_parts.size(); i++ ) {
+            // Read before the part is moved, source may be this scene
+            CoordReader rd( source, source.m_parts[i] );
+            m_parts[i].first = coords.size();
+            Coord c;
+            while ( rd.NextFixed( &c.lat, &c.lon ) )
+                  coords.push_back( c );
+      }
+      m_coords.swap( coords );
+}
+
+bool KMLOverlayScene::IsCompared( const Feature &f ) const
+{
+      // Containers only matter through their region or time
+      return f.type != FEATURE_CONTAINER || f.region != NoRegion || f.timed;
+}
+
+void KMLOverlayScene::GetDigests( Digests *digests ) const
+{
+      digests->clear();
+      digests->reserve( m_features.size() );
+      for ( size_t i = 0; i < m_features.size(); i++ ) {
+            if ( IsCompared( m_features[i] ) )
+                  digests->push_back( std::make_pair( m_features[i].key, m_features[i].digest ) );
+      }
+      std::sort( digests->begin(), digests->end() );
+}
+
+void KMLOverlayScene::Compare( const Digests &previous, Changes *changes ) const
+{
+      changes->added = 0;
+      changes->removed = 0;
+      changes->changed = 0;
+      changes->unchanged = 0;
+
+      size_t matched = 0;
+      for ( size_t i = 0; i < m_features.size(); i++ ) {
+            const Feature &f = m_features[i];
+            if ( !IsCompared( f ) )
+                  continue;
+            Digests::const_iterator it = std::lower_bound( previous.begin(), previous.end(),
+                                                           std::make_pair( f.key, (uint64_t)0 ) );
+            if ( it == previous.end() || it->first != f.key ) {
+                  changes->added++;
+                  continue;
+            }
+            matched++;
+            // Keys may repeat when ids are reused, any equal digest will do
+            bool same = false;
+            for ( ; it != previous.end() && it->first == f.key && !same; ++it )
+                  same = it->second == f.digest;
+            if ( same ) {
+                  changes->unchanged++;
+            } else {
+                  changes->changed++;
+            }
+      }
+      changes->removed = previous.size() > matched ? previous.size() - matched : 0;
+}
+
+size_t KMLOverlayScene::GetMemoryUsage() const
+{
+      size_t sz = sizeof( *this );
+      sz += m_features.capacity() * sizeof( Feature );
+      sz += m_parts.capacity() * sizeof( Part );
+      sz += m_styles.capacity() * sizeof( Style );
+      sz += m_regions.capacity() * sizeof( Region );
+      sz += m_times.capacity() * sizeof( TimeInterval );
+      sz += m_time_max.capacity() * sizeof( int64_t );
+      sz += m_sample_times.capacity() * sizeof( int64_t );
+      sz += m_tracks.capacity() * sizeof( m_tracks[0] );
+      sz += m_chunks.capacity() * sizeof( Chunk );
+      sz += m_chunked.capacity() * sizeof( m_chunked[0] );
+      sz += m_pick_items.capacity() * sizeof( PickItem );
+      sz += m_pick_nodes.capacity() * sizeof( Bounds );
+      sz += m_pick_levels.capacity() * sizeof( uint32_t );
+      sz += m_pick_times.capacity() * sizeof( TimeInterval );
+      sz += m_texts.capacity();
+      sz += m_text_index.capacity() * sizeof( m_text_index[0] );
+      sz += m_style_index.size() * ( sizeof( Style ) + 4 * sizeof( void * ) );
+      sz += m_coords.capacity() * sizeof( Coord );
+      sz += m_bytes.capacity();
+      for ( size_t i = 0; i < m_overlays.size(); i++ )
+            sz += sizeof( GroundOverlay ) + m_overlays[i].href.capacity();
+      for ( size_t i = 0; i < m_icons.size(); i++ )
+            sz += sizeof( std::string ) + m_icons[i].capacity();
+      for ( size_t i = 0; i < m_links.size(); i++ )
+            sz += sizeof( std::string ) + m_links[i].capacity();
+      return sz;
+}
+
+static const char KMLOverlaySceneMagic[8] = { 'K', 'M', 'L', 'S', 'C', 'N', '0', '9' };
+
+template <typename T>
+static bool WriteArray( FILE *f, const std::vector<T> &v )
+{
+      uint64_t n = v.size();
+      if ( fwrite( &n, sizeof( n ), 1, f ) != 1 )
+            return false;
+      return n == 0 || fwrite( &v[0], sizeof( T ), n, f ) == n;
+}
+
+// size is the file's, a count more than what is left of it is corrupt
+template <typename T>
+static bool ReadArray( FILE *f, uint64_t size, std::vector<T> &v )
+{
+      uint64_t n;
+      if ( fread( &n, sizeof( n ), 1, f ) != 1 )
+            return false;
+      long pos = ftell( f );
+      if ( pos < 0 || (uint64_t)pos > size || n > ( size - pos ) / sizeof( T ) )
+            return false;
+      v.resize( n );
+      return n == 0 || fread( &v[0], sizeof( T ), n, f ) == n;
+}
+
+bool KMLOverlayScene::Save( const std::string &path ) const
+{
+      // Written from a packed copy, this scene may be the one being drawn
+      if ( !m_packed )
+            return KMLOverlayScene( *this, true ).Save( path );
+
+      FILE *f = fopen( path.c_str(), "wb" );
+      if ( !f )
+            return false;
+
+      uint64_t vertices = m_vertex_count;
+      bool ok = fwrite( KMLOverlaySceneMagic, sizeof( KMLOverlaySceneMagic ), 1, f ) == 1
+            && fwrite( &vertices, sizeof( vertices ), 1, f ) == 1
+            && fwrite( &m_bounds, sizeof( m_bounds ), 1, f ) == 1
+            && WriteArray( f, m_features )
+            && WriteArray( f, m_parts )
+            && WriteArray( f, m_styles )
+            && WriteArray( f, m_regions )
+            && WriteArray( f, m_times )
+            && WriteArray( f, m_time_max )
+            && WriteArray( f, m_sample_times )
+            && WriteArray( f, m_tracks )
+            && WriteArray( f, m_chunks )
+            && WriteArray( f, m_chunked )
+            && WriteArray( f, m_pick_items )
+            && WriteArray( f, m_pick_nodes )
+            && WriteArray( f, m_pick_levels )
+            && WriteArray( f, m_pick_times )
+            && WriteArray( f, m_texts )
+            && WriteArray( f, m_text_index )
+            && WriteArray( f, m_bytes );
+
+      uint64_t n = m_overlays.size();
+      ok = ok && fwrite( &n, sizeof( n ), 1, f ) == 1;
+      for ( size_t i = 0; ok && i < m_overlays.size(); i++ ) {
+            const GroundOverlay &o = m_overlays[i];
+            std::vector<char> href( o.href.begin(), o.href.end() );
+            ok = fwrite( &o.north, sizeof( double ), 1, f ) == 1
+                  && fwrite( &o.south, sizeof( double ), 1, f ) == 1
+                  && fwrite( &o.east, sizeof( double ), 1, f ) == 1
+                  && fwrite( &o.west, sizeof( double ), 1, f ) == 1
+                  && fwrite( &o.alpha, sizeof( uint8_t ), 1, f ) == 1
+                  && WriteArray( f, href );
+      }
+
+      n = m_icons.size();
+      ok = ok && fwrite( &n, sizeof( n ), 1, f ) == 1;
+      for ( size_t i = 0; ok && i < m_icons.size(); i++ ) {
+            std::vector<char> href( m_icons[i].begin(), m_icons[i].end() );
+            ok = WriteArray( f, href );
+      }
+
+      n = m_links.size();
+      ok = ok && fwrite( &n, sizeof( n ), 1, f ) == 1;
+      for ( size_t i = 0; ok && i < m_links.size(); i++ ) {
+            std::vector<char> href( m_links[i].begin(), m_links[i].end() );
+            ok = WriteArray( f, href );
+      }
+
+      return fclose( f ) == 0 && ok;
+}
+
+bool KMLOverlayScene::Load( const std::string &path )
+{
+      FILE *f = fopen( path.c_str(), "rb" );
+      if ( !f )
+            return false;
+
+      Clear();
+
+      long end = -1;
+      if ( fseek( f, 0, SEEK_END ) == 0 )
+            end = ftell( f );
+      if ( end < 0 || fseek( f, 0, SEEK_SET ) != 0 ) {
+            fclose( f );
+            return false;
+      }
+      uint64_t size = end;
+
+      char magic[sizeof( KMLOverlaySceneMagic )];
+      uint64_t vertices = 0;
+      bool ok = fread( magic, sizeof( magic ), 1, f ) == 1
+            && memcmp( magic, KMLOverlaySceneMagic, sizeof( magic ) ) == 0
+            && fread( &vertices, sizeof( vertices ), 1, f ) == 1
+            && fread( &m_bounds, sizeof( m_bounds ), 1, f ) == 1
+            && ReadArray( f, size, m_features )
+            && ReadArray( f, size, m_parts )
+            && ReadArray( f, size, m_styles )
+            && ReadArray( f, size, m_regions )
+            && ReadArray( f, size, m_times )
+            && ReadArray( f, size, m_time_max )
+            && ReadArray( f, size, m_sample_times )
+            && ReadArray( f, size, m_tracks )
+            && ReadArray( f, size, m_chunks )
+            && ReadArray( f, size, m_chunked )
+            && ReadArray( f, size, m_pick_items )
+            && ReadArray( f, size, m_pick_nodes )
+            && ReadArray( f, size, m_pick_levels )
+            && ReadArray( f, size, m_pick_times )
+            && ReadArray( f, size, m_texts )
+            && ReadArray( f, size, m_text_index )
+            && ReadArray( f, size, m_bytes );
+
+      uint64_t n = 0;
+      ok = ok && fread( &n, sizeof( n ), 1, f ) == 1;
+      for ( uint64_t i = 0; ok && i < n; i++ ) {
+            GroundOverlay o;
+            std::vector<char> href;
+            ok = fread( &o.north, sizeof( double ), 1, f ) == 1
+                  && fread( &o.south, sizeof( double ), 1, f ) == 1
+                  && fread( &o.east, sizeof( double ), 1, f ) == 1
+                  && fread( &o.west, sizeof( double ), 1, f ) == 1
+                  && fread( &o.alpha, sizeof( uint8_t ), 1, f ) == 1
+                  && ReadArray( f, size, href );
+            o.href.assign( href.begin(), href.end() );
+            m_overlays.push_back( o );
+      }
+
+      n = 0;
+      ok = ok && fread( &n, sizeof( n ), 1, f ) == 1;
+      for ( uint64_t i = 0; ok && i < n; i++ ) {
+            std::vector<char> href;
+            ok = ReadArray( f, size, href );
+            m_icons.push_back( std::string( href.begin(), href.end() ) );
+      }
+
+      n = 0;
+      ok = ok && fread( &n, sizeof( n ), 1, f ) == 1;
+      for ( uint64_t i = 0; ok && i < n; i++ ) {
+            std::vector<char> href;
+            ok = ReadArray( f, size, href );
+            m_links.push_back( std::string( href.begin(), href.end() ) );
+      }
+      fclose( f );
+
+      m_packed = true;
+      if ( !ok || !IsConsistent( vertices ) ) {
+            Clear();
+            return false;
+      }
+      for ( size_t i = 0; i < m_styles.size(); i++ )
+            m_style_index[m_styles[i]] = i;
+      m_vertex_count = vertices;
+      return true;
+}
+
+/*    Walks the varints of a packed part without running off the bytes,
+ *    checking its chunks start where the encoder put them.
+ */
+bool KMLOverlayScene::IsPackedPartValid( const Part &p, const Chunk *chunks, uint32_t chunk_count ) const
+{
+      if ( p.first > m_bytes.size() )
+            return false;
+      size_t pos = p.first;
+      for ( uint32_t j = 0; j < p.count; j++ ) {
+            if ( chunks && j % ChunkSize == 0 && j / ChunkSize < chunk_count ) {
+                  const Chunk &chunk = chunks[j / ChunkSize];
+                  if ( chunk.first != j || chunk.offset != pos - p.first )
+                        return false;
+            }
+            // Latitude and longitude, no more than 5 bytes each for 32 bits
+            for ( int k = 0; k < 2; k++ ) {
+                  size_t start = pos;
+                  do {
+                        if ( pos >= m_bytes.size() || pos - start == 5 )
+                              return false;
+                  } while ( m_bytes[pos++] & 0x80 );
+            }
+      }
+      return true;
+}
+
+bool KMLOverlayScene::IsConsistent( uint64_t vertices ) const
+{
+      for ( size_t i = 0; i < m_features.size(); i++ ) {
+            const Feature &f = m_features[i];
+            if ( f.end <= i || f.end > m_features.size() )
+                  return false;
+            if ( f.region != NoRegion && f.region >= m_regions.size() )
+                  return false;
+            switch ( f.type ) {
+            case FEATURE_GROUNDOVERLAY:
+                  if ( f.first_part >= m_overlays.size() )
+                        return false;
+                  break;
+            case FEATURE_NETWORKLINK:
+                  if ( f.first_part >= m_links.size() )
+                        return false;
+                  break;
+            case FEATURE_PLACEMARK:
+                  if ( f.style >= m_styles.size() )
+                        return false;
+                  // fall through
+            case FEATURE_CONTAINER:
+                  if ( f.first_part > m_parts.size() || f.part_count > m_parts.size() - f.first_part )
+                        return false;
+                  break;
+            default:
+                  return false;
+            }
+      }
+      for ( size_t i = 0; i < m_styles.size(); i++ ) {
+            if ( m_styles[i].icon != NoIcon && m_styles[i].icon >= m_icons.size() )
+                  return false;
+      }
+
+      // Chunked parts in order, as GetChunks() searches them
+      for ( size_t i = 0; i < m_chunked.size(); i++ ) {
+            uint32_t part = m_chunked[i].first;
+            if ( part >= m_parts.size() || ( i > 0 && part <= m_chunked[i-1].first ) )
+                  return false;
+            uint32_t count = ChunkCount( m_parts[part].count );
+            if ( m_chunked[i].second > m_chunks.size() || count > m_chunks.size() - m_chunked[i].second )
+                  return false;
+      }
+      uint64_t total = 0;
+      size_t next_chunked = 0;
+      for ( size_t i = 0; i < m_parts.size(); i++ ) {
+            const Part &p = m_parts[i];
+            const Chunk *chunks = NULL;
+            uint32_t chunk_count = 0;
+            if ( next_chunked < m_chunked.size() && m_chunked[next_chunked].first == i ) {
+                  chunks = &m_chunks[m_chunked[next_chunked++].second];
+                  chunk_count = ChunkCount( p.count );
+            }
+            if ( !IsPackedPartValid( p, chunks, chunk_count ) )
+                  return false;
+            total += p.count;
+      }
+      if ( total != vertices )
+            return false;
+
+      for ( size_t i = 0; i < m_tracks.size(); i++ ) {
+            uint32_t part = m_tracks[i].first;
+            if ( part >= m_parts.size() || ( i > 0 && part <= m_tracks[i-1].first ) )
+                  return false;
+            if ( m_tracks[i].second > m_sample_times.size()
+                 || m_parts[part].count > m_sample_times.size() - m_tracks[i].second )
+                  return false;
+      }
+
+      if ( m_time_max.size() != m_times.size() )
+            return false;
+      for ( size_t i = 0; i < m_times.size(); i++ ) {
+            if ( m_times[i].feature >= m_features.size() )
+                  return false;
+      }
+
+      for ( size_t i = 0; i < m_pick_items.size(); i++ ) {
+            const PickItem &item = m_pick_items[i];
+            if ( item.feature >= m_features.size()
+                 || ( item.region != NoRegion && item.region >= m_regions.size() )
+                 || ( item.time != NoTime && item.time >= m_pick_times.size() ) )
+                  return false;
+      }
+      // Each level as many nodes as it takes to cover the one below, up to
+      // a single root, as BuildPickIndex() lays them out
+      if ( m_pick_items.empty() ) {
+            if ( !m_pick_levels.empty() || !m_pick_nodes.empty() )
+                  return false;
+      } else {
+            if ( m_pick_levels.size() < 2 || m_pick_levels[0] != 0
+                 || m_pick_levels.back() != m_pick_nodes.size() )
+                  return false;
+            size_t below = m_pick_items.size();
+            for ( size_t l = 0; l + 1 < m_pick_levels.size(); l++ ) {
+                  if ( m_pick_levels[l+1] < m_pick_levels[l] )
+                        return false;
+                  size_t count = m_pick_levels[l+1] - m_pick_levels[l];
+                  if ( count != ( below + PickNodeSize - 1 ) / PickNodeSize )
+                        return false;
+                  below = count;
+            }
+            if ( below != 1 )
+                  return false;
+      }
+
+      // Name and description, both terminated
+      if ( !m_texts.empty() && m_texts.back() != 0 )
+            return false;
+      for ( size_t i = 0; i < m_text_index.size(); i++ ) {
+            if ( m_text_index[i].first >= m_features.size() || m_text_index[i].second >= m_texts.size()
+                 || ( i > 0 && m_text_index[i].first < m_text_index[i-1].first ) )
+                  return false;
+            const char *text = &m_texts[m_text_index[i].second];
+            size_t left = m_texts.size() - m_text_index[i].second;
+            size_t name = strnlen( text, left );
+            if ( name + 1 >= left )
+                  return false;
+      }
+      return true;
+}
@@ -0,0 +1,435 @@
+/***************************************************************************
+ * $Id: scene.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayScene_H_
+#define _KMLOverlayScene_H_
+
+#include <stdint.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <map>
+
+/*    Compiled, render-ready form of a KML document.
+ *
+ *    Features are stored in document order, each one knowing where its
+ *    subtree ends so whole containers can be skipped, for instance when
+ *    their Region is out of view or out of its Lod range. Coordinates are kept
+ *    as 1e-7 degree fixed-point integers (about 1 cm), either as a plain
+ *    array or, for cold layers, as zigzag delta varints restarted on each
+ *    part. Altitude is dropped: we only draw in 2D.
+ *
+ *    Features with a TimeStamp or TimeSpan, and gx:Tracks, are indexed by
+ *    time: a static interval tree over the feature intervals, and for each
+ *    track a column of sample times sorted along its coordinates.
+ *
+ *    Placemarks are also indexed in space for picking, by a packed R-tree
+ *    over their bounds in Hilbert order, and keep their name and description.
+ *
+ *    Long lines and rings are cut in chunks of ChunkSize segments, each
+ *    with its bounds and where to resume decoding, so a multi-week track
+ *    is culled piece by piece instead of as a whole.
+ *************************************************************************/
+
+class KMLOverlayScene
+{
+public:
+      enum FeatureType
+      {
+            FEATURE_CONTAINER,
+            FEATURE_PLACEMARK,
+            FEATURE_GROUNDOVERLAY,
+            FEATURE_NETWORKLINK
+      };
+
+      enum PartType
+      {
+            PART_POINT,
+            PART_LINESTRING,
+            PART_LINEARRING,
+            PART_INNERRING,
+            PART_TRACK              // a LineString with one time per coordinate
+      };
+
+      struct Coord
+      {
+            int32_t lat;
+            int32_t lon;
+      };
+
+      struct Feature
+      {
+            uint8_t  type;
+            uint8_t  timed;         // in the time index
+            uint32_t end;           // index one past the last descendant
+            uint32_t first_part;    // for ground overlays and links, index in overlays or links
+            uint32_t part_count;
+            uint32_t style;
+            uint32_t region;        // index in regions, NoRegion when always active
+            uint64_t key;           // identity across reloads, from the KML id or path
+            uint64_t digest;        // hash of the compiled content
+      };
+
+      struct Part
+      {
+            uint8_t  type;
+            uint32_t count;
+            uint32_t first;         // index in coords, or byte offset once packed
+      };
+
+      // Colours are packed as 0xRRGGBBAA
+      struct Style
+      {
+            uint32_t line_colour;
+            float    line_width;
+            uint32_t ring_colour;
+            float    ring_width;
+            uint32_t fill_colour;
+            bool     ring_stroke;
+            bool     ring_fill;
+            uint32_t icon;          // index in icons, NoIcon for the default one
+            float    icon_scale;
+            uint32_t label_colour;
+            float    label_scale;   // 0 hides the placemark's name
+
+            bool operator<( const Style &other ) const;
+      };
+
+      // Extent in fixed-point degrees, empty while south > north
+      struct Bounds
+      {
+            int32_t south, west, north, east;
+
+            Bounds() : south( INT32_MAX ), west( INT32_MAX ), north( INT32_MIN ), east( INT32_MIN ) {}
+            bool IsEmpty() const { return south > north; }
+            void Extend( int32_t lat, int32_t lon )
+            {
+                  if ( lat < south ) south = lat;
+                  if ( lat > north ) north = lat;
+                  if ( lon < west ) west = lon;
+                  if ( lon > east ) east = lon;
+            }
+            void Extend( const Bounds &other )
+            {
+                  if ( other.IsEmpty() )
+                        return;
+                  Extend( other.south, other.west );
+                  Extend( other.north, other.east );
+            }
+      };
+
+      // Stretch of a long part: segments from coordinate first up to the
+      // next chunk's first, which both share
+      struct Chunk
+      {
+            Bounds   box;
+            uint32_t first;         // coordinate within the part
+            uint32_t offset;        // byte offset within the part once packed
+            Coord    base;          // the coordinate before first, packed deltas start from it
+      };
+      static const uint32_t ChunkSize = 256;
+
+      // KML Region: a LatLonAltBox and its Lod, in pixels across the
+      // projected box. max_lod < 0 means no upper limit.
+      struct Region
+      {
+            Bounds   box;
+            float    min_lod;
+            float    max_lod;
+            uint32_t vertices;      // in the subtree, what is skipped with it
+      };
+
+      struct GroundOverlay
+      {
+            double      north, south, east, west;
+            uint8_t     alpha;
+            std::string href;
+      };
+
+      // Result of comparing a reloaded scene with the previous one. Only
+      // counted: a reload swaps in a whole new scene, the comparison tells
+      // whether there is anything to swap.
+      struct Changes
+      {
+            size_t                added;
+            size_t                removed;
+            size_t                changed;
+            size_t                unchanged;
+      };
+      typedef std::vector< std::pair<uint64_t, uint64_t> > Digests;
+
+      // Seconds since the epoch, open ends are TimeMin or TimeMax
+      struct TimeInterval
+      {
+            int64_t  begin;
+            int64_t  end;
+            uint32_t feature;
+      };
+      static const int64_t TimeMin = INT64_MIN;
+      static const int64_t TimeMax = INT64_MAX;
+
+      // Placemark in the spatial index, with the innermost Region over it
+      // and, when it or a container above it is timed, the interval it is
+      // drawn in
+      struct PickItem
+      {
+            Bounds   box;
+            uint32_t feature;
+            uint32_t region;        // NoRegion when always active
+            uint32_t time;          // index in pick times, NoTime when never filtered
+      };
+      static const uint32_t NoTime = 0xffffffff;
+
+      static const double CoordScale;
+      static const uint32_t NoIcon = 0xffffffff;
+      static const uint32_t NoRegion = 0xffffffff;
+
+      static int32_t ToFixed( double deg );
+      static double FromFixed( int32_t fixed ) { return fixed / CoordScale; }
+      static uint64_t Hash( const void *data, size_t len, uint64_t seed = 14695981039346656037ULL );
+      static uint32_t MakeColour( uint8_t r, uint8_t g, uint8_t b, uint8_t a )
+            { return ((uint32_t)r << 24) | ((uint32_t)g << 16) | ((uint32_t)b << 8) | a; }
+
+      KMLOverlayScene();
+      // A copy in packed or unpacked form, the coordinates are converted
+      // straight from other's without a copy of them in its own form
+      KMLOverlayScene( const KMLOverlayScene &other, bool packed );
+
+      // Builder interface, used by the loaders
+      uint32_t AddStyle( const Style &style );
+      uint32_t AddIcon( const std::string &href );
+      uint32_t AddRegion( const Region &region );
+      size_t BeginFeature( FeatureType type, uint32_t style, uint64_t key, uint32_t region = NoRegion );
+      void EndFeature( size_t idx );
+      size_t AddGroundOverlay( const GroundOverlay &overlay );
+      size_t AddLink( const std::string &href );
+      void BeginPart( PartType type );
+      void AddCoord( double lat, double lon );
+      // Within a PART_TRACK, in increasing time order
+      void AddTrackSample( int64_t when, double lat, double lon );
+      // After EndFeature, the feature is then only drawn within its interval
+      void SetFeatureTime( size_t idx, int64_t begin, int64_t end );
+      // UTF-8, features must be given in increasing order
+      void SetFeatureText( size_t idx, const std::string &name, const std::string &description );
+      void EndPart();
+      void Shrink();
+      void Clear();
+
+      // Cold storage
+      void Pack();
+      void Unpack();
+      bool IsPacked() const { return m_packed; }
+
+      size_t GetFeatureCount() const { return m_features.size(); }
+      const Feature &GetFeature( size_t idx ) const { return m_features[idx]; }
+      const Part &GetPart( size_t idx ) const { return m_parts[idx]; }
+      const Style &GetStyle( size_t idx ) const { return m_styles[idx]; }
+      const GroundOverlay &GetGroundOverlay( size_t idx ) const { return m_overlays[idx]; }
+      const Region &GetRegion( size_t idx ) const { return m_regions[idx]; }
+      size_t GetRegionCount() const { return m_regions.size(); }
+      const std::string &GetIcon( size_t idx ) const { return m_icons[idx]; }
+      size_t GetIconCount() const { return m_icons.size(); }
+      size_t GetGroundOverlayCount() const { return m_overlays.size(); }
+      const std::string &GetLink( size_t idx ) const { return m_links[idx]; }
+      size_t GetLinkCount() const { return m_links.size(); }
+      // Images, icons or linked documents to read from the source
+      bool HasAssets() const { return !m_overlays.empty() || !m_icons.empty() || !m_links.empty(); }
+      size_t GetVertexCount() const { return m_vertex_count; }
+      const Bounds &GetBounds() const { return m_bounds; }
+      size_t GetMemoryUsage() const;
+
+      // Time index, built by Shrink()
+      bool HasTime() const { return !m_times.empty(); }
+      bool GetTimeExtent( int64_t *begin, int64_t *end ) const;
+      // Timed features whose interval meets [begin, end], by increasing index
+      void QueryTime( int64_t begin, int64_t end, std::vector<uint32_t> *features ) const;
+      // Samples of a track within [begin, end], as [*first, *last)
+      void GetTrackRange( size_t part, int64_t begin, int64_t end, uint32_t *first, uint32_t *last ) const;
+
+      // Chunks of a part in coordinate order, NULL when it is short enough
+      // to be drawn whole
+      const Chunk *GetChunks( size_t part, uint32_t *count ) const;
+
+      // Spatial index, built by Shrink()
+      void QueryBounds( const Bounds &box, std::vector<const PickItem *> *items ) const;
+      const TimeInterval &GetPickTime( size_t idx ) const { return m_pick_times[idx]; }
+      bool GetFeatureText( size_t idx, std::string *name, std::string *description ) const;
+      // Nul terminated UTF-8 in place, NULL without a name
+      const char *GetFeatureName( size_t idx ) const;
+
+      // Feature level comparison, digests are sorted by key
+      void GetDigests( Digests *digests ) const;
+      void Compare( const Digests &previous, Changes *changes ) const;
+
+      // Binary cache, always written in packed form. The scene itself is
+      // left as it is. A cache whose counts or indices don't hold together
+      // is refused, the caller parses the source again.
+      bool Save( const std::string &path ) const;
+      bool Load( const std::string &path );
+
+      /* Sequential decoder for the coordinates of one part, whatever the
+       * storage form. Meant to be used straight inside the projection loop.
+       */
+      class CoordReader
+      {
+      public:
+            CoordReader( const KMLOverlayScene &scene, const Part &part )
+                  : m_left( part.count ), m_lat( 0 ), m_lon( 0 )
+            {
+                  if ( scene.m_packed ) {
+                        m_coord = NULL;
+                        m_bytes = scene.m_bytes.empty() ? NULL : &scene.m_bytes[part.first];
+                  } else {
+                        m_coord = scene.m_coords.empty() ? NULL : &scene.m_coords[part.first];
+                        m_bytes = NULL;
+                  }
+            }
+
+            // From the start of one of the part's chunks to the end of the part
+            CoordReader( const KMLOverlayScene &scene, const Part &part, const Chunk &chunk )
+                  : m_left( part.count - chunk.first ), m_lat( chunk.base.lat ), m_lon( chunk.base.lon )
+            {
+                  if ( scene.m_packed ) {
+                        m_coord = NULL;
+                        m_bytes = &scene.m_bytes[part.first + chunk.offset];
+                  } else {
+                        m_coord = &scene.m_coords[part.first + chunk.first];
+                        m_bytes = NULL;
+                  }
+            }
+
+            bool NextFixed( int32_t *lat, int32_t *lon )
+            {
+                  if ( !m_left )
+                        return false;
+                  m_left--;
+                  if ( m_coord ) {
+                        *lat = m_coord->lat;
+                        *lon = m_coord->lon;
+                        m_coord++;
+                  } else {
+                        // deltas wrap around, see Pack()
+                        m_lat = (int32_t)( (uint32_t)m_lat + (uint32_t)DecodeZigZag( ReadVarint() ) );
+                        m_lon = (int32_t)( (uint32_t)m_lon + (uint32_t)DecodeZigZag( ReadVarint() ) );
+                        *lat = m_lat;
+                        *lon = m_lon;
+                  }
+                  return true;
+            }
+
+            void Skip( uint32_t n )
+            {
+                  if ( n > m_left )
+                        n = m_left;
+                  if ( m_coord ) {
+                        m_coord += n;
+                        m_left -= n;
+                  } else {
+                        int32_t lat, lon;
+                        while ( n-- )
+                              NextFixed( &lat, &lon );
+                  }
+            }
+
+            bool Next( double *lat, double *lon )
+            {
+                  int32_t flat, flon;
+                  if ( !NextFixed( &flat, &flon ) )
+                        return false;
+                  *lat = FromFixed( flat );
+                  *lon = FromFixed( flon );
+                  return true;
+            }
+
+      private:
+            uint32_t ReadVarint()
+            {
+                  uint32_t v = 0;
+                  int shift = 0;
+                  uint8_t b;
+                  do {
+                        b = *m_bytes++;
+                        v |= (uint32_t)(b & 0x7f) << shift;
+                        shift += 7;
+                  } while ( b & 0x80 );
+                  return v;
+            }
+            static int32_t DecodeZigZag( uint32_t v ) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+            const Coord   *m_coord;
+            const uint8_t *m_bytes;
+            uint32_t       m_left;
+            int32_t        m_lat;
+            int32_t        m_lon;
+      };
+
+private:
+      bool IsCompared( const Feature &f ) const;
+      const int64_t *GetTrackTimes( size_t part ) const;
+      void BuildTimeIndex();
+      int64_t BuildTimeNode( size_t lo, size_t hi );
+      void QueryTimeNode( size_t lo, size_t hi, int64_t begin, int64_t end, std::vector<uint32_t> *features ) const;
+      void BuildPickIndex();
+      // From coordinates laid out as m_parts says, into m_bytes
+      void PackFrom( const std::vector<Coord> &coords );
+      // From source's coordinates, of the same parts, into m_coords
+      void UnpackFrom( const KMLOverlayScene &source );
+      // Every index of a loaded cache within its array
+      bool IsConsistent( uint64_t vertices ) const;
+      bool IsPackedPartValid( const Part &p, const Chunk *chunks, uint32_t chunk_count ) const;
+      void QueryPickNode( size_t level, size_t idx, const Bounds &box, std::vector<const PickItem *> *items ) const;
+
+      std::vector<Feature>       m_features;
+      std::vector<Part>          m_parts;
+      std::vector<Style>         m_styles;
+      std::vector<GroundOverlay> m_overlays;
+      std::vector<Region>        m_regions;
+      std::vector<std::string>   m_icons;
+      std::vector<std::string>   m_links;
+      std::vector<TimeInterval>  m_times;         // sorted by begin once indexed
+      std::vector<int64_t>       m_time_max;      // latest end in each subtree of the implicit tree
+      std::vector<int64_t>       m_sample_times;  // track columns, one after the other
+      std::vector< std::pair<uint32_t, uint32_t> > m_tracks;   // part, first sample time
+      std::vector<Chunk>         m_chunks;
+      std::vector< std::pair<uint32_t, uint32_t> > m_chunked;  // part, first chunk
+      std::vector<PickItem>      m_pick_items;    // in Hilbert order
+      std::vector<Bounds>        m_pick_nodes;    // the levels above, bottom up
+      std::vector<uint32_t>      m_pick_levels;   // first node of each level, and the end
+      std::vector<TimeInterval>  m_pick_times;    // combined with the containers' intervals
+      std::vector<char>          m_texts;         // name and description, nul terminated
+      std::vector< std::pair<uint32_t, uint32_t> > m_text_index;   // feature, offset in texts
+      std::vector<Coord>         m_coords;
+      std::vector<uint8_t>       m_bytes;
+      std::map<Style, uint32_t>  m_style_index;
+      std::vector<size_t>        m_open;     // features being built
+      Bounds                     m_bounds;
+      size_t                     m_vertex_count;
+      bool                       m_packed;
+};
+
+#endif
@@ -0,0 +1,125 @@
+/***************************************************************************
+ * $Id: scratch.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <string.h>
+#include "scratch.h"
+#include "imageops.h"
+
+// Frames the pixels of a bitmap are kept without being drawn, what
+// panning back and forth brings in and out of view
+static const unsigned long KeepFrames = 32;
+
+static wxColour ToColour( uint32_t colour )
+{
+      return wxColour( colour >> 24, (colour >> 16) & 0xff, (colour >> 8) & 0xff, colour & 0xff );
+}
+
+KMLOverlayScratch::KMLOverlayScratch()
+      : m_frame( 0 ), m_warned_mask( false )
+{
+}
+
+const wxPen &KMLOverlayScratch::GetPen( uint32_t colour, float width )
+{
+      uint32_t bits;
+      memcpy( &bits, &width, sizeof( bits ) );
+      uint64_t key = (uint64_t)colour << 32 | bits;
+      std::map<uint64_t, wxPen>::iterator it = m_pens.find( key );
+      if ( it == m_pens.end() )
+            it = m_pens.insert( std::make_pair( key, wxPen( ToColour( colour ), width ) ) ).first;
+      return it->second;
+}
+
+const wxBrush &KMLOverlayScratch::GetBrush( uint32_t colour )
+{
+      std::map<uint32_t, wxBrush>::iterator it = m_brushes.find( colour );
+      if ( it == m_brushes.end() )
+            it = m_brushes.insert( std::make_pair( colour, wxBrush( ToColour( colour ) ) ) ).first;
+      return it->second;
+}
+
+const unsigned char *KMLOverlayScratch::GetPixels( const wxBitmap &bitmap, bool usemask )
+{
+      if ( !bitmap.IsOk() )
+            return NULL;
+      std::map<const void *, Pixels>::iterator it = m_pixels.find( bitmap.GetRefData() );
+      if ( it != m_pixels.end() && it->second.usemask == usemask ) {
+            it->second.last_used = m_frame;
+            return &it->second.data[0];
+      }
+
+      // Only bitmaps that convert get an entry
+      wxImage image = bitmap.ConvertToImage();
+      size_t size = (size_t)image.GetWidth() * image.GetHeight();
+      if ( !image.IsOk() || !size )
+            return NULL;
+      Pixels &pixels = it != m_pixels.end() ? it->second : m_pixels[bitmap.GetRefData()];
+      pixels.last_used = m_frame;
+      if ( usemask ) {
+            unsigned char *a = image.GetAlpha();
+            unsigned char mask[3];
+            if ( !image.GetOrFindMaskColour( &mask[0], &mask[1], &mask[2] ) && !a && !m_warned_mask ) {
+                  wxLogMessage( _T("KMLOverlayScratch::GetPixels Bitmap drawn with its mask has neither alpha nor mask") );
+                  m_warned_mask = true;
+            }
+            pixels.data.resize( 4 * size );
+            KMLOverlayImageOps::ToRGBA( image.GetData(), a, mask, &pixels.data[0], size );
+      } else {
+            pixels.data.assign( image.GetData(), image.GetData() + 3 * size );
+      }
+      pixels.bitmap = bitmap;
+      pixels.usemask = usemask;
+      return &pixels.data[0];
+}
+
+void KMLOverlayScratch::EndFrame()
+{
+      // A bitmap only we still hold can't be drawn again
+      for ( std::map<const void *, Pixels>::iterator it = m_pixels.begin(); it != m_pixels.end(); ) {
+            const wxBitmap &bitmap = it->second.bitmap;
+            if ( m_frame - it->second.last_used >= KeepFrames || !bitmap.IsOk() || bitmap.GetRefData()->GetRefCount() == 1 )
+                  m_pixels.erase( it++ );
+            else
+                  ++it;
+      }
+      m_frame++;
+}
+
+size_t KMLOverlayScratch::GetMemoryUsage() const
+{
+      size_t sz = 0;
+      for ( std::map<const void *, Pixels>::const_iterator it = m_pixels.begin(); it != m_pixels.end(); ++it )
+            sz += it->second.data.capacity();
+      return sz;
+}
@@ -0,0 +1,83 @@
+/***************************************************************************
+ * $Id: scratch.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayScratch_H_
+#define _KMLOverlayScratch_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+/*    What frames draw with, kept from one frame to the next.
+ *
+ *    Pens and brushes are made once per colour, and the pixels GL is
+ *    handed are converted once per bitmap, then kept while it is drawn.
+ *    Once every style and icon in view was drawn, a frame allocates
+ *    nothing here. Shared by the layers, on the paint thread; what one
+ *    frame works with is in its render context, see factory.h.
+ *************************************************************************/
+
+class KMLOverlayScratch
+{
+public:
+      KMLOverlayScratch();
+
+      // Colours are packed as 0xRRGGBBAA
+      const wxPen &GetPen( uint32_t colour, float width );
+      const wxBrush &GetBrush( uint32_t colour );
+      // The bitmap as glDrawPixels takes it, rows top down: RGBA with its
+      // mask or alpha when usemask, RGB otherwise. NULL if it can't be.
+      const unsigned char *GetPixels( const wxBitmap &bitmap, bool usemask );
+
+      // Lets go of the pixels of bitmaps not drawn for a while
+      void EndFrame();
+      size_t GetMemoryUsage() const;
+
+private:
+      struct Pixels
+      {
+            wxBitmap                   bitmap;      // held so its data can't be reused for another
+            bool                       usemask;
+            unsigned long              last_used;
+            std::vector<unsigned char> data;
+      };
+
+      std::map<uint64_t, wxPen>      m_pens;
+      std::map<uint32_t, wxBrush>    m_brushes;
+      std::map<const void *, Pixels> m_pixels;      // by the bitmap's shared data
+      unsigned long                  m_frame;
+      bool                           m_warned_mask;  // logged once
+};
+
+#endif
@@ -0,0 +1,247 @@
+/***************************************************************************
+ * $Id: superoverlay.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include "superoverlay.h"
+#include "kmlcompiler.h"
+#include "trace.h"
+
+// Frames a failed or pending tile is kept without being asked for, a
+// failed one is not retried every frame and a prefetch may still be used
+static const unsigned long KeepIdleFrames = 32;
+
+KMLOverlaySuperOverlay::KMLOverlaySuperOverlay( const std::string &source, KMLOverlayAssetCache *assets,
+                                                KMLOverlayWorkerPool *pool, KMLOverlayReclaimer *reclaimer,
+                                                wxEvtHandler *handler )
+      : m_source( source ), m_assets( assets ), m_pool( pool ), m_reclaimer( reclaimer ),
+      m_handler( handler ), m_frame( 0 ), m_bytes( 0 ), m_refs( 1 )
+{
+}
+
+KMLOverlaySuperOverlay::~KMLOverlaySuperOverlay()
+{
+      Clear();
+}
+
+void KMLOverlaySuperOverlay::Release()
+{
+      // A job still running finds no tile and drops its result
+      Clear();
+      Unref();
+}
+
+void KMLOverlaySuperOverlay::Unref()
+{
+      bool last;
+      {
+            wxMutexLocker lock( m_mutex );
+            last = --m_refs == 0;
+      }
+      if ( last )
+            delete this;
+}
+
+KMLOverlaySuperOverlay::Tile *KMLOverlaySuperOverlay::Request( const std::string &href, int priority )
+{
+      {
+            wxMutexLocker lock( m_mutex );
+
+            std::map<std::string, Tile *>::iterator it = m_tiles.find( href );
+            if ( it != m_tiles.end() ) {
+                  Tile *tile = it->second;
+                  // Still wanted, a ready one is only kept by being drawn
+                  if ( tile->state != TILE_READY )
+                        Touch( tile );
+                  // A prefetch now needed for drawing: the pool can't reorder
+                  // its queue, queue the load again, the first job to run
+                  // does it
+                  if ( tile->state != TILE_PENDING || tile->loading || priority <= tile->priority )
+                        return tile;
+                  tile->priority = priority;
+            } else {
+                  Tile *tile = new Tile();
+                  tile->state = TILE_PENDING;
+                  tile->scene = NULL;
+                  tile->bytes = 0;
+                  tile->last_used = m_frame;
+                  tile->priority = priority;
+                  tile->loading = false;
+                  tile->lru = m_idle.insert( m_idle.end(), href );
+                  m_tiles[href] = tile;
+            }
+            m_refs++;
+      }
+
+      // Outside of the lock: without threads the pool runs the job right away
+      m_pool->Submit( new LoadJob( this, href ), priority );
+
+      wxMutexLocker lock( m_mutex );
+      std::map<std::string, Tile *>::iterator it = m_tiles.find( href );
+      return it != m_tiles.end() ? it->second : NULL;
+}
+
+const KMLOverlayScene *KMLOverlaySuperOverlay::Get( const std::string &href )
+{
+      // Along with image decoding, above reloads
+      Tile *tile = Request( href, 0 );
+      wxMutexLocker lock( m_mutex );
+      if ( !tile || tile->state != TILE_READY )
+            return NULL;
+      Touch( tile );
+      return tile->scene;
+}
+
+void KMLOverlaySuperOverlay::Touch( Tile *tile )
+{
+      if ( tile->last_used == m_frame )
+            return;
+      tile->last_used = m_frame;
+      std::list<std::string> &lru = tile->state == TILE_READY ? m_ready : m_idle;
+      lru.splice( lru.end(), lru, tile->lru );
+}
+
+void KMLOverlaySuperOverlay::Prefetch( const std::string &href )
+{
+      Request( href, -1 );
+}
+
+void KMLOverlaySuperOverlay::Load( const std::string &href )
+{
+      {
+            // Trim() drops stale prefetches while they are still queued, and
+            // a prefetch raised by Get() has two jobs
+            wxMutexLocker lock( m_mutex );
+            std::map<std::string, Tile *>::iterator it = m_tiles.find( href );
+            if ( it == m_tiles.end() || it->second->state != TILE_PENDING || it->second->loading )
+                  return;
+            it->second->loading = true;
+      }
+
+      KMLOverlayTrace::Scope trace( "tile load", href.c_str() );
+      std::string content, error;
+      KMLOverlayScene *scene = new KMLOverlayScene();
+      bool ok = m_assets->ReadAsset( m_source, href, &content );
+      if ( !ok )
+            error = "Failed to read linked document";
+      else
+            ok = KMLOverlayCompiler::CompileLinked( content, href, scene, &error );
+
+      {
+            wxMutexLocker lock( m_mutex );
+
+            std::map<std::string, Tile *>::iterator it = m_tiles.find( href );
+            if ( it != m_tiles.end() && it->second->state == TILE_PENDING ) {
+                  Tile *tile = it->second;
+                  if ( ok ) {
+                        tile->scene = scene;
+                        tile->bytes = scene->GetMemoryUsage();
+                        tile->state = TILE_READY;
+                        m_bytes += tile->bytes;
+                        scene = NULL;
+                        // Newest, it has not had a frame to be drawn in yet
+                        tile->last_used = m_frame;
+                        m_ready.splice( m_ready.end(), m_idle, tile->lru );
+                  } else {
+                        tile->state = TILE_FAILED;
+                  }
+            }
+      }
+      delete scene;
+
+      // A failed document draws nothing until it is left alone long
+      // enough to be dropped
+      if ( ok && m_handler ) {
+            wxCommandEvent event( wxEVT_KMLOVERLAY_REFRESH );
+            wxPostEvent( m_handler, event );
+      }
+}
+
+void KMLOverlaySuperOverlay::BeginFrame()
+{
+      wxMutexLocker lock( m_mutex );
+      m_frame++;
+}
+
+// Drops the oldest tile of lru, a job still queued for it finds nothing
+// to do
+void KMLOverlaySuperOverlay::Drop( std::list<std::string> &lru )
+{
+      std::map<std::string, Tile *>::iterator it = m_tiles.find( lru.front() );
+      lru.pop_front();
+      Tile *tile = it->second;
+      if ( tile->scene ) {
+            m_bytes -= tile->bytes;
+            m_reclaimer->Retire( tile->scene );
+      }
+      delete tile;
+      m_tiles.erase( it );
+}
+
+void KMLOverlaySuperOverlay::Trim( size_t budget )
+{
+      wxMutexLocker lock( m_mutex );
+
+      // Oldest first, up to the tiles of this frame
+      while ( m_bytes > budget && !m_ready.empty() && m_tiles[m_ready.front()]->last_used != m_frame )
+            Drop( m_ready );
+
+      while ( !m_idle.empty() && m_tiles[m_idle.front()]->last_used + KeepIdleFrames < m_frame )
+            Drop( m_idle );
+}
+
+void KMLOverlaySuperOverlay::Clear()
+{
+      wxMutexLocker lock( m_mutex );
+
+      for ( std::map<std::string, Tile *>::iterator it = m_tiles.begin(); it != m_tiles.end(); ++it )
+      {
+            if ( it->second->scene )
+                  m_reclaimer->Retire( it->second->scene );
+            delete it->second;
+      }
+      m_tiles.clear();
+      m_ready.clear();
+      m_idle.clear();
+      m_bytes = 0;
+}
+
+size_t KMLOverlaySuperOverlay::GetMemoryUsage()
+{
+      wxMutexLocker lock( m_mutex );
+      return m_bytes;
+}
+
+size_t KMLOverlaySuperOverlay::GetTileCount()
+{
+      wxMutexLocker lock( m_mutex );
+      return m_tiles.size();
+}
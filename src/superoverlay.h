@@ -0,0 +1,132 @@
+/***************************************************************************
+ * $Id: superoverlay.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+#ifndef _KMLOverlaySuperOverlay_H_
+#define _KMLOverlaySuperOverlay_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/thread.h>
+#include <list>
+#include <map>
+#include <string>
+#include "scene.h"
+#include "assets.h"
+#include "workerpool.h"
+#include "reclaimer.h"
+
+/*    Documents reached through NetworkLinks, as in Region based
+ *    super-overlays (gdal2tiles, MapTiler).
+ *
+ *    A linked document is only read when the renderer reaches its link
+ *    with an active Region, then compiled on the worker pool and kept in
+ *    a least recently used cache. Links about to come into view may be
+ *    prefetched at a lower priority. Documents are read through the asset
+ *    cache, from the KMZ archive or next to the KML file.
+ *
+ *    Scenes are handed to the UI thread for the current frame only: they
+ *    are dropped from the UI thread and freed through the reclaimer.
+ *************************************************************************/
+
+class KMLOverlaySuperOverlay
+{
+public:
+      KMLOverlaySuperOverlay( const std::string &source, KMLOverlayAssetCache *assets, KMLOverlayWorkerPool *pool,
+                              KMLOverlayReclaimer *reclaimer, wxEvtHandler *handler );
+      // Drops the tiles, the last running job frees the object
+      void Release();
+
+      // UI thread only. NULL while the document is loading or if it can't be.
+      const KMLOverlayScene *Get( const std::string &href );
+      void Prefetch( const std::string &href );
+      void BeginFrame();
+      // Least recently used first, tiles drawn in this frame are kept.
+      // Failed and pending tiles not asked for in a while are dropped too.
+      void Trim( size_t budget );
+      void Clear();
+      size_t GetMemoryUsage();
+      size_t GetTileCount();
+
+private:
+      enum State
+      {
+            TILE_PENDING,
+            TILE_READY,
+            TILE_FAILED
+      };
+
+      struct Tile
+      {
+            State            state;
+            KMLOverlayScene *scene;
+            size_t           bytes;
+            unsigned long    last_used;
+            int              priority;      // of the latest job queued for it
+            bool             loading;       // a job took it, others queued find nothing to do
+            std::list<std::string>::iterator lru;   // in m_ready once ready, m_idle before
+      };
+
+      class LoadJob : public KMLOverlayWorkerPool::Job
+      {
+      public:
+            LoadJob( KMLOverlaySuperOverlay *owner, const std::string &href )
+                  : m_owner( owner ), m_href( href ) {}
+            ~LoadJob() { m_owner->Unref(); }
+            void Run() { m_owner->Load( m_href ); }
+      private:
+            KMLOverlaySuperOverlay *m_owner;
+            std::string             m_href;
+      };
+
+      ~KMLOverlaySuperOverlay();
+      Tile *Request( const std::string &href, int priority );
+      void Touch( Tile *tile );
+      void Drop( std::list<std::string> &lru );
+      void Load( const std::string &href );
+      void Unref();
+
+      std::string           m_source;
+      KMLOverlayAssetCache *m_assets;
+      KMLOverlayWorkerPool *m_pool;
+      KMLOverlayReclaimer  *m_reclaimer;
+      wxEvtHandler         *m_handler;
+      unsigned long         m_frame;
+
+      wxMutex                       m_mutex;      // tiles and refs
+      std::map<std::string, Tile *> m_tiles;
+      // Hrefs by last use, oldest first, so trimming never scans the tiles
+      std::list<std::string>        m_ready;
+      std::list<std::string>        m_idle;       // pending or failed
+      size_t                        m_bytes;
+      int                           m_refs;
+};
+
+#endif
@@ -0,0 +1,357 @@
+/***************************************************************************
+ * $Id: tilepyramid.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <set>
+#include <zlib.h>
+#include "tilepyramid.h"
+#include "jsonreader.h"
+#include "kmlcompiler.h"
+#include "query.h"
+#include "trace.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef KMLOverlayTilePyramid::Tile Tile;
+
+namespace {
+
+// Web Mercator stops short of the poles
+static const double MaxLatitude = 85.0511287798066;
+// A level is drawn from 1/sqrt(2) to sqrt(2) times its native size, the
+// next one takes over beyond
+static const double LodRatio = 1.41421356237;
+static const size_t BufferSize = 64 * 1024;
+
+// [z, x, y]
+static bool ReadTile( KMLOverlayJsonReader &reader, Tile *tile )
+{
+      double v[3];
+      if ( !reader.Expect( '[' ) )
+            return false;
+      for ( int i = 0; i < 3; i++ ) {
+            if ( ( i && !reader.Expect( ',' ) ) || !reader.ReadNumber( &v[i] ) )
+                  return false;
+            if ( v[i] != floor( v[i] ) || v[i] < 0 )
+                  return reader.Fail( "bad tile" );
+      }
+      if ( !reader.Expect( ']' ) )
+            return false;
+      if ( v[0] > KMLOverlayTilePyramid::MaxZoom )
+            return reader.Fail( "tile zoom out of range" );
+      tile->z = (int)v[0];
+      double n = ldexp( 1., tile->z );
+      if ( v[1] >= n || v[2] >= n )
+            return reader.Fail( "tile out of the grid" );
+      tile->x = (int)v[1];
+      tile->y = (int)v[2];
+      return true;
+}
+
+// {"south": ..., "west": ..., "north": ..., "east": ...}
+static bool ReadBounds( KMLOverlayJsonReader &reader, KMLOverlayTilePyramid::Index *index )
+{
+      std::string key;
+      if ( !reader.Expect( '{' ) )
+            return false;
+      if ( reader.PeekToken() == '}' )
+            return reader.Fail( "empty bounds" );
+      for ( ;; ) {
+            if ( !reader.ReadString( &key ) || !reader.Expect( ':' ) )
+                  return false;
+            bool ok;
+            if ( key == "south" )
+                  ok = reader.ReadNumber( &index->south );
+            else if ( key == "west" )
+                  ok = reader.ReadNumber( &index->west );
+            else if ( key == "north" )
+                  ok = reader.ReadNumber( &index->north );
+            else if ( key == "east" )
+                  ok = reader.ReadNumber( &index->east );
+            else
+                  ok = reader.SkipValue( 2 );
+            if ( !ok )
+                  return false;
+            int next = reader.GetToken();
+            if ( next == '}' )
+                  return true;
+            if ( next != ',' )
+                  return reader.Fail( "expected ',' or '}'" );
+      }
+}
+
+static bool ReadIndexObject( KMLOverlayJsonReader &reader, KMLOverlayTilePyramid::Index *index )
+{
+      std::string key, format;
+      double version = 0, value;
+      if ( !reader.Expect( '{' ) )
+            return false;
+      if ( reader.PeekToken() == '}' )
+            return reader.Fail( "empty index" );
+      for ( ;; ) {
+            if ( !reader.ReadString( &key ) || !reader.Expect( ':' ) )
+                  return false;
+            bool ok = true;
+            if ( key == "format" ) {
+                  ok = reader.ReadString( &format );
+            } else if ( key == "version" ) {
+                  ok = reader.ReadNumber( &version );
+            } else if ( key == "tile_size" || key == "min_zoom" || key == "max_zoom" ) {
+                  ok = reader.ReadNumber( &value );
+                  int v = value < 0 ? -1 : value > 65536 ? 65536 : (int)value;
+                  if ( key == "tile_size" )
+                        index->tile_size = v;
+                  else if ( key == "min_zoom" )
+                        index->min_zoom = v;
+                  else
+                        index->max_zoom = v;
+            } else if ( key == "bounds" ) {
+                  ok = ReadBounds( reader, index );
+            } else if ( key == "sources" ) {
+                  ok = reader.Expect( '[' );
+                  while ( ok && reader.PeekToken() != ']' ) {
+                        std::string source;
+                        ok = reader.ReadString( &source );
+                        index->sources.push_back( source );
+                        if ( ok && reader.PeekToken() == ',' )
+                              reader.GetToken();
+                  }
+                  ok = ok && reader.Expect( ']' );
+            } else if ( key == "tiles" ) {
+                  ok = reader.Expect( '[' );
+                  while ( ok && reader.PeekToken() != ']' ) {
+                        Tile tile;
+                        ok = ReadTile( reader, &tile );
+                        index->tiles.push_back( tile );
+                        if ( ok && reader.PeekToken() == ',' )
+                              reader.GetToken();
+                  }
+                  ok = ok && reader.Expect( ']' );
+            } else {
+                  ok = reader.SkipValue( 1 );
+            }
+            if ( !ok )
+                  return false;
+            int next = reader.GetToken();
+            if ( next == '}' )
+                  break;
+            if ( next != ',' )
+                  return reader.Fail( "expected ',' or '}'" );
+      }
+
+      if ( format != "kmloverlay-tiles" )
+            return reader.Fail( "not a tile pyramid index" );
+      if ( version != 1 )
+            return reader.Fail( "unsupported version" );
+      if ( index->tile_size < 16 || index->tile_size > 4096 )
+            return reader.Fail( "bad tile size" );
+      if ( index->min_zoom < 0 || index->min_zoom > index->max_zoom || index->max_zoom > KMLOverlayTilePyramid::MaxZoom )
+            return reader.Fail( "bad zoom range" );
+      for ( size_t i = 0; i < index->tiles.size(); i++ ) {
+            if ( index->tiles[i].z < index->min_zoom || index->tiles[i].z > index->max_zoom )
+                  return reader.Fail( "tile outside of the zoom range" );
+      }
+      return true;
+}
+
+static Tile GetParent( const Tile &tile )
+{
+      Tile parent = { tile.z - 1, tile.x / 2, tile.y / 2 };
+      return parent;
+}
+
+static uint32_t AddTileRegion( KMLOverlayScene *scene, const Tile &tile, float min_lod, float max_lod )
+{
+      double south, west, north, east;
+      KMLOverlayTilePyramid::GetTileBounds( tile, &south, &west, &north, &east );
+      KMLOverlayScene::Region region;
+      region.box.Extend( KMLOverlayScene::ToFixed( south ), KMLOverlayScene::ToFixed( west ) );
+      region.box.Extend( KMLOverlayScene::ToFixed( north ), KMLOverlayScene::ToFixed( east ) );
+      region.min_lod = min_lod;
+      region.max_lod = max_lod;
+      return scene->AddRegion( region );
+}
+
+/* A container per tile, over the tile itself when it has an image and the
+ * containers of its children. The container becomes active once the tile
+ * is large enough on screen, its image is then drawn until the children
+ * take over.
+ */
+static void CompileTile( KMLOverlayScene *scene, const KMLOverlayTilePyramid::Index &index,
+                         const std::set<Tile> &tiles, const std::set<Tile> &nodes, const Tile &tile )
+{
+      std::string id = KMLOverlayTilePyramid::GetTileHref( tile );
+      float min_lod = tile.z == index.min_zoom ? 0 : (float)( index.tile_size / LodRatio );
+      size_t folder = scene->BeginFeature( KMLOverlayScene::FEATURE_CONTAINER, 0,
+                                           KMLOverlayCompiler::MakeFeatureKey( id, KMLOverlayScene::FEATURE_CONTAINER ),
+                                           AddTileRegion( scene, tile, min_lod, -1 ) );
+      if ( tiles.count( tile ) ) {
+            float max_lod = tile.z == index.max_zoom ? -1 : (float)( index.tile_size * LodRatio );
+            size_t idx = scene->BeginFeature( KMLOverlayScene::FEATURE_GROUNDOVERLAY, 0,
+                                              KMLOverlayCompiler::MakeFeatureKey( id, KMLOverlayScene::FEATURE_GROUNDOVERLAY ),
+                                              AddTileRegion( scene, tile, 0, max_lod ) );
+            KMLOverlayScene::GroundOverlay overlay;
+            KMLOverlayTilePyramid::GetTileBounds( tile, &overlay.south, &overlay.west, &overlay.north, &overlay.east );
+            overlay.alpha = 255;
+            overlay.href = id;
+            scene->AddGroundOverlay( overlay );
+            scene->EndFeature( idx );
+      }
+      if ( tile.z < index.max_zoom ) {
+            for ( int i = 0; i < 4; i++ ) {
+                  Tile child = { tile.z + 1, tile.x * 2 + ( i & 1 ), tile.y * 2 + ( i >> 1 ) };
+                  if ( nodes.count( child ) )
+                        CompileTile( scene, index, tiles, nodes, child );
+            }
+      }
+      scene->EndFeature( folder );
+}
+
+}
+
+int KMLOverlayTilePyramid::LonToTileX( double lon, int z )
+{
+      double n = ldexp( 1., z );
+      int x = (int)floor( ( lon + 180 ) / 360 * n );
+      return std::max( 0, std::min( x, (int)n - 1 ) );
+}
+
+int KMLOverlayTilePyramid::LatToTileY( double lat, int z )
+{
+      double n = ldexp( 1., z );
+      lat = std::max( -MaxLatitude, std::min( lat, MaxLatitude ) ) * M_PI / 180;
+      int y = (int)floor( ( 1 - log( tan( lat ) + 1 / cos( lat ) ) / M_PI ) / 2 * n );
+      return std::max( 0, std::min( y, (int)n - 1 ) );
+}
+
+double KMLOverlayTilePyramid::TileYToLat( double y, int z )
+{
+      return atan( sinh( M_PI * ( 1 - 2 * y / ldexp( 1., z ) ) ) ) * 180 / M_PI;
+}
+
+void KMLOverlayTilePyramid::GetTileBounds( const Tile &tile, double *south, double *west, double *north, double *east )
+{
+      double n = ldexp( 1., tile.z );
+      *west = tile.x / n * 360 - 180;
+      *east = ( tile.x + 1 ) / n * 360 - 180;
+      *north = TileYToLat( tile.y, tile.z );
+      *south = TileYToLat( tile.y + 1, tile.z );
+}
+
+std::string KMLOverlayTilePyramid::GetTileHref( const Tile &tile )
+{
+      char href[64];
+      snprintf( href, sizeof( href ), "%d/%d/%d.png", tile.z, tile.x, tile.y );
+      return href;
+}
+
+bool KMLOverlayTilePyramid::ReadIndex( const std::string &path, Index *index, std::string *error )
+{
+      gzFile gz = gzopen( path.c_str(), "rb" );
+      if ( !gz ) {
+            *error = "Failed to read file content";
+            return false;
+      }
+      gzbuffer( gz, BufferSize );
+
+      index->tile_size = DefaultTileSize;
+      index->min_zoom = index->max_zoom = -1;
+      index->south = index->west = index->north = index->east = 0;
+      index->sources.clear();
+      index->tiles.clear();
+      KMLOverlayJsonReader reader( gz, BufferSize );
+      bool ok = ReadIndexObject( reader, index );
+      if ( ok && reader.PeekToken() != -1 )
+            ok = reader.Fail( "trailing content" );
+      gzclose( gz );
+      if ( !ok ) {
+            *error = "Tile index: " + reader.GetError();
+            return false;
+      }
+      return true;
+}
+
+bool KMLOverlayTilePyramid::WriteIndex( const std::string &path, const Index &index, std::string *error )
+{
+      char text[256];
+      snprintf( text, sizeof( text ), "{\"format\":\"kmloverlay-tiles\",\"version\":1,\"tile_size\":%d,"
+                "\"min_zoom\":%d,\"max_zoom\":%d,\n\"bounds\":{\"south\":%.9f,\"west\":%.9f,\"north\":%.9f,\"east\":%.9f},\n\"sources\":[",
+                index.tile_size, index.min_zoom, index.max_zoom, index.south, index.west, index.north, index.east );
+      std::string json = text;
+      for ( size_t i = 0; i < index.sources.size(); i++ ) {
+            if ( i )
+                  json += ',';
+            KMLOverlayQuery::AppendString( &json, index.sources[i].c_str() );
+      }
+      json += "],\n\"tiles\":[";
+      // A tile a line, runs are easier to compare
+      for ( size_t i = 0; i < index.tiles.size(); i++ ) {
+            snprintf( text, sizeof( text ), "%s\n[%d,%d,%d]", i ? "," : "",
+                      index.tiles[i].z, index.tiles[i].x, index.tiles[i].y );
+            json += text;
+      }
+      json += "]}\n";
+
+      FILE *f = fopen( path.c_str(), "wb" );
+      bool ok = f && fwrite( json.data(), 1, json.size(), f ) == json.size();
+      if ( f && fclose( f ) )
+            ok = false;
+      if ( !ok )
+            *error = "Failed to write " + path;
+      return ok;
+}
+
+bool KMLOverlayTilePyramid::LoadFile( const std::string &path, KMLOverlayScene *scene, std::string *error )
+{
+      KMLOverlayTrace::Scope trace( "tile index", path.c_str() );
+      Index index;
+      if ( !ReadIndex( path, &index, error ) )
+            return false;
+
+      // Containers are needed all the way down to the tiles, even where a
+      // coarser level had nothing drawn on it
+      std::set<Tile> tiles( index.tiles.begin(), index.tiles.end() );
+      std::set<Tile> nodes;
+      for ( std::set<Tile>::const_iterator it = tiles.begin(); it != tiles.end(); ++it ) {
+            for ( Tile node = *it; nodes.insert( node ).second && node.z > index.min_zoom; )
+                  node = GetParent( node );
+      }
+
+      scene->AddStyle( KMLOverlayCompiler::GetDefaultStyle() );
+      size_t root = scene->BeginFeature( KMLOverlayScene::FEATURE_CONTAINER, 0,
+                                         KMLOverlayCompiler::MakeFeatureKey( 0, 0, KMLOverlayScene::FEATURE_CONTAINER ) );
+      for ( std::set<Tile>::const_iterator it = nodes.begin(); it != nodes.end() && it->z == index.min_zoom; ++it )
+            CompileTile( scene, index, tiles, nodes, *it );
+      scene->EndFeature( root );
+      scene->Shrink();
+      return true;
+}
@@ -0,0 +1,96 @@
+/***************************************************************************
+ * $Id: tilepyramid.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayTilePyramid_H_
+#define _KMLOverlayTilePyramid_H_
+
+#include <string>
+#include <vector>
+#include "scene.h"
+
+/*    Raster tile pyramid pre-rendered by kmloverlay_tiler, shown in place
+ *    of the vector layers it was drawn from.
+ *
+ *    Tiles are PNG files named z/x/y.png beside the index, on the Web
+ *    Mercator grid the chart is projected to, so each one is drawn as a
+ *    ground overlay without warping. The index is JSON:
+ *
+ *      {"format":"kmloverlay-tiles","version":1,"tile_size":256,
+ *       "min_zoom":4,"max_zoom":12,
+ *       "bounds":{"south":..,"west":..,"north":..,"east":..},
+ *       "sources":["ais.kml"],"tiles":[[4,8,5],...]}
+ *
+ *    Only tiles with something drawn on them are listed. Once loaded the
+ *    pyramid is a quadtree of containers whose Regions pick the level
+ *    closest to its native size on screen, as a KML super-overlay would:
+ *    a frame only walks the tiles in view, and their images are decoded
+ *    when their level is first drawn.
+ *************************************************************************/
+
+class KMLOverlayTilePyramid
+{
+public:
+      static const int MaxZoom = 24;
+      static const int DefaultTileSize = 256;
+
+      struct Tile
+      {
+            int z, x, y;
+
+            bool operator<( const Tile &other ) const
+            {
+                  if ( z != other.z )
+                        return z < other.z;
+                  return x != other.x ? x < other.x : y < other.y;
+            }
+      };
+
+      struct Index
+      {
+            int                      tile_size;
+            int                      min_zoom, max_zoom;
+            double                   south, west, north, east;
+            std::vector<std::string> sources;
+            std::vector<Tile>        tiles;
+      };
+
+      // Web Mercator grid, positions beyond it are clamped
+      static int LonToTileX( double lon, int z );
+      static int LatToTileY( double lat, int z );
+      static double TileYToLat( double y, int z );
+      static void GetTileBounds( const Tile &tile, double *south, double *west, double *north, double *east );
+      // z/x/y.png, relative to the index
+      static std::string GetTileHref( const Tile &tile );
+
+      static bool ReadIndex( const std::string &path, Index *index, std::string *error );
+      static bool WriteIndex( const std::string &path, const Index &index, std::string *error );
+      // .kmltiles index
+      static bool LoadFile( const std::string &path, KMLOverlayScene *scene, std::string *error );
+};
+
+#endif
@@ -0,0 +1,170 @@
+/***************************************************************************
+ * $Id: trace.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/ffile.h>
+#include <algorithm>
+#include <chrono>
+#include "trace.h"
+
+// About 100 MB of JSON, a long session is cut rather than filling memory
+static const size_t MaxEvents = 1000000;
+
+std::atomic<bool>               KMLOverlayTrace::s_enabled( false );
+wxMutex                         KMLOverlayTrace::s_mutex;
+std::vector<KMLOverlayTrace::Event> KMLOverlayTrace::s_events;
+unsigned long                   KMLOverlayTrace::s_dropped = 0;
+unsigned long                   KMLOverlayTrace::s_main_tid = 0;
+wxString                        KMLOverlayTrace::s_filename;
+
+static std::chrono::steady_clock::time_point s_origin;
+
+static std::string Escape( const std::string &s )
+{
+      std::string out;
+      for ( size_t i = 0; i < s.size(); i++ ) {
+            unsigned char c = s[i];
+            if ( c == '"' || c == '\\' ) {
+                  out += '\\';
+                  out += c;
+            } else if ( c < 0x20 ) {
+                  char buf[8];
+                  snprintf( buf, sizeof( buf ), "\\u%04x", c );
+                  out += buf;
+            } else {
+                  out += c;
+            }
+      }
+      return out;
+}
+
+void KMLOverlayTrace::Scope::Begin( const char *name, const char *detail )
+{
+      m_name = name;
+      m_detail = detail;
+      m_start = Now();
+}
+
+void KMLOverlayTrace::Scope::End()
+{
+      Record( m_name, m_detail, m_start, Now() );
+}
+
+long long KMLOverlayTrace::Now()
+{
+      return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - s_origin ).count();
+}
+
+void KMLOverlayTrace::Record( const char *name, const char *detail, long long start, long long end )
+{
+      unsigned long tid = wxThread::GetCurrentId();
+      wxMutexLocker lock( s_mutex );
+      if ( s_events.size() >= MaxEvents ) {
+            s_dropped++;
+            return;
+      }
+      s_events.push_back( Event() );
+      Event &event = s_events.back();
+      event.name = name;
+      if ( detail )
+            event.detail = detail;
+      event.start = start;
+      event.duration = end - start;
+      event.tid = tid;
+}
+
+bool KMLOverlayTrace::Start( const wxString &filename )
+{
+      if ( s_enabled.load() || filename.IsEmpty() )
+            return false;
+      s_filename = filename;
+      s_main_tid = wxThread::GetCurrentId();
+      s_origin = std::chrono::steady_clock::now();
+      // Publishes the origin to the worker threads
+      s_enabled.store( true, std::memory_order_release );
+      wxLogMessage( _T("KMLOverlayTrace: tracing to %s"), filename.c_str() );
+      return true;
+}
+
+void KMLOverlayTrace::Stop()
+{
+      if ( !s_enabled.load() )
+            return;
+      s_enabled.store( false );
+
+      std::vector<Event> events;
+      unsigned long dropped;
+      {
+            wxMutexLocker lock( s_mutex );
+            events.swap( s_events );
+            dropped = s_dropped;
+            s_dropped = 0;
+      }
+
+      wxFFile file( s_filename, _T("w") );
+      if ( !file.IsOpened() ) {
+            wxLogMessage( _T("KMLOverlayTrace::Stop Failed to write %s"), s_filename.c_str() );
+            return;
+      }
+
+      long pid = wxGetProcessId();
+      std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+      char buf[256];
+      std::vector<unsigned long> tids;
+      for ( size_t i = 0; i < events.size(); i++ ) {
+            const Event &event = events[i];
+            snprintf( buf, sizeof( buf ), "{\"name\":\"%s\",\"cat\":\"kmloverlay\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%lu,\"ts\":%lld,\"dur\":%lld",
+                      event.name, pid, event.tid, event.start, event.duration );
+            json += buf;
+            if ( !event.detail.empty() ) {
+                  json += ",\"args\":{\"detail\":\"";
+                  json += Escape( event.detail );
+                  json += "\"}";
+            }
+            json += "},\n";
+            if ( std::find( tids.begin(), tids.end(), event.tid ) == tids.end() )
+                  tids.push_back( event.tid );
+      }
+      // Name the threads, every one but the UI thread belongs to a pool
+      for ( size_t i = 0; i < tids.size(); i++ ) {
+            snprintf( buf, sizeof( buf ), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%lu,\"args\":{\"name\":\"%s\"}},\n",
+                      pid, tids[i], tids[i] == s_main_tid ? "UI" : "worker" );
+            json += buf;
+      }
+      snprintf( buf, sizeof( buf ), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"name\":\"kmloverlay_pi\"}}\n]}\n", pid );
+      json += buf;
+
+      file.Write( json.data(), json.size() );
+      file.Close();
+      wxLogMessage( _T("KMLOverlayTrace::Stop %lu events written to %s, %lu dropped"),
+                    (unsigned long)events.size(), s_filename.c_str(), dropped );
+}
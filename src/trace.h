@@ -0,0 +1,107 @@
+/***************************************************************************
+ * $Id: trace.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+#ifndef _KMLOverlayTrace_H_
+#define _KMLOverlayTrace_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/thread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*    Scoped spans written as Chrome trace_event JSON.
+ *
+ *    Started from the KMLOVERLAY_TRACE environment variable or the
+ *    TraceFile key under /PlugIns/KMLOverlay, both naming the output file,
+ *    which is written when tracing stops. Each span is recorded as a
+ *    complete event with its thread id, so worker pool activity shows up
+ *    next to the UI thread in chrome://tracing or Perfetto.
+ *
+ *    While tracing is off a span costs a load and a branch on a flag that
+ *    never changes, on entry and on exit.
+ *************************************************************************/
+
+class KMLOverlayTrace
+{
+public:
+      class Scope
+      {
+      public:
+            // name must be a literal, detail is copied
+            Scope( const char *name, const char *detail = NULL )
+                  : m_name( NULL )
+            {
+                  if ( s_enabled.load( std::memory_order_acquire ) )
+                        Begin( name, detail );
+            }
+            ~Scope()
+            {
+                  if ( m_name )
+                        End();
+            }
+      private:
+            void Begin( const char *name, const char *detail );
+            void End();
+
+            const char *m_name;
+            const char *m_detail;
+            long long   m_start;
+      };
+
+      // From the UI thread, before and after any traced work
+      static bool Start( const wxString &filename );
+      static void Stop();
+      static bool IsEnabled() { return s_enabled.load( std::memory_order_acquire ); }
+
+private:
+      struct Event
+      {
+            const char   *name;
+            std::string   detail;
+            long long     start;        // microseconds since Start
+            long long     duration;
+            unsigned long tid;
+      };
+
+      static long long Now();
+      static void Record( const char *name, const char *detail, long long start, long long end );
+
+      static std::atomic<bool>  s_enabled;
+      static wxMutex            s_mutex;
+      static std::vector<Event> s_events;
+      static unsigned long      s_dropped;
+      static unsigned long      s_main_tid;
+      static wxString           s_filename;
+};
+
+#endif
@@ -33,6 +33,8 @@
 #endif //precompiled headers
 
 #include <wx/filename.h>
+#include <wx/datetime.h>
+#include <algorithm>
 #include "icons.h"
 #include "ui.h"
 
@@ -40,6 +42,48 @@
  *
  *************************************************************************/
 
+// Widths of the time window, in seconds
+static const int64_t s_time_widths[] = { 3600, 86400, 7*86400, 30*86400, 365*86400 };
+static const int s_time_steps = 1000;
+
+// Longest description shown on hover
+static const size_t s_max_description = 300;
+
+// KML descriptions are often HTML, a tooltip only takes plain text
+static wxString StripMarkup( const wxString &html )
+{
+      wxString text;
+      bool tag = false, space = false;
+      for ( size_t i = 0; i < html.Length() && text.Length() < s_max_description; i++ ) {
+            wxChar c = html[i];
+            if ( tag ) {
+                  tag = c != '>';
+                  continue;
+            }
+            if ( c == '<' ) {
+                  tag = true;
+                  space = !text.IsEmpty();
+                  continue;
+            }
+            if ( c == ' ' || c == '\t' || c == '\n' || c == '\r' ) {
+                  space = !text.IsEmpty();
+                  continue;
+            }
+            if ( space )
+                  text += ' ';
+            space = false;
+            text += c;
+      }
+      text.Replace( _T("&lt;"), _T("<") );
+      text.Replace( _T("&gt;"), _T(">") );
+      text.Replace( _T("&quot;"), _T("\"") );
+      text.Replace( _T("&nbsp;"), _T(" ") );
+      text.Replace( _T("&amp;"), _T("&") );
+      if ( text.Length() >= s_max_description )
+            text += _T("...");
+      return text;
+}
+
 KMLOverlayUI::KMLOverlayUI( wxWindow *pparent, wxWindowID id, wxString filename )
       :wxPanel( pparent, id, wxDefaultPosition, wxDefaultSize, wxBORDER_NONE, _("KML overlay") )
 {
@@ -56,6 +100,8 @@ KMLOverlayUI::KMLOverlayUI( wxWindow *pparent, wxWindowID id, wxString filename
             wxCommandEventHandler( KMLOverlayUI::OnListItemSelected ), NULL, this );
       m_pCheckListBox->Connect( wxEVT_COMMAND_CHECKLISTBOX_TOGGLED,
             wxCommandEventHandler( KMLOverlayUI::OnCheckToggle ), NULL, this );
+      m_pCheckListBox->Connect( wxEVT_MOTION,
+            wxMouseEventHandler( KMLOverlayUI::OnListMotion ), NULL, this );
       topsizer->Add( m_pCheckListBox, 0, wxEXPAND|wxALL );
 
       wxBoxSizer *itemBoxSizer01 = new wxBoxSizer( wxHORIZONTAL );
@@ -69,6 +115,30 @@ KMLOverlayUI::KMLOverlayUI( wxWindow *pparent, wxWindowID id, wxString filename
       itemBoxSizer01->Add( m_pButtonDelete, 0, wxALIGN_CENTER, 2 );
       m_pButtonDelete->Connect( wxEVT_COMMAND_BUTTON_CLICKED,
             wxCommandEventHandler( KMLOverlayUI::OnItemDelete ), NULL, this );
+      m_pButtonStats = new wxButton( this, wxID_ANY, _("Stats"), wxDefaultPosition, wxDefaultSize, wxBU_EXACTFIT );
+      m_pButtonStats->SetToolTip( _("Write the statistics of all layers to the log") );
+      itemBoxSizer01->Add( m_pButtonStats, 0, wxALIGN_CENTER, 2 );
+      m_pButtonStats->Connect( wxEVT_COMMAND_BUTTON_CLICKED,
+            wxCommandEventHandler( KMLOverlayUI::OnLogStats ), NULL, this );
+
+      m_pCheckTime = new wxCheckBox( this, wxID_ANY, _("Time filter") );
+      topsizer->Add( m_pCheckTime, 0, wxALL );
+      m_pCheckTime->Connect( wxEVT_COMMAND_CHECKBOX_CLICKED,
+            wxCommandEventHandler( KMLOverlayUI::OnTimeChanged ), NULL, this );
+      m_pSliderTime = new wxSlider( this, wxID_ANY, 0, 0, s_time_steps, wxDefaultPosition, wxSize(150, -1) );
+      topsizer->Add( m_pSliderTime, 0, wxEXPAND|wxALL );
+      m_pSliderTime->Connect( wxEVT_SCROLL_THUMBTRACK,
+            wxScrollEventHandler( KMLOverlayUI::OnTimeScroll ), NULL, this );
+      m_pSliderTime->Connect( wxEVT_SCROLL_CHANGED,
+            wxScrollEventHandler( KMLOverlayUI::OnTimeScroll ), NULL, this );
+      wxString widths[] = { _("1 hour"), _("1 day"), _("1 week"), _("1 month"), _("1 year") };
+      m_pChoiceWidth = new wxChoice( this, wxID_ANY, wxDefaultPosition, wxDefaultSize, 5, widths );
+      m_pChoiceWidth->SetSelection( 1 );
+      topsizer->Add( m_pChoiceWidth, 0, wxALL );
+      m_pChoiceWidth->Connect( wxEVT_COMMAND_CHOICE_SELECTED,
+            wxCommandEventHandler( KMLOverlayUI::OnTimeChanged ), NULL, this );
+      m_pLabelTime = new wxStaticText( this, wxID_ANY, wxEmptyString );
+      topsizer->Add( m_pLabelTime, 0, wxEXPAND|wxALL );
 
       Fit();
       // GetSize() doesn't seems to count aui borders so we add it now.
@@ -76,11 +146,19 @@ KMLOverlayUI::KMLOverlayUI( wxWindow *pparent, wxWindowID id, wxString filename
       SetMinSize(sz);
 
       UpdateButtonsState();
-      m_pFactory = new KMLOverlayFactory();
+      m_pFactory = new KMLOverlayFactory( this );
+      Connect( wxEVT_KMLOVERLAY_REFRESH, wxCommandEventHandler( KMLOverlayUI::OnRefresh ), NULL, this );
+      m_ReloadTimer.SetOwner( this );
+      Connect( wxEVT_TIMER, wxTimerEventHandler( KMLOverlayUI::OnReloadTimer ), NULL, this );
+      // Render times are only measured while the panel is shown
+      Connect( wxEVT_SHOW, wxShowEventHandler( KMLOverlayUI::OnShow ), NULL, this );
+      m_pFactory->SetStatsEnabled( IsShown() );
+      UpdateTimeWindow();
 }
 
 KMLOverlayUI::~KMLOverlayUI()
 {
+      m_ReloadTimer.Stop();
       delete m_pFactory;
 }
 
@@ -110,6 +188,7 @@ void KMLOverlayUI::AddFile( wxString filename, bool visible )
       }
       m_pCheckListBox->Append( wxFileName(filename).GetFullName() );
       m_pCheckListBox->Check( m_pCheckListBox->GetCount()-1, visible );
+      UpdateTimeWindow();
 }
 
 wxString KMLOverlayUI::GetFilename( int idx )
@@ -127,6 +206,71 @@ int KMLOverlayUI::GetCount()
       return m_pFactory->GetCount(); // m_pCheckListBox->GetCount();
 }
 
+void KMLOverlayUI::SetMemoryBudget( int megabytes )
+{
+      m_pFactory->SetMemoryBudget( megabytes > 0 ? (size_t)megabytes * 1024 * 1024 : 0 );
+}
+
+void KMLOverlayUI::SetReloadInterval( int minutes )
+{
+      m_pFactory->SetReloadInterval( minutes );
+      // Changes are checked every second, the watcher itself only polls
+      // the files every interval.
+      if ( minutes >= 0 )
+            m_ReloadTimer.Start( 1000 );
+      else
+            m_ReloadTimer.Stop();
+}
+
+void KMLOverlayUI::SetLabelsEnabled( bool enabled )
+{
+      m_pFactory->SetLabelsEnabled( enabled );
+}
+
+void KMLOverlayUI::SetCursorLatLon( double lat, double lon )
+{
+      wxString name, description, tip;
+      if ( m_pFactory->Pick( lat, lon, &name, &description ) ) {
+            tip = name;
+            wxString text = StripMarkup( description );
+            if ( !tip.IsEmpty() && !text.IsEmpty() )
+                  tip += _T("\n");
+            tip += text;
+      }
+      if ( tip == m_HoverTip )
+            return;
+
+      m_HoverTip = tip;
+      wxWindow *canvas = GetOCPNCanvasWindow();
+      if ( !canvas )
+            return;
+      if ( tip.IsEmpty() )
+            canvas->UnsetToolTip();
+      else
+            canvas->SetToolTip( tip );
+}
+
+wxString KMLOverlayUI::Query( const wxString &request )
+{
+      std::string response = m_pFactory->Query( std::string( request.ToUTF8() ) );
+      return wxString::FromUTF8( response.c_str() );
+}
+
+void KMLOverlayUI::OnRefresh( wxCommandEvent& event )
+{
+      // Also sent when a reload is ready to be swapped in
+      m_pFactory->CheckReload();
+      // Extents change as layers are loaded, and show up here
+      UpdateTimeWindow();
+      RequestRefresh( GetOCPNCanvasWindow() );
+}
+
+void KMLOverlayUI::OnReloadTimer( wxTimerEvent& event )
+{
+      if ( m_pFactory->CheckReload() )
+            RequestRefresh( GetOCPNCanvasWindow() );
+}
+
 void KMLOverlayUI::OnListItemSelected( wxCommandEvent& event )
 {
       UpdateButtonsState();
@@ -144,7 +288,12 @@ void KMLOverlayUI::UpdateButtonsState()
 
 void KMLOverlayUI::OnItemAdd( wxCommandEvent &event )
 {
-      wxFileDialog fdlg( this, _("Select a file"), wxT(""), wxT(""), _("KML files (*.kml;*.kmz)|*.kml;*.kmz"), wxFD_OPEN|wxFD_FILE_MUST_EXIST );
+      wxFileDialog fdlg( this, _("Select a file"), wxT(""), wxT(""),
+                         _("All supported files|*.kml;*.kmz;*.kml.gz;*.geojson;*.json;*.geojson.gz;*.gpx;*.gpx.gz;*.kmltiles|"
+                           "KML files (*.kml;*.kmz;*.kml.gz)|*.kml;*.kmz;*.kml.gz|"
+                           "GeoJSON files (*.geojson;*.json)|*.geojson;*.json;*.geojson.gz|"
+                           "GPX files (*.gpx)|*.gpx;*.gpx.gz|"
+                           "Tile pyramids (*.kmltiles)|*.kmltiles"), wxFD_OPEN|wxFD_FILE_MUST_EXIST );
       if ( fdlg.ShowModal() == wxID_OK)
       {
             AddFile( fdlg.GetPath(), true );
@@ -161,5 +310,90 @@ void KMLOverlayUI::OnItemDelete( wxCommandEvent &event )
             m_pFactory->Delete( itemID );
       }
       UpdateButtonsState();
+      UpdateTimeWindow();
+}
+
+void KMLOverlayUI::OnLogStats( wxCommandEvent &event )
+{
+      m_pFactory->LogStats();
+}
+
+void KMLOverlayUI::OnTimeChanged( wxCommandEvent &event )
+{
+      UpdateTimeWindow();
+}
+
+void KMLOverlayUI::OnTimeScroll( wxScrollEvent &event )
+{
+      UpdateTimeWindow();
+}
+
+void KMLOverlayUI::UpdateTimeWindow()
+{
+      int64_t first, last;
+      bool has_time = m_pFactory->GetTimeExtent( &first, &last );
+      m_pCheckTime->Enable( has_time );
+      bool enabled = has_time && m_pCheckTime->IsChecked();
+      m_pSliderTime->Enable( enabled );
+      m_pChoiceWidth->Enable( enabled );
+      if ( !enabled ) {
+            m_pLabelTime->SetLabel( wxEmptyString );
+            m_pFactory->SetTimeWindow( false, 0, 0 );
+            return;
+      }
+
+      // The slider spans the start of the window, so its end stays within the data
+      int sel = m_pChoiceWidth->GetSelection();
+      int64_t width = s_time_widths[sel == wxNOT_FOUND ? 1 : sel];
+      int64_t range = std::max( last - first - width, (int64_t)0 );
+      int64_t begin = first + (int64_t)( (double)range * m_pSliderTime->GetValue() / s_time_steps );
+      int64_t end = begin + width;
+
+      wxDateTime from( (time_t)begin ), to( (time_t)end );
+      m_pLabelTime->SetLabel( from.Format( _T("%Y-%m-%d %H:%M"), wxDateTime::UTC ) + _T(" - ") +
+                              to.Format( _T("%Y-%m-%d %H:%M UTC"), wxDateTime::UTC ) );
+      m_pFactory->SetTimeWindow( true, begin, end );
+}
+
+void KMLOverlayUI::OnShow( wxShowEvent &event )
+{
+      m_pFactory->SetStatsEnabled( event.IsShown() );
+      event.Skip();
+}
+
+void KMLOverlayUI::OnListMotion( wxMouseEvent &event )
+{
+      // Formatted when the mouse moves over the list, never while drawing
+      wxString tip = FormatStats( m_pCheckListBox->HitTest( event.GetPosition() ) );
+      wxToolTip *current = m_pCheckListBox->GetToolTip();
+      if ( !current || current->GetTip() != tip )
+            m_pCheckListBox->SetToolTip( tip );
+      event.Skip();
 }
 
+wxString KMLOverlayUI::FormatStats( int idx )
+{
+      KMLOverlayFactory::LayerStats stats;
+      if ( idx == wxNOT_FOUND || !m_pFactory->GetStats( idx, &stats ) )
+            return wxEmptyString;
+
+      wxString tip = m_pFactory->GetFilename( idx );
+      tip += wxString::Format( _("\nParsed in %.1f ms"), stats.parse_ms );
+      if ( stats.loaded )
+            tip += wxString::Format( _("\nMemory: %.1f MB"), stats.memory / 1048576. );
+      else
+            tip += _("\nUnloaded");
+      if ( stats.frames )
+            tip += wxString::Format( _("\nRender: %.2f ms, %.2f ms average over %lu frames"),
+                                     stats.last_render_ms, stats.avg_render_ms, stats.frames );
+      tip += wxString::Format( _("\nVertices: %lu drawn, %lu culled"), stats.vertices_drawn, stats.vertices_culled );
+      tip += wxString::Format( _("\nImages: %.1f MB uploaded, %lu hits, %lu misses"),
+                               stats.image_bytes / 1048576., stats.image_hits, stats.image_misses );
+      if ( stats.tiles )
+            tip += wxString::Format( _("\nLinked documents: %lu cached"), stats.tiles );
+      if ( stats.rehydrations )
+            tip += wxString::Format( _("\nReloaded %lu times from the binary cache"), stats.rehydrations );
+      if ( stats.view_hits )
+            tip += wxString::Format( _("\n%lu frames replayed from the view cache"), stats.view_hits );
+      return tip;
+}
@@ -36,6 +36,7 @@
 #endif //precompiled headers
 
 #include <wx/checklst.h>
+#include <wx/timer.h>
 #include "../../../include/ocpn_plugin.h"
 #include "factory.h"
 
@@ -53,19 +54,42 @@ public:
       wxString GetFilename( int idx );
       bool GetVisibility( int idx );
       int GetCount();
+      void SetMemoryBudget( int megabytes );
+      void SetReloadInterval( int minutes );
+      void SetLabelsEnabled( bool enabled );
+      // Shows what is under the cursor on the chart
+      void SetCursorLatLon( double lat, double lon );
+      // Spatial query from another plugin, see KMLOverlayQuery
+      wxString Query( const wxString &request );
 
 private:
+      void OnRefresh( wxCommandEvent& event );
+      void OnReloadTimer( wxTimerEvent& event );
       void OnListItemSelected( wxCommandEvent& event );
       void OnCheckToggle( wxCommandEvent& event );
       void UpdateButtonsState();
       void OnItemAdd( wxCommandEvent& event );
       void OnItemDelete( wxCommandEvent& event );
+      void OnLogStats( wxCommandEvent& event );
+      void OnListMotion( wxMouseEvent& event );
+      void OnShow( wxShowEvent& event );
+      wxString FormatStats( int idx );
+      void OnTimeChanged( wxCommandEvent& event );
+      void OnTimeScroll( wxScrollEvent& event );
+      void UpdateTimeWindow();
 
       wxCheckListBox       *m_pCheckListBox;
       wxBitmapButton       *m_pButtonAdd;
       wxBitmapButton       *m_pButtonDelete;
+      wxButton             *m_pButtonStats;
+      wxCheckBox           *m_pCheckTime;
+      wxSlider             *m_pSliderTime;
+      wxChoice             *m_pChoiceWidth;
+      wxStaticText         *m_pLabelTime;
 
       KMLOverlayFactory    *m_pFactory;
+      wxTimer               m_ReloadTimer;
+      wxString              m_HoverTip;
 };
 
 #endif
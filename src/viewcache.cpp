@@ -0,0 +1,207 @@
+/***************************************************************************
+ * $Id: viewcache.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <algorithm>
+#include "viewcache.h"
+
+// Viewports per layer, two canvases and the overview or a quilting pass
+static const size_t MaxEntries = 4;
+// Larger records are drawn once and dropped
+static const size_t MaxEntryBytes = 16 * 1024 * 1024;
+
+unsigned long long KMLOverlayViewCache::Recorder::DrawBitmap( const wxBitmap &bitmap, wxCoord x, wxCoord y, bool usemask )
+{
+      // wxBitmap is reference counted, icons are shared with the asset cache
+      Primitive p;
+      p.op = Primitive::BITMAP;
+      p.usemask = usemask;
+      p.first = m_entry->bitmaps.size();
+      p.count = 1;
+      p.rings = 0;
+      p.x = x;
+      p.y = y;
+      m_entry->bitmaps.push_back( bitmap );
+      m_entry->primitives.push_back( p );
+      m_entry->bytes += (size_t)bitmap.GetWidth() * bitmap.GetHeight() * 4;
+      return 0;
+}
+
+void KMLOverlayViewCache::Recorder::Add( uint8_t op, const wxPen &pen, const wxBrush &brush, int n, wxPoint points[] )
+{
+      Primitive p;
+      p.op = op;
+      p.usemask = false;
+      p.pen = pen;
+      p.brush = brush;
+      p.first = m_entry->points.size();
+      p.count = n;
+      p.rings = 0;
+      p.x = p.y = 0;
+      m_entry->points.insert( m_entry->points.end(), points, points + n );
+      m_entry->primitives.push_back( p );
+      m_entry->bytes += n * sizeof( wxPoint ) + sizeof( Primitive );
+}
+
+void KMLOverlayViewCache::Recorder::DrawPolyPolygon( const wxPen &pen, const wxBrush &brush, int n, const int counts[],
+                                                     wxPoint points[] )
+{
+      // The rings' points follow each other, as for a single polygon
+      int total = 0;
+      for ( int i = 0; i < n; i++ )
+            total += counts[i];
+      Add( Primitive::POLYPOLYGON, pen, brush, total, points );
+      Primitive &p = m_entry->primitives.back();
+      p.count = n;
+      p.rings = m_entry->counts.size();
+      m_entry->counts.insert( m_entry->counts.end(), counts, counts + n );
+      m_entry->bytes += n * sizeof( int );
+}
+
+KMLOverlayViewCache::KMLOverlayViewCache()
+      : m_clock( 0 ), m_hits( 0 ), m_peak_primitives( 0 ), m_peak_points( 0 ), m_peak_counts( 0 ), m_peak_bitmaps( 0 ),
+      m_peak_labels( 0 )
+{
+}
+
+KMLOverlayViewCache::~KMLOverlayViewCache()
+{
+      for ( size_t i = 0; i < m_entries.size(); i++ )
+            delete m_entries[i];
+}
+
+bool KMLOverlayViewCache::IsSameView( const PlugIn_ViewPort &a, const PlugIn_ViewPort &b )
+{
+      // Everything GetCanvasPixLL depends on
+      return a.clat == b.clat && a.clon == b.clon && a.view_scale_ppm == b.view_scale_ppm
+            && a.rotation == b.rotation && a.skew == b.skew && a.m_projection_type == b.m_projection_type
+            && a.pix_width == b.pix_width && a.pix_height == b.pix_height;
+}
+
+void KMLOverlayViewCache::Reset( Entry *entry, bool release )
+{
+      entry->scene = NULL;
+      entry->complete = false;
+      entry->vertices_drawn = 0;
+      entry->vertices_culled = 0;
+      entry->bytes = 0;
+      // Bitmaps are let go either way, the buffers are kept for the next
+      // record unless it grew too large
+      if ( release ) {
+            std::vector<Primitive>().swap( entry->primitives );
+            std::vector<wxPoint>().swap( entry->points );
+            std::vector<int>().swap( entry->counts );
+            std::vector<wxBitmap>().swap( entry->bitmaps );
+            std::vector<Label>().swap( entry->labels );
+      } else {
+            entry->primitives.clear();
+            entry->points.clear();
+            entry->counts.clear();
+            entry->bitmaps.clear();
+            entry->labels.clear();
+      }
+}
+
+KMLOverlayViewCache::Entry *KMLOverlayViewCache::Find( const KMLOverlayScene *scene, const PlugIn_ViewPort &vp )
+{
+      for ( size_t i = 0; i < m_entries.size(); i++ ) {
+            Entry *entry = m_entries[i];
+            if ( entry->complete && entry->scene == scene && IsSameView( entry->vp, vp ) ) {
+                  entry->last_used = ++m_clock;
+                  m_hits++;
+                  return entry;
+            }
+      }
+      return NULL;
+}
+
+KMLOverlayViewCache::Entry *KMLOverlayViewCache::Begin( const KMLOverlayScene *scene, const PlugIn_ViewPort &vp )
+{
+      Entry *entry = NULL;
+      if ( m_entries.size() < MaxEntries ) {
+            entry = new Entry();
+            m_entries.push_back( entry );
+      } else {
+            entry = m_entries[0];
+            for ( size_t i = 1; i < m_entries.size(); i++ ) {
+                  if ( m_entries[i]->last_used < entry->last_used )
+                        entry = m_entries[i];
+            }
+      }
+      Reset( entry, false );
+      // Sized for the largest record kept so far: once panning went over
+      // the layer, recording allocates nothing
+      entry->primitives.reserve( m_peak_primitives );
+      entry->points.reserve( m_peak_points );
+      entry->counts.reserve( m_peak_counts );
+      entry->bitmaps.reserve( m_peak_bitmaps );
+      entry->labels.reserve( m_peak_labels );
+      entry->scene = scene;
+      entry->vp = vp;
+      entry->last_used = ++m_clock;
+      return entry;
+}
+
+void KMLOverlayViewCache::End( Entry *entry )
+{
+      if ( entry->bytes > MaxEntryBytes ) {
+            Reset( entry, true );
+            return;
+      }
+      m_peak_primitives = std::max( m_peak_primitives, entry->primitives.size() );
+      m_peak_points = std::max( m_peak_points, entry->points.size() );
+      m_peak_counts = std::max( m_peak_counts, entry->counts.size() );
+      m_peak_bitmaps = std::max( m_peak_bitmaps, entry->bitmaps.size() );
+      m_peak_labels = std::max( m_peak_labels, entry->labels.size() );
+}
+
+void KMLOverlayViewCache::Clear()
+{
+      for ( size_t i = 0; i < m_entries.size(); i++ )
+            Reset( m_entries[i], true );
+      m_peak_primitives = m_peak_points = m_peak_counts = m_peak_bitmaps = m_peak_labels = 0;
+}
+
+size_t KMLOverlayViewCache::GetMemoryUsage() const
+{
+      size_t sz = 0;
+      for ( size_t i = 0; i < m_entries.size(); i++ ) {
+            const Entry *entry = m_entries[i];
+            sz += sizeof( Entry ) + entry->primitives.capacity() * sizeof( Primitive )
+                  + entry->points.capacity() * sizeof( wxPoint ) + entry->counts.capacity() * sizeof( int )
+                  + entry->labels.capacity() * sizeof( Label );
+            for ( size_t j = 0; j < entry->bitmaps.size(); j++ )
+                  sz += (size_t)entry->bitmaps[j].GetWidth() * entry->bitmaps[j].GetHeight() * 4;
+      }
+      return sz;
+}
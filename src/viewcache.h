@@ -0,0 +1,161 @@
+/***************************************************************************
+ * $Id: viewcache.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayViewCache_H_
+#define _KMLOverlayViewCache_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <vector>
+#include "../../../include/ocpn_plugin.h"
+#include "scene.h"
+#include "labels.h"
+
+/*    Recorded frames of one layer, by viewport.
+ *
+ *    Drawing a layer records what it draws: projected points with their
+ *    pen and brush, icons, ground overlays scaled to the screen and labels.
+ *    The record is then drawn with the other layers' by
+ *    KMLOverlayRenderQueue. A few records are kept, keyed by the
+ *    viewport's projection, scale, rotation, skew, centre and size.
+ *    Canvases drawn in turn, or a view drawn twice in one refresh, then
+ *    project and scale nothing.
+ *
+ *    A record is only reused for the scene it was made from, and only when
+ *    complete: no image still decoding, no linked document still loading.
+ *    Whatever else changes what is drawn clears the cache.
+ *************************************************************************/
+
+class KMLOverlayViewCache
+{
+public:
+      struct Primitive
+      {
+            enum Op
+            {
+                  LINES,
+                  POLYGON,
+                  POLYPOLYGON,
+                  BITMAP
+            };
+
+            uint8_t  op;
+            bool     usemask;
+            wxPen    pen;
+            wxBrush  brush;
+            uint32_t first;         // in points, or in bitmaps
+            uint32_t count;         // points, or rings of a POLYPOLYGON
+            uint32_t rings;         // in counts, for a POLYPOLYGON
+            wxCoord  x, y;
+      };
+
+      // Texts point into the scene
+      struct Label
+      {
+            const char *text;
+            int         x, y;
+            uint32_t    colour;
+      };
+
+      struct Entry
+      {
+            const KMLOverlayScene *scene;
+            PlugIn_ViewPort        vp;
+            bool                   complete;
+            unsigned long          last_used;
+            unsigned long          vertices_drawn;
+            unsigned long          vertices_culled;
+            size_t                 bytes;
+            std::vector<Primitive> primitives;
+            std::vector<wxPoint>   points;
+            std::vector<int>       counts;        // points of each ring
+            std::vector<wxBitmap>  bitmaps;
+            std::vector<Label>     labels;
+      };
+
+      // Backend the layer's traversal draws into, see backend.h
+      class Recorder
+      {
+      public:
+            Recorder( Entry *entry ) : m_entry( entry ) {}
+
+            void DrawLines( const wxPen &pen, int n, wxPoint points[] )
+            {
+                  Add( Primitive::LINES, pen, wxNullBrush, n, points );
+            }
+            void DrawPolygon( const wxPen &pen, const wxBrush &brush, int n, wxPoint points[] )
+            {
+                  Add( Primitive::POLYGON, pen, brush, n, points );
+            }
+            void DrawPolyPolygon( const wxPen &pen, const wxBrush &brush, int n, const int counts[], wxPoint points[] );
+            unsigned long long DrawBitmap( const wxBitmap &bitmap, wxCoord x, wxCoord y, bool usemask );
+            void AddLabel( KMLOverlayLabels *, const char *text, int x, int y, uint32_t colour )
+            {
+                  Label label = { text, x, y, colour };
+                  m_entry->labels.push_back( label );
+            }
+
+      private:
+            void Add( uint8_t op, const wxPen &pen, const wxBrush &brush, int n, wxPoint points[] );
+
+            Entry *m_entry;
+      };
+
+      KMLOverlayViewCache();
+      ~KMLOverlayViewCache();
+
+      // A complete record of scene in vp, NULL when there is none
+      Entry *Find( const KMLOverlayScene *scene, const PlugIn_ViewPort &vp );
+      // An empty record to draw into, the least recently used one is recycled
+      Entry *Begin( const KMLOverlayScene *scene, const PlugIn_ViewPort &vp );
+      // Once drawn, see KMLOverlayRenderQueue: records too large to keep
+      // are dropped
+      void End( Entry *entry );
+      void Clear();
+      size_t GetMemoryUsage() const;
+      unsigned long GetHits() const { return m_hits; }
+
+private:
+      static bool IsSameView( const PlugIn_ViewPort &a, const PlugIn_ViewPort &b );
+      static void Reset( Entry *entry, bool release );
+
+      std::vector<Entry *> m_entries;
+      unsigned long        m_clock;
+      unsigned long        m_hits;
+      size_t               m_peak_primitives;   // of the records kept
+      size_t               m_peak_points;
+      size_t               m_peak_counts;
+      size_t               m_peak_bitmaps;
+      size_t               m_peak_labels;
+};
+
+#endif
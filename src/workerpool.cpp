@@ -0,0 +1,129 @@
+/***************************************************************************
+ * $Id: workerpool.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include "workerpool.h"
+
+const wxEventType wxEVT_KMLOVERLAY_REFRESH = wxNewEventType();
+
+KMLOverlayWorkerPool::KMLOverlayWorkerPool( int threads )
+      : m_cond( m_mutex ), m_serial( 0 ), m_stop( false )
+{
+      if ( threads <= 0 )
+            threads = wxThread::GetCPUCount() - 1;
+      if ( threads < 1 )
+            threads = 1;
+
+      for ( int i = 0; i < threads; i++ )
+      {
+            Worker *worker = new Worker( this );
+            if ( worker->Create() != wxTHREAD_NO_ERROR || worker->Run() != wxTHREAD_NO_ERROR )
+            {
+                  wxLogMessage( _T("KMLOverlayWorkerPool: failed to start worker thread") );
+                  delete worker;
+                  continue;
+            }
+            m_workers.push_back( worker );
+      }
+}
+
+KMLOverlayWorkerPool::~KMLOverlayWorkerPool()
+{
+      {
+            wxMutexLocker lock( m_mutex );
+            m_stop = true;
+            m_cond.Broadcast();
+      }
+      for ( size_t i = 0; i < m_workers.size(); i++ )
+      {
+            m_workers[i]->Wait();
+            delete m_workers[i];
+      }
+      while ( !m_jobs.empty() )
+      {
+            delete m_jobs.top().job;
+            m_jobs.pop();
+      }
+}
+
+void KMLOverlayWorkerPool::Submit( Job *job, int priority )
+{
+      // No thread could be started, run synchronously rather than never
+      if ( m_workers.empty() )
+      {
+            job->Run();
+            delete job;
+            return;
+      }
+
+      wxMutexLocker lock( m_mutex );
+      Pending p;
+      p.job = job;
+      p.priority = priority;
+      p.serial = m_serial++;
+      m_jobs.push( p );
+      m_cond.Signal();
+}
+
+size_t KMLOverlayWorkerPool::GetPendingCount()
+{
+      wxMutexLocker lock( m_mutex );
+      return m_jobs.size();
+}
+
+KMLOverlayWorkerPool::Job *KMLOverlayWorkerPool::WaitJob()
+{
+      wxMutexLocker lock( m_mutex );
+      while ( !m_stop && m_jobs.empty() )
+            m_cond.Wait();
+      if ( m_stop )
+            return NULL;
+      Job *job = m_jobs.top().job;
+      m_jobs.pop();
+      return job;
+}
+
+KMLOverlayWorkerPool::Worker::Worker( KMLOverlayWorkerPool *pool )
+      : wxThread( wxTHREAD_JOINABLE ), m_pool( pool )
+{
+}
+
+wxThread::ExitCode KMLOverlayWorkerPool::Worker::Entry()
+{
+      while ( Job *job = m_pool->WaitJob() )
+      {
+            job->Run();
+            delete job;
+      }
+      return 0;
+}
@@ -0,0 +1,105 @@
+/***************************************************************************
+ * $Id: workerpool.h, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+#ifndef _KMLOverlayWorkerPool_H_
+#define _KMLOverlayWorkerPool_H_
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/thread.h>
+#include <queue>
+#include <vector>
+
+// Posted to the UI when background work needs the chart to be redrawn
+extern const wxEventType wxEVT_KMLOVERLAY_REFRESH;
+
+/*    Small pool of joinable wxThreads running jobs by priority.
+ *
+ *    Jobs must not touch wx GUI objects: they report back by posting
+ *    wxEVT_KMLOVERLAY_REFRESH, or through their own locked state.
+ *************************************************************************/
+
+class KMLOverlayWorkerPool
+{
+public:
+      class Job
+      {
+      public:
+            virtual ~Job() {}
+            virtual void Run() = 0;
+      };
+
+      // threads <= 0 means one less than the number of CPUs, at least one
+      KMLOverlayWorkerPool( int threads = 0 );
+      ~KMLOverlayWorkerPool();
+
+      // The pool takes ownership of the job, higher priorities run first
+      void Submit( Job *job, int priority = 0 );
+      size_t GetPendingCount();
+      int GetThreadCount() { return m_workers.size(); }
+
+private:
+      class Worker : public wxThread
+      {
+      public:
+            Worker( KMLOverlayWorkerPool *pool );
+      protected:
+            ExitCode Entry();
+      private:
+            KMLOverlayWorkerPool *m_pool;
+      };
+
+      struct Pending
+      {
+            Job     *job;
+            int      priority;
+            unsigned serial;
+            bool operator<( const Pending &other ) const
+            {
+                  // priority_queue pops the largest, keep FIFO among equals
+                  if ( priority != other.priority )
+                        return priority < other.priority;
+                  return serial > other.serial;
+            }
+      };
+
+      Job *WaitJob();
+
+      wxMutex                        m_mutex;
+      wxCondition                    m_cond;
+      std::priority_queue<Pending>   m_jobs;
+      std::vector<Worker *>          m_workers;
+      unsigned                       m_serial;
+      bool                           m_stop;
+};
+
+#endif
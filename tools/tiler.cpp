@@ -0,0 +1,421 @@
+/***************************************************************************
+ * $Id: tiler.cpp, v0.1 2026-10-19 SethDart Exp $
+ *
+ * Project:  OpenCPN
+ * Purpose:  KML overlay plugin
+ * Author:   Jean-Eudes Onfray
+ *
+ ***************************************************************************
+ *   Copyright (C) 2012 by Jean-Eudes Onfray                               *
+ *   je@onfray.fr                                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************
+ */
+
+/*    kmloverlay_tiler: renders layers once into a raster tile pyramid.
+ *
+ *    kmloverlay_tiler [options] file.kml... outdir
+ *          --zoom MIN-MAX    levels to render (default from the level the
+ *                            layers fit in a single tile, 6 levels down)
+ *          --tile-size N     tile width and height in pixels (default 256)
+ *          --jobs N          worker processes (default one per core)
+ *          --labels          draw placemark names
+ *          --timeout S       seconds a tile may wait for its images and
+ *                            linked documents (default 30)
+ *
+ *    Each worker loads the layers through KMLOverlayFactory, exactly as
+ *    the plugin does, and draws the tiles it takes from a counter shared
+ *    by all into a wxMemoryDC. A tile is drawn with a margin, so icons and
+ *    wide strokes crossing its edges match those of its neighbours, and
+ *    twice, over white then over black: the difference gives back the
+ *    transparency of each pixel. The second drawing is replayed from the
+ *    view cache.
+ *
+ *    Tiles are written as outdir/z/x/y.png, those with nothing on them are
+ *    not. outdir/index.kmltiles lists the others, added as a layer it shows
+ *    the pyramid in place of the vector layers.
+ *************************************************************************/
+
+#include <wx/wxprec.h>
+
+#ifndef  WX_PRECOMP
+  #include <wx/wx.h>
+#endif //precompiled headers
+
+#include <wx/dcmemory.h>
+#include <wx/filefn.h>
+#include <wx/filename.h>
+#include <wx/image.h>
+#include <wx/thread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "factory.h"
+#include "kmlcompiler.h"
+#include "tilepyramid.h"
+#include "icons.h"
+#include "../bench/ocpn_stub.h"
+
+typedef KMLOverlayTilePyramid::Tile Tile;
+
+// Pixels drawn around each tile and cropped away
+static const int TileMargin = 32;
+static const int DefaultLevels = 6;
+
+struct TilerOptions
+{
+      std::vector<wxString> files;
+      wxString              outdir;
+      int                   min_zoom, max_zoom;
+      int                   tile_size;
+      int                   jobs;
+      bool                  labels;
+      double                timeout;
+};
+
+// In memory shared by the workers
+struct TilerProgress
+{
+      std::atomic<size_t> next;
+      std::atomic<size_t> done;
+      std::atomic<size_t> written;
+      std::atomic<size_t> incomplete;   // drawn before everything was loaded
+};
+
+static double Since( const std::chrono::steady_clock::time_point &start )
+{
+      return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+static wxString GetTilePath( const wxString &outdir, const Tile &tile )
+{
+      wxFileName fn( outdir, wxEmptyString );
+      fn.AppendDir( wxString::Format( _T("%d"), tile.z ) );
+      fn.AppendDir( wxString::Format( _T("%d"), tile.x ) );
+      fn.SetName( wxString::Format( _T("%d"), tile.y ) );
+      fn.SetExt( _T("png") );
+      return fn.GetFullPath();
+}
+
+static bool IsComplete( KMLOverlayFactory *factory )
+{
+      for ( int i = 0; i < factory->GetCount(); i++ ) {
+            KMLOverlayFactory::LayerStats stats;
+            if ( factory->GetStats( i, &stats ) && !stats.complete )
+                  return false;
+      }
+      return true;
+}
+
+// Draws until nothing is left loading or the timeout, false on timeout
+static bool Draw( KMLOverlayFactory *factory, wxBitmap &bitmap, wxMemoryDC &dc, PlugIn_ViewPort *vp,
+                  const wxColour &background, double timeout, wxImage *image )
+{
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      bool complete;
+      for ( ;; ) {
+            dc.SetBackground( wxBrush( background ) );
+            dc.Clear();
+            factory->RenderOverlay( dc, vp );
+            complete = IsComplete( factory );
+            if ( complete || Since( start ) > timeout )
+                  break;
+            wxMilliSleep( 10 );
+      }
+      dc.SelectObject( wxNullBitmap );
+      *image = bitmap.ConvertToImage();
+      dc.SelectObject( bitmap );
+      return complete;
+}
+
+/* Pixels drawn with coverage a over white give w = a*c + (1-a)*255 and
+ * over black b = a*c, so a = 1 - (w-b)/255 and c = b/a. Returns false
+ * when nothing was drawn.
+ */
+static bool Matte( const wxImage &white, const wxImage &black, int margin, int size, wxImage *tile )
+{
+      tile->Create( size, size, false );
+      tile->SetAlpha();
+      const unsigned char *w = white.GetData(), *b = black.GetData();
+      unsigned char *rgb = tile->GetData(), *alpha = tile->GetAlpha();
+      int stride = white.GetWidth();
+      bool drawn = false;
+      for ( int y = 0; y < size; y++ ) {
+            size_t src = ( (size_t)( y + margin ) * stride + margin ) * 3;
+            for ( int x = 0; x < size; x++, src += 3, rgb += 3, alpha++ ) {
+                  int diff = ( w[src] - b[src] ) + ( w[src+1] - b[src+1] ) + ( w[src+2] - b[src+2] );
+                  int a = 255 - std::max( 0, std::min( diff / 3, 255 ) );
+                  *alpha = a;
+                  if ( !a ) {
+                        rgb[0] = rgb[1] = rgb[2] = 0;
+                        continue;
+                  }
+                  drawn = true;
+                  for ( int c = 0; c < 3; c++ )
+                        rgb[c] = std::min( b[src+c] * 255 / a, 255 );
+            }
+      }
+      return drawn;
+}
+
+// Runs in a worker process
+static bool RenderTiles( const TilerOptions &options, const std::vector<Tile> &tiles, TilerProgress *progress )
+{
+      KMLOverlayFactory factory( NULL );
+      factory.SetLabelsEnabled( options.labels );
+      for ( size_t i = 0; i < options.files.size(); i++ ) {
+            if ( !factory.Add( options.files[i], true ) ) {
+                  fprintf( stderr, "%s: failed to load\n", (const char *)options.files[i].mb_str() );
+                  return false;
+            }
+      }
+
+      int size = options.tile_size + 2 * TileMargin;
+      wxBitmap bitmap( size, size, 24 );
+      wxMemoryDC dc( bitmap );
+      wxImage white, black, tile;
+      for ( ;; ) {
+            size_t idx = progress->next.fetch_add( 1 );
+            if ( idx >= tiles.size() )
+                  break;
+            double south, west, north, east;
+            KMLOverlayTilePyramid::GetTileBounds( tiles[idx], &south, &west, &north, &east );
+            PlugIn_ViewPort vp;
+            KMLOverlayBenchSetViewport( &vp, KMLOverlayTilePyramid::TileYToLat( tiles[idx].y + .5, tiles[idx].z ),
+                                        ( west + east ) / 2, ( east - west ) * size / options.tile_size, size, size );
+
+            bool complete = Draw( &factory, bitmap, dc, &vp, *wxWHITE, options.timeout, &white );
+            complete = Draw( &factory, bitmap, dc, &vp, *wxBLACK, options.timeout, &black ) && complete;
+            if ( !complete )
+                  progress->incomplete++;
+
+            wxString path = GetTilePath( options.outdir, tiles[idx] );
+            if ( Matte( white, black, TileMargin, options.tile_size, &tile ) ) {
+                  // Workers may race creating the same directory
+                  wxFileName::Mkdir( wxFileName( path ).GetPath(), 0777, wxPATH_MKDIR_FULL );
+                  if ( !tile.SaveFile( path, wxBITMAP_TYPE_PNG ) ) {
+                        fprintf( stderr, "%s: failed to write\n", (const char *)path.mb_str() );
+                        return false;
+                  }
+                  progress->written++;
+            } else if ( wxFileExists( path ) ) {
+                  // Left from an earlier run
+                  wxRemoveFile( path );
+            }
+            progress->done++;
+      }
+      return true;
+}
+
+// Layers are compiled once more here, only for their extent
+static bool GetBounds( const TilerOptions &options, KMLOverlayScene::Bounds *bounds )
+{
+      for ( size_t i = 0; i < options.files.size(); i++ ) {
+            KMLOverlayScene scene;
+            kmlengine::KmzFilePtr kmz;
+            size_t kmz_size;
+            std::string error;
+            std::string path( options.files[i].mb_str() );
+            if ( !KMLOverlayCompiler::CompileFile( path, &scene, &kmz, &kmz_size, &error ) ) {
+                  fprintf( stderr, "%s: %s\n", path.c_str(), error.c_str() );
+                  return false;
+            }
+            bounds->Extend( scene.GetBounds() );
+      }
+      return !bounds->IsEmpty();
+}
+
+static int Usage()
+{
+      fprintf( stderr, "usage: kmloverlay_tiler [--zoom MIN-MAX] [--tile-size N] [--jobs N] [--labels]\n"
+                       "                        [--timeout S] file.kml... outdir\n" );
+      return 2;
+}
+
+static int Tiler( int argc, char **argv )
+{
+      TilerOptions options;
+      options.min_zoom = options.max_zoom = -1;
+      options.tile_size = KMLOverlayTilePyramid::DefaultTileSize;
+      options.jobs = std::max( wxThread::GetCPUCount(), 1 );
+      options.labels = false;
+      options.timeout = 30;
+
+      for ( int i = 1; i < argc; i++ ) {
+            bool more = i+1 < argc;
+            if ( !strcmp( argv[i], "--zoom" ) && more ) {
+                  if ( sscanf( argv[++i], "%d-%d", &options.min_zoom, &options.max_zoom ) != 2 )
+                        return Usage();
+            }
+            else if ( !strcmp( argv[i], "--tile-size" ) && more )
+                  options.tile_size = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--jobs" ) && more )
+                  options.jobs = atoi( argv[++i] );
+            else if ( !strcmp( argv[i], "--labels" ) )
+                  options.labels = true;
+            else if ( !strcmp( argv[i], "--timeout" ) && more )
+                  options.timeout = atof( argv[++i] );
+            else if ( argv[i][0] == '-' )
+                  return Usage();
+            else
+                  options.files.push_back( wxString( argv[i], wxConvFile ) );
+      }
+      if ( options.files.size() < 2 || options.tile_size < 16 || options.tile_size > 4096 || options.jobs < 1 )
+            return Usage();
+      options.outdir = options.files.back();
+      options.files.pop_back();
+
+      KMLOverlayScene::Bounds bounds;
+      if ( !GetBounds( options, &bounds ) ) {
+            fprintf( stderr, "nothing to draw\n" );
+            return 1;
+      }
+      KMLOverlayTilePyramid::Index index;
+      index.tile_size = options.tile_size;
+      index.south = KMLOverlayScene::FromFixed( bounds.south );
+      index.west = KMLOverlayScene::FromFixed( bounds.west );
+      index.north = KMLOverlayScene::FromFixed( bounds.north );
+      index.east = KMLOverlayScene::FromFixed( bounds.east );
+      if ( options.min_zoom < 0 ) {
+            // The deepest level holding all layers in one tile
+            options.min_zoom = 0;
+            while ( options.min_zoom < KMLOverlayTilePyramid::MaxZoom
+                    && KMLOverlayTilePyramid::LonToTileX( index.west, options.min_zoom+1 )
+                       == KMLOverlayTilePyramid::LonToTileX( index.east, options.min_zoom+1 )
+                    && KMLOverlayTilePyramid::LatToTileY( index.north, options.min_zoom+1 )
+                       == KMLOverlayTilePyramid::LatToTileY( index.south, options.min_zoom+1 ) )
+                  options.min_zoom++;
+            options.max_zoom = std::min( options.min_zoom + DefaultLevels, (int)KMLOverlayTilePyramid::MaxZoom );
+      }
+      if ( options.min_zoom > options.max_zoom || options.max_zoom > KMLOverlayTilePyramid::MaxZoom )
+            return Usage();
+      index.min_zoom = options.min_zoom;
+      index.max_zoom = options.max_zoom;
+
+      // Coarse levels first, they are the slowest to draw
+      std::vector<Tile> tiles;
+      for ( int z = options.min_zoom; z <= options.max_zoom; z++ ) {
+            int x0 = KMLOverlayTilePyramid::LonToTileX( index.west, z ), x1 = KMLOverlayTilePyramid::LonToTileX( index.east, z );
+            int y0 = KMLOverlayTilePyramid::LatToTileY( index.north, z ), y1 = KMLOverlayTilePyramid::LatToTileY( index.south, z );
+            for ( int x = x0; x <= x1; x++ ) {
+                  for ( int y = y0; y <= y1; y++ ) {
+                        Tile tile = { z, x, y };
+                        tiles.push_back( tile );
+                  }
+            }
+      }
+      options.jobs = (int)std::min( (size_t)options.jobs, tiles.size() );
+      printf( "%lu tiles, levels %d to %d, %d workers\n", (unsigned long)tiles.size(),
+              options.min_zoom, options.max_zoom, options.jobs );
+      if ( !wxFileName::Mkdir( options.outdir, 0777, wxPATH_MKDIR_FULL ) && !wxDirExists( options.outdir ) ) {
+            fprintf( stderr, "%s: cannot create\n", (const char *)options.outdir.mb_str() );
+            return 1;
+      }
+
+      void *shared = mmap( NULL, sizeof( TilerProgress ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+      if ( shared == MAP_FAILED ) {
+            perror( "mmap" );
+            return 1;
+      }
+      TilerProgress *progress = new ( shared ) TilerProgress();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      fflush( stdout );
+      int running = 0;
+      bool ok = true;
+      for ( int i = 0; i < options.jobs; i++ ) {
+            pid_t pid = fork();
+            if ( pid < 0 ) {
+                  perror( "fork" );
+                  ok = false;
+                  break;
+            }
+            if ( pid == 0 )
+                  _exit( RenderTiles( options, tiles, progress ) ? 0 : 1 );
+            running++;
+      }
+      while ( running ) {
+            int status;
+            pid_t pid = waitpid( -1, &status, WNOHANG );
+            if ( pid > 0 ) {
+                  running--;
+                  ok = ok && WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+                  continue;
+            }
+            if ( pid < 0 )
+                  break;
+            printf( "\r%lu/%lu tiles", (unsigned long)progress->done.load(), (unsigned long)tiles.size() );
+            fflush( stdout );
+            wxMilliSleep( 500 );
+      }
+      double elapsed = Since( start );
+      printf( "\r%lu/%lu tiles in %.1f s, %.1f tiles/s, %lu written, %lu incomplete\n",
+              (unsigned long)progress->done.load(), (unsigned long)tiles.size(), elapsed,
+              progress->done.load() / std::max( elapsed, 1e-3 ), (unsigned long)progress->written.load(),
+              (unsigned long)progress->incomplete.load() );
+      munmap( shared, sizeof( TilerProgress ) );
+      if ( !ok ) {
+            fprintf( stderr, "a worker failed\n" );
+            return 1;
+      }
+
+      for ( size_t i = 0; i < options.files.size(); i++ )
+            index.sources.push_back( std::string( wxFileName( options.files[i] ).GetFullName().ToUTF8() ) );
+      for ( size_t i = 0; i < tiles.size(); i++ ) {
+            if ( wxFileExists( GetTilePath( options.outdir, tiles[i] ) ) )
+                  index.tiles.push_back( tiles[i] );
+      }
+      std::string error;
+      wxFileName fn( options.outdir, _T("index.kmltiles") );
+      if ( !KMLOverlayTilePyramid::WriteIndex( std::string( fn.GetFullPath().mb_str() ), index, &error ) ) {
+            fprintf( stderr, "%s\n", error.c_str() );
+            return 1;
+      }
+      printf( "%s\n", (const char *)fn.GetFullPath().mb_str() );
+      return 0;
+}
+
+class KMLOverlayTilerApp : public wxApp
+{
+public:
+      bool OnInit() { return true; }
+};
+
+IMPLEMENT_APP_NO_MAIN( KMLOverlayTilerApp )
+
+int main( int argc, char **argv )
+{
+      if ( !wxEntryStart( argc, argv ) ) {
+            fprintf( stderr, "failed to initialize wxWidgets\n" );
+            return 1;
+      }
+      wxInitAllImageHandlers();
+      initialize_images();
+
+      int rc = Tiler( argc, argv );
+
+      wxEntryCleanup();
+      return rc;
+}